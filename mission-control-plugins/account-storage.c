@@ -145,6 +145,95 @@ default_set_parameter (McpAccountStorage *storage,
   return FALSE;
 }
 
+static gboolean
+default_set_batch (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GVariant *changes)
+{
+  return FALSE;
+}
+
+static void
+default_commit_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GTask *task = g_task_new (storage, cancellable, callback, user_data);
+  gboolean ok;
+
+  g_task_set_source_tag (task, default_commit_async);
+
+  if (account != NULL)
+    ok = mcp_account_storage_commit_one (storage, am, account);
+  else
+    ok = mcp_account_storage_commit (storage, am);
+
+  if (ok)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "%s failed to commit", mcp_account_storage_name (storage));
+
+  g_object_unref (task);
+}
+
+static gboolean
+default_commit_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, storage), FALSE);
+  /* a plugin that overrides only commit_async uses this to finish, so the
+   * result only has our tag if our commit_async made it */
+  g_return_val_if_fail (
+      MCP_ACCOUNT_STORAGE_GET_IFACE (storage)->commit_async !=
+        default_commit_async ||
+      g_async_result_is_tagged (result, default_commit_async), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+free_account_list (gpointer p)
+{
+  g_list_free_full (p, g_free);
+}
+
+static void
+default_list_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GTask *task = g_task_new (storage, cancellable, callback, user_data);
+
+  g_task_set_source_tag (task, default_list_async);
+  g_task_return_pointer (task, mcp_account_storage_list (storage, am),
+      free_account_list);
+  g_object_unref (task);
+}
+
+static GList *
+default_list_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, storage), NULL);
+  /* a plugin that overrides only list_async uses this to finish, so the
+   * result only has our tag if our list_async made it */
+  g_return_val_if_fail (
+      MCP_ACCOUNT_STORAGE_GET_IFACE (storage)->list_async !=
+        default_list_async ||
+      g_async_result_is_tagged (result, default_list_async), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 static gboolean
 default_owns (McpAccountStorage *storage,
     McpAccountManager *am,
@@ -169,6 +258,11 @@ class_init (gpointer klass,
   iface->set = default_set;
   iface->set_attribute = default_set_attribute;
   iface->set_parameter = default_set_parameter;
+  iface->set_batch = default_set_batch;
+  iface->commit_async = default_commit_async;
+  iface->commit_finish = default_commit_finish;
+  iface->list_async = default_list_async;
+  iface->list_finish = default_list_finish;
 
   if (signals[CREATED] != 0)
     {
@@ -693,6 +787,189 @@ mcp_account_storage_set_parameter (McpAccountStorage *storage,
   return iface->set_parameter (storage, am, account, parameter, value, flags);
 }
 
+/**
+ * mcp_account_storage_set_batch:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @account: the unique name of the account
+ * @changes: a #GVariant of type a{smv} mapping settings to their new
+ *  values: either attributes like "DisplayName", or "param-" plus a
+ *  parameter like "account". A setting mapped to nothing is to be
+ *  deleted.
+ *
+ * Store several settings of one account at once, for instance all the
+ * parameters changed by a single UpdateParameters() call. Parameters
+ * that are to be stored securely are never included: Mission Control
+ * passes them to mcp_account_storage_set_parameter() one by one, with
+ * %MCP_PARAMETER_FLAG_SECRET.
+ *
+ * Mission Control only calls this on the plugin which has @account.
+ * As with mcp_account_storage_set(), the plugin is expected to update its
+ * internal cache quickly and synchronously, and not to write to its long
+ * term storage until it is asked to commit.
+ *
+ * There is a default implementation, which just returns %FALSE.
+ * Mission Control will store the settings one by one instead.
+ *
+ * Returns: %TRUE if every setting in @changes was stored, %FALSE if
+ *  none of them were
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_account_storage_set_batch (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GVariant *changes)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+  g_return_val_if_fail (iface != NULL, FALSE);
+  g_return_val_if_fail (iface->set_batch != NULL, FALSE);
+  g_return_val_if_fail (g_variant_is_of_type (changes,
+        G_VARIANT_TYPE ("a{smv}")), FALSE);
+
+  return iface->set_batch (storage, am, account, changes);
+}
+
+/**
+ * mcp_account_storage_commit_async:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @account: (allow-none): the unique name of an account to commit, or
+ *  %NULL to commit every account
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: called when the changes have been written
+ * @user_data: data for @callback
+ *
+ * Write changes to long term storage, like mcp_account_storage_commit_one()
+ * or mcp_account_storage_commit(), without blocking Mission Control while
+ * doing so. Mission Control may start commits in several plugins at once,
+ * but does not start a commit for an @account until its previous commit
+ * for the same @account has finished.
+ *
+ * The plugin must not assume that its internal cache will stay the same
+ * while it is committing: Mission Control can call
+ * mcp_account_storage_set() and similar methods before @callback is
+ * called. The changes made by such calls are committed by the next call
+ * to this function.
+ *
+ * There is a default implementation, which calls
+ * mcp_account_storage_commit_one() or mcp_account_storage_commit()
+ * and returns their result. Plugins with a slow backend should implement
+ * this method and commit_finish instead. A plugin that implements only
+ * this method must report its result with a #GTask whose source object is
+ * @storage, using g_task_return_boolean() or g_task_return_error(), so that
+ * the default commit_finish can finish it.
+ *
+ * Since: 5.17.0
+ */
+void
+mcp_account_storage_commit_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+  g_return_if_fail (iface != NULL);
+  g_return_if_fail (iface->commit_async != NULL);
+
+  iface->commit_async (storage, am, account, cancellable, callback,
+      user_data);
+}
+
+/**
+ * mcp_account_storage_commit_finish:
+ * @storage: an #McpAccountStorage instance
+ * @result: the result passed to the callback of
+ *  mcp_account_storage_commit_async()
+ * @error: used to raise an error if %FALSE is returned
+ *
+ * Returns: %TRUE if the changes were written successfully
+ *
+ * Since: 5.17.0
+ */
+gboolean
+mcp_account_storage_commit_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  g_return_val_if_fail (iface != NULL, FALSE);
+  g_return_val_if_fail (iface->commit_finish != NULL, FALSE);
+
+  return iface->commit_finish (storage, result, error);
+}
+
+/**
+ * mcp_account_storage_list_async:
+ * @storage: an #McpAccountStorage instance
+ * @am: an #McpAccountManager instance
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: called when the accounts have been listed
+ * @user_data: data for @callback
+ *
+ * Load the accounts in long term storage, like mcp_account_storage_list(),
+ * without blocking Mission Control while doing so. Mission Control may
+ * list the accounts of several plugins at once.
+ *
+ * There is a default implementation, which calls
+ * mcp_account_storage_list(). Plugins with a slow backend should
+ * implement this method and list_finish instead. A plugin that implements
+ * only this method must report its result with a #GTask whose source object
+ * is @storage, using g_task_return_pointer() with a #GList of owned strings,
+ * so that the default list_finish can finish it.
+ *
+ * Since: 5.17.0
+ */
+void
+mcp_account_storage_list_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  SDEBUG (storage, "");
+  g_return_if_fail (iface != NULL);
+  g_return_if_fail (iface->list_async != NULL);
+
+  iface->list_async (storage, am, cancellable, callback, user_data);
+}
+
+/**
+ * mcp_account_storage_list_finish:
+ * @storage: an #McpAccountStorage instance
+ * @result: the result passed to the callback of
+ *  mcp_account_storage_list_async()
+ * @error: used to raise an error if %NULL is returned
+ *
+ * Returns: (transfer full) (element-type utf8): a list of account names,
+ *  as for mcp_account_storage_list(). %NULL can mean either that there
+ *  are no accounts, or that an error was raised.
+ *
+ * Since: 5.17.0
+ */
+GList *
+mcp_account_storage_list_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error)
+{
+  McpAccountStorageIface *iface = MCP_ACCOUNT_STORAGE_GET_IFACE (storage);
+
+  g_return_val_if_fail (iface != NULL, NULL);
+  g_return_val_if_fail (iface->list_finish != NULL, NULL);
+
+  return iface->list_finish (storage, result, error);
+}
+
 /**
  * McpAccountStorageCreate:
  * @storage: an #McpAccountStorage instance
@@ -144,6 +144,30 @@ struct _McpAccountStorageIface
       const gchar *parameter,
       GVariant *val,
       McpParameterFlags flags);
+
+  /* Since 5.17.0 */
+  gboolean (*set_batch) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      const gchar *account,
+      GVariant *changes);
+
+  void (*commit_async) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      const gchar *account,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+  gboolean (*commit_finish) (McpAccountStorage *storage,
+      GAsyncResult *result,
+      GError **error);
+  void (*list_async) (McpAccountStorage *storage,
+      McpAccountManager *am,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+  GList * (*list_finish) (McpAccountStorage *storage,
+      GAsyncResult *result,
+      GError **error);
 };
 
 #ifndef __GTK_DOC_IGNORE__
@@ -282,6 +306,29 @@ gboolean mcp_account_storage_set_parameter (McpAccountStorage *storage,
     GVariant *value,
     McpParameterFlags flags);
 
+gboolean mcp_account_storage_set_batch (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GVariant *changes);
+
+void mcp_account_storage_commit_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean mcp_account_storage_commit_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error);
+void mcp_account_storage_list_async (McpAccountStorage *storage,
+    McpAccountManager *am,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+GList *mcp_account_storage_list_finish (McpAccountStorage *storage,
+    GAsyncResult *result,
+    GError **error);
+
 void mcp_account_storage_emit_created (McpAccountStorage *storage,
     const gchar *account);
 G_DEPRECATED_FOR (something that is actually implemented)
@@ -23,6 +23,7 @@
 #define MCP_MISSION_CONTROL_PLUGINS_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <telepathy-glib/telepathy-glib.h>
 
 typedef enum {
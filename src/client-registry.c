@@ -26,13 +26,21 @@
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-debug.h"
+#include "mcd-filter-index.h"
+#include "mcd-lru-cache.h"
 
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 G_DEFINE_TYPE (McdClientRegistry, _mcd_client_registry, G_TYPE_OBJECT)
 
+/* how many different requests to remember the predicted handler for */
+#define PREDICTION_CACHE_SIZE 64
+
 enum
 {
   PROP_0,
@@ -56,6 +64,47 @@ struct _McdClientRegistryPrivate
 
   TpDBusDaemon *dbus_daemon;
 
+  /* owned; where every client's .client file is, and what's in it, so we
+   * don't search the filesystem every time a client appears */
+  McdClientFileIndex *file_index;
+
+  /* owned; decides when each client is introspected */
+  McdIntrospectionScheduler *scheduler;
+
+  /* owned; the channel filters of every client in @clients, for each
+   * McdClientInterface, so that matching a channel doesn't involve looking
+   * at every filter of every client */
+  McdFilterIndex *filter_index[MCD_CLIENT_N_INTERFACES];
+
+  /* owned arrays of borrowed McdClientProxy: the clients in @clients that
+   * implement each McdClientInterface, in the order they were found, so
+   * that each stage of dispatching only has to look at the clients that
+   * are relevant to it */
+  GPtrArray *by_interface[MCD_CLIENT_N_INTERFACES];
+  /* owned array of borrowed McdClientProxy: the subset of
+   * by_interface[MCD_CLIENT_HANDLER] with BypassApproval */
+  GPtrArray *bypass_handlers;
+
+  /* incremented whenever a client's filters, interfaces or BypassApproval
+   * might have changed, or a client appears or disappears */
+  guint64 filters_generation;
+  /* owned; canonical request key => borrowed McdClientProxy or NULL, the
+   * result of _mcd_client_registry_predict_handler() for that request */
+  McdLruCache *prediction_cache;
+  /* the filters_generation that @prediction_cache is valid for */
+  guint64 prediction_cache_generation;
+
+  /* owned; the handler capabilities of every Handler, or NULL if they
+   * have changed since it was last needed */
+  McdCapabilitySnapshot *capabilities;
+  /* the generation of the most recent snapshot */
+  guint64 capabilities_generation;
+  /* owned well-known name => owned guint64, the capabilities_generation
+   * when it went away: Handlers whose capabilities must be cleared by every
+   * snapshot until each connection has been sent one of them (see
+   * _mcd_client_registry_forget_departed_handlers()) */
+  GHashTable *departed_handlers;
+
   /* We don't want to start dispatching until startup has finished. This
    * is defined as:
    * - activatable clients have been enumerated (ListActivatableNames)
@@ -67,6 +116,8 @@ struct _McdClientRegistryPrivate
    * */
   gsize startup_lock;
   gboolean startup_completed;
+  /* when we started looking for clients, in g_get_monotonic_time() units */
+  gint64 startup_time;
 };
 
 static void
@@ -96,6 +147,33 @@ _mcd_client_registry_dec_startup_lock (McdClientRegistry *self)
 
   if (self->priv->startup_lock == 0)
     {
+      GHashTableIter iter;
+      gpointer client_p;
+      McdClientProxy *slowest = NULL;
+
+      DEBUG ("all %u clients ready after %.1fms",
+          g_hash_table_size (self->priv->clients),
+          (g_get_monotonic_time () - self->priv->startup_time) / 1000.0);
+
+      g_hash_table_iter_init (&iter, self->priv->clients);
+
+      while (g_hash_table_iter_next (&iter, NULL, &client_p))
+        {
+          if (slowest == NULL ||
+              _mcd_client_proxy_get_ready_latency (client_p) >
+              _mcd_client_proxy_get_ready_latency (slowest))
+            slowest = client_p;
+        }
+
+      if (slowest != NULL)
+        DEBUG ("slowest was %s, after %.1fms",
+            tp_proxy_get_bus_name (slowest),
+            _mcd_client_proxy_get_ready_latency (slowest) / 1000.0);
+
+      /* every client that has a .client file has been looked up by now,
+       * so this is a good time to make the next startup faster */
+      _mcd_client_file_index_save_cache (self->priv->file_index);
+
       self->priv->startup_completed = TRUE;
       g_signal_emit (self, signals[S_READY], 0);
     }
@@ -105,6 +183,111 @@ static void mcd_client_registry_ready_cb (McdClientProxy *client,
     McdClientRegistry *self);
 static void mcd_client_registry_gone_cb (McdClientProxy *client,
     McdClientRegistry *self);
+static void mcd_client_registry_filters_changed_cb (McdClientProxy *client,
+    guint interface,
+    McdClientRegistry *self);
+static void mcd_client_registry_capabilities_changed_cb (
+    McdClientProxy *client,
+    McdClientRegistry *self);
+
+static void
+_mcd_client_registry_index_filters (McdClientRegistry *self,
+    McdClientProxy *client,
+    McdClientInterface interface)
+{
+  _mcd_filter_index_set (self->priv->filter_index[interface], client,
+      _mcd_client_proxy_get_filters (client, interface));
+  self->priv->filters_generation++;
+}
+
+static void
+_mcd_client_registry_unindex_filters (McdClientRegistry *self,
+    McdClientProxy *client)
+{
+  guint i;
+
+  for (i = 0; i < MCD_CLIENT_N_INTERFACES; i++)
+    _mcd_filter_index_set (self->priv->filter_index[i], client, NULL);
+
+  self->priv->filters_generation++;
+}
+
+/* Add @client to @array if @member, or remove it if not, keeping the
+ * order of the other clients */
+static void
+update_membership (GPtrArray *array,
+    McdClientProxy *client,
+    gboolean member)
+{
+  guint i;
+
+  for (i = 0; i < array->len; i++)
+    {
+      if (g_ptr_array_index (array, i) == client)
+        {
+          if (!member)
+            g_ptr_array_remove_index (array, i);
+
+          return;
+        }
+    }
+
+  if (member)
+    g_ptr_array_add (array, client);
+}
+
+static GQuark
+interface_quark (McdClientInterface interface)
+{
+  switch (interface)
+    {
+      case MCD_CLIENT_APPROVER:
+        return TP_IFACE_QUARK_CLIENT_APPROVER;
+
+      case MCD_CLIENT_HANDLER:
+        return TP_IFACE_QUARK_CLIENT_HANDLER;
+
+      case MCD_CLIENT_OBSERVER:
+        return TP_IFACE_QUARK_CLIENT_OBSERVER;
+
+      default:
+        g_assert_not_reached ();
+    }
+
+  return 0;
+}
+
+/* Called whenever @client might have gained interfaces or changed its
+ * BypassApproval: when it's found, when its filters change, and when it
+ * becomes ready */
+static void
+_mcd_client_registry_update_lists (McdClientRegistry *self,
+    McdClientProxy *client)
+{
+  guint i;
+
+  for (i = 0; i < MCD_CLIENT_N_INTERFACES; i++)
+    update_membership (self->priv->by_interface[i], client,
+        tp_proxy_has_interface_by_id (client, interface_quark (i)));
+
+  update_membership (self->priv->bypass_handlers, client,
+      tp_proxy_has_interface_by_id (client, TP_IFACE_QUARK_CLIENT_HANDLER)
+      && _mcd_client_proxy_get_bypass_approval (client));
+  self->priv->filters_generation++;
+}
+
+static void
+_mcd_client_registry_remove_from_lists (McdClientRegistry *self,
+    McdClientProxy *client)
+{
+  guint i;
+
+  for (i = 0; i < MCD_CLIENT_N_INTERFACES; i++)
+    update_membership (self->priv->by_interface[i], client, FALSE);
+
+  update_membership (self->priv->bypass_handlers, client, FALSE);
+  self->priv->filters_generation++;
+}
 
 static void
 _mcd_client_registry_found_name (McdClientRegistry *self,
@@ -113,6 +296,7 @@ _mcd_client_registry_found_name (McdClientRegistry *self,
     gboolean activatable)
 {
   McdClientProxy *client;
+  guint i;
 
   if (!g_str_has_prefix (well_known_name, TP_CLIENT_BUS_NAME_BASE))
     {
@@ -152,7 +336,8 @@ _mcd_client_registry_found_name (McdClientRegistry *self,
   DEBUG ("Registering client %s", well_known_name);
 
   client = _mcd_client_proxy_new (self->priv->dbus_daemon,
-      well_known_name, unique_name_if_known, activatable);
+      self->priv->file_index, self->priv->scheduler, well_known_name,
+      unique_name_if_known, activatable);
   g_hash_table_insert (self->priv->clients, g_strdup (well_known_name),
       client);
 
@@ -168,6 +353,20 @@ _mcd_client_registry_found_name (McdClientRegistry *self,
                     G_CALLBACK (mcd_client_registry_gone_cb),
                     self);
 
+  g_signal_connect (client, "filters-changed",
+                    G_CALLBACK (mcd_client_registry_filters_changed_cb),
+                    self);
+
+  g_signal_connect (client, "handler-capabilities-changed",
+                    G_CALLBACK (mcd_client_registry_capabilities_changed_cb),
+                    self);
+
+  /* it might already have read its .client file */
+  for (i = 0; i < MCD_CLIENT_N_INTERFACES; i++)
+    _mcd_client_registry_index_filters (self, client, i);
+
+  _mcd_client_registry_update_lists (self, client);
+
   g_signal_emit (self, signals[S_CLIENT_ADDED], 0, client);
 }
 
@@ -186,6 +385,10 @@ mcd_client_registry_disconnect_client_signals (gpointer k G_GNUC_UNUSED,
 {
   g_signal_handlers_disconnect_by_func (v, mcd_client_registry_ready_cb, data);
   g_signal_handlers_disconnect_by_func (v, mcd_client_registry_gone_cb, data);
+  g_signal_handlers_disconnect_by_func (v,
+      mcd_client_registry_filters_changed_cb, data);
+  g_signal_handlers_disconnect_by_func (v,
+      mcd_client_registry_capabilities_changed_cb, data);
 
   if (!_mcd_client_proxy_is_ready (v))
     {
@@ -209,6 +412,20 @@ _mcd_client_registry_remove (McdClientRegistry *self,
     {
       mcd_client_registry_disconnect_client_signals (NULL,
           client, self);
+      _mcd_client_registry_unindex_filters (self, client);
+
+      if (tp_proxy_has_interface_by_id (client,
+            TP_IFACE_QUARK_CLIENT_HANDLER))
+        {
+          g_hash_table_insert (self->priv->departed_handlers,
+              g_strdup (well_known_name),
+              g_memdup (&self->priv->capabilities_generation,
+                sizeof (guint64)));
+          tp_clear_pointer (&self->priv->capabilities,
+              _mcd_capability_snapshot_unref);
+        }
+
+      _mcd_client_registry_remove_from_lists (self, client);
     }
 
   g_hash_table_remove (self->priv->clients, well_known_name);
@@ -224,14 +441,31 @@ void _mcd_client_registry_init_hash_iter (McdClientRegistry *self,
 static void
 _mcd_client_registry_init (McdClientRegistry *self)
 {
+  guint i;
+
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MCD_TYPE_CLIENT_REGISTRY,
       McdClientRegistryPrivate);
 
   self->priv->startup_completed = FALSE;
   /* the ListNames call we'll make in _constructed is the initial lock */
   self->priv->startup_lock = 1;
+  self->priv->startup_time = g_get_monotonic_time ();
   self->priv->clients = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
       g_object_unref);
+  self->priv->file_index = _mcd_client_file_index_new ();
+  self->priv->scheduler = _mcd_introspection_scheduler_new ();
+
+  for (i = 0; i < MCD_CLIENT_N_INTERFACES; i++)
+    {
+      self->priv->filter_index[i] = _mcd_filter_index_new ();
+      self->priv->by_interface[i] = g_ptr_array_new ();
+    }
+
+  self->priv->bypass_handlers = g_ptr_array_new ();
+  self->priv->prediction_cache = _mcd_lru_cache_new (PREDICTION_CACHE_SIZE,
+      g_str_hash, g_str_equal, g_free, NULL);
+  self->priv->departed_handlers = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, g_free);
 }
 
 static void
@@ -443,6 +677,7 @@ mcd_client_registry_dispose (GObject *object)
   McdClientRegistry *self = MCD_CLIENT_REGISTRY (object);
   void (*chain_up) (GObject *) =
     G_OBJECT_CLASS (_mcd_client_registry_parent_class)->dispose;
+  guint i;
 
   if (self->priv->dbus_daemon != NULL)
     {
@@ -465,6 +700,21 @@ mcd_client_registry_dispose (GObject *object)
     }
 
   tp_clear_pointer (&self->priv->clients, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->file_index, _mcd_client_file_index_unref);
+  tp_clear_pointer (&self->priv->scheduler,
+      _mcd_introspection_scheduler_unref);
+
+  for (i = 0; i < MCD_CLIENT_N_INTERFACES; i++)
+    {
+      tp_clear_pointer (&self->priv->filter_index[i], _mcd_filter_index_free);
+      tp_clear_pointer (&self->priv->by_interface[i], g_ptr_array_unref);
+    }
+
+  tp_clear_pointer (&self->priv->bypass_handlers, g_ptr_array_unref);
+  tp_clear_pointer (&self->priv->prediction_cache, _mcd_lru_cache_free);
+  tp_clear_pointer (&self->priv->capabilities,
+      _mcd_capability_snapshot_unref);
+  tp_clear_pointer (&self->priv->departed_handlers, g_hash_table_unref);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -519,6 +769,11 @@ mcd_client_registry_ready_cb (McdClientProxy *client,
   g_signal_handlers_disconnect_by_func (client,
       mcd_client_registry_ready_cb, self);
 
+  /* by now we know all its interfaces and whether it bypasses approval */
+  if (g_hash_table_lookup (self->priv->clients,
+        tp_proxy_get_bus_name (client)) == client)
+    _mcd_client_registry_update_lists (self, client);
+
   /* paired with the one in _mcd_client_registry_found_name */
   _mcd_client_registry_dec_startup_lock (self);
 }
@@ -530,26 +785,173 @@ mcd_client_registry_gone_cb (McdClientProxy *client,
   _mcd_client_registry_remove (self, tp_proxy_get_bus_name (client));
 }
 
-GPtrArray *
-_mcd_client_registry_dup_client_caps (McdClientRegistry *self)
+static void
+mcd_client_registry_filters_changed_cb (McdClientProxy *client,
+    guint interface,
+    McdClientRegistry *self)
 {
+  g_return_if_fail (interface < MCD_CLIENT_N_INTERFACES);
+
+  _mcd_client_registry_index_filters (self, client, interface);
+  _mcd_client_registry_update_lists (self, client);
+}
+
+static void
+mcd_client_registry_capabilities_changed_cb (McdClientProxy *client,
+    McdClientRegistry *self)
+{
+  /* rebuilt when it's next needed */
+  tp_clear_pointer (&self->priv->capabilities,
+      _mcd_capability_snapshot_unref);
+}
+
+/*
+ * _mcd_client_registry_get_clients:
+ * @self: the client registry
+ * @interface: a client interface
+ *
+ * Returns: (transfer none) (element-type McdClientProxy): the clients that
+ *  implement @interface, in a stable order, which is valid until the next
+ *  time a client appears, disappears or changes
+ */
+const GPtrArray *
+_mcd_client_registry_get_clients (McdClientRegistry *self,
+    McdClientInterface interface)
+{
+  g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
+  g_return_val_if_fail (interface < MCD_CLIENT_N_INTERFACES, NULL);
+
+  return self->priv->by_interface[interface];
+}
+
+/*
+ * _mcd_client_registry_get_bypass_handlers:
+ * @self: the client registry
+ *
+ * Returns: (transfer none) (element-type McdClientProxy): the subset of
+ *  the Handlers that have BypassApproval, in the same order, and valid for
+ *  as long as _mcd_client_registry_get_clients()
+ */
+const GPtrArray *
+_mcd_client_registry_get_bypass_handlers (McdClientRegistry *self)
+{
+  g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
+
+  return self->priv->bypass_handlers;
+}
+
+/*
+ * _mcd_client_registry_match_filters:
+ * @self: the client registry
+ * @interface: which clients' filters to use
+ * @record: a channel's immutable properties
+ * @assume_requested: as for _mcd_client_match_record()
+ *
+ * Find the clients with a filter for @interface that matches
+ * @record. This only looks at the filters that could match,
+ * so its cost doesn't depend on the total number of clients and filters.
+ *
+ * Note that a client with filters for an interface doesn't necessarily
+ * implement that interface: callers should look up the clients from
+ * _mcd_client_registry_get_clients() in the result, rather than the
+ * other way round.
+ *
+ * Returns: (transfer container): a map from borrowed #McdClientProxy to
+ *  the quality of its best match, as returned by
+ *  _mcd_client_match_record(), converted with GUINT_TO_POINTER()
+ */
+GHashTable *
+_mcd_client_registry_match_filters (McdClientRegistry *self,
+    McdClientInterface interface,
+    McdMatchRecord *record,
+    gboolean assume_requested)
+{
+  g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
+  g_return_val_if_fail (interface < MCD_CLIENT_N_INTERFACES, NULL);
+  g_return_val_if_fail (self->priv->filter_index[interface] != NULL, NULL);
+
+  return _mcd_filter_index_match (self->priv->filter_index[interface],
+      record, assume_requested);
+}
+
+/*
+ * _mcd_client_registry_ref_capabilities:
+ * @self: the client registry
+ *
+ * Returns: (transfer full): the handler capabilities of every Handler,
+ *  plus empty capabilities for any Handlers that have gone away and not
+ *  yet been forgotten. This is only rebuilt when a Handler's capabilities
+ *  change.
+ */
+McdCapabilitySnapshot *
+_mcd_client_registry_ref_capabilities (McdClientRegistry *self)
+{
+  const GPtrArray *handlers;
   GPtrArray *vas;
   GHashTableIter iter;
-  gpointer p;
+  gpointer k;
+  guint i;
 
   g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
 
-  vas = g_ptr_array_sized_new (g_hash_table_size (self->priv->clients));
+  if (self->priv->capabilities != NULL)
+    return _mcd_capability_snapshot_ref (self->priv->capabilities);
 
-  g_hash_table_iter_init (&iter, self->priv->clients);
+  handlers = self->priv->by_interface[MCD_CLIENT_HANDLER];
+  vas = g_ptr_array_sized_new (handlers->len +
+      g_hash_table_size (self->priv->departed_handlers));
 
-  while (g_hash_table_iter_next (&iter, NULL, &p))
+  for (i = 0; i < handlers->len; i++)
     {
-      g_ptr_array_add (vas,
-          _mcd_client_proxy_dup_handler_capabilities (p));
+      g_ptr_array_add (vas, _mcd_client_proxy_dup_handler_capabilities (
+            g_ptr_array_index (handlers, i)));
     }
 
-  return vas;
+  /* in ContactCapabilities we indicate the disappearance of a client by
+   * giving it an empty set of capabilities and filters */
+  g_hash_table_iter_init (&iter, self->priv->departed_handlers);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      /* it might have come back */
+      if (g_hash_table_lookup (self->priv->clients, k) == NULL)
+        g_ptr_array_add (vas,
+            _mcd_client_proxy_dup_empty_handler_capabilities (k));
+    }
+
+  self->priv->capabilities = _mcd_capability_snapshot_new (
+      ++self->priv->capabilities_generation, vas);
+  DEBUG ("new capabilities snapshot, generation %" G_GUINT64_FORMAT,
+      self->priv->capabilities_generation);
+  return _mcd_capability_snapshot_ref (self->priv->capabilities);
+}
+
+/*
+ * _mcd_client_registry_forget_departed_handlers:
+ * @self: the client registry
+ * @generation: the generation of a capabilities snapshot which every
+ *  connection has now been sent
+ *
+ * Stop including empty capabilities for the Handlers that went away before
+ * snapshot @generation was built. Every connection has been told about
+ * them, so later snapshots don't need to mention them again.
+ */
+void
+_mcd_client_registry_forget_departed_handlers (McdClientRegistry *self,
+    guint64 generation)
+{
+  GHashTableIter iter;
+  gpointer v;
+
+  g_return_if_fail (MCD_IS_CLIENT_REGISTRY (self));
+
+  g_hash_table_iter_init (&iter, self->priv->departed_handlers);
+
+  while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+      if (*(guint64 *) v < generation)
+        g_hash_table_iter_remove (&iter);
+    }
 }
 
 gboolean
@@ -562,7 +964,6 @@ _mcd_client_registry_is_ready (McdClientRegistry *self)
 typedef struct
 {
     McdClientProxy *client;
-    gboolean bypass;
     gsize quality;
 } PossibleHandler;
 
@@ -573,20 +974,6 @@ possible_handler_cmp (gconstpointer a_,
   const PossibleHandler *a = a_;
   const PossibleHandler *b = b_;
 
-  if (a->bypass)
-    {
-      if (!b->bypass)
-        {
-          /* BypassApproval wins, so a is better than b */
-          return 1;
-        }
-    }
-  else if (b->bypass)
-    {
-      /* BypassApproval wins, so b is better than a */
-      return -1;
-    }
-
   if (a->quality < b->quality)
     {
       return -1;
@@ -600,24 +987,51 @@ possible_handler_cmp (gconstpointer a_,
   return 0;
 }
 
-GList *
-_mcd_client_registry_list_possible_handlers (McdClientRegistry *self,
-    const gchar *preferred_handler,
-    GVariant *request_props,
-    TpChannel *channel,
-    const gchar *must_have_unique_name)
+static gboolean
+ptr_array_contains (const GPtrArray *array,
+    gconstpointer p)
 {
-  GList *handlers = NULL;
-  GList *handlers_iter;
-  GHashTableIter client_iter;
-  gpointer client_p;
+  guint i;
 
-  _mcd_client_registry_init_hash_iter (self, &client_iter);
+  for (i = 0; i < array->len; i++)
+    {
+      if (g_ptr_array_index (array, i) == p)
+        return TRUE;
+    }
 
-  while (g_hash_table_iter_next (&client_iter, NULL, &client_p))
+  return FALSE;
+}
+
+/* Prepend the clients in @candidates that have a match in @matches to
+ * @handlers, most preferred first, skipping any that are in @exclude */
+static GList *
+prepend_possible_handlers (GList *handlers,
+    const GPtrArray *candidates,
+    const GPtrArray *exclude,
+    GHashTable *matches,
+    const gchar *must_have_unique_name)
+{
+  GList *these = NULL;
+  GList *iter;
+  guint i;
+
+  for (i = 0; i < candidates->len; i++)
     {
-      McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
-      gsize quality;
+      McdClientProxy *client = g_ptr_array_index (candidates, i);
+      gpointer quality_p = g_hash_table_lookup (matches, client);
+      PossibleHandler *ph;
+
+      if (quality_p == NULL)
+        {
+          /* no filter matches */
+          continue;
+        }
+
+      if (exclude != NULL && ptr_array_contains (exclude, client))
+        {
+          /* already considered */
+          continue;
+        }
 
       if (must_have_unique_name != NULL &&
           tp_strdiff (must_have_unique_name,
@@ -628,46 +1042,73 @@ _mcd_client_registry_list_possible_handlers (McdClientRegistry *self,
           continue;
         }
 
-      if (!tp_proxy_has_interface_by_id (client,
-            TP_IFACE_QUARK_CLIENT_HANDLER))
-        {
-            /* not a handler at all */
-            continue;
-        }
+      ph = g_slice_new0 (PossibleHandler);
 
-      if (channel == NULL)
-        {
-          /* We don't know the channel's properties (the next part will not
-           * execute), so we must work out the quality of match from the
-           * channel request. We can assume that the request will return one
-           * channel, with the requested properties, plus Requested == TRUE.
-           */
-          g_assert (request_props != NULL);
-          quality = _mcd_client_match_filters (request_props,
-              _mcd_client_proxy_get_handler_filters (client), TRUE);
-        }
-      else
-        {
-          GVariant *properties;
+      ph->client = client;
+      ph->quality = GPOINTER_TO_UINT (quality_p);
 
-          g_assert (TP_IS_CHANNEL (channel));
-          properties = tp_channel_dup_immutable_properties (channel);
-          quality = _mcd_client_match_filters (properties,
-              _mcd_client_proxy_get_handler_filters (client), FALSE);
-          g_variant_unref (properties);
-        }
+      these = g_list_prepend (these, ph);
+    }
 
-      if (quality > 0)
-        {
-          PossibleHandler *ph = g_slice_new0 (PossibleHandler);
+  /* sort by ascending quality then reverse */
+  these = g_list_sort (these, possible_handler_cmp);
+  these = g_list_reverse (these);
+
+  /* convert in-place from a list of PossibleHandler to a list of
+   * McdClientProxy */
+  for (iter = these; iter != NULL; iter = iter->next)
+    {
+      PossibleHandler *ph = iter->data;
 
-          ph->client = client;
-          ph->bypass = _mcd_client_proxy_get_bypass_approval (client);
-          ph->quality = quality;
+      iter->data = ph->client;
+      g_slice_free (PossibleHandler, ph);
+    }
 
-          handlers = g_list_prepend (handlers, ph);
-        }
+  return g_list_concat (these, handlers);
+}
+
+GList *
+_mcd_client_registry_list_possible_handlers (McdClientRegistry *self,
+    const gchar *preferred_handler,
+    GVariant *request_props,
+    TpChannel *channel,
+    const gchar *must_have_unique_name)
+{
+  GList *handlers;
+  GHashTable *matches;
+
+  if (channel == NULL)
+    {
+      /* We don't know the channel's properties, so we must work out the
+       * quality of match from the channel request. We can assume that the
+       * request will return one channel, with the requested properties,
+       * plus Requested == TRUE.
+       */
+      McdMatchRecord *record;
+
+      g_assert (request_props != NULL);
+      record = _mcd_match_record_new (request_props);
+      matches = _mcd_client_registry_match_filters (self,
+          MCD_CLIENT_HANDLER, record, TRUE);
+      _mcd_match_record_free (record);
     }
+  else
+    {
+      g_assert (TP_IS_CHANNEL (channel));
+      matches = _mcd_client_registry_match_filters (self,
+          MCD_CLIENT_HANDLER, _mcd_match_record_for_tp_channel (channel),
+          FALSE);
+    }
+
+  /* Most preferred first: BypassApproval wins, then the quality of the
+   * match decides. */
+  handlers = prepend_possible_handlers (NULL,
+      self->priv->by_interface[MCD_CLIENT_HANDLER],
+      self->priv->bypass_handlers, matches, must_have_unique_name);
+  handlers = prepend_possible_handlers (handlers,
+      self->priv->bypass_handlers, NULL, matches, must_have_unique_name);
+
+  g_hash_table_unref (matches);
 
   /* if no handlers can take them all, fail - unless we're operating on
    * a request that specified a preferred handler, in which case assume
@@ -691,25 +1132,133 @@ _mcd_client_registry_list_possible_handlers (McdClientRegistry *self,
       return g_list_append (NULL, client);
     }
 
-  /* We have at least one handler that can take the whole batch. Sort
-   * the possible handlers, most preferred first (i.e. sort by ascending
-   * quality then reverse) */
-  handlers = g_list_sort (handlers, possible_handler_cmp);
-  handlers = g_list_reverse (handlers);
+  return handlers;
+}
 
-  /* convert in-place from a list of PossibleHandler to a list of
-   * McdClientProxy */
-  for (handlers_iter = handlers;
-       handlers_iter != NULL;
-       handlers_iter = handlers_iter->next)
+static gint
+compare_dict_entries (gconstpointer a,
+    gconstpointer b)
+{
+  GVariant *entry_a = *(GVariant * const *) a;
+  GVariant *entry_b = *(GVariant * const *) b;
+  const gchar *key_a, *key_b;
+
+  g_variant_get_child (entry_a, 0, "&s", &key_a);
+  g_variant_get_child (entry_b, 0, "&s", &key_b);
+  return strcmp (key_a, key_b);
+}
+
+/* The same string for any two requests that are equivalent for the
+ * purposes of _mcd_client_registry_list_possible_handlers(), regardless
+ * of the order of the properties */
+static gchar *
+prediction_key (const gchar *preferred_handler,
+    GVariant *request_props)
+{
+  gsize n = g_variant_n_children (request_props);
+  GVariant **entries = g_new (GVariant *, n);
+  GString *key = g_string_new (preferred_handler);
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    entries[i] = g_variant_get_child_value (request_props, i);
+
+  qsort (entries, n, sizeof (GVariant *), compare_dict_entries);
+  g_string_append_c (key, '\n');
+
+  for (i = 0; i < n; i++)
     {
-      PossibleHandler *ph = handlers_iter->data;
+      g_variant_print_string (entries[i], key, TRUE);
+      g_variant_unref (entries[i]);
+    }
 
-      handlers_iter->data = ph->client;
-      g_slice_free (PossibleHandler, ph);
+  g_free (entries);
+  return g_string_free (key, FALSE);
+}
+
+/*
+ * _mcd_client_registry_predict_handler:
+ * @self: the client registry
+ * @preferred_handler: the well-known name of the preferred handler, or
+ *  %NULL or ""
+ * @request_props: the requested channel properties, as an a{sv}
+ *
+ * Guess which Handler will get the channel that satisfies a request:
+ * the same as the first result of
+ * _mcd_client_registry_list_possible_handlers() with no channel, but
+ * remembered, so that similar requests in quick succession don't all need
+ * to look at every Handler's filters.
+ *
+ * Returns: (transfer none): the most likely Handler, or %NULL
+ */
+McdClientProxy *
+_mcd_client_registry_predict_handler (McdClientRegistry *self,
+    const gchar *preferred_handler,
+    GVariant *request_props)
+{
+  McdClientProxy *predicted = NULL;
+  gpointer cached;
+  gchar *key;
+  GList *handlers;
+
+  g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
+  g_return_val_if_fail (request_props != NULL, NULL);
+
+  /* the cached clients are borrowed, so this also stops us from returning
+   * one that has gone away */
+  if (self->priv->prediction_cache_generation !=
+      self->priv->filters_generation)
+    {
+      _mcd_lru_cache_remove_all (self->priv->prediction_cache);
+      self->priv->prediction_cache_generation =
+        self->priv->filters_generation;
     }
 
-  return handlers;
+  key = prediction_key (preferred_handler, request_props);
+
+  if (_mcd_lru_cache_lookup (self->priv->prediction_cache, key, &cached))
+    {
+      g_free (key);
+      return cached;
+    }
+
+  handlers = _mcd_client_registry_list_possible_handlers (self,
+      preferred_handler, request_props, NULL, NULL);
+
+  if (handlers != NULL)
+    predicted = handlers->data;
+
+  g_list_free (handlers);
+
+  /* takes ownership of the key */
+  _mcd_lru_cache_insert (self->priv->prediction_cache, key, predicted);
+  return predicted;
+}
+
+/*
+ * _mcd_client_registry_get_prediction_stats:
+ * @self: the client registry
+ * @hits: (out): how many times _mcd_client_registry_predict_handler()
+ *  found a remembered result
+ * @misses: (out): how many times it didn't
+ */
+void
+_mcd_client_registry_get_prediction_stats (McdClientRegistry *self,
+    guint64 *hits,
+    guint64 *misses)
+{
+  g_return_if_fail (MCD_IS_CLIENT_REGISTRY (self));
+
+  _mcd_lru_cache_get_stats (self->priv->prediction_cache, hits, misses,
+      NULL);
+}
+
+void
+_mcd_client_registry_reset_prediction_stats (McdClientRegistry *self)
+{
+  g_return_if_fail (MCD_IS_CLIENT_REGISTRY (self));
+
+  _mcd_lru_cache_reset_stats (self->priv->prediction_cache);
 }
 
 TpDBusDaemon *
@@ -26,6 +26,7 @@
 
 #include <telepathy-glib/telepathy-glib.h>
 
+#include "mcd-capability-snapshot.h"
 #include "mcd-client-priv.h"
 
 G_BEGIN_DECLS
@@ -71,20 +72,41 @@ TpDBusDaemon *_mcd_client_registry_get_dbus_daemon (McdClientRegistry *self);
 G_GNUC_INTERNAL McdClientProxy *_mcd_client_registry_lookup (
     McdClientRegistry *self, const gchar *well_known_name);
 
-G_GNUC_INTERNAL GPtrArray *_mcd_client_registry_dup_client_caps (
+G_GNUC_INTERNAL McdCapabilitySnapshot *_mcd_client_registry_ref_capabilities (
     McdClientRegistry *self);
 
+G_GNUC_INTERNAL void _mcd_client_registry_forget_departed_handlers (
+    McdClientRegistry *self, guint64 generation);
+
 G_GNUC_INTERNAL gboolean _mcd_client_registry_is_ready (
     McdClientRegistry *self);
 
 G_GNUC_INTERNAL void _mcd_client_registry_init_hash_iter (
     McdClientRegistry *self, GHashTableIter *iter);
 
+G_GNUC_INTERNAL const GPtrArray *_mcd_client_registry_get_clients (
+    McdClientRegistry *self, McdClientInterface interface);
+
+G_GNUC_INTERNAL const GPtrArray *_mcd_client_registry_get_bypass_handlers (
+    McdClientRegistry *self);
+
+G_GNUC_INTERNAL GHashTable *_mcd_client_registry_match_filters (
+    McdClientRegistry *self, McdClientInterface interface,
+    McdMatchRecord *record, gboolean assume_requested);
+
 G_GNUC_INTERNAL GList *_mcd_client_registry_list_possible_handlers (
     McdClientRegistry *self, const gchar *preferred_handler,
     GVariant *request_props, TpChannel *channel,
     const gchar *must_have_unique_name);
 
+G_GNUC_INTERNAL McdClientProxy *_mcd_client_registry_predict_handler (
+    McdClientRegistry *self, const gchar *preferred_handler,
+    GVariant *request_props);
+G_GNUC_INTERNAL void _mcd_client_registry_get_prediction_stats (
+    McdClientRegistry *self, guint64 *hits, guint64 *misses);
+G_GNUC_INTERNAL void _mcd_client_registry_reset_prediction_stats (
+    McdClientRegistry *self);
+
 G_END_DECLS
 
 #endif
@@ -22,14 +22,18 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <gio/gio.h>
 #include <glib/gstdio.h>
 
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-account-manager-default.h"
 #include "mcd-debug.h"
+#include "mcd-keyfile-journal.h"
 #include "mcd-misc.h"
 
 #define PLUGIN_NAME "default-gkeyfile"
@@ -71,23 +75,113 @@ account_filename_in (const gchar *dir)
       NULL);
 }
 
+static gchar *
+account_shard_dir_in (const gchar *dir)
+{
+  return g_build_filename (dir, "telepathy", "mission-control", "accounts.d",
+      NULL);
+}
+
 static void
 mcd_account_manager_default_init (McdAccountManagerDefault *self)
 {
   DEBUG ("mcd_account_manager_default_init");
   self->filename = account_filename_in (g_get_user_data_dir ());
+  self->shard_dir = account_shard_dir_in (g_get_user_data_dir ());
+  self->journal_filename = g_strconcat (self->filename, ".journal", NULL);
   self->keyfile = g_key_file_new ();
   self->removed = g_key_file_new ();
   self->removed_accounts =
     g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->dirty_accounts =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->journal_pending = g_string_new ("");
   self->save = FALSE;
   self->loaded = FALSE;
+
+  /* The sharded layout (one file per account, so that committing one
+   * account doesn't rewrite all of them) is used if it has been used
+   * before, or if explicitly requested. */
+  self->sharded = (g_getenv ("MC_SHARDED_ACCOUNTS") != NULL ||
+      g_file_test (self->shard_dir, G_FILE_TEST_IS_DIR));
+  self->shards_incomplete = FALSE;
+
+  /* Similarly, appending changes to a journal instead of rewriting the
+   * whole file is done if it has been done before, or if explicitly
+   * requested. Per-account files already make commits cheap, so they
+   * take precedence; but an existing journal is still replayed, and only
+   * deleted when its contents have been migrated to per-account files. */
+  self->journalled = (!self->sharded &&
+      (g_getenv ("MC_ACCOUNTS_JOURNAL") != NULL ||
+       g_file_test (self->journal_filename, G_FILE_TEST_EXISTS)));
+  self->journal_size = 0;
+  self->base_size = 0;
+  self->rewrite_base = FALSE;
+  self->compact_id = 0;
+}
+
+static void
+am_default_mark_dirty (McdAccountManagerDefault *self,
+    const gchar *account)
+{
+  self->save = TRUE;
+
+  if (self->sharded)
+    g_hash_table_add (self->dirty_accounts, g_strdup (account));
+}
+
+static void
+mcd_account_manager_default_dispose (GObject *object)
+{
+  McdAccountManagerDefault *self = MCD_ACCOUNT_MANAGER_DEFAULT (object);
+
+  if (self->compact_id != 0)
+    {
+      g_source_remove (self->compact_id);
+      self->compact_id = 0;
+    }
+
+  G_OBJECT_CLASS (mcd_account_manager_default_parent_class)->dispose (object);
 }
 
 static void
 mcd_account_manager_default_class_init (McdAccountManagerDefaultClass *cls)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (cls);
+
   DEBUG ("mcd_account_manager_default_class_init");
+
+  object_class->dispose = mcd_account_manager_default_dispose;
+}
+
+/* If we're keeping a journal, record that @key in @account was set to
+ * @val, or removed if @val is %NULL (the whole of @account, if @key is
+ * %NULL too). Anything the journal can't represent makes the next commit
+ * rewrite the whole file instead. */
+static void
+am_default_journal_set (McdAccountManagerDefault *self,
+    const gchar *account,
+    const gchar *key,
+    const gchar *val)
+{
+  gboolean ok;
+
+  if (!self->journalled)
+    return;
+
+  if (val != NULL)
+    ok = mcd_keyfile_journal_append_set (self->journal_pending, account,
+        key, val);
+  else
+    ok = mcd_keyfile_journal_append_remove (self->journal_pending, account,
+        key);
+
+  if (!ok)
+    {
+      DEBUG ("can't journal %s.%s, will rewrite %s instead", account,
+          key == NULL ? "(all)" : key, self->filename);
+      self->rewrite_base = TRUE;
+    }
 }
 
 /* We happen to know that the string MC gave us is "sufficiently escaped" to
@@ -101,13 +195,14 @@ _set (const McpAccountStorage *self,
 {
   McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
 
-  amd->save = TRUE;
+  am_default_mark_dirty (amd, account);
 
   if (val != NULL)
     g_key_file_set_value (amd->keyfile, account, key, val);
   else
     g_key_file_remove_key (amd->keyfile, account, key, NULL);
 
+  am_default_journal_set (amd, account, key, val);
   return TRUE;
 }
 
@@ -186,7 +281,10 @@ _delete (const McpAccountStorage *self,
   if (key == NULL)
     {
       if (g_key_file_remove_group (amd->keyfile, account, NULL))
-        amd->save = TRUE;
+        {
+          am_default_mark_dirty (amd, account);
+          am_default_journal_set (amd, account, NULL, NULL);
+        }
     }
   else
     {
@@ -197,14 +295,18 @@ _delete (const McpAccountStorage *self,
       save = g_key_file_remove_key (amd->keyfile, account, key, NULL);
 
       if (save)
-        amd->save = TRUE;
+        {
+          am_default_mark_dirty (amd, account);
+          am_default_journal_set (amd, account, key, NULL);
+        }
 
       keys = g_key_file_get_keys (amd->keyfile, account, &n, NULL);
 
       /* if that was the last parameter, the account is gone too */
       if (keys == NULL || n == 0)
         {
-          g_key_file_remove_group (amd->keyfile, account, NULL);
+          if (g_key_file_remove_group (amd->keyfile, account, NULL))
+            am_default_journal_set (amd, account, NULL, NULL);
         }
 
       g_strfreev (keys);
@@ -213,25 +315,207 @@ _delete (const McpAccountStorage *self,
   return TRUE;
 }
 
+static gboolean
+_set_batch (McpAccountStorage *self,
+    McpAccountManager *am,
+    const gchar *account,
+    GVariant *changes)
+{
+  GVariantIter iter;
+  const gchar *key;
+  GVariant *value;
 
+  g_variant_iter_init (&iter, changes);
+
+  while (g_variant_iter_next (&iter, "{&smv}", &key, &value))
+    {
+      if (value != NULL)
+        {
+          gchar *escaped = mcp_account_manager_escape_variant_for_keyfile (
+              am, value);
+
+          _set (self, am, account, key, escaped);
+          g_free (escaped);
+          g_variant_unref (value);
+        }
+      else
+        {
+          _delete (self, am, account, key);
+        }
+    }
+
+  return TRUE;
+}
+
+
+static gchar *
+am_default_shard_filename (McdAccountManagerDefault *self,
+    const gchar *account)
+{
+  gchar *escaped = tp_escape_as_identifier (account);
+  gchar *basename = g_strconcat (escaped, ".cfg", NULL);
+  gchar *ret = g_build_filename (self->shard_dir, basename, NULL);
+
+  g_free (basename);
+  g_free (escaped);
+  return ret;
+}
+
+/* Write @account's group to its own file, or delete that file if the
+ * account no longer exists. */
 static gboolean
-_commit (const McpAccountStorage *self,
-    const McpAccountManager *am,
+am_default_write_shard (McdAccountManagerDefault *self,
     const gchar *account)
+{
+  gchar *filename = am_default_shard_filename (self, account);
+  GError *error = NULL;
+  gboolean rval = TRUE;
+
+  if (g_key_file_has_group (self->keyfile, account))
+    {
+      GString *data = g_string_new (INITIAL_CONFIG);
+      GStrv keys = g_key_file_get_keys (self->keyfile, account, NULL, NULL);
+      gsize i;
+
+      g_string_append_printf (data, "[%s]\n", account);
+
+      for (i = 0; keys != NULL && keys[i] != NULL; i++)
+        {
+          gchar *v = g_key_file_get_value (self->keyfile, account, keys[i],
+              NULL);
+
+          if (v != NULL)
+            g_string_append_printf (data, "%s=%s\n", keys[i], v);
+
+          g_free (v);
+        }
+
+      DEBUG ("Saving account %s to %s", account, filename);
+      rval = g_file_set_contents (filename, data->str, data->len, &error);
+
+      if (!rval)
+        {
+          g_warning ("%s", error->message);
+          g_error_free (error);
+        }
+
+      g_strfreev (keys);
+      g_string_free (data, TRUE);
+    }
+  else if (g_unlink (filename) != 0 && errno != ENOENT)
+    {
+      g_warning ("Unable to delete %s: %s", filename, g_strerror (errno));
+      rval = FALSE;
+    }
+  else
+    {
+      DEBUG ("Deleted account %s from %s", account, filename);
+    }
+
+  g_free (filename);
+  return rval;
+}
+
+static gboolean
+am_default_commit_shards (McdAccountManagerDefault *self,
+    const gchar *account)
+{
+  GError *error = NULL;
+  gboolean rval = TRUE;
+
+  if (!mcd_ensure_directory (self->shard_dir, &error))
+    {
+      g_warning ("%s", error->message);
+      g_clear_error (&error);
+      /* fall through anyway: writing the files will fail */
+    }
+
+  /* Until every account has its own file, the accounts directory can't
+   * be trusted on its own, so write everything. */
+  if (self->shards_incomplete)
+    {
+      GStrv groups = g_key_file_get_groups (self->keyfile, NULL);
+      gsize i;
+
+      for (i = 0; groups != NULL && groups[i] != NULL; i++)
+        g_hash_table_add (self->dirty_accounts, g_strdup (groups[i]));
+
+      g_strfreev (groups);
+      account = NULL;
+    }
+
+  if (account != NULL)
+    {
+      if (g_hash_table_contains (self->dirty_accounts, account))
+        {
+          rval = am_default_write_shard (self, account);
+
+          if (rval)
+            g_hash_table_remove (self->dirty_accounts, account);
+        }
+    }
+  else
+    {
+      GHashTableIter iter;
+      gpointer k;
+
+      g_hash_table_iter_init (&iter, self->dirty_accounts);
+
+      while (g_hash_table_iter_next (&iter, &k, NULL))
+        {
+          if (am_default_write_shard (self, k))
+            g_hash_table_iter_remove (&iter);
+          else
+            rval = FALSE;
+        }
+    }
+
+  if (rval && self->shards_incomplete)
+    {
+      self->shards_incomplete = FALSE;
+
+      /* The monolithic file has been superseded, so get rid of it, or
+       * it'd be merged in again next time. */
+      if (g_file_test (self->filename, G_FILE_TEST_EXISTS))
+        {
+          DEBUG ("Migrated %s to %s: deleting old copy", self->filename,
+              self->shard_dir);
+
+          if (g_unlink (self->filename) != 0)
+            g_warning ("Unable to delete %s: %s", self->filename,
+                g_strerror (errno));
+        }
+
+      /* Likewise the journal, whose changes were replayed into the
+       * per-account files we just wrote. */
+      if (g_file_test (self->journal_filename, G_FILE_TEST_EXISTS))
+        {
+          DEBUG ("Migrated %s to %s: deleting it", self->journal_filename,
+              self->shard_dir);
+
+          if (g_unlink (self->journal_filename) != 0)
+            g_warning ("Unable to delete %s: %s", self->journal_filename,
+                g_strerror (errno));
+        }
+    }
+
+  self->save = (g_hash_table_size (self->dirty_accounts) > 0);
+  return rval;
+}
+
+/* Rewrite the whole of the monolithic file. */
+static gboolean
+am_default_write_keyfile (McdAccountManagerDefault *self)
 {
   gsize n;
   gchar *data;
-  McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
   gboolean rval = FALSE;
   gchar *dir;
   GError *error = NULL;
 
-  if (!amd->save)
-    return TRUE;
-
-  dir = g_path_get_dirname (amd->filename);
+  dir = g_path_get_dirname (self->filename);
 
-  DEBUG ("Saving accounts to %s", amd->filename);
+  DEBUG ("Saving accounts to %s", self->filename);
 
   if (!mcd_ensure_directory (dir, &error))
     {
@@ -243,12 +527,13 @@ _commit (const McpAccountStorage *self,
 
   g_free (dir);
 
-  data = g_key_file_to_data (amd->keyfile, &n, NULL);
-  rval = g_file_set_contents (amd->filename, data, n, &error);
+  data = g_key_file_to_data (self->keyfile, &n, NULL);
+  rval = g_file_set_contents (self->filename, data, n, &error);
 
   if (rval)
     {
-      amd->save = FALSE;
+      self->save = FALSE;
+      self->base_size = n;
     }
   else
     {
@@ -261,6 +546,169 @@ _commit (const McpAccountStorage *self,
   return rval;
 }
 
+/* Fold the journal into the monolithic file, by rewriting the latter in
+ * full and then starting a new journal. */
+static gboolean
+am_default_compact (McdAccountManagerDefault *self)
+{
+  GError *error = NULL;
+
+  if (!am_default_write_keyfile (self))
+    return FALSE;
+
+  /* Everything that was pending is in the file now. */
+  g_string_truncate (self->journal_pending, 0);
+
+  /* If we crash before this point, replaying the old journal onto the
+   * new file is harmless: see mcd-keyfile-journal.c */
+  if (!g_file_set_contents (self->journal_filename,
+        MCD_KEYFILE_JOURNAL_HEADER, -1, &error))
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      /* try again next time */
+      self->rewrite_base = TRUE;
+      return FALSE;
+    }
+
+  DEBUG ("Compacted %" G_GSIZE_FORMAT " bytes of journal into %s",
+      self->journal_size, self->filename);
+
+  self->journal_size = strlen (MCD_KEYFILE_JOURNAL_HEADER);
+  self->rewrite_base = FALSE;
+  return TRUE;
+}
+
+static gboolean
+am_default_compact_cb (gpointer data)
+{
+  McdAccountManagerDefault *self = data;
+
+  self->compact_id = 0;
+  am_default_compact (self);
+  return FALSE;
+}
+
+static void
+am_default_maybe_schedule_compaction (McdAccountManagerDefault *self)
+{
+  if (self->compact_id == 0 &&
+      mcd_keyfile_journal_should_compact (self->journal_size,
+        self->base_size))
+    self->compact_id = g_idle_add_full (G_PRIORITY_LOW,
+        am_default_compact_cb, self, NULL);
+}
+
+/* Append the pending transaction to the journal, and flush it to disk. */
+static gboolean
+am_default_append_journal (McdAccountManagerDefault *self,
+    GError **error)
+{
+  const gchar *p = self->journal_pending->str;
+  gsize remaining = self->journal_pending->len;
+  int fd;
+
+  fd = g_open (self->journal_filename, O_WRONLY | O_APPEND | O_CREAT, 0600);
+
+  if (fd < 0)
+    goto error;
+
+  while (remaining > 0)
+    {
+      gssize n = write (fd, p, remaining);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          goto error;
+        }
+
+      p += n;
+      remaining -= n;
+    }
+
+  if (fsync (fd) != 0)
+    goto error;
+
+  if (close (fd) != 0)
+    {
+      fd = -1;
+      goto error;
+    }
+
+  return TRUE;
+
+error:
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+      "Unable to append to %s: %s", self->journal_filename,
+      g_strerror (errno));
+
+  if (fd >= 0)
+    close (fd);
+
+  return FALSE;
+}
+
+static gboolean
+am_default_commit_journal (McdAccountManagerDefault *self)
+{
+  GError *error = NULL;
+  gsize len;
+
+  if (self->rewrite_base)
+    return am_default_compact (self);
+
+  if (self->journal_pending->len == 0)
+    {
+      self->save = FALSE;
+      return TRUE;
+    }
+
+  mcd_keyfile_journal_append_commit (self->journal_pending);
+  len = self->journal_pending->len;
+
+  DEBUG ("Appending %" G_GSIZE_FORMAT " bytes to %s", len,
+      self->journal_filename);
+
+  if (!am_default_append_journal (self, &error))
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      /* we might have left a partial transaction in the journal, which
+       * would hide anything appended after it */
+      self->rewrite_base = TRUE;
+      return FALSE;
+    }
+
+  g_string_truncate (self->journal_pending, 0);
+  self->journal_size += len;
+  self->save = FALSE;
+
+  am_default_maybe_schedule_compaction (self);
+  return TRUE;
+}
+
+static gboolean
+_commit (const McpAccountStorage *self,
+    const McpAccountManager *am,
+    const gchar *account)
+{
+  McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
+
+  if (!amd->save)
+    return TRUE;
+
+  if (amd->sharded)
+    return am_default_commit_shards (amd, account);
+
+  if (amd->journalled)
+    return am_default_commit_journal (amd);
+
+  return am_default_write_keyfile (amd);
+}
+
 static void
 am_default_load_keyfile (McdAccountManagerDefault *self,
     const gchar *filename)
@@ -286,6 +734,165 @@ am_default_load_keyfile (McdAccountManagerDefault *self,
     }
 }
 
+/* Merge every per-account file in @shard_dir into the keyfile. Returns
+ * %FALSE if @shard_dir doesn't exist. */
+static gboolean
+am_default_load_shards (McdAccountManagerDefault *self,
+    const gchar *shard_dir)
+{
+  GDir *dir = g_dir_open (shard_dir, 0, NULL);
+  const gchar *basename;
+  GKeyFile *shard;
+
+  if (dir == NULL)
+    return FALSE;
+
+  shard = g_key_file_new ();
+
+  while ((basename = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *filename;
+      GError *error = NULL;
+
+      if (!g_str_has_suffix (basename, ".cfg"))
+        continue;
+
+      filename = g_build_filename (shard_dir, basename, NULL);
+
+      if (g_key_file_load_from_file (shard, filename, G_KEY_FILE_NONE,
+            &error))
+        {
+          GStrv groups = g_key_file_get_groups (shard, NULL);
+          gsize i, j;
+
+          for (i = 0; groups[i] != NULL; i++)
+            {
+              GStrv keys = g_key_file_get_keys (shard, groups[i], NULL, NULL);
+
+              /* the per-account file supersedes anything in accounts.cfg */
+              g_key_file_remove_group (self->keyfile, groups[i], NULL);
+
+              for (j = 0; keys != NULL && keys[j] != NULL; j++)
+                {
+                  gchar *v = g_key_file_get_value (shard, groups[i], keys[j],
+                      NULL);
+
+                  g_key_file_set_value (self->keyfile, groups[i], keys[j], v);
+                  g_free (v);
+                }
+
+              g_strfreev (keys);
+            }
+
+          g_strfreev (groups);
+        }
+      else
+        {
+          DEBUG ("Failed to load account from %s: %s", filename,
+              error->message);
+          g_error_free (error);
+        }
+
+      g_free (filename);
+    }
+
+  g_key_file_free (shard);
+  g_dir_close (dir);
+  return TRUE;
+}
+
+/* Replay the journal on top of the monolithic file we just loaded. */
+static void
+am_default_load_journal (McdAccountManagerDefault *self)
+{
+  gchar *data = NULL;
+  gsize len = 0;
+  gsize valid;
+  guint n = 0;
+  GError *error = NULL;
+  struct stat st;
+
+  if (g_stat (self->filename, &st) == 0)
+    self->base_size = st.st_size;
+
+  if (!g_file_get_contents (self->journal_filename, &data, &len, &error))
+    {
+      DEBUG ("No journal to replay: %s", error->message);
+      g_error_free (error);
+      /* start one when something changes */
+      self->rewrite_base = TRUE;
+      return;
+    }
+
+  valid = mcd_keyfile_journal_replay (self->keyfile, data, len, &n);
+  DEBUG ("Replayed %u transactions from %s", n, self->journal_filename);
+
+  /* The journal is only being migrated to per-account files, so there's
+   * no need to keep track of it. */
+  if (self->sharded)
+    {
+      g_free (data);
+      return;
+    }
+
+  self->journal_size = len;
+
+  if (valid < len)
+    {
+      DEBUG ("Ignoring %" G_GSIZE_FORMAT " bytes of incomplete or damaged "
+          "journal", len - valid);
+      /* Anything we appended after the damaged part would be ignored too,
+       * so the next commit has to start a fresh journal. */
+      self->rewrite_base = TRUE;
+    }
+  else
+    {
+      am_default_maybe_schedule_compaction (self);
+    }
+
+  g_free (data);
+}
+
+/* Load the monolithic accounts.cfg and/or per-account files from the
+ * telepathy/mission-control directory in @data_dir. If @replay_journal,
+ * also replay the journal, which describes changes to accounts.cfg, so
+ * has to be replayed before the per-account files supersede it. Returns
+ * %FALSE if there was none of these. */
+static gboolean
+am_default_load_data_dir (McdAccountManagerDefault *self,
+    const gchar *data_dir,
+    gboolean replay_journal)
+{
+  gchar *filename = account_filename_in (data_dir);
+  gchar *shard_dir = account_shard_dir_in (data_dir);
+  gboolean loaded = FALSE;
+
+  if (g_file_test (filename, G_FILE_TEST_EXISTS))
+    {
+      am_default_load_keyfile (self, filename);
+      loaded = TRUE;
+    }
+
+  if (replay_journal &&
+      g_file_test (self->journal_filename, G_FILE_TEST_EXISTS))
+    {
+      am_default_load_journal (self);
+      loaded = TRUE;
+    }
+  else if (replay_journal && loaded && self->journalled)
+    {
+      /* there's no journal yet: start one when something changes */
+      am_default_load_journal (self);
+    }
+
+  if (am_default_load_shards (self, shard_dir))
+    loaded = TRUE;
+
+  g_free (shard_dir);
+  g_free (filename);
+  return loaded;
+}
+
 static GList *
 _list (const McpAccountStorage *self,
     const McpAccountManager *am)
@@ -296,14 +903,24 @@ _list (const McpAccountStorage *self,
   GList *rval = NULL;
   McdAccountManagerDefault *amd = MCD_ACCOUNT_MANAGER_DEFAULT (self);
 
-  if (!amd->loaded && g_file_test (amd->filename, G_FILE_TEST_EXISTS))
+  /* If the file exists, but loading it fails, we deliberately
+   * do not fall through to the "initial configuration" case,
+   * because we don't want to overwrite a corrupted file
+   * with an empty one until an actual write takes place. */
+  if (!amd->loaded &&
+      am_default_load_data_dir (amd, g_get_user_data_dir (), TRUE))
     {
-      /* If the file exists, but loading it fails, we deliberately
-       * do not fall through to the "initial configuration" case,
-       * because we don't want to overwrite a corrupted file
-       * with an empty one until an actual write takes place. */
-      am_default_load_keyfile (amd, amd->filename);
       amd->loaded = TRUE;
+
+      /* If there's still a monolithic file or journal here, its accounts
+       * need to be split out before it can be deleted. */
+      if (amd->sharded &&
+          (g_file_test (amd->filename, G_FILE_TEST_EXISTS) ||
+           g_file_test (amd->journal_filename, G_FILE_TEST_EXISTS)))
+        {
+          amd->shards_incomplete = TRUE;
+          amd->save = TRUE;
+        }
     }
 
   if (!amd->loaded)
@@ -314,20 +931,16 @@ _list (const McpAccountStorage *self,
           iter != NULL && *iter != NULL;
           iter++)
         {
-          gchar *filename = account_filename_in (*iter);
-
-          if (g_file_test (filename, G_FILE_TEST_EXISTS))
+          if (am_default_load_data_dir (amd, *iter, FALSE))
             {
-              am_default_load_keyfile (amd, filename);
               amd->loaded = TRUE;
               /* Do not set amd->save: we don't need to write it to a
-               * higher-priority directory until it actually changes. */
+               * higher-priority directory until it actually changes. When
+               * it does, it has to be written out in full. */
+              amd->shards_incomplete = amd->sharded;
+              amd->rewrite_base = amd->journalled;
+              break;
             }
-
-          g_free (filename);
-
-          if (amd->loaded)
-            break;
         }
     }
 
@@ -340,6 +953,8 @@ _list (const McpAccountStorage *self,
           am_default_load_keyfile (amd, old_filename);
           amd->loaded = TRUE;
           amd->save = TRUE;
+          amd->shards_incomplete = amd->sharded;
+          amd->rewrite_base = amd->journalled;
 
           if (_commit (self, am, NULL))
             {
@@ -361,6 +976,8 @@ _list (const McpAccountStorage *self,
           G_KEY_FILE_KEEP_COMMENTS, NULL);
       amd->loaded = TRUE;
       amd->save = TRUE;
+      amd->shards_incomplete = amd->sharded;
+      amd->rewrite_base = amd->journalled;
       _commit (self, am, NULL);
     }
 
@@ -376,6 +993,128 @@ _list (const McpAccountStorage *self,
   return rval;
 }
 
+static void
+am_default_stamp_file (GString *stamp,
+    const gchar *path)
+{
+  GFile *file = g_file_new_for_path (path);
+  GFileInfo *info = g_file_query_info (file,
+      G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+      G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+      G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+      G_FILE_ATTRIBUTE_UNIX_INODE,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+  g_string_append (stamp, path);
+
+  if (info == NULL)
+    {
+      g_string_append (stamp, ":-\n");
+    }
+  else
+    {
+      g_string_append_printf (stamp,
+          ":%" G_GOFFSET_FORMAT ":%" G_GUINT64_FORMAT ".%06u:%"
+          G_GUINT64_FORMAT "\n",
+          g_file_info_get_size (info),
+          g_file_info_get_attribute_uint64 (info,
+            G_FILE_ATTRIBUTE_TIME_MODIFIED),
+          g_file_info_get_attribute_uint32 (info,
+            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+          g_file_info_get_attribute_uint64 (info,
+            G_FILE_ATTRIBUTE_UNIX_INODE));
+      g_object_unref (info);
+    }
+
+  g_object_unref (file);
+}
+
+static gint
+am_default_strcmp (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Append a description of everything am_default_load_data_dir() would
+ * read from @data_dir to @stamp. Returns %FALSE if it would read nothing. */
+static gboolean
+am_default_stamp_data_dir (GString *stamp,
+    const gchar *data_dir)
+{
+  gchar *filename = account_filename_in (data_dir);
+  gchar *journal = g_strconcat (filename, ".journal", NULL);
+  gchar *shard_dir = account_shard_dir_in (data_dir);
+  GDir *dir = g_dir_open (shard_dir, 0, NULL);
+  gboolean exists = (dir != NULL ||
+      g_file_test (filename, G_FILE_TEST_EXISTS) ||
+      g_file_test (journal, G_FILE_TEST_EXISTS));
+
+  if (exists)
+    {
+      am_default_stamp_file (stamp, filename);
+      am_default_stamp_file (stamp, journal);
+    }
+
+  if (dir != NULL)
+    {
+      GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+      const gchar *basename;
+      guint i;
+
+      while ((basename = g_dir_read_name (dir)) != NULL)
+        {
+          if (g_str_has_suffix (basename, ".cfg"))
+            g_ptr_array_add (names, g_build_filename (shard_dir, basename,
+                  NULL));
+        }
+
+      /* readdir order isn't meaningful */
+      g_ptr_array_sort (names, am_default_strcmp);
+
+      for (i = 0; i < names->len; i++)
+        am_default_stamp_file (stamp, g_ptr_array_index (names, i));
+
+      g_ptr_array_unref (names);
+      g_dir_close (dir);
+    }
+
+  g_free (shard_dir);
+  g_free (journal);
+  g_free (filename);
+  return exists;
+}
+
+/*
+ * mcd_account_manager_default_dup_stamp:
+ * @self: the default storage backend
+ *
+ * Returns: a string which changes whenever the files that the next call
+ *  to _list() would load accounts from are changed
+ */
+gchar *
+mcd_account_manager_default_dup_stamp (McdAccountManagerDefault *self)
+{
+  GString *stamp = g_string_new ("");
+
+  g_return_val_if_fail (MCD_IS_ACCOUNT_MANAGER_DEFAULT (self), NULL);
+
+  if (!am_default_stamp_data_dir (stamp, g_get_user_data_dir ()))
+    {
+      const gchar * const *iter;
+
+      for (iter = g_get_system_data_dirs ();
+          iter != NULL && *iter != NULL;
+          iter++)
+        {
+          if (am_default_stamp_data_dir (stamp, *iter))
+            break;
+        }
+    }
+
+  return g_string_free (stamp, FALSE);
+}
+
 static void
 account_storage_iface_init (McpAccountStorageIface *iface,
     gpointer unused G_GNUC_UNUSED)
@@ -388,6 +1127,7 @@ account_storage_iface_init (McpAccountStorageIface *iface,
   iface->set = _set;
   iface->create = _create;
   iface->delete = _delete;
+  iface->set_batch = _set_batch;
   iface->commit_one = _commit;
   iface->list = _list;
 
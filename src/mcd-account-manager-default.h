@@ -55,6 +55,27 @@ typedef struct {
   gchar *filename;
   gboolean save;
   gboolean loaded;
+  /* directory holding one keyfile per account, if we're using that layout */
+  gchar *shard_dir;
+  gboolean sharded;
+  /* set of owned account names whose shard needs (re)writing */
+  GHashTable *dirty_accounts;
+  /* TRUE if every account needs writing to shard_dir before we can rely
+   * on it (we loaded from somewhere else, or are migrating) */
+  gboolean shards_incomplete;
+  /* log of changes not yet folded into filename, if we're using that
+   * mode instead of rewriting filename every time */
+  gchar *journal_filename;
+  gboolean journalled;
+  /* records for changes that haven't been committed yet */
+  GString *journal_pending;
+  /* current size of journal_filename, and of filename when last written */
+  gsize journal_size;
+  gsize base_size;
+  /* TRUE if filename must be rewritten in full and the journal reset
+   * before we can append to it */
+  gboolean rewrite_base;
+  guint compact_id;
 } _McdAccountManagerDefault;
 
 typedef struct {
@@ -70,6 +91,8 @@ GType mcd_account_manager_default_get_type (void) G_GNUC_CONST;
 
 McdAccountManagerDefault *mcd_account_manager_default_new (void);
 
+gchar *mcd_account_manager_default_dup_stamp (McdAccountManagerDefault *self);
+
 G_END_DECLS
 
 #endif
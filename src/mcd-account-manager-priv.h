@@ -39,6 +39,9 @@ G_GNUC_INTERNAL void _mcd_account_manager_setup
 G_GNUC_INTERNAL GHashTable *_mcd_account_manager_get_accounts
     (McdAccountManager *account_manager);
 
+G_GNUC_INTERNAL void _mcd_account_manager_flush_conf
+    (McdAccountManager *account_manager);
+
 typedef void (*McdGetAccountCb) (McdAccountManager *account_manager,
                                  McdAccount *account,
                                  const GError *error,
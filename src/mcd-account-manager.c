@@ -99,8 +99,33 @@ struct _McdAccountManagerPrivate
     gchar *account_connections_file; /* in account_connections_dir */
 
     gboolean dbus_registered;
+
+    /* unique names of accounts with changes not yet committed */
+    GHashTable *dirty_accounts;
+    /* TRUE if every account needs committing */
+    gboolean dirty_all;
+    /* GTasks to complete when the next write has finished */
+    GQueue write_conf_tasks;
+    guint write_conf_id;
+    /* how long to wait for more changes before writing, in ms */
+    guint write_conf_delay;
+
+    /* TRUE once the storage plugins have listed their accounts */
+    gboolean storage_loaded;
+    /* TRUE if _mcd_account_manager_setup() is waiting for that */
+    gboolean setup_pending;
 };
 
+typedef struct
+{
+    /* GTasks to complete when this write has finished */
+    GQueue tasks;
+    /* number of commits still in progress */
+    guint pending;
+    /* the first error, if any */
+    GError *error;
+} McdWriteConfBatch;
+
 typedef struct
 {
     McdAccountManager *account_manager;
@@ -135,7 +160,15 @@ enum
     PROP_CLIENT_FACTORY
 };
 
-static guint write_conf_id = 0;
+/* By default, writes within this many milliseconds of each other are
+ * combined; override with $MC_WRITE_CONF_DELAY */
+#define DEFAULT_WRITE_CONF_DELAY 100
+
+typedef struct
+{
+    McdAccountManagerWriteConfCb callback;
+    gpointer user_data;
+} McdWriteConfData;
 
 static void register_dbus_service (McdAccountManager *account_manager);
 
@@ -745,10 +778,15 @@ set_new_account_properties (McdAccount *account,
                             GHashTable *properties,
                             GError **error)
 {
+    McdStorage *storage = _mcd_account_get_storage (account);
+    const gchar *account_name = mcd_account_get_unique_name (account);
     GHashTableIter iter;
     gpointer key, value;
     gboolean ok = TRUE;
 
+    /* pass all the changes to the storage plugin in one go */
+    mcd_storage_begin (storage, account_name);
+
     g_hash_table_iter_init (&iter, properties);
 
     while (g_hash_table_iter_next (&iter, &key, &value) && ok)
@@ -772,6 +810,7 @@ set_new_account_properties (McdAccount *account,
         }
     }
 
+    mcd_storage_end (storage, account_name);
     return ok;
 }
 
@@ -915,7 +954,9 @@ _mcd_account_manager_create_account (McdAccountManager *account_manager,
         return;
     }
 
-    /* create the basic account keys */
+    /* create the basic account keys; the batch has to be over before
+     * mcd_account_new(), which asks the plugins who has the account */
+    mcd_storage_begin (storage, unique_name);
     mcd_storage_set_string (storage, unique_name,
                             MC_ACCOUNTS_KEY_MANAGER, manager);
     mcd_storage_set_string (storage, unique_name,
@@ -925,6 +966,8 @@ _mcd_account_manager_create_account (McdAccountManager *account_manager,
         mcd_storage_set_string (storage, unique_name,
                                 MC_ACCOUNTS_KEY_DISPLAY_NAME, display_name);
 
+    mcd_storage_end (storage, unique_name);
+
     account = mcd_account_new (account_manager, unique_name, priv->minotaur);
     g_free (unique_name);
 
@@ -1123,18 +1166,143 @@ properties_iface_init (TpSvcDBusPropertiesClass *iface, gpointer iface_data)
 #undef IMPLEMENT
 }
 
+/*
+ * _mcd_account_manager_flush_conf:
+ * @account_manager: the #McdAccountManager
+ *
+ * Commit every change scheduled by mcd_account_manager_write_conf_async()
+ * now, instead of waiting for more changes to be made.
+ */
+void
+_mcd_account_manager_flush_conf (McdAccountManager *account_manager)
+{
+    McdAccountManagerPrivate *priv = account_manager->priv;
+    GTask *task;
+
+    if (priv->write_conf_id != 0)
+    {
+        g_source_remove (priv->write_conf_id);
+        priv->write_conf_id = 0;
+    }
+
+    if (priv->dirty_all)
+    {
+        DEBUG ("committing all accounts");
+        mcd_storage_commit (priv->storage, NULL);
+    }
+    else
+    {
+        GHashTableIter iter;
+        gpointer name;
+
+        g_hash_table_iter_init (&iter, priv->dirty_accounts);
+
+        while (g_hash_table_iter_next (&iter, &name, NULL))
+        {
+            DEBUG ("committing %s", (const gchar *) name);
+            mcd_storage_commit (priv->storage, name);
+        }
+    }
+
+    g_hash_table_remove_all (priv->dirty_accounts);
+    priv->dirty_all = FALSE;
+
+    /* mcd_storage_commit() doesn't tell us whether it worked */
+    while ((task = g_queue_pop_head (&priv->write_conf_tasks)) != NULL)
+    {
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+    }
+}
+
+static void
+write_conf_batch_done (McdWriteConfBatch *batch)
+{
+    GTask *task;
+
+    if (--batch->pending > 0)
+        return;
+
+    while ((task = g_queue_pop_head (&batch->tasks)) != NULL)
+    {
+        if (batch->error != NULL)
+            g_task_return_error (task, g_error_copy (batch->error));
+        else
+            g_task_return_boolean (task, TRUE);
+
+        g_object_unref (task);
+    }
+
+    g_clear_error (&batch->error);
+    g_slice_free (McdWriteConfBatch, batch);
+}
+
+static void
+write_conf_commit_cb (GObject *source,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+    McdWriteConfBatch *batch = user_data;
+    GError *error = NULL;
+
+    if (!mcd_storage_commit_finish (MCD_STORAGE (source), result, &error))
+    {
+        DEBUG ("%s", error->message);
+
+        if (batch->error == NULL)
+            batch->error = error;
+        else
+            g_error_free (error);
+    }
+
+    write_conf_batch_done (batch);
+}
+
 static gboolean
 write_conf (gpointer userdata)
 {
-    McdStorage *storage = MCD_STORAGE (userdata);
+    McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (userdata);
+    McdAccountManagerPrivate *priv = account_manager->priv;
+    McdWriteConfBatch *batch = g_slice_new0 (McdWriteConfBatch);
 
     DEBUG ("called");
-    g_source_remove (write_conf_id);
-    write_conf_id = 0;
+    priv->write_conf_id = 0;
+
+    /* Changes scheduled while this write is in progress wait for the
+     * next one, and so do their callbacks */
+    batch->tasks = priv->write_conf_tasks;
+    g_queue_init (&priv->write_conf_tasks);
+    /* don't finish until we've started every commit */
+    batch->pending = 1;
+
+    if (priv->dirty_all)
+    {
+        DEBUG ("committing all accounts");
+        batch->pending++;
+        mcd_storage_commit_async (priv->storage, NULL, write_conf_commit_cb,
+                                  batch);
+    }
+    else
+    {
+        GHashTableIter iter;
+        gpointer name;
 
-    mcd_storage_commit (storage, NULL);
+        g_hash_table_iter_init (&iter, priv->dirty_accounts);
 
-    return TRUE;
+        while (g_hash_table_iter_next (&iter, &name, NULL))
+        {
+            DEBUG ("committing %s", (const gchar *) name);
+            batch->pending++;
+            mcd_storage_commit_async (priv->storage, name,
+                                      write_conf_commit_cb, batch);
+        }
+    }
+
+    g_hash_table_remove_all (priv->dirty_accounts);
+    priv->dirty_all = FALSE;
+
+    write_conf_batch_done (batch);
+    return FALSE;
 }
 
 static void
@@ -1411,7 +1579,9 @@ migrate_accounts (McdAccountManager *self,
  * @account_manager: the #McdAccountManager.
  *
  * This function must be called by the McdMaster; it reads the accounts from
- * the config file, and it needs a McdMaster instance to be active.
+ * the config file, and it needs a McdMaster instance to be active. If the
+ * storage plugins are still listing their accounts, it is done when they
+ * have finished.
  */
 void
 _mcd_account_manager_setup (McdAccountManager *account_manager)
@@ -1423,6 +1593,13 @@ _mcd_account_manager_setup (McdAccountManager *account_manager)
     GHashTableIter iter;
     gpointer v;
 
+    if (!priv->storage_loaded)
+    {
+        DEBUG ("waiting for storage plugins to list their accounts");
+        priv->setup_pending = TRUE;
+        return;
+    }
+
     tp_list_connection_names (priv->dbus_daemon,
                               list_connection_names_cb, NULL, NULL,
                               (GObject *)account_manager);
@@ -1566,18 +1743,13 @@ _mcd_account_manager_finalize (GObject *object)
 {
     McdAccountManagerPrivate *priv = MCD_ACCOUNT_MANAGER_PRIV (object);
 
-    if (write_conf_id)
-    {
-        write_conf (priv->storage);
-        g_assert (write_conf_id == 0);
-    }
-
     tp_clear_object (&priv->storage);
     g_free (priv->account_connections_dir);
     remove (priv->account_connections_file);
     g_free (priv->account_connections_file);
 
     g_hash_table_unref (priv->accounts);
+    g_hash_table_unref (priv->dirty_accounts);
 
     G_OBJECT_CLASS (mcd_account_manager_parent_class)->finalize (object);
 }
@@ -1587,6 +1759,10 @@ _mcd_account_manager_dispose (GObject *object)
 {
     McdAccountManagerPrivate *priv = MCD_ACCOUNT_MANAGER_PRIV (object);
 
+    /* don't lose changes that were waiting to be written */
+    if (priv->storage != NULL)
+        _mcd_account_manager_flush_conf (MCD_ACCOUNT_MANAGER (object));
+
     tp_clear_object (&priv->dbus_daemon);
     tp_clear_object (&priv->client_factory);
     tp_clear_object (&priv->minotaur);
@@ -1648,14 +1824,21 @@ mcd_account_manager_init (McdAccountManager *account_manager)
 					MCD_TYPE_ACCOUNT_MANAGER,
 					McdAccountManagerPrivate);
     account_manager->priv = priv;
+
+    priv->dirty_accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+    g_queue_init (&priv->write_conf_tasks);
 }
 
 static void
-_mcd_account_manager_constructed (GObject *obj)
+storage_loaded_cb (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
 {
-    McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (obj);
+    McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (user_data);
     McdAccountManagerPrivate *priv = account_manager->priv;
-    guint i = 0;
+    GError *error = NULL;
+    guint i;
     static struct { const gchar *name; GCallback handler; } sig[] =
       { { "created", G_CALLBACK (created_cb) },
         { "altered", G_CALLBACK (altered_cb) },
@@ -1665,10 +1848,51 @@ _mcd_account_manager_constructed (GObject *obj)
         { "reconnect", G_CALLBACK (reconnect_cb) },
         { NULL, NULL } };
 
+    if (!mcd_storage_load_finish (MCD_STORAGE (source), result, &error))
+    {
+        /* can't happen at the moment; it's not fatal anyway */
+        WARNING ("%s", error->message);
+        g_error_free (error);
+    }
+
+    DEBUG ("storage plugins have listed their accounts");
+    priv->storage_loaded = TRUE;
+
+    /* hook up all the storage plugin signals to their handlers, now that
+     * the accounts they might refer to have been loaded: */
+    for (i = 0; sig[i].name != NULL; i++)
+    {
+        mcd_storage_connect_signal (sig[i].name, sig[i].handler,
+                                    account_manager);
+    }
+
+    if (priv->setup_pending)
+    {
+        priv->setup_pending = FALSE;
+        _mcd_account_manager_setup (account_manager);
+    }
+
+    g_object_unref (account_manager);
+}
+
+static void
+_mcd_account_manager_constructed (GObject *obj)
+{
+    McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (obj);
+    McdAccountManagerPrivate *priv = account_manager->priv;
+    const gchar *delay;
+
     DEBUG ("");
 
     priv->minotaur = mcd_connectivity_monitor_new ();
 
+    delay = g_getenv ("MC_WRITE_CONF_DELAY");
+
+    if (delay != NULL)
+        priv->write_conf_delay = strtoul (delay, NULL, 10);
+    else
+        priv->write_conf_delay = DEFAULT_WRITE_CONF_DELAY;
+
     priv->storage = mcd_storage_new (priv->dbus_daemon);
     priv->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
                                             NULL, unref_account);
@@ -1679,14 +1903,8 @@ _mcd_account_manager_constructed (GObject *obj)
                           NULL);
 
     DEBUG ("loading plugins");
-    mcd_storage_load (priv->storage);
-
-    /* hook up all the storage plugin signals to their handlers: */
-    for (i = 0; sig[i].name != NULL; i++)
-    {
-        mcd_storage_connect_signal (sig[i].name, sig[i].handler,
-                                    account_manager);
-    }
+    mcd_storage_load_async (priv->storage, storage_loaded_cb,
+                            g_object_ref (account_manager));
 
     /* initializes the interfaces */
     mcd_dbus_init_interfaces_instances (account_manager);
@@ -1735,6 +1953,21 @@ mcd_account_manager_get_connectivity_monitor (McdAccountManager *self)
  * with the appropriate error.
  */
 
+static void
+write_conf_task_cb (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+    McdWriteConfData *data = user_data;
+    GError *error = NULL;
+
+    g_task_propagate_boolean (G_TASK (result), &error);
+    data->callback (MCD_ACCOUNT_MANAGER (source), error, data->user_data);
+
+    g_clear_error (&error);
+    g_slice_free (McdWriteConfData, data);
+}
+
 /**
  * mcd_account_manager_write_conf_async:
  * @account_manager: the #McdAccountManager
@@ -1742,7 +1975,10 @@ mcd_account_manager_get_connectivity_monitor (McdAccountManager *self)
  * @callback: a callback to be called on write success or failure
  * @user_data: data to be passed to @callback
  *
- * Write the account manager configuration to disk.
+ * Write the account manager configuration to disk. This happens a short
+ * time later, so that a burst of changes results in a single write, and
+ * so that D-Bus method calls can be answered without waiting for it.
+ * @callback, if not %NULL, is called when the write has finished.
  */
 void
 mcd_account_manager_write_conf_async (McdAccountManager *account_manager,
@@ -1750,35 +1986,46 @@ mcd_account_manager_write_conf_async (McdAccountManager *account_manager,
                                       McdAccountManagerWriteConfCb callback,
                                       gpointer user_data)
 {
-    McdStorage *storage = NULL;
-    const gchar *account_name = NULL;
+    McdAccountManagerPrivate *priv;
 
     g_return_if_fail (MCD_IS_ACCOUNT_MANAGER (account_manager));
 
-    storage = account_manager->priv->storage;
+    priv = account_manager->priv;
 
     if (account != NULL)
     {
-        account_name = mcd_account_get_unique_name (account);
+        const gchar *account_name = mcd_account_get_unique_name (account);
 
-        DEBUG ("updating %s", account_name);
-        mcd_storage_commit (storage, account_name);
+        DEBUG ("scheduling update of %s", account_name);
+        g_hash_table_add (priv->dirty_accounts, g_strdup (account_name));
     }
     else
     {
-        GStrv groups;
-        gsize n_accounts = 0;
-
-        groups = mcd_storage_dup_accounts (storage, &n_accounts);
-        DEBUG ("updating all %" G_GSIZE_FORMAT " accounts", n_accounts);
+        DEBUG ("scheduling update of all accounts");
+        priv->dirty_all = TRUE;
+    }
 
-        mcd_storage_commit (storage, NULL);
+    if (callback != NULL)
+    {
+        McdWriteConfData *data = g_slice_new (McdWriteConfData);
 
-        g_strfreev (groups);
+        data->callback = callback;
+        data->user_data = user_data;
+        g_queue_push_tail (&priv->write_conf_tasks,
+                           g_task_new (account_manager, NULL,
+                                       write_conf_task_cb, data));
     }
 
-    if (callback != NULL)
-        callback (account_manager, NULL, user_data);
+    /* Don't postpone an existing write: that would let a steady stream of
+     * changes delay it indefinitely. */
+    if (priv->write_conf_id == 0)
+    {
+        if (priv->write_conf_delay == 0)
+            priv->write_conf_id = g_idle_add (write_conf, account_manager);
+        else
+            priv->write_conf_id = g_timeout_add (priv->write_conf_delay,
+                                                 write_conf, account_manager);
+    }
 }
 
 GHashTable *
@@ -108,15 +108,7 @@ void _mcd_account_connect_with_auto_presence (McdAccount *account,
 
 G_GNUC_INTERNAL McdStorage *_mcd_account_get_storage (McdAccount *account);
 
-static inline void
-_mcd_account_write_conf (McdAccount *account)
-{
-    McdStorage *storage = _mcd_account_get_storage (account);
-
-    g_return_if_fail (MCD_IS_STORAGE (storage));
-
-    mcd_storage_commit (storage, mcd_account_get_unique_name (account));
-}
+G_GNUC_INTERNAL void _mcd_account_write_conf (McdAccount *account);
 
 G_GNUC_INTERNAL void _mcd_account_connection_begin (McdAccount *account,
                                                     gboolean user_initiated);
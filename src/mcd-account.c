@@ -125,6 +125,8 @@ struct _McdAccountPrivate
     McdManager *manager;
 
     McdStorage *storage;
+    /* weak reference, used to schedule writes to storage */
+    McdAccountManager *account_manager;
     TpDBusDaemon *dbus_daemon;
     gboolean registered;
     McdConnectivityMonitor *connectivity;
@@ -1085,7 +1087,7 @@ mcd_account_set_string_val (McdAccount *account,
     }
     else if (mcd_storage_set_string (storage, name, key, new_string))
     {
-        mcd_storage_commit (storage, name);
+        _mcd_account_write_conf (account);
         mcd_account_changed_property (account, key, value);
         return SET_RESULT_CHANGED;
     }
@@ -1225,7 +1227,7 @@ _mcd_account_set_enabled (McdAccount *account,
                                        MC_ACCOUNTS_KEY_ENABLED, &value);
 
             if (write_out)
-                mcd_storage_commit (priv->storage, name);
+                _mcd_account_write_conf (account);
         }
 
         mcd_account_changed_property (account, "Enabled", &value);
@@ -1762,7 +1764,7 @@ set_automatic_presence (TpSvcDBusProperties *self,
         mcd_storage_set_attribute (priv->storage, account_name,
                                    MC_ACCOUNTS_KEY_AUTOMATIC_PRESENCE,
                                    value);
-        mcd_storage_commit (priv->storage, account_name);
+        _mcd_account_write_conf (account);
         mcd_account_changed_property (account, name, value);
     }
 
@@ -1833,7 +1835,7 @@ set_connect_automatically (TpSvcDBusProperties *self,
             mcd_storage_set_attribute (priv->storage, account_name,
                                        MC_ACCOUNTS_KEY_CONNECT_AUTOMATICALLY,
                                        value);
-            mcd_storage_commit (priv->storage, account_name);
+            _mcd_account_write_conf (account);
         }
 
         priv->connect_automatically = connect_automatically;
@@ -2059,7 +2061,7 @@ set_supersedes (TpSvcDBusProperties *svc,
 
   mcd_storage_set_attribute (self->priv->storage, self->priv->unique_name,
       MC_ACCOUNTS_KEY_SUPERSEDES, value);
-  mcd_storage_commit (self->priv->storage, self->priv->unique_name);
+  _mcd_account_write_conf (self);
 
   return TRUE;
 }
@@ -2286,7 +2288,7 @@ set_hidden (TpSvcDBusProperties *self,
   if (mcd_storage_set_attribute (priv->storage, account_name,
           MC_ACCOUNTS_KEY_HIDDEN, value))
     {
-      mcd_storage_commit (priv->storage, account_name);
+      _mcd_account_write_conf (account);
       mcd_account_changed_property (account, MC_ACCOUNTS_KEY_HIDDEN, value);
       g_object_set_property (G_OBJECT (self), "hidden", value);
     }
@@ -2691,6 +2693,9 @@ apply_parameter_updates (McdAccount *account,
     gpointer name, value;
     const gchar **unset_iter;
 
+    /* pass all the changes to the storage plugin in one go */
+    mcd_storage_begin (priv->storage, priv->unique_name);
+
     g_hash_table_iter_init (&iter, params);
     while (g_hash_table_iter_next (&iter, &name, &value))
     {
@@ -2704,6 +2709,8 @@ apply_parameter_updates (McdAccount *account,
         _mcd_account_set_parameter (account, *unset_iter, NULL);
     }
 
+    mcd_storage_end (priv->storage, priv->unique_name);
+
     if (mcd_account_get_connection_status (account) ==
         TP_CONNECTION_STATUS_CONNECTED)
     {
@@ -2988,7 +2995,7 @@ account_update_parameters_cb (McdAccount *account, GPtrArray *not_yet,
     g_value_unset (&value);
 
     /* Commit the changes to disk */
-    mcd_storage_commit (priv->storage, account_name);
+    _mcd_account_write_conf (account);
 
     /* And finally, return from UpdateParameters() */
     g_ptr_array_add (not_yet, NULL);
@@ -3418,7 +3425,7 @@ mcd_account_setup (McdAccount *account)
             mcd_storage_set_attribute (storage, name,
                                        MC_ACCOUNTS_KEY_AUTO_PRESENCE_MESSAGE,
                                        NULL);
-            mcd_storage_commit (storage, name);
+            _mcd_account_write_conf (account);
         }
     }
 
@@ -3614,6 +3621,13 @@ _mcd_account_dispose (GObject *object)
 	priv->online_requests = NULL;
     }
 
+    if (priv->account_manager != NULL)
+    {
+        g_object_remove_weak_pointer ((GObject *) priv->account_manager,
+                                      (gpointer *) &priv->account_manager);
+        priv->account_manager = NULL;
+    }
+
     tp_clear_object (&priv->manager);
     tp_clear_object (&priv->storage_plugin);
     tp_clear_object (&priv->storage);
@@ -3866,6 +3880,11 @@ mcd_account_new (McdAccountManager *account_manager,
                         "connectivity-monitor", connectivity,
 			"name", name,
 			NULL);
+
+    MCD_ACCOUNT (obj)->priv->account_manager = account_manager;
+    g_object_add_weak_pointer ((GObject *) account_manager,
+        (gpointer *) &MCD_ACCOUNT (obj)->priv->account_manager);
+
     return MCD_ACCOUNT (obj);
 }
 
@@ -3875,6 +3894,27 @@ _mcd_account_get_storage (McdAccount *account)
     return account->priv->storage;
 }
 
+/*
+ * _mcd_account_write_conf:
+ * @account: the #McdAccount
+ *
+ * Arrange for changes to @account to be committed to storage soon, along
+ * with any other changes made in the meantime.
+ */
+void
+_mcd_account_write_conf (McdAccount *account)
+{
+    McdAccountPrivate *priv = account->priv;
+
+    g_return_if_fail (MCD_IS_STORAGE (priv->storage));
+
+    if (priv->account_manager != NULL)
+        mcd_account_manager_write_conf_async (priv->account_manager, account,
+                                              NULL, NULL);
+    else
+        mcd_storage_commit (priv->storage, priv->unique_name);
+}
+
 /*
  * mcd_account_is_valid:
  * @account: the #McdAccount.
@@ -4205,7 +4245,7 @@ _mcd_account_set_normalized_name (McdAccount *account, const gchar *name)
 
     mcd_storage_set_attribute (priv->storage, account_name,
                                MC_ACCOUNTS_KEY_NORMALIZED_NAME, &value);
-    mcd_storage_commit (priv->storage, account_name);
+    _mcd_account_write_conf (account);
     mcd_account_changed_property (account, MC_ACCOUNTS_KEY_NORMALIZED_NAME,
                                   &value);
 
@@ -4224,7 +4264,7 @@ _mcd_account_set_avatar_token (McdAccount *account, const gchar *token)
                             MC_ACCOUNTS_KEY_AVATAR_TOKEN,
                             token);
 
-    mcd_storage_commit (priv->storage, account_name);
+    _mcd_account_write_conf (account);
 }
 
 gchar *
@@ -4297,7 +4337,7 @@ _mcd_account_set_avatar (McdAccount *account, const GArray *avatar,
         mcd_account_send_avatar_to_connection (account, avatar, mime_type);
     }
 
-    mcd_storage_commit (priv->storage, account_name);
+    _mcd_account_write_conf (account);
 
     return TRUE;
 }
@@ -4502,7 +4542,7 @@ clear_register (McdAccount *self)
         mcd_account_changed_property (self, "Parameters", &value);
         g_value_unset (&value);
 
-        mcd_storage_commit (self->priv->storage, account_name);
+        _mcd_account_write_conf (self);
     }
     else
     {
@@ -5228,7 +5268,7 @@ _mcd_account_set_has_been_online (McdAccount *account)
         mcd_storage_set_attribute (account->priv->storage, account_name,
                                    MC_ACCOUNTS_KEY_HAS_BEEN_ONLINE, &value);
         account->priv->has_been_online = TRUE;
-        mcd_storage_commit (account->priv->storage, account_name);
+        _mcd_account_write_conf (account);
         mcd_account_changed_property (account, MC_ACCOUNTS_KEY_HAS_BEEN_ONLINE,
                                       &value);
         g_value_unset (&value);
@@ -0,0 +1,109 @@
+/* Mission Control capability snapshot - the handler capabilities of every
+ * client, as passed to UpdateCapabilities, shared between connections
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * A snapshot is never modified after it's created: when a handler's
+ * capabilities change, the client registry makes a new one with a higher
+ * generation. So every connection can send the same one, and a connection
+ * that has already sent a snapshot's generation knows it has nothing new
+ * to say.
+ */
+
+#include "config.h"
+#include "mcd-capability-snapshot.h"
+
+#include <glib-object.h>
+
+struct _McdCapabilitySnapshot {
+    gint refcount;
+    guint64 generation;
+    /* owned GPtrArray of owned GValueArray, as for UpdateCapabilities */
+    GPtrArray *client_caps;
+};
+
+/*
+ * _mcd_capability_snapshot_new:
+ * @generation: a number that is higher than that of any earlier snapshot
+ * @client_caps: (transfer full) (element-type GValueArray): the
+ *  Handler_Capabilities of some clients
+ *
+ * Returns: (transfer full): a new snapshot with one reference
+ */
+McdCapabilitySnapshot *
+_mcd_capability_snapshot_new (guint64 generation,
+    GPtrArray *client_caps)
+{
+  McdCapabilitySnapshot *self;
+
+  g_return_val_if_fail (client_caps != NULL, NULL);
+
+  self = g_slice_new0 (McdCapabilitySnapshot);
+  self->refcount = 1;
+  self->generation = generation;
+  self->client_caps = client_caps;
+  g_ptr_array_set_free_func (self->client_caps,
+      (GDestroyNotify) g_value_array_free);
+  return self;
+}
+
+McdCapabilitySnapshot *
+_mcd_capability_snapshot_ref (McdCapabilitySnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->refcount);
+  return self;
+}
+
+void
+_mcd_capability_snapshot_unref (McdCapabilitySnapshot *self)
+{
+  if (self == NULL)
+    return;
+
+  if (g_atomic_int_dec_and_test (&self->refcount))
+    {
+      g_ptr_array_unref (self->client_caps);
+      g_slice_free (McdCapabilitySnapshot, self);
+    }
+}
+
+guint64
+_mcd_capability_snapshot_get_generation (McdCapabilitySnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->generation;
+}
+
+/*
+ * _mcd_capability_snapshot_get_client_caps:
+ * @self: a snapshot
+ *
+ * Returns: (transfer none) (element-type GValueArray): the capabilities,
+ *  which must not be modified
+ */
+const GPtrArray *
+_mcd_capability_snapshot_get_client_caps (McdCapabilitySnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->client_caps;
+}
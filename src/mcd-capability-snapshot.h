@@ -0,0 +1,44 @@
+/* Mission Control capability snapshot - the handler capabilities of every
+ * client, as passed to UpdateCapabilities, shared between connections
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_CAPABILITY_SNAPSHOT_H
+#define MCD_CAPABILITY_SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _McdCapabilitySnapshot McdCapabilitySnapshot;
+
+G_GNUC_INTERNAL McdCapabilitySnapshot *_mcd_capability_snapshot_new (
+    guint64 generation, GPtrArray *client_caps);
+G_GNUC_INTERNAL McdCapabilitySnapshot *_mcd_capability_snapshot_ref (
+    McdCapabilitySnapshot *self);
+G_GNUC_INTERNAL void _mcd_capability_snapshot_unref (
+    McdCapabilitySnapshot *self);
+
+G_GNUC_INTERNAL guint64 _mcd_capability_snapshot_get_generation (
+    McdCapabilitySnapshot *self);
+G_GNUC_INTERNAL const GPtrArray *_mcd_capability_snapshot_get_client_caps (
+    McdCapabilitySnapshot *self);
+
+G_END_DECLS
+
+#endif /* MCD_CAPABILITY_SNAPSHOT_H */
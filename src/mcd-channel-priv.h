@@ -76,6 +76,9 @@ G_GNUC_INTERNAL gboolean _mcd_channel_is_primary_for_path (McdChannel *self,
 
 G_GNUC_INTERNAL McdChannel *_mcd_channel_new_request (McdRequest *request);
 
+G_GNUC_INTERNAL McdMatchRecord *_mcd_channel_get_match_record (
+    McdChannel *self);
+
 G_END_DECLS
 #endif
 
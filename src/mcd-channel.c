@@ -771,6 +771,29 @@ mcd_channel_dup_immutable_properties (McdChannel *channel)
     return ret;
 }
 
+/*
+ * _mcd_channel_get_match_record:
+ * @channel: the #McdChannel.
+ *
+ * Returns: (transfer none): the immutable properties of @channel, decoded
+ * for matching against channel filters, or %NULL if they aren't known yet.
+ * The record belongs to the underlying #TpChannel, so it is shared with
+ * anything else that matches that channel, and is only built once.
+ */
+McdMatchRecord *
+_mcd_channel_get_match_record (McdChannel *channel)
+{
+    g_return_val_if_fail (MCD_IS_CHANNEL (channel), NULL);
+
+    if (channel->priv->tp_chan == NULL)
+    {
+        DEBUG ("Channel %p has no associated TpChannel", channel);
+        return NULL;
+    }
+
+    return _mcd_match_record_for_tp_channel (channel->priv->tp_chan);
+}
+
 /**
  * mcd_channel_take_error:
  * @channel: the #McdChannel.
@@ -0,0 +1,871 @@
+/* Mission Control client file index - finds and parses .client files
+ * without searching the filesystem for every client
+ *
+ * Copyright © 2009-2010 Nokia Corporation
+ * Copyright © 2009-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The full path of a .client file is
+ * $XDG_DATA_DIRS/telepathy/clients/clientname.client or
+ * $XDG_DATA_HOME/telepathy/clients/clientname.client; for testing
+ * purposes, we also look in $MC_CLIENTS_DIR if it is set. If more than one
+ * directory has a file for the same client, the first one in that order
+ * wins.
+ *
+ * Rather than looking in each directory every time a client appears, we
+ * list them all once, and watch them with a GFileMonitor: a file being
+ * created or deleted means listing them again next time, and a file being
+ * changed means parsing it again next time. If a directory can't be
+ * watched, we can't trust anything, so we list the directories for every
+ * lookup and only reuse a parsed file if its inode, size and mtime (to the
+ * nanosecond, where available) are the same.
+ *
+ * What we parsed is also saved to a cache in $XDG_CACHE_HOME when the
+ * client registry is ready, so that the next time MC starts, a file which
+ * passes the same checks doesn't have to be parsed at all.
+ */
+
+#include "config.h"
+#include "mcd-client-file-index.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-glib/telepathy-glib-dbus.h>
+
+#include "mcd-debug.h"
+#include "mcd-misc.h"
+
+/* Bump the last component if the cache's contents change meaning; the
+ * cache is in native byte order, so that's part of the version too. */
+#define CACHE_VERSION \
+  PACKAGE_VERSION "/" G_STRINGIFY (G_BYTE_ORDER) "/2"
+/* (mtime, nanoseconds part of mtime, size, inode, interfaces, approver
+ * filters, observer filters, handler filters, capability tokens,
+ * BypassApproval, BypassObservers, DelayApprovers, Recover) */
+#define CACHE_ENTRY_TYPE "(xxxtasaa{sv}aa{sv}aa{sv}asbbbb)"
+/* the same, as format strings for g_variant_get() and g_variant_new() */
+#define CACHE_ENTRY_GET_FORMAT "(xxxt^asaa{sv}aa{sv}aa{sv}^asbbbb)"
+#define CACHE_ENTRY_NEW_FORMAT "(xxxt^as@aa{sv}@aa{sv}@aa{sv}^asbbbb)"
+/* (version, {path: entry}) */
+#define CACHE_TYPE "(sa{s" CACHE_ENTRY_TYPE "})"
+
+struct _McdClientFileIndex {
+    gint refcount;
+    /* owned array of owned gchar *: the directories to look in, most
+     * important first */
+    GPtrArray *dirs;
+    /* owned array of owned GFileMonitor */
+    GPtrArray *monitors;
+    /* FALSE if any of @dirs couldn't be watched */
+    gboolean monitored;
+    /* TRUE if @paths needs to be rebuilt before it's used */
+    gboolean stale;
+    /* owned client name => owned absolute path of its .client file */
+    GHashTable *paths;
+    /* owned absolute path => owned Entry */
+    GHashTable *parsed;
+    /* owned absolute path => owned CACHE_ENTRY_TYPE variant: what the
+     * cache we loaded at startup says about each file */
+    GHashTable *cached;
+    /* TRUE if the cache on disk is out of date */
+    gboolean cache_dirty;
+};
+
+/* What we know about a .client file without reading it: if any of these
+ * differ, it has been changed or replaced since we parsed it */
+typedef struct {
+    gint64 mtime;
+    gint64 mtime_nsec;
+    gint64 size;
+    guint64 inode;
+} FileStamp;
+
+typedef struct {
+    McdClientFile file;
+    FileStamp stamp;
+} Entry;
+
+static void
+file_stamp_from_stat (FileStamp *stamp,
+                      const GStatBuf *st)
+{
+    stamp->mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    stamp->mtime_nsec = st->st_mtim.tv_nsec;
+#else
+    stamp->mtime_nsec = 0;
+#endif
+    stamp->size = st->st_size;
+    stamp->inode = st->st_ino;
+}
+
+static gboolean
+file_stamp_equal (const FileStamp *a,
+                  const FileStamp *b)
+{
+    return (a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec &&
+            a->size == b->size && a->inode == b->inode);
+}
+
+static void
+entry_free (gpointer p)
+{
+    Entry *entry = p;
+
+    g_strfreev (entry->file.interfaces);
+    g_list_free_full (entry->file.approver_filters,
+                      (GDestroyNotify) g_hash_table_unref);
+    g_list_free_full (entry->file.observer_filters,
+                      (GDestroyNotify) g_hash_table_unref);
+    g_list_free_full (entry->file.handler_filters,
+                      (GDestroyNotify) g_hash_table_unref);
+    g_strfreev (entry->file.capability_tokens);
+    g_slice_free (Entry, entry);
+}
+
+static GHashTable *
+parse_client_filter (GKeyFile *file, const gchar *group)
+{
+    GHashTable *filter;
+    gchar **keys;
+    gsize len;
+    guint i;
+
+    filter = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify) tp_g_value_slice_free);
+
+    keys = g_key_file_get_keys (file, group, &len, NULL);
+
+    if (keys == NULL)
+        len = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        const gchar *key;
+        const gchar *space;
+        gchar *file_property;
+        gchar file_property_type;
+
+        key = keys[i];
+        space = g_strrstr (key, " ");
+
+        if (space == NULL || space[1] == '\0' || space[2] != '\0')
+        {
+            g_warning ("Invalid key %s in client file", key);
+            continue;
+        }
+        file_property_type = space[1];
+        file_property = g_strndup (key, space - key);
+
+        switch (file_property_type)
+        {
+        case 'q':
+        case 'u':
+        case 't': /* unsigned integer */
+            {
+                /* g_key_file_get_integer cannot be used because we need
+                 * to support 64 bits */
+                guint x;
+                GValue *value = tp_g_value_slice_new (G_TYPE_UINT64);
+                gchar *str = g_key_file_get_string (file, group, key,
+                                                    NULL);
+                errno = 0;
+                x = g_ascii_strtoull (str, NULL, 0);
+                if (errno != 0)
+                {
+                    g_warning ("Invalid unsigned integer '%s' in client"
+                               " file", str);
+                }
+                else
+                {
+                    g_value_set_uint64 (value, x);
+                    g_hash_table_insert (filter, file_property, value);
+                }
+                g_free (str);
+                break;
+            }
+
+        case 'y':
+        case 'n':
+        case 'i':
+        case 'x': /* signed integer */
+            {
+                gint x;
+                GValue *value = tp_g_value_slice_new (G_TYPE_INT64);
+                gchar *str = g_key_file_get_string (file, group, key, NULL);
+                errno = 0;
+                x = g_ascii_strtoll (str, NULL, 0);
+                if (errno != 0)
+                {
+                    g_warning ("Invalid signed integer '%s' in client"
+                               " file", str);
+                }
+                else
+                {
+                    g_value_set_int64 (value, x);
+                    g_hash_table_insert (filter, file_property, value);
+                }
+                g_free (str);
+                break;
+            }
+
+        case 'b':
+            {
+                GValue *value = tp_g_value_slice_new (G_TYPE_BOOLEAN);
+                gboolean b = g_key_file_get_boolean (file, group, key, NULL);
+                g_value_set_boolean (value, b);
+                g_hash_table_insert (filter, file_property, value);
+                break;
+            }
+
+        case 's':
+            {
+                GValue *value = tp_g_value_slice_new (G_TYPE_STRING);
+                gchar *str = g_key_file_get_string (file, group, key, NULL);
+
+                g_value_take_string (value, str);
+                g_hash_table_insert (filter, file_property, value);
+                break;
+            }
+
+        case 'o':
+            {
+                GValue *value = tp_g_value_slice_new
+                    (DBUS_TYPE_G_OBJECT_PATH);
+                gchar *str = g_key_file_get_string (file, group, key, NULL);
+
+                g_value_take_boxed (value, str);
+                g_hash_table_insert (filter, file_property, value);
+                break;
+            }
+
+        default:
+            g_warning ("Invalid key %s in client file", key);
+            continue;
+        }
+    }
+    g_strfreev (keys);
+
+    return filter;
+}
+
+static Entry *
+entry_new (GKeyFile *file)
+{
+    Entry *entry = g_slice_new0 (Entry);
+    McdClientFile *client_file = &entry->file;
+    gchar **groups;
+    guint i;
+    gsize len = 0;
+    gboolean is_approver, is_handler, is_observer;
+
+    client_file->interfaces = g_key_file_get_string_list (file,
+        TP_IFACE_CLIENT, "Interfaces", 0, NULL);
+    if (!client_file->interfaces)
+        return entry;
+
+    is_approver = tp_strv_contains (
+        (const gchar * const *) client_file->interfaces,
+        TP_IFACE_CLIENT_APPROVER);
+    is_observer = tp_strv_contains (
+        (const gchar * const *) client_file->interfaces,
+        TP_IFACE_CLIENT_OBSERVER);
+    is_handler = tp_strv_contains (
+        (const gchar * const *) client_file->interfaces,
+        TP_IFACE_CLIENT_HANDLER);
+
+    /* parse filtering rules */
+    groups = g_key_file_get_groups (file, &len);
+    for (i = 0; i < len; i++)
+    {
+        if (is_approver &&
+            g_str_has_prefix (groups[i], TP_IFACE_CLIENT_APPROVER
+                              ".ApproverChannelFilter "))
+        {
+            client_file->approver_filters =
+                g_list_prepend (client_file->approver_filters,
+                                parse_client_filter (file, groups[i]));
+        }
+        else if (is_handler &&
+            g_str_has_prefix (groups[i], TP_IFACE_CLIENT_HANDLER
+                              ".HandlerChannelFilter "))
+        {
+            client_file->handler_filters =
+                g_list_prepend (client_file->handler_filters,
+                                parse_client_filter (file, groups[i]));
+        }
+        else if (is_observer &&
+            g_str_has_prefix (groups[i], TP_IFACE_CLIENT_OBSERVER
+                              ".ObserverChannelFilter "))
+        {
+            client_file->observer_filters =
+                g_list_prepend (client_file->observer_filters,
+                                parse_client_filter (file, groups[i]));
+        }
+    }
+    g_strfreev (groups);
+
+    /* Other client options */
+    client_file->bypass_approval =
+        g_key_file_get_boolean (file, TP_IFACE_CLIENT_HANDLER,
+                                "BypassApproval", NULL);
+
+    client_file->bypass_observers =
+        g_key_file_get_boolean (file, TP_IFACE_CLIENT_HANDLER,
+                                "BypassObservers", NULL);
+
+    client_file->delay_approvers =
+        g_key_file_get_boolean (file, TP_IFACE_CLIENT_OBSERVER,
+                                "DelayApprovers", NULL);
+
+    client_file->recover =
+        g_key_file_get_boolean (file, TP_IFACE_CLIENT_OBSERVER,
+                                "Recover", NULL);
+
+    client_file->capability_tokens =
+        g_key_file_get_keys (file, TP_IFACE_CLIENT_HANDLER ".Capabilities",
+                             NULL, NULL);
+
+    return entry;
+}
+
+static GList *
+filters_from_variant (GVariantIter *iter)
+{
+    GList *filters = NULL;
+    GVariant *filter;
+
+    while ((filter = g_variant_iter_next_value (iter)) != NULL)
+    {
+        filters = g_list_prepend (filters, tp_asv_from_vardict (filter));
+        g_variant_unref (filter);
+    }
+
+    g_variant_iter_free (iter);
+    return g_list_reverse (filters);
+}
+
+static Entry *
+entry_new_from_variant (GVariant *variant)
+{
+    Entry *entry = g_slice_new0 (Entry);
+    McdClientFile *client_file = &entry->file;
+    GVariantIter *approver_filters, *observer_filters, *handler_filters;
+
+    g_variant_get (variant, CACHE_ENTRY_GET_FORMAT, &entry->stamp.mtime,
+                   &entry->stamp.mtime_nsec, &entry->stamp.size,
+                   &entry->stamp.inode, &client_file->interfaces, &approver_filters,
+                   &observer_filters, &handler_filters,
+                   &client_file->capability_tokens,
+                   &client_file->bypass_approval,
+                   &client_file->bypass_observers,
+                   &client_file->delay_approvers, &client_file->recover);
+
+    client_file->approver_filters = filters_from_variant (approver_filters);
+    client_file->observer_filters = filters_from_variant (observer_filters);
+    client_file->handler_filters = filters_from_variant (handler_filters);
+
+    /* see entry_new() */
+    if (client_file->interfaces[0] == NULL)
+        tp_clear_pointer (&client_file->interfaces, g_strfreev);
+
+    if (client_file->capability_tokens[0] == NULL)
+        tp_clear_pointer (&client_file->capability_tokens, g_strfreev);
+
+    return entry;
+}
+
+static GVariant *
+filters_to_variant (const GList *filters)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+
+    for (; filters != NULL; filters = filters->next)
+        g_variant_builder_add_value (&builder,
+                                     tp_asv_to_vardict (filters->data));
+
+    return g_variant_builder_end (&builder);
+}
+
+static const gchar * const no_strings[] = { NULL };
+
+static GVariant *
+entry_to_variant (Entry *entry)
+{
+    McdClientFile *client_file = &entry->file;
+
+    return g_variant_new (CACHE_ENTRY_NEW_FORMAT, entry->stamp.mtime,
+        entry->stamp.mtime_nsec, entry->stamp.size, entry->stamp.inode,
+        client_file->interfaces != NULL ? client_file->interfaces :
+            (gchar **) no_strings,
+        filters_to_variant (client_file->approver_filters),
+        filters_to_variant (client_file->observer_filters),
+        filters_to_variant (client_file->handler_filters),
+        client_file->capability_tokens != NULL ?
+            client_file->capability_tokens : (gchar **) no_strings,
+        client_file->bypass_approval, client_file->bypass_observers,
+        client_file->delay_approvers, client_file->recover);
+}
+
+static gchar *
+cache_filename (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), "telepathy",
+        "mission-control", "clients.cache", NULL);
+}
+
+static void
+mcd_client_file_index_load_cache (McdClientFileIndex *self)
+{
+    gchar *filename = cache_filename ();
+    GMappedFile *mapped;
+    GBytes *bytes;
+    GVariant *cache;
+    GVariantIter *iter;
+    const gchar *version;
+    const gchar *path;
+    GVariant *value;
+    GError *error = NULL;
+
+    mapped = g_mapped_file_new (filename, FALSE, &error);
+
+    if (mapped == NULL)
+    {
+        DEBUG ("No client file cache: %s", error->message);
+        g_error_free (error);
+        g_free (filename);
+        return;
+    }
+
+    bytes = g_mapped_file_get_bytes (mapped);
+    g_mapped_file_unref (mapped);
+    /* untrusted, so that a corrupt file can't do any harm */
+    cache = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+    g_bytes_unref (bytes);
+
+    g_variant_get (cache, "(&sa{s" CACHE_ENTRY_TYPE "})", &version, &iter);
+
+    if (tp_strdiff (version, CACHE_VERSION))
+    {
+        DEBUG ("Ignoring cache %s from version '%s'", filename, version);
+    }
+    else
+    {
+        /* the values point into the mapped file */
+        while (g_variant_iter_next (iter, "{&s@" CACHE_ENTRY_TYPE "}", &path,
+                                    &value))
+            g_hash_table_insert (self->cached, g_strdup (path), value);
+
+        DEBUG ("Loaded %u client files from %s",
+               g_hash_table_size (self->cached), filename);
+    }
+
+    g_variant_iter_free (iter);
+    g_variant_unref (cache);
+    g_free (filename);
+}
+
+static void mcd_client_file_index_scan (McdClientFileIndex *self);
+
+/*
+ * _mcd_client_file_index_save_cache:
+ * @self: the index
+ *
+ * If we've parsed any files that weren't in the cache, write a new one
+ * containing everything we know about.
+ */
+void
+_mcd_client_file_index_save_cache (McdClientFileIndex *self)
+{
+    GVariantBuilder entries;
+    GHashTableIter iter;
+    gpointer k, v;
+    GVariant *cache;
+    gchar *filename;
+    gchar *dir;
+    GError *error = NULL;
+
+    g_return_if_fail (self != NULL);
+
+    if (!self->cache_dirty)
+        return;
+
+    filename = cache_filename ();
+    dir = g_path_get_dirname (filename);
+
+    g_variant_builder_init (&entries,
+                            G_VARIANT_TYPE ("a{s" CACHE_ENTRY_TYPE "}"));
+    g_hash_table_iter_init (&iter, self->parsed);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+        g_variant_builder_add (&entries, "{s@" CACHE_ENTRY_TYPE "}", k,
+                               entry_to_variant (v));
+
+    /* files we haven't needed yet in this run are probably still valid;
+     * they're checked when the cache is next loaded anyway. Files that
+     * have gone away, or are hidden by a file in an earlier directory,
+     * are dropped, so the cache doesn't grow forever */
+    if (self->stale)
+        mcd_client_file_index_scan (self);
+
+    g_hash_table_iter_init (&iter, self->cached);
+
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        gchar *basename;
+        gchar *client_name;
+        const gchar *path = NULL;
+
+        if (g_hash_table_contains (self->parsed, k))
+            continue;
+
+        basename = g_path_get_basename (k);
+
+        if (g_str_has_suffix (basename, ".client"))
+        {
+            client_name = g_strndup (basename,
+                                     strlen (basename) - strlen (".client"));
+            path = g_hash_table_lookup (self->paths, client_name);
+            g_free (client_name);
+        }
+
+        if (!tp_strdiff (path, k))
+            g_variant_builder_add (&entries, "{s@" CACHE_ENTRY_TYPE "}", k,
+                                   v);
+        else
+            DEBUG ("dropping %s from the cache", (const gchar *) k);
+
+        g_free (basename);
+    }
+
+    cache = g_variant_ref_sink (g_variant_new ("(sa{s" CACHE_ENTRY_TYPE "})",
+        CACHE_VERSION, &entries));
+
+    if (!mcd_ensure_directory (dir, &error) ||
+        !g_file_set_contents (filename, g_variant_get_data (cache),
+                              g_variant_get_size (cache), &error))
+    {
+        DEBUG ("Unable to save client file cache: %s", error->message);
+        g_error_free (error);
+    }
+    else
+    {
+        DEBUG ("Saved client file cache to %s", filename);
+        self->cache_dirty = FALSE;
+    }
+
+    g_variant_unref (cache);
+    g_free (dir);
+    g_free (filename);
+}
+
+static void
+mcd_client_file_index_scan (McdClientFileIndex *self)
+{
+    guint i;
+
+    g_hash_table_remove_all (self->paths);
+
+    for (i = 0; i < self->dirs->len; i++)
+    {
+        const gchar *dirname = g_ptr_array_index (self->dirs, i);
+        GDir *dir = g_dir_open (dirname, 0, NULL);
+        const gchar *basename;
+
+        if (dir == NULL)
+            continue;
+
+        while ((basename = g_dir_read_name (dir)) != NULL)
+        {
+            gchar *client_name;
+            gchar *path;
+
+            if (!g_str_has_suffix (basename, ".client"))
+                continue;
+
+            client_name = g_strndup (basename,
+                                     strlen (basename) - strlen (".client"));
+
+            /* an earlier directory takes precedence */
+            if (g_hash_table_contains (self->paths, client_name))
+            {
+                g_free (client_name);
+                continue;
+            }
+
+            path = g_build_filename (dirname, basename, NULL);
+
+            /* ... but only if it's really a file */
+            if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
+            {
+                g_free (path);
+                g_free (client_name);
+                continue;
+            }
+
+            g_hash_table_insert (self->paths, client_name, path);
+        }
+
+        g_dir_close (dir);
+    }
+
+    DEBUG ("found %u .client files", g_hash_table_size (self->paths));
+    self->stale = FALSE;
+}
+
+static void
+mcd_client_file_index_changed_cb (GFileMonitor *monitor,
+                                  GFile *file,
+                                  GFile *other_file,
+                                  GFileMonitorEvent event_type,
+                                  gpointer user_data)
+{
+    McdClientFileIndex *self = user_data;
+    gchar *path = g_file_get_path (file);
+
+    if (path == NULL || !g_str_has_suffix (path, ".client"))
+    {
+        g_free (path);
+        return;
+    }
+
+    DEBUG ("%s changed (event %d)", path, event_type);
+
+    /* whatever happened, parse it again next time */
+    g_hash_table_remove (self->parsed, path);
+    g_hash_table_remove (self->cached, path);
+
+    switch (event_type)
+    {
+        case G_FILE_MONITOR_EVENT_CHANGED:
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+            break;
+
+        default:
+            /* a file might have appeared or disappeared, which could change
+             * which directory wins */
+            self->stale = TRUE;
+    }
+
+    g_free (path);
+}
+
+static void
+mcd_client_file_index_add_dir (McdClientFileIndex *self,
+                               gchar *dirname)
+{
+    GFile *dir = g_file_new_for_path (dirname);
+    GFileMonitor *monitor;
+    GError *error = NULL;
+
+    g_ptr_array_add (self->dirs, dirname);
+
+    monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL,
+                                        &error);
+
+    if (monitor == NULL)
+    {
+        DEBUG ("can't watch %s, will look for changes every time: %s",
+               dirname, error->message);
+        g_clear_error (&error);
+        self->monitored = FALSE;
+    }
+    else
+    {
+        g_signal_connect (monitor, "changed",
+                          G_CALLBACK (mcd_client_file_index_changed_cb),
+                          self);
+        g_ptr_array_add (self->monitors, monitor);
+    }
+
+    g_object_unref (dir);
+}
+
+McdClientFileIndex *
+_mcd_client_file_index_new (void)
+{
+    McdClientFileIndex *self = g_slice_new0 (McdClientFileIndex);
+    const gchar * const *dirs;
+    const gchar *dirname;
+
+    self->refcount = 1;
+    self->dirs = g_ptr_array_new_with_free_func (g_free);
+    self->monitors = g_ptr_array_new_with_free_func (g_object_unref);
+    self->monitored = TRUE;
+    self->stale = TRUE;
+    self->paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         g_free);
+    self->parsed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          entry_free);
+    self->cached = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) g_variant_unref);
+
+    dirname = g_getenv ("MC_CLIENTS_DIR");
+    if (dirname)
+        mcd_client_file_index_add_dir (self, g_strdup (dirname));
+
+    dirname = g_get_user_data_dir ();
+    if (G_LIKELY (dirname))
+        mcd_client_file_index_add_dir (self,
+            g_build_filename (dirname, "telepathy/clients", NULL));
+
+    dirs = g_get_system_data_dirs ();
+    for (dirname = *dirs; dirname != NULL; dirs++, dirname = *dirs)
+        mcd_client_file_index_add_dir (self,
+            g_build_filename (dirname, "telepathy/clients", NULL));
+
+    mcd_client_file_index_load_cache (self);
+    return self;
+}
+
+McdClientFileIndex *
+_mcd_client_file_index_ref (McdClientFileIndex *self)
+{
+    g_return_val_if_fail (self != NULL, NULL);
+
+    g_atomic_int_inc (&self->refcount);
+    return self;
+}
+
+void
+_mcd_client_file_index_unref (McdClientFileIndex *self)
+{
+    guint i;
+
+    if (self == NULL)
+        return;
+
+    if (!g_atomic_int_dec_and_test (&self->refcount))
+        return;
+
+    for (i = 0; i < self->monitors->len; i++)
+    {
+        GFileMonitor *monitor = g_ptr_array_index (self->monitors, i);
+
+        g_signal_handlers_disconnect_by_func (monitor,
+            mcd_client_file_index_changed_cb, self);
+        g_file_monitor_cancel (monitor);
+    }
+
+    g_ptr_array_unref (self->monitors);
+    g_ptr_array_unref (self->dirs);
+    g_hash_table_unref (self->paths);
+    g_hash_table_unref (self->parsed);
+    g_hash_table_unref (self->cached);
+    g_slice_free (McdClientFileIndex, self);
+}
+
+/*
+ * _mcd_client_file_index_lookup:
+ * @self: the index
+ * @client_name: the part of a client's bus name after
+ *  TP_CLIENT_BUS_NAME_BASE
+ *
+ * Returns: (transfer none): the contents of the client's .client file,
+ *  which remain valid until the main loop next runs, or %NULL if it doesn't
+ *  have one or it can't be read
+ */
+const McdClientFile *
+_mcd_client_file_index_lookup (McdClientFileIndex *self,
+                               const gchar *client_name)
+{
+    const gchar *filename;
+    GStatBuf st;
+    FileStamp stamp;
+    Entry *entry;
+    GVariant *cached;
+    GKeyFile *file;
+    GError *error = NULL;
+
+    g_return_val_if_fail (self != NULL, NULL);
+
+    if (self->stale || !self->monitored)
+        mcd_client_file_index_scan (self);
+
+    filename = g_hash_table_lookup (self->paths, client_name);
+
+    if (filename == NULL)
+        return NULL;
+
+    entry = g_hash_table_lookup (self->parsed, filename);
+
+    /* if the file had changed, the monitor would have thrown this away */
+    if (entry != NULL && self->monitored)
+        return &entry->file;
+
+    if (g_stat (filename, &st) != 0)
+    {
+        DEBUG ("%s: %s", filename, g_strerror (errno));
+        g_hash_table_remove (self->parsed, filename);
+        return NULL;
+    }
+
+    file_stamp_from_stat (&stamp, &st);
+
+    if (entry != NULL && file_stamp_equal (&entry->stamp, &stamp))
+        return &entry->file;
+
+    cached = g_hash_table_lookup (self->cached, filename);
+
+    if (cached != NULL)
+    {
+        FileStamp cached_stamp;
+
+        g_variant_get_child (cached, 0, "x", &cached_stamp.mtime);
+        g_variant_get_child (cached, 1, "x", &cached_stamp.mtime_nsec);
+        g_variant_get_child (cached, 2, "x", &cached_stamp.size);
+        g_variant_get_child (cached, 3, "t", &cached_stamp.inode);
+
+        if (file_stamp_equal (&cached_stamp, &stamp))
+        {
+            DEBUG ("Cached file found for %s: %s", client_name, filename);
+            entry = entry_new_from_variant (cached);
+            g_hash_table_insert (self->parsed, g_strdup (filename), entry);
+            return &entry->file;
+        }
+    }
+
+    file = g_key_file_new ();
+
+    if (!g_key_file_load_from_file (file, filename, 0, &error))
+    {
+        g_warning ("Loading file %s failed: %s", filename, error->message);
+        g_error_free (error);
+        g_key_file_free (file);
+        g_hash_table_remove (self->parsed, filename);
+        return NULL;
+    }
+
+    DEBUG ("File found for %s: %s", client_name, filename);
+    entry = entry_new (file);
+    entry->stamp = stamp;
+    g_key_file_free (file);
+
+    g_hash_table_insert (self->parsed, g_strdup (filename), entry);
+    self->cache_dirty = TRUE;
+    return &entry->file;
+}
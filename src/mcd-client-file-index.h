@@ -0,0 +1,58 @@
+/* Mission Control client file index - finds and parses .client files
+ * without searching the filesystem for every client
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_CLIENT_FILE_INDEX_H
+#define MCD_CLIENT_FILE_INDEX_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _McdClientFileIndex McdClientFileIndex;
+
+/* What a .client file says about a client. The filters are as described
+ * in McdClientProxyPrivate; nothing here may be modified. */
+typedef struct {
+    /* NULL if the file doesn't list any interfaces, in which case
+     * nothing else is set */
+    GStrv interfaces;
+    GList *approver_filters;
+    GList *observer_filters;
+    GList *handler_filters;
+    GStrv capability_tokens;
+    gboolean bypass_approval;
+    gboolean bypass_observers;
+    gboolean delay_approvers;
+    gboolean recover;
+} McdClientFile;
+
+G_GNUC_INTERNAL McdClientFileIndex *_mcd_client_file_index_new (void);
+G_GNUC_INTERNAL McdClientFileIndex *_mcd_client_file_index_ref (
+    McdClientFileIndex *self);
+G_GNUC_INTERNAL void _mcd_client_file_index_unref (McdClientFileIndex *self);
+
+G_GNUC_INTERNAL const McdClientFile *_mcd_client_file_index_lookup (
+    McdClientFileIndex *self, const gchar *client_name);
+G_GNUC_INTERNAL void _mcd_client_file_index_save_cache (
+    McdClientFileIndex *self);
+
+G_END_DECLS
+
+#endif /* MCD_CLIENT_FILE_INDEX_H */
@@ -32,6 +32,10 @@
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "mcd-client-file-index.h"
+#include "mcd-introspection-scheduler.h"
+#include "mcd-match-record.h"
+
 G_BEGIN_DECLS
 
 typedef struct _McdClientProxy McdClientProxy;
@@ -49,6 +53,14 @@ struct _McdClientProxyClass
   TpClientClass parent_class;
 };
 
+typedef enum
+{
+    MCD_CLIENT_APPROVER,
+    MCD_CLIENT_HANDLER,
+    MCD_CLIENT_OBSERVER,
+    MCD_CLIENT_N_INTERFACES
+} McdClientInterface;
+
 G_GNUC_INTERNAL GType _mcd_client_proxy_get_type (void);
 
 #define MCD_TYPE_CLIENT_PROXY \
@@ -69,6 +81,8 @@ G_GNUC_INTERNAL GType _mcd_client_proxy_get_type (void);
 
 G_GNUC_INTERNAL McdClientProxy *_mcd_client_proxy_new (
     TpDBusDaemon *dbus_daemon,
+    McdClientFileIndex *file_index,
+    McdIntrospectionScheduler *scheduler,
     const gchar *well_known_name,
     const gchar *unique_name_if_known,
     gboolean activatable);
@@ -95,6 +109,8 @@ G_GNUC_INTERNAL const GList *_mcd_client_proxy_get_observer_filters
     (McdClientProxy *self);
 G_GNUC_INTERNAL const GList *_mcd_client_proxy_get_handler_filters
     (McdClientProxy *self);
+G_GNUC_INTERNAL const GList *_mcd_client_proxy_get_filters
+    (McdClientProxy *self, McdClientInterface interface);
 G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_bypass_approval
     (McdClientProxy *self);
 G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_bypass_observers
@@ -104,24 +120,37 @@ G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_delay_approvers
 
 G_GNUC_INTERNAL GValueArray *_mcd_client_proxy_dup_handler_capabilities (
     McdClientProxy *self);
+G_GNUC_INTERNAL GValueArray *_mcd_client_proxy_dup_empty_handler_capabilities (
+    const gchar *bus_name);
 
 G_GNUC_INTERNAL void _mcd_client_proxy_inc_ready_lock (McdClientProxy *self);
 G_GNUC_INTERNAL void _mcd_client_proxy_dec_ready_lock (McdClientProxy *self);
 
+G_GNUC_INTERNAL void _mcd_client_proxy_start_introspection (
+    McdClientProxy *self);
+G_GNUC_INTERNAL void _mcd_client_proxy_give_up_introspection (
+    McdClientProxy *self);
+G_GNUC_INTERNAL gint64 _mcd_client_proxy_get_ready_latency (
+    McdClientProxy *self);
+
 #define MC_CLIENT_BUS_NAME_BASE_LEN (sizeof (TP_CLIENT_BUS_NAME_BASE) - 1)
 
 G_GNUC_INTERNAL guint _mcd_client_match_filters (
     GVariant *channel_properties, const GList *filters,
     gboolean assume_requested);
+G_GNUC_INTERNAL guint _mcd_client_match_record (McdMatchRecord *record,
+    const GList *filters, gboolean assume_requested);
 
-G_GNUC_INTERNAL void _mcd_client_proxy_handle_channels (McdClientProxy *self,
+G_GNUC_INTERNAL TpProxyPendingCall *_mcd_client_proxy_handle_channels (
+    McdClientProxy *self,
     gint timeout_ms, const GList *channels,
     gint64 user_action_time, GHashTable *handler_info,
     tp_cli_client_handler_callback_for_handle_channels callback,
     gpointer user_data, GDestroyNotify destroy, GObject *weak_object);
 
 G_GNUC_INTERNAL void _mcd_client_recover_observer (McdClientProxy *self,
-    TpChannel *channel, const gchar *account_path);
+    const gchar *account_path, const gchar *connection_path,
+    const GPtrArray *channel_details);
 
 G_END_DECLS
 
@@ -26,8 +26,6 @@
 #include "config.h"
 #include "mcd-client-priv.h"
 
-#include <errno.h>
-
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
@@ -43,6 +41,8 @@ enum
 {
     PROP_0,
     PROP_ACTIVATABLE,
+    PROP_FILE_INDEX,
+    PROP_INTROSPECTION_SCHEDULER,
     PROP_STRING_POOL,
     PROP_UNIQUE_NAME,
 };
@@ -54,6 +54,7 @@ enum
     S_HANDLER_CAPABILITIES_CHANGED,
     S_GONE,
     S_NEED_RECOVERY,
+    S_FILTERS_CHANGED,
     N_SIGNALS
 };
 
@@ -64,8 +65,16 @@ struct _McdClientProxyPrivate
     GStrv capability_tokens;
 
     gchar *unique_name;
+    /* owned, or NULL if we shouldn't look for a .client file */
+    McdClientFileIndex *file_index;
+    /* owned, or NULL if we should introspect as soon as we can */
+    McdIntrospectionScheduler *scheduler;
     guint ready_lock;
     gboolean introspect_started;
+    /* when introspection started, and how long it took to become ready,
+     * in g_get_monotonic_time() units */
+    gint64 introspect_time;
+    gint64 ready_latency;
     gboolean ready;
     gboolean bypass_approval;
     gboolean bypass_observers;
@@ -99,13 +108,6 @@ struct _McdClientProxyPrivate
     gboolean disposed;
 };
 
-typedef enum
-{
-    MCD_CLIENT_APPROVER,
-    MCD_CLIENT_HANDLER,
-    MCD_CLIENT_OBSERVER
-} McdClientInterface;
-
 void
 _mcd_client_proxy_inc_ready_lock (McdClientProxy *self)
 {
@@ -132,6 +134,15 @@ _mcd_client_proxy_dec_ready_lock (McdClientProxy *self)
     if (--self->priv->ready_lock == 0)
     {
         self->priv->ready = TRUE;
+
+        if (self->priv->introspect_started)
+        {
+            self->priv->ready_latency =
+                g_get_monotonic_time () - self->priv->introspect_time;
+            DEBUG ("%s ready after %.1fms", tp_proxy_get_bus_name (self),
+                   self->priv->ready_latency / 1000.0);
+        }
+
         g_signal_emit (self, signals[S_READY], 0);
 
         /* Activatable Observers needing recovery have already
@@ -148,276 +159,46 @@ static void _mcd_client_proxy_take_observer_filters
 static void _mcd_client_proxy_take_handler_filters
     (McdClientProxy *self, GList *filters);
 
-static gchar *
-_mcd_client_proxy_find_client_file (const gchar *client_name)
-{
-    const gchar * const *dirs;
-    const gchar *dirname;
-    const gchar *env_dirname;
-    gchar *filename, *absolute_filepath;
-
-    /*
-     * The full path is $XDG_DATA_DIRS/telepathy/clients/clientname.client
-     * or $XDG_DATA_HOME/telepathy/clients/clientname.client
-     * For testing purposes, we also look for $MC_CLIENTS_DIR/clientname.client
-     * if $MC_CLIENTS_DIR is set.
-     */
-    filename = g_strdup_printf ("%s.client", client_name);
-    env_dirname = g_getenv ("MC_CLIENTS_DIR");
-    if (env_dirname)
-    {
-        absolute_filepath = g_build_filename (env_dirname, filename, NULL);
-        if (g_file_test (absolute_filepath, G_FILE_TEST_IS_REGULAR))
-            goto finish;
-        g_free (absolute_filepath);
-    }
-
-    dirname = g_get_user_data_dir ();
-    if (G_LIKELY (dirname))
-    {
-        absolute_filepath = g_build_filename (dirname, "telepathy/clients",
-                                              filename, NULL);
-        if (g_file_test (absolute_filepath, G_FILE_TEST_IS_REGULAR))
-            goto finish;
-        g_free (absolute_filepath);
-    }
-
-    dirs = g_get_system_data_dirs ();
-    for (dirname = *dirs; dirname != NULL; dirs++, dirname = *dirs)
-    {
-        absolute_filepath = g_build_filename (dirname, "telepathy/clients",
-                                              filename, NULL);
-        if (g_file_test (absolute_filepath, G_FILE_TEST_IS_REGULAR))
-            goto finish;
-        g_free (absolute_filepath);
-    }
-
-    absolute_filepath = NULL;
-finish:
-    g_free (filename);
-    return absolute_filepath;
-}
-
-static GHashTable *
-parse_client_filter (GKeyFile *file, const gchar *group)
-{
-    GHashTable *filter;
-    gchar **keys;
-    gsize len;
-    guint i;
-
-    filter = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-                                    (GDestroyNotify) tp_g_value_slice_free);
-
-    keys = g_key_file_get_keys (file, group, &len, NULL);
-
-    if (keys == NULL)
-        len = 0;
-
-    for (i = 0; i < len; i++)
-    {
-        const gchar *key;
-        const gchar *space;
-        gchar *file_property;
-        gchar file_property_type;
-
-        key = keys[i];
-        space = g_strrstr (key, " ");
-
-        if (space == NULL || space[1] == '\0' || space[2] != '\0')
-        {
-            g_warning ("Invalid key %s in client file", key);
-            continue;
-        }
-        file_property_type = space[1];
-        file_property = g_strndup (key, space - key);
-
-        switch (file_property_type)
-        {
-        case 'q':
-        case 'u':
-        case 't': /* unsigned integer */
-            {
-                /* g_key_file_get_integer cannot be used because we need
-                 * to support 64 bits */
-                guint x;
-                GValue *value = tp_g_value_slice_new (G_TYPE_UINT64);
-                gchar *str = g_key_file_get_string (file, group, key,
-                                                    NULL);
-                errno = 0;
-                x = g_ascii_strtoull (str, NULL, 0);
-                if (errno != 0)
-                {
-                    g_warning ("Invalid unsigned integer '%s' in client"
-                               " file", str);
-                }
-                else
-                {
-                    g_value_set_uint64 (value, x);
-                    g_hash_table_insert (filter, file_property, value);
-                }
-                g_free (str);
-                break;
-            }
-
-        case 'y':
-        case 'n':
-        case 'i':
-        case 'x': /* signed integer */
-            {
-                gint x;
-                GValue *value = tp_g_value_slice_new (G_TYPE_INT64);
-                gchar *str = g_key_file_get_string (file, group, key, NULL);
-                errno = 0;
-                x = g_ascii_strtoll (str, NULL, 0);
-                if (errno != 0)
-                {
-                    g_warning ("Invalid signed integer '%s' in client"
-                               " file", str);
-                }
-                else
-                {
-                    g_value_set_int64 (value, x);
-                    g_hash_table_insert (filter, file_property, value);
-                }
-                g_free (str);
-                break;
-            }
-
-        case 'b':
-            {
-                GValue *value = tp_g_value_slice_new (G_TYPE_BOOLEAN);
-                gboolean b = g_key_file_get_boolean (file, group, key, NULL);
-                g_value_set_boolean (value, b);
-                g_hash_table_insert (filter, file_property, value);
-                break;
-            }
-
-        case 's':
-            {
-                GValue *value = tp_g_value_slice_new (G_TYPE_STRING);
-                gchar *str = g_key_file_get_string (file, group, key, NULL);
-
-                g_value_take_string (value, str);
-                g_hash_table_insert (filter, file_property, value);
-                break;
-            }
-
-        case 'o':
-            {
-                GValue *value = tp_g_value_slice_new
-                    (DBUS_TYPE_G_OBJECT_PATH);
-                gchar *str = g_key_file_get_string (file, group, key, NULL);
-
-                g_value_take_boxed (value, str);
-                g_hash_table_insert (filter, file_property, value);
-                break;
-            }
-
-        default:
-            g_warning ("Invalid key %s in client file", key);
-            continue;
-        }
-    }
-    g_strfreev (keys);
-
-    return filter;
-}
-
 static void _mcd_client_proxy_set_cap_tokens (McdClientProxy *self,
                                               GStrv cap_tokens);
 static void _mcd_client_proxy_add_interfaces (McdClientProxy *self,
                                               const gchar * const *interfaces);
 
+static GList *
+copy_filters (const GList *filters)
+{
+    return g_list_copy_deep ((GList *) filters, (GCopyFunc) g_hash_table_ref,
+                             NULL);
+}
+
 static void
 parse_client_file (McdClientProxy *client,
-                   GKeyFile *file)
+                   const McdClientFile *file)
 {
-    gchar **iface_names, **groups, **cap_tokens;
-    guint i;
-    gsize len = 0;
-    gboolean is_approver, is_handler, is_observer;
-    GList *approver_filters = NULL;
-    GList *observer_filters = NULL;
-    GList *handler_filters = NULL;
-
-    iface_names = g_key_file_get_string_list (file, TP_IFACE_CLIENT,
-                                              "Interfaces", 0, NULL);
-    if (!iface_names)
+    if (!file->interfaces)
         return;
 
     _mcd_client_proxy_add_interfaces (client,
-                                      (const gchar * const *) iface_names);
-    g_strfreev (iface_names);
-
-    is_approver = tp_proxy_has_interface_by_id (client,
-                                                TP_IFACE_QUARK_CLIENT_APPROVER);
-    is_observer = tp_proxy_has_interface_by_id (client,
-                                                TP_IFACE_QUARK_CLIENT_OBSERVER);
-    is_handler = tp_proxy_has_interface_by_id (client,
-                                               TP_IFACE_QUARK_CLIENT_HANDLER);
-
-    /* parse filtering rules */
-    groups = g_key_file_get_groups (file, &len);
-    for (i = 0; i < len; i++)
-    {
-        if (is_approver &&
-            g_str_has_prefix (groups[i], TP_IFACE_CLIENT_APPROVER
-                              ".ApproverChannelFilter "))
-        {
-            approver_filters =
-                g_list_prepend (approver_filters,
-                                parse_client_filter (file, groups[i]));
-        }
-        else if (is_handler &&
-            g_str_has_prefix (groups[i], TP_IFACE_CLIENT_HANDLER
-                              ".HandlerChannelFilter "))
-        {
-            handler_filters =
-                g_list_prepend (handler_filters,
-                                parse_client_filter (file, groups[i]));
-        }
-        else if (is_observer &&
-            g_str_has_prefix (groups[i], TP_IFACE_CLIENT_OBSERVER
-                              ".ObserverChannelFilter "))
-        {
-            observer_filters =
-                g_list_prepend (observer_filters,
-                                parse_client_filter (file, groups[i]));
-        }
-    }
-    g_strfreev (groups);
+        (const gchar * const *) file->interfaces);
 
+    /* Other client options; BypassApproval is set before the filters, so
+     * that the client registry sees both together */
+    client->priv->bypass_approval = file->bypass_approval;
+
+    /* the index keeps its own copy, so we can use it the next time this
+     * client appears */
     _mcd_client_proxy_take_approver_filters (client,
-                                             approver_filters);
+        copy_filters (file->approver_filters));
     _mcd_client_proxy_take_observer_filters (client,
-                                             observer_filters);
+        copy_filters (file->observer_filters));
     _mcd_client_proxy_take_handler_filters (client,
-                                            handler_filters);
-
-    /* Other client options */
-    client->priv->bypass_approval =
-        g_key_file_get_boolean (file, TP_IFACE_CLIENT_HANDLER,
-                                "BypassApproval", NULL);
-
-    client->priv->bypass_observers =
-        g_key_file_get_boolean (file, TP_IFACE_CLIENT_HANDLER,
-                                "BypassObservers", NULL);
-
-    client->priv->delay_approvers =
-        g_key_file_get_boolean (file, TP_IFACE_CLIENT_OBSERVER,
-                                "DelayApprovers", NULL);
-
-    client->priv->recover =
-        g_key_file_get_boolean (file, TP_IFACE_CLIENT_OBSERVER,
-                                "Recover", NULL);
-
-    cap_tokens = g_key_file_get_keys (file,
-                                      TP_IFACE_CLIENT_HANDLER ".Capabilities",
-                                      NULL,
-                                      NULL);
-    _mcd_client_proxy_set_cap_tokens (client, cap_tokens);
-    g_strfreev (cap_tokens);
+        copy_filters (file->handler_filters));
+
+    client->priv->bypass_observers = file->bypass_observers;
+    client->priv->delay_approvers = file->delay_approvers;
+    client->priv->recover = file->recover;
+
+    _mcd_client_proxy_set_cap_tokens (client, file->capability_tokens);
 }
 
 static void
@@ -585,15 +366,25 @@ _mcd_client_proxy_get_unique_name (McdClientProxy *self)
     return self->priv->unique_name;
 }
 
+/*
+ * _mcd_client_recover_observer:
+ * @self: an Observer
+ * @account_path: the account that all of @channel_details belong to
+ * @connection_path: the connection that all of @channel_details belong to
+ * @channel_details: a #GPtrArray of Channel_Details, as returned by
+ *  _mcd_tp_channel_details_build_from_tp_chans()
+ *
+ * Tell @self about channels that it missed while it wasn't running, in a
+ * single call to ObserveChannels.
+ */
 void
-_mcd_client_recover_observer (McdClientProxy *self, TpChannel *channel,
-    const gchar *account_path)
+_mcd_client_recover_observer (McdClientProxy *self,
+    const gchar *account_path,
+    const gchar *connection_path,
+    const GPtrArray *channel_details)
 {
     GPtrArray *satisfied_requests;
     GHashTable *observer_info;
-    TpConnection *conn;
-    const gchar *connection_path;
-    GPtrArray *channels_array;
 
     satisfied_requests = g_ptr_array_new ();
     observer_info = g_hash_table_new (g_str_hash, g_str_equal);
@@ -602,20 +393,16 @@ _mcd_client_recover_observer (McdClientProxy *self, TpChannel *channel,
         TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP,
         g_hash_table_new (NULL, NULL));
 
-    channels_array = _mcd_tp_channel_details_build_from_tp_chan (channel);
-    conn = tp_channel_get_connection (channel);
-    connection_path = tp_proxy_get_object_path (conn);
-
-    DEBUG ("calling ObserveChannels on %s for channel %p",
-           tp_proxy_get_bus_name (self), channel);
+    DEBUG ("calling ObserveChannels on %s for %u channel(s) on %s",
+           tp_proxy_get_bus_name (self), channel_details->len,
+           connection_path);
 
     tp_cli_client_observer_call_observe_channels (
         (TpClient *) self, -1, account_path,
-        connection_path, channels_array,
+        connection_path, channel_details,
         "/", satisfied_requests, observer_info,
         NULL, NULL, NULL, NULL);
 
-    _mcd_tp_channel_details_free (channels_array);
     g_ptr_array_unref (satisfied_requests);
     g_hash_table_unref (observer_info);
 }
@@ -644,6 +431,17 @@ _mcd_client_proxy_handler_get_all_cb (TpProxy *proxy,
     /* by now, we at least know whether the client is running or not */
     g_assert (self->priv->unique_name != NULL);
 
+    /* if wrong type or absent, assuming False is reasonable; this is set
+     * before the filters, so that the client registry sees both together
+     * when they change */
+    bypass = tp_asv_get_boolean (properties, "BypassApproval", NULL);
+    self->priv->bypass_approval = bypass;
+    DEBUG ("%s has BypassApproval=%c", bus_name, bypass ? 'T' : 'F');
+
+    bypass = tp_asv_get_boolean (properties, "BypassObservers", NULL);
+    self->priv->bypass_observers = bypass;
+    DEBUG ("%s has BypassObservers=%c", bus_name, bypass ? 'T' : 'F');
+
     filters = tp_asv_get_boxed (properties, "HandlerChannelFilter",
                                 TP_ARRAY_TYPE_STRING_VARIANT_MAP_LIST);
 
@@ -659,15 +457,6 @@ _mcd_client_proxy_handler_get_all_cb (TpProxy *proxy,
                "no channels can match", bus_name);
     }
 
-    /* if wrong type or absent, assuming False is reasonable */
-    bypass = tp_asv_get_boolean (properties, "BypassApproval", NULL);
-    self->priv->bypass_approval = bypass;
-    DEBUG ("%s has BypassApproval=%c", bus_name, bypass ? 'T' : 'F');
-
-    bypass = tp_asv_get_boolean (properties, "BypassObservers", NULL);
-    self->priv->bypass_observers = bypass;
-    DEBUG ("%s has BypassObservers=%c", bus_name, bypass ? 'T' : 'F');
-
     /* don't emit handler-capabilities-changed if we're not actually available
      * any more - if that's the case, then we already signalled our loss of
      * any capabilities */
@@ -860,36 +649,20 @@ finally:
 static gboolean
 _mcd_client_proxy_parse_client_file (McdClientProxy *self)
 {
-    gboolean file_found = FALSE;
-    gchar *filename;
+    const McdClientFile *file;
     const gchar *bus_name = tp_proxy_get_bus_name (self);
 
-    filename = _mcd_client_proxy_find_client_file (
-        bus_name + MC_CLIENT_BUS_NAME_BASE_LEN);
+    if (self->priv->file_index == NULL)
+        return FALSE;
 
-    if (filename)
-    {
-        GKeyFile *file;
-        GError *error = NULL;
+    file = _mcd_client_file_index_lookup (self->priv->file_index,
+        bus_name + MC_CLIENT_BUS_NAME_BASE_LEN);
 
-        file = g_key_file_new ();
-        g_key_file_load_from_file (file, filename, 0, &error);
-        if (G_LIKELY (!error))
-        {
-            DEBUG ("File found for %s: %s", bus_name, filename);
-            parse_client_file (self, file);
-            file_found = TRUE;
-        }
-        else
-        {
-            g_warning ("Loading file %s failed: %s", filename, error->message);
-            g_error_free (error);
-        }
-        g_key_file_free (file);
-        g_free (filename);
-    }
+    if (file == NULL)
+        return FALSE;
 
-    return file_found;
+    parse_client_file (self, file);
+    return TRUE;
 }
 
 static gboolean
@@ -904,6 +677,7 @@ mcd_client_proxy_introspect (gpointer data)
     }
 
     self->priv->introspect_started = TRUE;
+    self->priv->introspect_time = g_get_monotonic_time ();
 
     /* The .client file is not mandatory as per the spec. However if it
      * exists, it is better to read it than activating the service to read the
@@ -956,6 +730,67 @@ mcd_client_proxy_introspect (gpointer data)
     return FALSE;
 }
 
+void
+_mcd_client_proxy_start_introspection (McdClientProxy *self)
+{
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+
+    mcd_client_proxy_introspect (self);
+}
+
+/*
+ * _mcd_client_proxy_give_up_introspection:
+ * @self: a client
+ *
+ * Stop waiting for @self to answer our questions, and consider it to be
+ * ready with whatever we know so far. Any answers that arrive later are
+ * still used.
+ */
+void
+_mcd_client_proxy_give_up_introspection (McdClientProxy *self)
+{
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+
+    if (self->priv->ready)
+        return;
+
+    DEBUG ("%s: giving up after %u outstanding calls",
+           tp_proxy_get_bus_name (self), self->priv->ready_lock);
+    self->priv->ready_lock = 1;
+    _mcd_client_proxy_dec_ready_lock (self);
+}
+
+/*
+ * _mcd_client_proxy_get_ready_latency:
+ * @self: a client
+ *
+ * Returns: how long @self took to become ready after we started
+ *  introspecting it, in microseconds, or 0 if it isn't ready yet
+ */
+gint64
+_mcd_client_proxy_get_ready_latency (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), 0);
+
+    return self->priv->ready_latency;
+}
+
+static void
+mcd_client_proxy_schedule_introspection (McdClientProxy *self)
+{
+    if (self->priv->scheduler != NULL)
+    {
+        _mcd_introspection_scheduler_add (self->priv->scheduler, self);
+    }
+    else
+    {
+        /* It's safe to call mcd_client_proxy_introspect any number of
+         * times, so we don't need to guard against duplication */
+        g_idle_add_full (G_PRIORITY_HIGH, mcd_client_proxy_introspect,
+                         g_object_ref (self), g_object_unref);
+    }
+}
+
 static void
 mcd_client_proxy_unique_name_cb (TpDBusDaemon *dbus_daemon,
                                  const gchar *well_known_name G_GNUC_UNUSED,
@@ -980,7 +815,10 @@ mcd_client_proxy_unique_name_cb (TpDBusDaemon *dbus_daemon,
         _mcd_client_proxy_set_active (self, unique_name);
     }
 
-    mcd_client_proxy_introspect (self);
+    if (self->priv->scheduler != NULL)
+        _mcd_introspection_scheduler_add (self->priv->scheduler, self);
+    else
+        mcd_client_proxy_introspect (self);
 
     if (should_recover)
         g_signal_emit (self, signals[S_NEED_RECOVERY], 0);
@@ -1006,6 +844,14 @@ mcd_client_proxy_dispose (GObject *object)
                                             self);
 
     tp_clear_pointer (&self->priv->capability_tokens, g_strfreev);
+    tp_clear_pointer (&self->priv->file_index, _mcd_client_file_index_unref);
+
+    if (self->priv->scheduler != NULL)
+    {
+        _mcd_introspection_scheduler_remove (self->priv->scheduler, self);
+        tp_clear_pointer (&self->priv->scheduler,
+                          _mcd_introspection_scheduler_unref);
+    }
 
     if (chain_up != NULL)
     {
@@ -1059,11 +905,8 @@ mcd_client_proxy_constructed (GObject *object)
     if (self->priv->unique_name != NULL)
     {
         /* we already know who we are, so we can skip straight to the
-         * introspection. It's safe to call mcd_client_proxy_introspect
-         * any number of times, so we don't need to guard against
-         * duplication */
-        g_idle_add_full (G_PRIORITY_HIGH, mcd_client_proxy_introspect,
-                         g_object_ref (self), g_object_unref);
+         * introspection */
+        mcd_client_proxy_schedule_introspection (self);
     }
 }
 
@@ -1081,6 +924,22 @@ mcd_client_proxy_set_property (GObject *object,
             self->priv->activatable = g_value_get_boolean (value);
             break;
 
+        case PROP_FILE_INDEX:
+            g_assert (self->priv->file_index == NULL);
+
+            if (g_value_get_pointer (value) != NULL)
+                self->priv->file_index = _mcd_client_file_index_ref (
+                    g_value_get_pointer (value));
+            break;
+
+        case PROP_INTROSPECTION_SCHEDULER:
+            g_assert (self->priv->scheduler == NULL);
+
+            if (g_value_get_pointer (value) != NULL)
+                self->priv->scheduler = _mcd_introspection_scheduler_ref (
+                    g_value_get_pointer (value));
+            break;
+
         case PROP_UNIQUE_NAME:
             g_assert (self->priv->unique_name == NULL);
             self->priv->unique_name = g_value_dup_string (value);
@@ -1141,11 +1000,35 @@ _mcd_client_proxy_class_init (McdClientProxyClass *klass)
         g_cclosure_marshal_VOID__VOID,
         G_TYPE_NONE, 0);
 
+    /* Emitted with a McdClientInterface when the channel filters for that
+     * interface have been replaced */
+    signals[S_FILTERS_CHANGED] = g_signal_new ("filters-changed",
+        G_OBJECT_CLASS_TYPE (klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+        0, NULL, NULL,
+        g_cclosure_marshal_VOID__UINT,
+        G_TYPE_NONE, 1, G_TYPE_UINT);
+
     g_object_class_install_property (object_class, PROP_ACTIVATABLE,
         g_param_spec_boolean ("activatable", "Activatable?",
             "TRUE if this client can be service-activated", FALSE,
             G_PARAM_WRITABLE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 
+    g_object_class_install_property (object_class, PROP_FILE_INDEX,
+        g_param_spec_pointer ("file-index", "File index",
+            "The McdClientFileIndex in which to look for a .client file",
+            G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY |
+            G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property (object_class,
+        PROP_INTROSPECTION_SCHEDULER,
+        g_param_spec_pointer ("introspection-scheduler",
+            "Introspection scheduler",
+            "The McdIntrospectionScheduler that decides when to introspect "
+            "this client, or NULL to do so as soon as possible",
+            G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY |
+            G_PARAM_STATIC_STRINGS));
+
     g_object_class_install_property (object_class, PROP_UNIQUE_NAME,
         g_param_spec_string ("unique-name", "Unique name",
             "The D-Bus unique name of this client, \"\" if not running or "
@@ -1212,6 +1095,8 @@ _mcd_client_check_valid_name (const gchar *name_suffix,
 
 McdClientProxy *
 _mcd_client_proxy_new (TpDBusDaemon *dbus_daemon,
+                       McdClientFileIndex *file_index,
+                       McdIntrospectionScheduler *scheduler,
                        const gchar *well_known_name,
                        const gchar *unique_name_if_known,
                        gboolean activatable)
@@ -1236,6 +1121,8 @@ _mcd_client_proxy_new (TpDBusDaemon *dbus_daemon,
 
     self = g_object_new (MCD_TYPE_CLIENT_PROXY,
                          "dbus-daemon", dbus_daemon,
+                         "file-index", file_index,
+                         "introspection-scheduler", scheduler,
                          "object-path", object_path,
                          "bus-name", well_known_name,
                          "unique-name", unique_name_if_known,
@@ -1317,6 +1204,28 @@ _mcd_client_proxy_get_handler_filters (McdClientProxy *self)
     return self->priv->handler_filters;
 }
 
+const GList *
+_mcd_client_proxy_get_filters (McdClientProxy *self,
+                               McdClientInterface interface)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), NULL);
+
+    switch (interface)
+    {
+        case MCD_CLIENT_APPROVER:
+            return self->priv->approver_filters;
+
+        case MCD_CLIENT_HANDLER:
+            return self->priv->handler_filters;
+
+        case MCD_CLIENT_OBSERVER:
+            return self->priv->observer_filters;
+
+        default:
+            g_return_val_if_reached (NULL);
+    }
+}
+
 static void
 mcd_client_proxy_free_client_filters (GList **client_filters)
 {
@@ -1338,6 +1247,10 @@ _mcd_client_proxy_take_approver_filters (McdClientProxy *self,
 
     mcd_client_proxy_free_client_filters (&(self->priv->approver_filters));
     self->priv->approver_filters = filters;
+
+    if (!self->priv->disposed)
+        g_signal_emit (self, signals[S_FILTERS_CHANGED], 0,
+                       MCD_CLIENT_APPROVER);
 }
 
 void
@@ -1348,6 +1261,10 @@ _mcd_client_proxy_take_observer_filters (McdClientProxy *self,
 
     mcd_client_proxy_free_client_filters (&(self->priv->observer_filters));
     self->priv->observer_filters = filters;
+
+    if (!self->priv->disposed)
+        g_signal_emit (self, signals[S_FILTERS_CHANGED], 0,
+                       MCD_CLIENT_OBSERVER);
 }
 
 void
@@ -1358,6 +1275,10 @@ _mcd_client_proxy_take_handler_filters (McdClientProxy *self,
 
     mcd_client_proxy_free_client_filters (&(self->priv->handler_filters));
     self->priv->handler_filters = filters;
+
+    if (!self->priv->disposed)
+        g_signal_emit (self, signals[S_FILTERS_CHANGED], 0,
+                       MCD_CLIENT_HANDLER);
 }
 
 gboolean
@@ -1406,12 +1327,53 @@ _mcd_client_proxy_become_incapable (McdClientProxy *self)
     }
 }
 
+/* @filters is taken, @cap_tokens is copied */
+static GValueArray *
+handler_capabilities_new (const gchar *bus_name,
+                          GPtrArray *filters,
+                          GStrv cap_tokens)
+{
+    GValueArray *va;
+
+    va = g_value_array_new (3);
+    g_value_array_append (va, NULL);
+    g_value_array_append (va, NULL);
+    g_value_array_append (va, NULL);
+
+    g_value_init (va->values + 0, G_TYPE_STRING);
+    g_value_init (va->values + 1, TP_ARRAY_TYPE_CHANNEL_CLASS_LIST);
+    g_value_init (va->values + 2, G_TYPE_STRV);
+
+    g_value_set_string (va->values + 0, bus_name);
+    g_value_take_boxed (va->values + 1, filters);
+    g_value_set_boxed (va->values + 2, cap_tokens);
+
+    return va;
+}
+
+/*
+ * _mcd_client_proxy_dup_empty_handler_capabilities:
+ * @bus_name: the well-known name of a client that has gone away
+ *
+ * Returns: a Handler_Capabilities struct saying that @bus_name can no
+ *  longer handle anything
+ */
+GValueArray *
+_mcd_client_proxy_dup_empty_handler_capabilities (const gchar *bus_name)
+{
+    gchar *empty_strv[] = { NULL };
+
+    g_return_val_if_fail (bus_name != NULL, NULL);
+
+    return handler_capabilities_new (bus_name, g_ptr_array_new (),
+                                     empty_strv);
+}
+
 GValueArray *
 _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
 {
     GPtrArray *filters;
     GStrv cap_tokens;
-    GValueArray *va;
     const GList *list;
     gchar *empty_strv[] = { NULL };
 
@@ -1453,41 +1415,26 @@ _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
         DEBUG ("-end-");
     }
 
-    va = g_value_array_new (3);
-    g_value_array_append (va, NULL);
-    g_value_array_append (va, NULL);
-    g_value_array_append (va, NULL);
-
-    g_value_init (va->values + 0, G_TYPE_STRING);
-    g_value_init (va->values + 1, TP_ARRAY_TYPE_CHANNEL_CLASS_LIST);
-    g_value_init (va->values + 2, G_TYPE_STRV);
-
-    g_value_set_string (va->values + 0, tp_proxy_get_bus_name (self));
-    g_value_take_boxed (va->values + 1, filters);
-    g_value_set_boxed (va->values + 2, cap_tokens);
-
-    return va;
+    return handler_capabilities_new (tp_proxy_get_bus_name (self), filters,
+                                     cap_tokens);
 }
 
 /* returns TRUE if the channel matches one property criteria
  */
 static gboolean
-_mcd_client_match_property (GVariant *channel_properties,
+_mcd_client_match_property (McdMatchRecord *record,
                             gchar *property_name,
                             GValue *filter_value)
 {
     GType filter_type = G_VALUE_TYPE (filter_value);
 
-    g_return_val_if_fail (g_variant_is_of_type (channel_properties,
-            G_VARIANT_TYPE_VARDICT), FALSE);
-
     g_assert (G_IS_VALUE (filter_value));
 
     if (filter_type == G_TYPE_STRING)
     {
         const gchar *string;
 
-        string = tp_vardict_get_string (channel_properties, property_name);
+        string = _mcd_match_record_get_string (record, property_name);
         if (!string)
             return FALSE;
 
@@ -1498,7 +1445,7 @@ _mcd_client_match_property (GVariant *channel_properties,
     {
         const gchar *path;
 
-        path = tp_vardict_get_object_path (channel_properties, property_name);
+        path = _mcd_match_record_get_object_path (record, property_name);
         if (!path)
             return FALSE;
 
@@ -1510,7 +1457,7 @@ _mcd_client_match_property (GVariant *channel_properties,
         gboolean valid;
         gboolean b;
 
-        b = tp_vardict_get_boolean (channel_properties, property_name, &valid);
+        b = _mcd_match_record_get_boolean (record, property_name, &valid);
         if (!valid)
             return FALSE;
 
@@ -1523,7 +1470,7 @@ _mcd_client_match_property (GVariant *channel_properties,
         gboolean valid;
         guint64 i;
 
-        i = tp_vardict_get_uint64 (channel_properties, property_name, &valid);
+        i = _mcd_match_record_get_uint64 (record, property_name, &valid);
         if (!valid)
             return FALSE;
 
@@ -1540,7 +1487,7 @@ _mcd_client_match_property (GVariant *channel_properties,
         gboolean valid;
         gint64 i;
 
-        i = tp_vardict_get_int64 (channel_properties, property_name, &valid);
+        i = _mcd_match_record_get_int64 (record, property_name, &valid);
         if (!valid)
             return FALSE;
 
@@ -1562,15 +1509,14 @@ _mcd_client_match_property (GVariant *channel_properties,
  * largest filter that matched)
  */
 guint
-_mcd_client_match_filters (GVariant *channel_properties,
-                           const GList *filters,
-                           gboolean assume_requested)
+_mcd_client_match_record (McdMatchRecord *record,
+                          const GList *filters,
+                          gboolean assume_requested)
 {
     const GList *list;
     guint best_quality = 0;
 
-    g_return_val_if_fail (g_variant_is_of_type (channel_properties,
-            G_VARIANT_TYPE_VARDICT), 0);
+    g_return_val_if_fail (record != NULL, 0);
 
     for (list = filters; list != NULL; list = list->next)
     {
@@ -1606,7 +1552,7 @@ _mcd_client_match_filters (GVariant *channel_properties,
                     break;
                 }
             }
-            else if (! _mcd_client_match_property (channel_properties,
+            else if (! _mcd_client_match_property (record,
                                                    property_name,
                                                    filter_value))
             {
@@ -1624,6 +1570,25 @@ _mcd_client_match_filters (GVariant *channel_properties,
     return best_quality;
 }
 
+/* the same as _mcd_client_match_record(), for a channel that will only be
+ * matched once */
+guint
+_mcd_client_match_filters (GVariant *channel_properties,
+                           const GList *filters,
+                           gboolean assume_requested)
+{
+    McdMatchRecord *record;
+    guint quality;
+
+    g_return_val_if_fail (g_variant_is_of_type (channel_properties,
+            G_VARIANT_TYPE_VARDICT), 0);
+
+    record = _mcd_match_record_new (channel_properties);
+    quality = _mcd_client_match_record (record, filters, assume_requested);
+    _mcd_match_record_free (record);
+    return quality;
+}
+
 static const gchar *
 borrow_channel_account_path (McdChannel *channel)
 {
@@ -1656,7 +1621,16 @@ borrow_channel_connection_path (McdChannel *channel)
     return connection_path;
 }
 
-void
+/*
+ * _mcd_client_proxy_handle_channels:
+ *
+ * Call HandleChannels on @self, marking @channels as having had their
+ * handler invoked.
+ *
+ * Returns: (transfer none): the pending call, which may be cancelled with
+ *  tp_proxy_pending_call_cancel() until @callback is called
+ */
+TpProxyPendingCall *
 _mcd_client_proxy_handle_channels (McdClientProxy *self,
     gint timeout_ms,
     const GList *channels,
@@ -1670,9 +1644,10 @@ _mcd_client_proxy_handle_channels (McdClientProxy *self,
     GPtrArray *channel_details;
     GPtrArray *requests_satisfied;
     const GList *iter;
+    TpProxyPendingCall *call;
 
-    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
-    g_return_if_fail (channels != NULL);
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), NULL);
+    g_return_val_if_fail (channels != NULL, NULL);
 
     DEBUG ("calling HandleChannels on %s", tp_proxy_get_bus_name (self));
 
@@ -1718,7 +1693,7 @@ _mcd_client_proxy_handle_channels (McdClientProxy *self,
                                  MCD_CHANNEL_STATUS_HANDLER_INVOKED);
     }
 
-    tp_cli_client_handler_call_handle_channels ((TpClient *) self,
+    call = tp_cli_client_handler_call_handle_channels ((TpClient *) self,
         timeout_ms, borrow_channel_account_path (channels->data),
         borrow_channel_connection_path (channels->data), channel_details,
         requests_satisfied, user_action_time, handler_info,
@@ -1727,4 +1702,6 @@ _mcd_client_proxy_handle_channels (McdClientProxy *self,
     _mcd_tp_channel_details_free (channel_details);
     g_ptr_array_unref (requests_satisfied);
     g_hash_table_unref (handler_info);
+
+    return call;
 }
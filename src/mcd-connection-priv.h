@@ -25,6 +25,7 @@
 #ifndef __MCD_CONNECTION_PRIV_H__
 #define __MCD_CONNECTION_PRIV_H__
 
+#include "mcd-capability-snapshot.h"
 #include "mcd-connection.h"
 
 G_BEGIN_DECLS
@@ -43,7 +44,7 @@ void _mcd_connection_set_tp_connection (McdConnection *connection,
                                         const gchar *obj_path, GError **error);
 
 G_GNUC_INTERNAL void _mcd_connection_start_dispatching (McdConnection *self,
-    GPtrArray *client_caps);
+    McdCapabilitySnapshot *client_caps);
 
 G_GNUC_INTERNAL gboolean _mcd_connection_is_ready (McdConnection *self);
 
@@ -51,7 +52,7 @@ G_GNUC_INTERNAL void _mcd_connection_set_avatar (McdConnection *self,
                                                  const GArray *avatar,
                                                  const gchar *mime_type);
 G_GNUC_INTERNAL void _mcd_connection_update_client_caps (McdConnection *self,
-    GPtrArray *client_caps);
+    McdCapabilitySnapshot *client_caps);
 
 G_GNUC_INTERNAL gboolean _mcd_connection_presence_info_is_ready (McdConnection *self);
 
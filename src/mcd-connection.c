@@ -108,6 +108,10 @@ struct _McdConnectionPrivate
     guint has_contact_capabilities_if : 1;
     guint has_power_saving_if : 1;
 
+    /* The generation of the last client capabilities snapshot we sent to
+     * the connection manager, or 0 if none */
+    guint64 client_caps_generation;
+
     /* FALSE until the dispatcher has said it's ready for us */
     guint dispatching_started : 1;
     /* FALSE until channels announced by NewChannel/NewChannels need to be
@@ -1193,7 +1197,7 @@ finally:
 
 void
 _mcd_connection_start_dispatching (McdConnection *self,
-                                   GPtrArray *client_caps)
+                                   McdCapabilitySnapshot *client_caps)
 {
     g_return_if_fail (MCD_IS_CONNECTION (self));
     g_return_if_fail (!self->priv->dispatching_started);
@@ -1215,9 +1219,12 @@ _mcd_connection_start_dispatching (McdConnection *self,
 
 void
 _mcd_connection_update_client_caps (McdConnection *self,
-                                    GPtrArray *client_caps)
+                                    McdCapabilitySnapshot *client_caps)
 {
+    guint64 generation;
+
     g_return_if_fail (MCD_IS_CONNECTION (self));
+    g_return_if_fail (client_caps != NULL);
 
     if (!self->priv->has_contact_capabilities_if)
     {
@@ -1225,9 +1232,22 @@ _mcd_connection_update_client_caps (McdConnection *self,
         return;
     }
 
-    DEBUG ("Sending client caps to connection");
+    generation = _mcd_capability_snapshot_get_generation (client_caps);
+
+    if (generation == self->priv->client_caps_generation)
+    {
+        DEBUG ("Connection already has client caps generation %"
+               G_GUINT64_FORMAT, generation);
+        return;
+    }
+
+    DEBUG ("Sending client caps generation %" G_GUINT64_FORMAT
+           " to connection", generation);
     tp_cli_connection_interface_contact_capabilities_call_update_capabilities
-      (self->priv->tp_conn, -1, client_caps, NULL, NULL, NULL, NULL);
+      (self->priv->tp_conn, -1,
+       _mcd_capability_snapshot_get_client_caps (client_caps),
+       NULL, NULL, NULL, NULL);
+    self->priv->client_caps_generation = generation;
 }
 
 static void
@@ -1341,7 +1361,7 @@ mcd_connection_early_get_interfaces_cb (TpConnection *tp_conn,
             }
             else if (q == TP_IFACE_QUARK_CONNECTION_INTERFACE_CONTACT_CAPABILITIES)
             {
-                GPtrArray *client_caps;
+                McdCapabilitySnapshot *client_caps;
 
                 /* nail on the interface (TpConnection will eventually know
                  * how to do this for itself) */
@@ -1351,15 +1371,13 @@ mcd_connection_early_get_interfaces_cb (TpConnection *tp_conn,
                 /* we don't need to delay Connect for this, it can be
                  * fire-and-forget */
 
-                client_caps = _mcd_dispatcher_dup_client_caps (
+                client_caps = _mcd_dispatcher_ref_client_caps (
                     self->priv->dispatcher);
 
                 if (client_caps != NULL)
                 {
                     _mcd_connection_update_client_caps (self, client_caps);
-                    g_ptr_array_foreach (client_caps,
-                                         (GFunc) g_value_array_free, NULL);
-                    g_ptr_array_unref (client_caps);
+                    _mcd_capability_snapshot_unref (client_caps);
                 }
                 /* else the McdDispatcher hasn't sorted itself out yet, so
                  * we can't usefully pre-load capabilities - we'll be told
@@ -1610,6 +1628,8 @@ _mcd_connection_release_tp_connection (McdConnection *connection,
         g_hash_table_remove_all (priv->recognized_presences);
 
   priv->dispatching_started = FALSE;
+  /* a new TpConnection will need to be told about all the clients */
+  priv->client_caps_generation = 0;
 }
 
 static void
@@ -27,6 +27,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "client-registry.h"
+#include "mcd-dispatch-timings.h"
 #include "mcd-handler-map-priv.h"
 
 G_BEGIN_DECLS
@@ -74,7 +75,9 @@ G_GNUC_INTERNAL McdDispatchOperation *_mcd_dispatch_operation_new (
     gboolean needs_approval,
     gboolean observe_only,
     McdChannel *channel,
-    const gchar * const *possible_handlers);
+    const gchar * const *possible_handlers,
+    McdDispatchTimings *timings,
+    guint handler_deadline);
 
 G_GNUC_INTERNAL gboolean _mcd_dispatch_operation_has_channel (
     McdDispatchOperation *self, McdChannel *channel);
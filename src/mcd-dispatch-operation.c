@@ -254,6 +254,18 @@ struct _McdDispatchOperationPrivate
      * HandleChannels, or doing so. This is a client lock. */
     McdClientProxy *trying_handler;
 
+    /* If non-NULL, HandleChannels on trying_handler hasn't returned yet */
+    TpProxyPendingCall *handle_channels_call;
+    /* How long to wait for HandleChannels to return before giving up on
+     * trying_handler and trying the next, in milliseconds; 0 means as
+     * long as D-Bus will */
+    guint handler_deadline;
+    /* If nonzero, the source that will give up on trying_handler */
+    guint handler_deadline_source;
+    /* owned McdClientProxy: Handlers we gave up on whose HandleChannels
+     * call is still outstanding */
+    GList *timed_out_handlers;
+
     /* If TRUE, we've tried all the BypassApproval handlers, which happens
      * before we run approvers. */
     gboolean tried_handlers_before_approval;
@@ -261,6 +273,23 @@ struct _McdDispatchOperationPrivate
     McdPluginDispatchOperation *plugin_api;
     gsize plugins_pending;
     gboolean did_post_observer_actions;
+
+    /* Shared with the dispatcher, which exposes them on D-Bus; we add our
+     * phases to them when we finish. */
+    McdDispatchTimings *timings;
+
+    /* When each phase started or ended, from g_get_monotonic_time(), or 0
+     * if it hasn't */
+    gint64 created_time;
+    gint64 plugin_delay_start_time;
+    gint64 plugin_delay_end_time;
+    gint64 observers_start_time;
+    gint64 observers_end_time;
+    gint64 approvers_start_time;
+    gint64 approvers_end_time;
+    gint64 handler_selection_time;
+    gint64 handle_channels_start_time;
+    gint64 handle_channels_end_time;
 };
 
 static void _mcd_dispatch_operation_check_finished (
@@ -314,6 +343,9 @@ _mcd_dispatch_operation_dec_observers_pending (McdDispatchOperation *self,
     if (_mcd_client_proxy_get_delay_approvers (client))
       self->priv->delay_approver_observers_pending--;
 
+    if (self->priv->observers_pending == 0)
+      self->priv->observers_end_time = g_get_monotonic_time ();
+
     _mcd_dispatch_operation_check_finished (self);
     _mcd_dispatch_operation_check_client_locks (self);
     g_object_unref (self);
@@ -341,6 +373,9 @@ _mcd_dispatch_operation_dec_ado_pending (McdDispatchOperation *self)
     g_return_if_fail (self->priv->ado_pending > 0);
     self->priv->ado_pending--;
 
+    if (self->priv->ado_pending == 0)
+      self->priv->approvers_end_time = g_get_monotonic_time ();
+
     _mcd_dispatch_operation_check_finished (self);
 
     if (self->priv->ado_pending == 0 && !self->priv->accepted_by_an_approver)
@@ -614,6 +649,8 @@ enum
     PROP_POSSIBLE_HANDLERS,
     PROP_NEEDS_APPROVAL,
     PROP_OBSERVE_ONLY,
+    PROP_TIMINGS,
+    PROP_HANDLER_DEADLINE,
 };
 
 /*
@@ -794,6 +831,79 @@ mcd_dispatch_operation_actually_finish (McdDispatchOperation *self)
     g_object_unref (self);
 }
 
+/* in milliseconds, or -1 if the phase didn't happen, for debug output */
+static gdouble
+interval_ms (gint64 start, gint64 end)
+{
+    if (start == 0 || end == 0 || end < start)
+        return -1;
+
+    return (end - start) / 1000.0;
+}
+
+static void
+mcd_dispatch_operation_record_timings (McdDispatchOperation *self)
+{
+    McdDispatchOperationPrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time ();
+
+    DEBUG ("%s/%p: plugin delay %.1fms, observers %.1fms, "
+           "AddDispatchOperation %.1fms, approval %.1fms, "
+           "handler selection %.1fms, HandleChannels %.1fms, total %.1fms",
+           priv->unique_name, self,
+           interval_ms (priv->plugin_delay_start_time,
+                        priv->plugin_delay_end_time),
+           interval_ms (priv->observers_start_time, priv->observers_end_time),
+           interval_ms (priv->approvers_start_time, priv->approvers_end_time),
+           interval_ms (priv->approvers_start_time,
+                        priv->handler_selection_time),
+           interval_ms (priv->handler_selection_time,
+                        priv->handle_channels_start_time),
+           interval_ms (priv->handle_channels_start_time,
+                        priv->handle_channels_end_time),
+           interval_ms (priv->created_time, now));
+
+    if (priv->timings == NULL)
+        return;
+
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_PLUGIN_DELAY,
+        priv->plugin_delay_start_time, priv->plugin_delay_end_time);
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_OBSERVERS,
+        priv->observers_start_time, priv->observers_end_time);
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_ADD_DISPATCH_OPERATION,
+        priv->approvers_start_time, priv->approvers_end_time);
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_APPROVAL,
+        priv->approvers_start_time, priv->handler_selection_time);
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_HANDLER_SELECTION,
+        priv->handler_selection_time, priv->handle_channels_start_time);
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_HANDLE_CHANNELS,
+        priv->handle_channels_start_time, priv->handle_channels_end_time);
+    _mcd_dispatch_timings_record_interval (priv->timings,
+        MCD_DISPATCH_PHASE_TOTAL, priv->created_time, now);
+}
+
+/* Record how long a single Observer or Approver took to reply, so the
+ * slow ones stand out */
+static void
+mcd_dispatch_operation_record_client (McdDispatchOperation *self,
+                                      const gchar *prefix,
+                                      TpClient *client,
+                                      gint64 start)
+{
+    if (self->priv->timings == NULL || start == 0)
+        return;
+
+    _mcd_dispatch_timings_record_client (self->priv->timings, prefix,
+                                         tp_proxy_get_bus_name (client),
+                                         g_get_monotonic_time () - start);
+}
+
 static void
 _mcd_dispatch_operation_finish (McdDispatchOperation *operation,
                                 GQuark domain, gint code,
@@ -820,6 +930,8 @@ _mcd_dispatch_operation_finish (McdDispatchOperation *operation,
     va_end (ap);
     DEBUG ("Result: %s", priv->result->message);
 
+    mcd_dispatch_operation_record_timings (operation);
+
     for (approval = g_queue_pop_head (priv->approvals);
          approval != NULL;
          approval = g_queue_pop_head (priv->approvals))
@@ -1253,6 +1365,18 @@ mcd_dispatch_operation_set_property (GObject *obj, guint prop_id,
         priv->observe_only = g_value_get_boolean (val);
         break;
 
+    case PROP_TIMINGS:
+        g_assert (priv->timings == NULL); /* construct-only */
+        priv->timings = g_value_get_pointer (val);
+
+        if (priv->timings != NULL)
+            _mcd_dispatch_timings_ref (priv->timings);
+        break;
+
+    case PROP_HANDLER_DEADLINE:
+        priv->handler_deadline = g_value_get_uint (val);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
         break;
@@ -1287,6 +1411,14 @@ mcd_dispatch_operation_get_property (GObject *obj, guint prop_id,
         g_value_set_boolean (val, priv->observe_only);
         break;
 
+    case PROP_TIMINGS:
+        g_value_set_pointer (val, priv->timings);
+        break;
+
+    case PROP_HANDLER_DEADLINE:
+        g_value_set_uint (val, priv->handler_deadline);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
         break;
@@ -1326,6 +1458,16 @@ mcd_dispatch_operation_dispose (GObject *object)
     tp_clear_object (&priv->account);
     tp_clear_object (&priv->handler_map);
     tp_clear_object (&priv->client_registry);
+    tp_clear_pointer (&priv->timings, _mcd_dispatch_timings_unref);
+
+    if (priv->handler_deadline_source != 0)
+    {
+        g_source_remove (priv->handler_deadline_source);
+        priv->handler_deadline_source = 0;
+    }
+
+    g_list_free_full (priv->timed_out_handlers, g_object_unref);
+    priv->timed_out_handlers = NULL;
 
     if (priv->approvals != NULL)
     {
@@ -1390,6 +1532,22 @@ _mcd_dispatch_operation_class_init (McdDispatchOperationClass * klass)
                               FALSE,
                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
                               G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property (object_class, PROP_TIMINGS,
+        g_param_spec_pointer ("timings", "Timings",
+                              "McdDispatchTimings to which this CDO adds "
+                              "the duration of each phase, or NULL",
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                              G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property (object_class, PROP_HANDLER_DEADLINE,
+        g_param_spec_uint ("handler-deadline", "Handler deadline",
+                           "Milliseconds to wait for each Handler's "
+                           "HandleChannels to return before trying the "
+                           "next, or 0 to wait as long as D-Bus does",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                           G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -1402,6 +1560,7 @@ _mcd_dispatch_operation_init (McdDispatchOperation *operation)
                                         McdDispatchOperationPrivate);
     operation->priv = priv;
     operation->priv->approvals = g_queue_new ();
+    operation->priv->created_time = g_get_monotonic_time ();
 
     /* initializes the interfaces */
     mcd_dbus_init_interfaces_instances (operation);
@@ -1413,6 +1572,8 @@ _mcd_dispatch_operation_init (McdDispatchOperation *operation)
  * @handler_map: the handler map
  * @channel: the channel to dispatch
  * @possible_handlers: the bus names of possible handlers for this channel
+ * @timings: (allow-none): where to record how long each phase took
+ * @handler_deadline: milliseconds to wait for each Handler, or 0
  *
  * Creates a #McdDispatchOperation.
  */
@@ -1422,7 +1583,9 @@ _mcd_dispatch_operation_new (McdClientRegistry *client_registry,
                              gboolean needs_approval,
                              gboolean observe_only,
                              McdChannel *channel,
-                             const gchar * const *possible_handlers)
+                             const gchar * const *possible_handlers,
+                             McdDispatchTimings *timings,
+                             guint handler_deadline)
 {
     gpointer *obj;
 
@@ -1439,6 +1602,8 @@ _mcd_dispatch_operation_new (McdClientRegistry *client_registry,
                         "possible-handlers", possible_handlers,
                         "needs-approval", needs_approval,
                         "observe-only", observe_only,
+                        "timings", timings,
+                        "handler-deadline", handler_deadline,
                         NULL);
 
     return MCD_DISPATCH_OPERATION (obj);
@@ -1885,6 +2050,37 @@ _mcd_dispatch_operation_dup_channel (McdDispatchOperation *self)
     return NULL;
 }
 
+/* A Handler we gave up on has replied to HandleChannels after all. By now
+ * we have moved on to another Handler, or failed altogether, so if it
+ * accepted the channel, nobody can be sure who has it: close it rather than
+ * let two Handlers both think they own it. */
+static void
+mcd_dispatch_operation_late_handler_reply (McdDispatchOperation *self,
+                                           GList *link,
+                                           const GError *error)
+{
+    McdClientProxy *client = link->data;
+
+    self->priv->timed_out_handlers = g_list_delete_link (
+        self->priv->timed_out_handlers, link);
+
+    if (error != NULL)
+    {
+        DEBUG ("%s/%p: Handler %s failed after its deadline: %s",
+               self->priv->unique_name, self,
+               tp_proxy_get_bus_name (client), error->message);
+    }
+    else if (self->priv->channel != NULL)
+    {
+        DEBUG ("%s/%p: Handler %s accepted %s after its deadline, closing it",
+               self->priv->unique_name, self, tp_proxy_get_bus_name (client),
+               mcd_channel_get_object_path (self->priv->channel));
+        _mcd_channel_close (self->priv->channel);
+    }
+
+    g_object_unref (client);
+}
+
 static void
 _mcd_dispatch_operation_handle_channels_cb (TpClient *client,
                                             const GError *error,
@@ -1892,6 +2088,22 @@ _mcd_dispatch_operation_handle_channels_cb (TpClient *client,
                                             GObject *weak G_GNUC_UNUSED)
 {
     McdDispatchOperation *self = user_data;
+    GList *late = g_list_find (self->priv->timed_out_handlers, client);
+
+    if (late != NULL)
+    {
+        mcd_dispatch_operation_late_handler_reply (self, late, error);
+        return;
+    }
+
+    self->priv->handle_channels_end_time = g_get_monotonic_time ();
+    self->priv->handle_channels_call = NULL;
+
+    if (self->priv->handler_deadline_source != 0)
+    {
+        g_source_remove (self->priv->handler_deadline_source);
+        self->priv->handler_deadline_source = 0;
+    }
 
     if (error)
     {
@@ -1968,6 +2180,10 @@ observe_channels_cb (TpClient *proxy, const GError *error,
     else
         DEBUG ("success from %s", tp_proxy_get_object_path (proxy));
 
+    mcd_dispatch_operation_record_client (self,
+        MCD_DISPATCH_PHASE_OBSERVER_PREFIX, proxy,
+        self->priv->observers_start_time);
+
     _mcd_dispatch_operation_dec_observers_pending (self, MCD_CLIENT_PROXY (proxy));
 }
 
@@ -2025,68 +2241,63 @@ static void
 _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
 {
     const gchar *dispatch_operation_path = "/";
+    const gchar *account_path, *connection_path;
+    GPtrArray *channels_array, *satisfied_requests;
+    GHashTable *request_properties;
     GHashTable *observer_info;
-    GHashTableIter iter;
-    gpointer client_p;
+    GHashTable *matches;
+    const GPtrArray *observers;
+    McdMatchRecord *record;
+    guint i;
 
-    observer_info = tp_asv_new (NULL, NULL);
+    /* in particular this happens if there is no channel at all */
+    if (self->priv->channel == NULL)
+        return;
 
-    _mcd_client_registry_init_hash_iter (self->priv->client_registry, &iter);
+    record = _mcd_channel_get_match_record (self->priv->channel);
+    g_assert (record != NULL);
+    matches = _mcd_client_registry_match_filters (self->priv->client_registry,
+        MCD_CLIENT_OBSERVER, record, FALSE);
 
-    while (g_hash_table_iter_next (&iter, NULL, &client_p))
+    if (g_hash_table_size (matches) == 0)
     {
-        McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
-        gboolean observed = FALSE;
-        const gchar *account_path, *connection_path;
-        GPtrArray *channels_array, *satisfied_requests;
-        GHashTable *request_properties;
-
-        if (!tp_proxy_has_interface_by_id (client,
-                                           TP_IFACE_QUARK_CLIENT_OBSERVER))
-            continue;
-
-        if (self->priv->channel != NULL)
-        {
-            McdChannel *channel = MCD_CHANNEL (self->priv->channel);
-            GVariant *properties;
-
-            properties = mcd_channel_dup_immutable_properties (channel);
-            g_assert (properties != NULL);
-
-            if (_mcd_client_match_filters (properties,
-                _mcd_client_proxy_get_observer_filters (client),
-                FALSE))
-                observed = TRUE;
-
-            g_variant_unref (properties);
-        }
+        g_hash_table_unref (matches);
+        return;
+    }
 
-        /* in particular this happens if there is no channel at all */
-        if (!observed) continue;
+    self->priv->observers_start_time = g_get_monotonic_time ();
 
-        /* build up the parameters and invoke the observer */
+    /* Every observer gets exactly the same arguments, so build them once
+     * and pass the same ones to each call, rather than building a copy of
+     * the channel's properties and the satisfied requests per observer. */
+    connection_path = _mcd_dispatch_operation_get_connection_path (self);
+    account_path = _mcd_dispatch_operation_get_account_path (self);
+    channels_array = _mcd_tp_channel_details_build_from_tp_chan (
+        mcd_channel_get_tp_channel (self->priv->channel));
+    collect_satisfied_requests (self->priv->channel, &satisfied_requests,
+                                &request_properties);
 
-        connection_path = _mcd_dispatch_operation_get_connection_path (self);
-        account_path = _mcd_dispatch_operation_get_account_path (self);
+    observer_info = tp_asv_new (NULL, NULL);
+    /* transfer ownership into observer_info */
+    tp_asv_take_boxed (observer_info, "request-properties",
+        TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP,
+        request_properties);
+    request_properties = NULL;
 
-        /* TODO: there's room for optimization here: reuse the channels_array,
-         * if the observed list is the same */
-        channels_array = _mcd_tp_channel_details_build_from_tp_chan (
-            mcd_channel_get_tp_channel (self->priv->channel));
+    if (_mcd_dispatch_operation_needs_approval (self))
+    {
+        dispatch_operation_path = _mcd_dispatch_operation_get_path (self);
+    }
 
-        collect_satisfied_requests (self->priv->channel, &satisfied_requests,
-                                    &request_properties);
+    observers = _mcd_client_registry_get_clients (
+        self->priv->client_registry, MCD_CLIENT_OBSERVER);
 
-        /* transfer ownership into observer_info */
-        tp_asv_take_boxed (observer_info, "request-properties",
-            TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP,
-            request_properties);
-        request_properties = NULL;
+    for (i = 0; i < observers->len; i++)
+    {
+        McdClientProxy *client = g_ptr_array_index (observers, i);
 
-        if (_mcd_dispatch_operation_needs_approval (self))
-        {
-            dispatch_operation_path = _mcd_dispatch_operation_get_path (self);
-        }
+        if (!g_hash_table_contains (matches, client))
+            continue;
 
         _mcd_dispatch_operation_inc_observers_pending (self, client);
 
@@ -2098,13 +2309,12 @@ _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
             dispatch_operation_path, satisfied_requests, observer_info,
             observe_channels_cb,
             g_object_ref (self), g_object_unref, NULL);
-
-        g_ptr_array_unref (satisfied_requests);
-
-        _mcd_tp_channel_details_free (channels_array);
     }
 
+    _mcd_tp_channel_details_free (channels_array);
+    g_ptr_array_unref (satisfied_requests);
     g_hash_table_unref (observer_info);
+    g_hash_table_unref (matches);
 }
 
 static void
@@ -2134,6 +2344,10 @@ add_dispatch_operation_cb (TpClient *proxy,
         }
     }
 
+    mcd_dispatch_operation_record_client (self,
+        MCD_DISPATCH_PHASE_APPROVER_PREFIX, proxy,
+        self->priv->approvers_start_time);
+
     /* If all approvers fail to add the DO, then we behave as if no
      * approver was registered: i.e., we continue dispatching. If at least
      * one approver accepted it, then we can still continue dispatching,
@@ -2144,53 +2358,53 @@ add_dispatch_operation_cb (TpClient *proxy,
 static void
 _mcd_dispatch_operation_run_approvers (McdDispatchOperation *self)
 {
-    GHashTableIter iter;
-    gpointer client_p;
+    GPtrArray *channel_details = NULL;
+    GHashTable *matches;
+    const GPtrArray *approvers;
+    guint i;
 
     /* we temporarily increment this count and decrement it at the end of the
      * function, to make sure it won't become 0 while we are still invoking
      * approvers */
     _mcd_dispatch_operation_inc_ado_pending (self);
+    self->priv->approvers_start_time = g_get_monotonic_time ();
 
-    _mcd_client_registry_init_hash_iter (self->priv->client_registry, &iter);
-    while (g_hash_table_iter_next (&iter, NULL, &client_p))
+    if (self->priv->channel != NULL)
     {
-        McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
-        GPtrArray *channel_details;
-        const gchar *dispatch_operation;
-        GHashTable *properties;
-        gboolean matched = FALSE;
-
-        if (!tp_proxy_has_interface_by_id (client,
-                                           TP_IFACE_QUARK_CLIENT_APPROVER))
-            continue;
+        McdMatchRecord *record;
 
-        if (self->priv->channel != NULL)
-        {
-            McdChannel *channel = MCD_CHANNEL (self->priv->channel);
-            GVariant *channel_properties;
+        record = _mcd_channel_get_match_record (self->priv->channel);
+        g_assert (record != NULL);
+        matches = _mcd_client_registry_match_filters (
+            self->priv->client_registry, MCD_CLIENT_APPROVER, record, FALSE);
+    }
+    else
+    {
+        /* no approver can match if there is no channel */
+        matches = g_hash_table_new (NULL, NULL);
+    }
 
-            channel_properties = mcd_channel_dup_immutable_properties (channel);
-            g_assert (channel_properties != NULL);
+    approvers = _mcd_client_registry_get_clients (
+        self->priv->client_registry, MCD_CLIENT_APPROVER);
 
-            if (_mcd_client_match_filters (channel_properties,
-                _mcd_client_proxy_get_approver_filters (client),
-                FALSE))
-            {
-                matched = TRUE;
-            }
+    for (i = 0; i < approvers->len; i++)
+    {
+        McdClientProxy *client = g_ptr_array_index (approvers, i);
+        const gchar *dispatch_operation;
+        GHashTable *properties;
 
-            g_variant_unref (channel_properties);
-        }
+        if (!g_hash_table_contains (matches, client))
+            continue;
 
         /* in particular, after this point, self->priv->channel can't
          * be NULL */
-        if (!matched) continue;
-
         dispatch_operation = _mcd_dispatch_operation_get_path (self);
         properties = _mcd_dispatch_operation_get_properties (self);
-        channel_details = _mcd_tp_channel_details_build_from_tp_chan (
-            mcd_channel_get_tp_channel (self->priv->channel));
+
+        /* as for observers, every approver gets the same arguments */
+        if (channel_details == NULL)
+            channel_details = _mcd_tp_channel_details_build_from_tp_chan (
+                mcd_channel_get_tp_channel (self->priv->channel));
 
         DEBUG ("Calling AddDispatchOperation on approver %s for CDO %s @ %p",
                tp_proxy_get_bus_name (client), dispatch_operation, self);
@@ -2202,10 +2416,13 @@ _mcd_dispatch_operation_run_approvers (McdDispatchOperation *self)
             channel_details, dispatch_operation, properties,
             add_dispatch_operation_cb,
             g_object_ref (self), g_object_unref, NULL);
-
-        g_boxed_free (TP_ARRAY_TYPE_CHANNEL_DETAILS_LIST, channel_details);
     }
 
+    if (channel_details != NULL)
+        _mcd_tp_channel_details_free (channel_details);
+
+    g_hash_table_unref (matches);
+
     /* This matches the approvers count set to 1 at the beginning of the
      * function */
     _mcd_dispatch_operation_dec_ado_pending (self);
@@ -2272,6 +2489,47 @@ _mcd_dispatch_operation_run_clients (McdDispatchOperation *self)
     g_object_unref (self);
 }
 
+/* The Handler we're trying hasn't replied to HandleChannels in time: treat
+ * it as having failed, and move on to the next one. The call is left
+ * pending, so that we find out if the Handler does accept the channel
+ * later (see mcd_dispatch_operation_late_handler_reply()). */
+static gboolean
+mcd_dispatch_operation_handler_deadline_cb (gpointer user_data)
+{
+    McdDispatchOperation *self = user_data;
+    const gchar *bus_name;
+    GError *error;
+
+    self->priv->handler_deadline_source = 0;
+    g_return_val_if_fail (self->priv->trying_handler != NULL, FALSE);
+    g_return_val_if_fail (self->priv->handle_channels_call != NULL, FALSE);
+
+    bus_name = tp_proxy_get_bus_name (self->priv->trying_handler);
+    error = g_error_new (TP_ERROR, TP_ERROR_NOT_AVAILABLE,
+                         "Handler %s did not reply to HandleChannels "
+                         "within %ums", bus_name,
+                         self->priv->handler_deadline);
+    DEBUG ("%s/%p: %s", self->priv->unique_name, self, error->message);
+
+    /* the pending call still holds a ref to us */
+    self->priv->timed_out_handlers = g_list_prepend (
+        self->priv->timed_out_handlers,
+        g_object_ref (self->priv->trying_handler));
+    self->priv->handle_channels_call = NULL;
+    self->priv->handle_channels_end_time = g_get_monotonic_time ();
+
+    if (self->priv->timings != NULL)
+        _mcd_dispatch_timings_count_client (self->priv->timings,
+            MCD_DISPATCH_COUNTER_HANDLER_TIMEOUT_PREFIX, bus_name);
+
+    _mcd_dispatch_operation_set_handler_failed (self, bus_name, error);
+    g_error_free (error);
+
+    tp_clear_object (&self->priv->trying_handler);
+    _mcd_dispatch_operation_check_client_locks (self);
+    return FALSE;
+}
+
 /*
  * mcd_dispatch_operation_handle_channels:
  * @self: the dispatch operation
@@ -2323,11 +2581,26 @@ mcd_dispatch_operation_handle_channels (McdDispatchOperation *self)
         TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP, request_properties);
     request_properties = NULL;
 
-    _mcd_client_proxy_handle_channels (self->priv->trying_handler,
+    self->priv->handle_channels_start_time = g_get_monotonic_time ();
+    self->priv->handle_channels_call = _mcd_client_proxy_handle_channels (
+        self->priv->trying_handler,
         -1, channels, self->priv->handle_with_time,
         handler_info, _mcd_dispatch_operation_handle_channels_cb,
         g_object_ref (self), g_object_unref, NULL);
 
+    /* the pending call holds a ref to us, so we don't need one here.
+     * A Handler that isn't running yet has to be activated by the bus
+     * daemon first, which can legitimately take a while, so it gets as
+     * long as D-Bus allows. */
+    if (self->priv->handle_channels_call != NULL &&
+        self->priv->handler_deadline > 0 &&
+        _mcd_client_proxy_is_active (self->priv->trying_handler))
+    {
+        self->priv->handler_deadline_source = g_timeout_add (
+            self->priv->handler_deadline,
+            mcd_dispatch_operation_handler_deadline_cb, self);
+    }
+
     g_hash_table_unref (handler_info);
     g_list_free (channels);
 }
@@ -2407,6 +2680,13 @@ _mcd_dispatch_operation_try_next_handler (McdDispatchOperation *self)
     gboolean is_approved = _mcd_dispatch_operation_is_approved (self);
     Approval *approval = g_queue_peek_head (self->priv->approvals);
 
+    /* Handler selection starts with the first attempt after approval;
+     * if we tried BypassApproval handlers before running Approvers, that
+     * doesn't count. */
+    if (self->priv->handler_selection_time <=
+        self->priv->approvers_start_time)
+        self->priv->handler_selection_time = g_get_monotonic_time ();
+
     /* If there is a preferred Handler chosen by the first Approver or
      * request, it's the first one we'll consider. We'll even consider
      * it even if its filter doesn't match.
@@ -2510,6 +2790,10 @@ _mcd_dispatch_operation_start_plugin_delay (McdDispatchOperation *self)
     DEBUG ("%" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT,
            self->priv->plugins_pending,
            self->priv->plugins_pending + 1);
+
+    if (self->priv->plugin_delay_start_time == 0)
+        self->priv->plugin_delay_start_time = g_get_monotonic_time ();
+
     self->priv->plugins_pending++;
 }
 
@@ -2522,6 +2806,9 @@ _mcd_dispatch_operation_end_plugin_delay (McdDispatchOperation *self)
     g_return_if_fail (self->priv->plugins_pending > 0);
     self->priv->plugins_pending--;
 
+    if (self->priv->plugins_pending == 0)
+        self->priv->plugin_delay_end_time = g_get_monotonic_time ();
+
     _mcd_dispatch_operation_check_client_locks (self);
     g_object_unref (self);
 }
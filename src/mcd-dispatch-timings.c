@@ -0,0 +1,316 @@
+/* Mission Control dispatch timings - histograms of how long each phase of
+ * dispatching a channel takes, and counts of things going wrong
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The dispatcher owns one of these, and each dispatch operation adds the
+ * durations of its phases to it when it finishes. The buckets are fixed,
+ * so recording is cheap and a histogram never grows; the only thing that
+ * does grow is the number of phases and counters, since there is one per
+ * Observer, Approver and timed-out Handler. Clients that uniquify their
+ * bus names would make that grow forever, so there is a limit, after which
+ * new clients are lumped together.
+ */
+
+#include "config.h"
+#include "mcd-dispatch-timings.h"
+
+/* upper bounds of the buckets, in milliseconds */
+static const guint bucket_bounds[MCD_DISPATCH_TIMINGS_N_BOUNDS] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+
+/* how many distinct per-client phases and counters there can be */
+#define MAX_CLIENT_ENTRIES 64
+
+struct _McdDispatchTimings {
+    volatile gint refcount;
+    /* owned phase name => owned McdPhaseHistogram */
+    GHashTable *phases;
+    /* owned counter name => owned guint64 */
+    GHashTable *counters;
+    /* number of entries in @phases and @counters that are per-client */
+    guint n_client_entries;
+};
+
+static void
+histogram_free (gpointer p)
+{
+  g_slice_free (McdPhaseHistogram, p);
+}
+
+McdDispatchTimings *
+_mcd_dispatch_timings_new (void)
+{
+  McdDispatchTimings *self = g_slice_new0 (McdDispatchTimings);
+
+  self->refcount = 1;
+  self->phases = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      histogram_free);
+  self->counters = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  return self;
+}
+
+McdDispatchTimings *
+_mcd_dispatch_timings_ref (McdDispatchTimings *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->refcount);
+  return self;
+}
+
+void
+_mcd_dispatch_timings_unref (McdDispatchTimings *self)
+{
+  if (self == NULL)
+    return;
+
+  if (g_atomic_int_dec_and_test (&self->refcount))
+    {
+      g_hash_table_unref (self->phases);
+      g_hash_table_unref (self->counters);
+      g_slice_free (McdDispatchTimings, self);
+    }
+}
+
+/*
+ * _mcd_dispatch_timings_record:
+ * @self: the timings
+ * @phase: the name of a phase, usually one of the MCD_DISPATCH_PHASE_*
+ *  constants
+ * @usec: how long it took, in microseconds
+ */
+void
+_mcd_dispatch_timings_record (McdDispatchTimings *self,
+    const gchar *phase,
+    gint64 usec)
+{
+  McdPhaseHistogram *histogram;
+  guint i;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (phase != NULL);
+
+  if (usec < 0)
+    usec = 0;
+
+  histogram = g_hash_table_lookup (self->phases, phase);
+
+  if (histogram == NULL)
+    {
+      histogram = g_slice_new0 (McdPhaseHistogram);
+      g_hash_table_insert (self->phases, g_strdup (phase), histogram);
+    }
+
+  histogram->count++;
+  histogram->total_usec += usec;
+
+  if ((guint64) usec > histogram->max_usec)
+    histogram->max_usec = usec;
+
+  for (i = 0; i < MCD_DISPATCH_TIMINGS_N_BOUNDS; i++)
+    {
+      if (usec < (gint64) bucket_bounds[i] * 1000)
+        break;
+    }
+
+  /* if we fell off the end, i is the overflow bucket */
+  histogram->buckets[i]++;
+}
+
+/*
+ * _mcd_dispatch_timings_record_interval:
+ * @self: the timings
+ * @phase: as for _mcd_dispatch_timings_record()
+ * @start: when the phase started, from g_get_monotonic_time(), or 0
+ * @end: when it ended, or 0
+ *
+ * Record the phase if it both started and ended; not every dispatch
+ * operation goes through every phase.
+ */
+void
+_mcd_dispatch_timings_record_interval (McdDispatchTimings *self,
+    const gchar *phase,
+    gint64 start,
+    gint64 end)
+{
+  if (start == 0 || end == 0 || end < start)
+    return;
+
+  _mcd_dispatch_timings_record (self, phase, end - start);
+}
+
+/* Returns: (transfer full): @prefix followed by @bus_name, or by
+ * MCD_DISPATCH_OTHER_CLIENTS if @table doesn't already have that and there
+ * are too many per-client entries already */
+static gchar *
+client_key (McdDispatchTimings *self,
+    GHashTable *table,
+    const gchar *prefix,
+    const gchar *bus_name)
+{
+  gchar *key = g_strconcat (prefix, bus_name, NULL);
+
+  if (g_hash_table_contains (table, key))
+    return key;
+
+  if (self->n_client_entries >= MAX_CLIENT_ENTRIES)
+    {
+      g_free (key);
+      return g_strconcat (prefix, MCD_DISPATCH_OTHER_CLIENTS, NULL);
+    }
+
+  self->n_client_entries++;
+  return key;
+}
+
+/*
+ * _mcd_dispatch_timings_record_client:
+ * @self: the timings
+ * @prefix: one of the MCD_DISPATCH_PHASE_*_PREFIX constants
+ * @bus_name: the client's bus name
+ * @usec: how long it took, in microseconds
+ *
+ * Record a per-client phase, as for _mcd_dispatch_timings_record().
+ */
+void
+_mcd_dispatch_timings_record_client (McdDispatchTimings *self,
+    const gchar *prefix,
+    const gchar *bus_name,
+    gint64 usec)
+{
+  gchar *phase;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (prefix != NULL);
+  g_return_if_fail (bus_name != NULL);
+
+  phase = client_key (self, self->phases, prefix, bus_name);
+  _mcd_dispatch_timings_record (self, phase, usec);
+  g_free (phase);
+}
+
+void
+_mcd_dispatch_timings_foreach (McdDispatchTimings *self,
+    McdDispatchTimingsFunc func,
+    gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer k, v;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (func != NULL);
+
+  g_hash_table_iter_init (&iter, self->phases);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    func (k, v, user_data);
+}
+
+void
+_mcd_dispatch_timings_reset (McdDispatchTimings *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_remove_all (self->phases);
+  g_hash_table_remove_all (self->counters);
+  self->n_client_entries = 0;
+}
+
+/*
+ * _mcd_dispatch_timings_count:
+ * @self: the timings
+ * @counter: the name of a counter, usually starting with one of the
+ *  MCD_DISPATCH_COUNTER_* constants
+ *
+ * Add 1 to @counter, which starts from 0.
+ */
+void
+_mcd_dispatch_timings_count (McdDispatchTimings *self,
+    const gchar *counter)
+{
+  guint64 *value;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (counter != NULL);
+
+  value = g_hash_table_lookup (self->counters, counter);
+
+  if (value == NULL)
+    {
+      value = g_new0 (guint64, 1);
+      g_hash_table_insert (self->counters, g_strdup (counter), value);
+    }
+
+  (*value)++;
+}
+
+/*
+ * _mcd_dispatch_timings_count_client:
+ * @self: the timings
+ * @prefix: one of the MCD_DISPATCH_COUNTER_*_PREFIX constants
+ * @bus_name: the client's bus name
+ *
+ * Add 1 to a per-client counter, as for _mcd_dispatch_timings_count().
+ */
+void
+_mcd_dispatch_timings_count_client (McdDispatchTimings *self,
+    const gchar *prefix,
+    const gchar *bus_name)
+{
+  gchar *counter;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (prefix != NULL);
+  g_return_if_fail (bus_name != NULL);
+
+  counter = client_key (self, self->counters, prefix, bus_name);
+  _mcd_dispatch_timings_count (self, counter);
+  g_free (counter);
+}
+
+void
+_mcd_dispatch_timings_foreach_counter (McdDispatchTimings *self,
+    McdDispatchCountersFunc func,
+    gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer k, v;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (func != NULL);
+
+  g_hash_table_iter_init (&iter, self->counters);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    func (k, *(guint64 *) v, user_data);
+}
+
+/*
+ * Returns: (array fixed-size=MCD_DISPATCH_TIMINGS_N_BOUNDS): the upper
+ *  bound of each bucket but the last, in milliseconds. Bucket i counts the
+ *  durations at least as long as bound i - 1 but shorter than bound i.
+ */
+const guint *
+_mcd_dispatch_timings_get_bucket_bounds (void)
+{
+  return bucket_bounds;
+}
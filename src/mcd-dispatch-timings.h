@@ -0,0 +1,108 @@
+/* Mission Control dispatch timings - histograms of how long each phase of
+ * dispatching a channel takes, and counts of things going wrong
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_DISPATCH_TIMINGS_H
+#define MCD_DISPATCH_TIMINGS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* the phases of every dispatch operation; see mcd-dispatch-operation.c */
+#define MCD_DISPATCH_PHASE_PLUGIN_DELAY "plugin-delay"
+#define MCD_DISPATCH_PHASE_OBSERVERS "observers"
+#define MCD_DISPATCH_PHASE_ADD_DISPATCH_OPERATION "add-dispatch-operation"
+#define MCD_DISPATCH_PHASE_APPROVAL "approval"
+#define MCD_DISPATCH_PHASE_HANDLER_SELECTION "handler-selection"
+#define MCD_DISPATCH_PHASE_HANDLE_CHANNELS "handle-channels"
+#define MCD_DISPATCH_PHASE_TOTAL "total"
+
+/* per-client phases are this prefix followed by the client's bus name,
+ * or by MCD_DISPATCH_OTHER_CLIENTS */
+#define MCD_DISPATCH_PHASE_OBSERVER_PREFIX "observer:"
+#define MCD_DISPATCH_PHASE_APPROVER_PREFIX "approver:"
+
+/* time spent in the dispatcher's queue before dispatching started, per
+ * priority class: this prefix followed by the name of the class */
+#define MCD_DISPATCH_PHASE_QUEUE_WAIT_PREFIX "queue-wait:"
+
+/* counted once per Handler that didn't reply to HandleChannels in time;
+ * followed by the Handler's bus name */
+#define MCD_DISPATCH_COUNTER_HANDLER_TIMEOUT_PREFIX "handler-timeout:"
+
+/* used instead of the bus name in per-client phases and counters once
+ * there are too many clients to keep them apart */
+#define MCD_DISPATCH_OTHER_CLIENTS "(other)"
+
+/* counted once per Messages.DRAFT.SendMessage attempt, depending on
+ * whether it reused a text channel kept from an earlier message or had to
+ * request one */
+#define MCD_DISPATCH_COUNTER_SEND_MESSAGE_WARM "send-message-warm-channel"
+#define MCD_DISPATCH_COUNTER_SEND_MESSAGE_COLD "send-message-new-channel"
+
+/* the number of upper bounds returned by
+ * _mcd_dispatch_timings_get_bucket_bounds(); there is one more bucket,
+ * for anything slower than the last bound */
+#define MCD_DISPATCH_TIMINGS_N_BOUNDS 13
+#define MCD_DISPATCH_TIMINGS_N_BUCKETS (MCD_DISPATCH_TIMINGS_N_BOUNDS + 1)
+
+typedef struct _McdDispatchTimings McdDispatchTimings;
+
+typedef struct {
+    guint64 count;
+    guint64 total_usec;
+    guint64 max_usec;
+    guint buckets[MCD_DISPATCH_TIMINGS_N_BUCKETS];
+} McdPhaseHistogram;
+
+typedef void (*McdDispatchTimingsFunc) (const gchar *phase,
+    const McdPhaseHistogram *histogram, gpointer user_data);
+typedef void (*McdDispatchCountersFunc) (const gchar *counter,
+    guint64 value, gpointer user_data);
+
+G_GNUC_INTERNAL McdDispatchTimings *_mcd_dispatch_timings_new (void);
+G_GNUC_INTERNAL McdDispatchTimings *_mcd_dispatch_timings_ref (
+    McdDispatchTimings *self);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_unref (McdDispatchTimings *self);
+
+G_GNUC_INTERNAL void _mcd_dispatch_timings_record (McdDispatchTimings *self,
+    const gchar *phase, gint64 usec);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_record_interval (
+    McdDispatchTimings *self, const gchar *phase, gint64 start, gint64 end);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_record_client (
+    McdDispatchTimings *self, const gchar *prefix, const gchar *bus_name,
+    gint64 usec);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_foreach (McdDispatchTimings *self,
+    McdDispatchTimingsFunc func, gpointer user_data);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_reset (McdDispatchTimings *self);
+
+G_GNUC_INTERNAL void _mcd_dispatch_timings_count (McdDispatchTimings *self,
+    const gchar *counter);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_count_client (
+    McdDispatchTimings *self, const gchar *prefix, const gchar *bus_name);
+G_GNUC_INTERNAL void _mcd_dispatch_timings_foreach_counter (
+    McdDispatchTimings *self, McdDispatchCountersFunc func,
+    gpointer user_data);
+
+G_GNUC_INTERNAL const guint *_mcd_dispatch_timings_get_bucket_bounds (void);
+
+G_END_DECLS
+
+#endif /* MCD_DISPATCH_TIMINGS_H */
@@ -51,7 +51,7 @@ void _mcd_dispatcher_recover_channel (McdDispatcher *dispatcher,
 G_GNUC_INTERNAL void _mcd_dispatcher_add_connection (McdDispatcher *self,
     McdConnection *connection);
 
-G_GNUC_INTERNAL GPtrArray *_mcd_dispatcher_dup_client_caps (
+G_GNUC_INTERNAL McdCapabilitySnapshot *_mcd_dispatcher_ref_client_caps (
     McdDispatcher *self);
 
 G_END_DECLS
@@ -45,6 +45,7 @@
 
 #include "mission-control-plugins/mission-control-plugins.h"
 
+#include "channel-utils.h"
 #include "client-registry.h"
 #include "mcd-account-priv.h"
 #include "mcd-client-priv.h"
@@ -55,7 +56,9 @@
 #include "mcd-channel-priv.h"
 #include "mcd-dispatcher-priv.h"
 #include "mcd-dispatch-operation-priv.h"
+#include "mcd-dispatch-timings.h"
 #include "mcd-handler-map-priv.h"
+#include "mcd-lru-cache.h"
 #include "mcd-misc.h"
 #include "plugin-loader.h"
 
@@ -77,8 +80,53 @@
 
 #define MCD_DISPATCHER_PRIV(dispatcher) (MCD_DISPATCHER (dispatcher)->priv)
 
+/* How long to wait, in milliseconds, for more clients' capabilities to
+ * change before telling the connections; can be overridden with
+ * MC_CLIENT_CAPS_DELAY */
+#define DEFAULT_CLIENT_CAPS_DELAY 100
+
+/* How long to wait, in milliseconds, for a Handler to reply to
+ * HandleChannels before trying the next one; can be overridden with
+ * MC_HANDLER_DEADLINE, where 0 means to wait for the D-Bus timeout */
+#define DEFAULT_HANDLER_DEADLINE 10000
+
+/* How many channels to start dispatching per main loop iteration. Any more
+ * wait in the dispatch queue, so that a burst of channels (typically
+ * recovered ones, at login) can't hold up an urgent one that arrives
+ * during it. */
+#define DISPATCH_BATCH_SIZE 10
+
+/* How many text channels to keep for Messages.DRAFT.SendMessage to reuse,
+ * one per (account, target) pair; can be overridden with MC_WARM_CHANNELS,
+ * where 0 means to request a channel for every message. Messages sent to
+ * a kept channel are still checked by the request policy plugins; see
+ * send_message_to_warm_channel() */
+#define DEFAULT_WARM_CHANNELS 16
+
+/* Priority classes for the dispatch queue, most urgent first */
+typedef enum {
+    /* to or from an emergency number; see
+     * _mcd_connection_target_id_is_urgent() */
+    DISPATCH_PRIORITY_EMERGENCY,
+    /* requested by the user, i.e. with a user action time */
+    DISPATCH_PRIORITY_USER_ACTION,
+    /* incoming, or requested without user action */
+    DISPATCH_PRIORITY_INCOMING,
+    /* already existed when MC started, or when the connection was set up */
+    DISPATCH_PRIORITY_RECOVERED,
+    N_DISPATCH_PRIORITIES
+} DispatchPriority;
+
+static const gchar * const dispatch_priority_names[N_DISPATCH_PRIORITIES] = {
+    "emergency",
+    "user-action",
+    "incoming",
+    "recovered"
+};
+
 static void dispatcher_iface_init (gpointer, gpointer);
 static void messages_iface_init (gpointer, gpointer);
+static void debug_iface_init (gpointer, gpointer);
 
 
 G_DEFINE_TYPE_WITH_CODE (McdDispatcher, mcd_dispatcher, G_TYPE_OBJECT,
@@ -86,6 +134,8 @@ G_DEFINE_TYPE_WITH_CODE (McdDispatcher, mcd_dispatcher, G_TYPE_OBJECT,
                            dispatcher_iface_init);
     G_IMPLEMENT_INTERFACE (MC_TYPE_SVC_CHANNEL_DISPATCHER_INTERFACE_MESSAGES_DRAFT,
                            messages_iface_init);
+    G_IMPLEMENT_INTERFACE (MC_TYPE_SVC_CHANNEL_DISPATCHER_INTERFACE_DEBUG_DRAFT,
+                           debug_iface_init);
     G_IMPLEMENT_INTERFACE (
         TP_TYPE_SVC_CHANNEL_DISPATCHER_INTERFACE_OPERATION_LIST,
         NULL);
@@ -111,6 +161,70 @@ typedef struct
     gboolean ensure;
 } McdChannelRequestACL;
 
+typedef struct
+{
+    /* borrowed: the dispatcher owns the queue */
+    McdDispatcher *dispatcher;
+    McdChannel *channel;
+    gboolean requested;
+    DispatchPriority priority;
+    /* from g_get_monotonic_time() */
+    gint64 queued_time;
+    gulong abort_id;
+    /* TRUE if a request was satisfied by this channel while it was queued,
+     * in which case it must be approved as soon as it has a CDO */
+    gboolean approved;
+    gchar *preferred_handler;
+} QueuedChannel;
+
+static void
+queued_channel_free (QueuedChannel *qc)
+{
+    if (qc->abort_id != 0)
+        g_signal_handler_disconnect (qc->channel, qc->abort_id);
+
+    g_object_unref (qc->channel);
+    g_free (qc->preferred_handler);
+    g_slice_free (QueuedChannel, qc);
+}
+
+typedef struct
+{
+    /* borrowed: the dispatcher owns the cache */
+    McdDispatcher *dispatcher;
+    /* a copy of this entry's key in the cache */
+    gchar *key;
+    gchar *account_path;
+    /* as passed to SendMessage, which is not necessarily normalized */
+    gchar *target_id;
+    TpChannel *channel;
+    /* TRUE if we are the channel's handler, so nobody else will close it */
+    gboolean owned;
+    gulong invalidated_id;
+    TpProxySignalConnection *message_received;
+} WarmChannel;
+
+static void
+warm_channel_free (gpointer p)
+{
+    WarmChannel *warm = p;
+
+    if (warm->invalidated_id != 0)
+        g_signal_handler_disconnect (warm->channel, warm->invalidated_id);
+
+    if (warm->message_received != NULL)
+        tp_proxy_signal_connection_disconnect (warm->message_received);
+
+    if (warm->owned && _mcd_tp_channel_should_close (warm->channel, "closing"))
+        tp_cli_channel_call_close (warm->channel, -1, NULL, NULL, NULL, NULL);
+
+    g_object_unref (warm->channel);
+    g_free (warm->key);
+    g_free (warm->account_path);
+    g_free (warm->target_id);
+    g_slice_free (WarmChannel, warm);
+}
+
 struct _McdDispatcherPrivate
 {
     /* Dispatching contexts */
@@ -132,6 +246,39 @@ struct _McdDispatcherPrivate
     /* connection => itself, borrowed */
     GHashTable *connections;
 
+    /* If nonzero, the source that will push the client capabilities to
+     * all connections, collecting any other changes that happen in the
+     * meantime */
+    guint client_caps_source;
+    /* milliseconds to wait between a change and pushing it */
+    guint client_caps_delay;
+
+    /* how long each phase of dispatching has taken, shared with every
+     * dispatch operation; see the Debug.DRAFT interface */
+    McdDispatchTimings *timings;
+    /* milliseconds each dispatch operation waits for a Handler */
+    guint handler_deadline;
+
+    /* Channels waiting to be dispatched: one GQueue of QueuedChannel per
+     * DispatchPriority */
+    GQueue dispatch_queues[N_DISPATCH_PRIORITIES];
+    /* the most there have ever been in each queue, for the Debug.DRAFT
+     * interface */
+    guint dispatch_queue_peaks[N_DISPATCH_PRIORITIES];
+    /* how many more channels we may start dispatching before returning to
+     * the main loop */
+    guint dispatch_budget;
+    /* if nonzero, the source that will replenish dispatch_budget and carry
+     * on with the queue */
+    guint dispatch_queue_source;
+    /* TRUE while we're taking channels from the queue */
+    gboolean draining_dispatch_queue;
+
+    /* "account path\ntarget ID" => owned WarmChannel: text channels that
+     * SendMessage has used, kept for the next message to the same target;
+     * or NULL if disabled */
+    McdLruCache *warm_channels;
+
     /* Initially FALSE, meaning we suppress OperationList.DispatchOperations
      * change notification signals because nobody has retrieved that property
      * yet. Set to TRUE the first time someone reads the DispatchOperations
@@ -276,7 +423,8 @@ _mcd_dispatcher_enter_state_machine (McdDispatcher *dispatcher,
 
     operation = _mcd_dispatch_operation_new (priv->clients,
         priv->handler_map, !requested, only_observe, channel,
-        (const gchar * const *) possible_handlers);
+        (const gchar * const *) possible_handlers, priv->timings,
+        priv->handler_deadline);
 
     if (!requested)
     {
@@ -579,6 +727,59 @@ _mcd_dispatcher_lookup_handler (McdDispatcher *self,
     return handler;
 }
 
+/* Channels to be given to a recovering Observer in one ObserveChannels
+ * call. Each connection belongs to exactly one account, so the connection
+ * is enough to identify a batch. */
+typedef struct
+{
+    /* borrowed */
+    const gchar *account_path;
+    /* borrowed from the channels */
+    const gchar *connection_path;
+    /* borrowed TpChannel, most recently added first */
+    GList *channels;
+} RecoveryBatch;
+
+static void
+recovery_batch_free (gpointer p)
+{
+    RecoveryBatch *batch = p;
+
+    g_list_free (batch->channels);
+    g_slice_free (RecoveryBatch, batch);
+}
+
+static void
+recovery_batches_add (GHashTable *batches,
+                      GHashTable *seen,
+                      const gchar *account_path,
+                      TpChannel *channel)
+{
+    const gchar *object_path = tp_proxy_get_object_path (channel);
+    const gchar *connection_path =
+        tp_proxy_get_object_path (tp_channel_get_connection (channel));
+    RecoveryBatch *batch;
+
+    /* a channel can still have a dispatch operation after it has been
+     * handled, but the Observer only needs to hear about it once */
+    if (g_hash_table_contains (seen, object_path))
+        return;
+
+    g_hash_table_add (seen, (gchar *) object_path);
+
+    batch = g_hash_table_lookup (batches, connection_path);
+
+    if (batch == NULL)
+    {
+        batch = g_slice_new0 (RecoveryBatch);
+        batch->account_path = account_path;
+        batch->connection_path = connection_path;
+        g_hash_table_insert (batches, (gchar *) connection_path, batch);
+    }
+
+    batch->channels = g_list_prepend (batch->channels, channel);
+}
+
 static void
 mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
                                          McdDispatcher *self)
@@ -587,6 +788,13 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
         _mcd_handler_map_get_handled_channels (self->priv->handler_map);
     const GList *observer_filters;
     const GList *list;
+    /* borrowed connection path => owned RecoveryBatch */
+    GHashTable *batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, recovery_batch_free);
+    /* borrowed channel paths */
+    GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    gpointer v;
 
     DEBUG ("called");
 
@@ -596,7 +804,7 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
     {
         TpChannel *channel = list->data;
         const gchar *object_path = tp_proxy_get_object_path (channel);
-        GVariant *properties;
+        McdMatchRecord *record;
         McdClientProxy *handler;
 
         /* FIXME: This is not exactly the right behaviour, see fd.o#40305 */
@@ -607,19 +815,17 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
             continue;
         }
 
-        properties = tp_channel_dup_immutable_properties (channel);
+        record = _mcd_match_record_for_tp_channel (channel);
 
-        if (_mcd_client_match_filters (properties, observer_filters,
-            FALSE))
+        if (record != NULL &&
+            _mcd_client_match_record (record, observer_filters, FALSE))
         {
             const gchar *account_path =
                 _mcd_handler_map_get_channel_account (self->priv->handler_map,
                     tp_proxy_get_object_path (channel));
 
-            _mcd_client_recover_observer (client, channel, account_path);
+            recovery_batches_add (batches, seen, account_path, channel);
         }
-
-        g_variant_unref (properties);
     }
 
     /* we also need to think about channels that are still being dispatched,
@@ -635,21 +841,41 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
 
             if (mcd_channel != NULL)
             {
-                GVariant *properties =
-                    mcd_channel_dup_immutable_properties (mcd_channel);
+                McdMatchRecord *record =
+                    _mcd_channel_get_match_record (mcd_channel);
 
-                if (_mcd_client_match_filters (properties, observer_filters,
+                if (record != NULL &&
+                    _mcd_client_match_record (record, observer_filters,
                         FALSE))
                 {
-                    _mcd_client_recover_observer (client,
-                        mcd_channel_get_tp_channel (mcd_channel),
-                        _mcd_dispatch_operation_get_account_path (op));
+                    recovery_batches_add (batches, seen,
+                        _mcd_dispatch_operation_get_account_path (op),
+                        mcd_channel_get_tp_channel (mcd_channel));
                 }
-
-                g_variant_unref (properties);
             }
         }
     }
+
+    /* one call per connection, rather than one per channel, so that
+     * restarting an Observer doesn't flood the bus */
+    g_hash_table_iter_init (&iter, batches);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        RecoveryBatch *batch = v;
+        GPtrArray *channel_details;
+
+        batch->channels = g_list_reverse (batch->channels);
+        channel_details = _mcd_tp_channel_details_build_from_tp_chans (
+            batch->channels);
+        _mcd_client_recover_observer (client, batch->account_path,
+                                      batch->connection_path,
+                                      channel_details);
+        _mcd_tp_channel_details_free (channel_details);
+    }
+
+    g_hash_table_unref (batches);
+    g_hash_table_unref (seen);
 }
 
 static void
@@ -681,21 +907,22 @@ mcd_dispatcher_client_registry_ready_cb (McdClientRegistry *clients,
 {
     GHashTableIter iter;
     gpointer p;
-    GPtrArray *vas;
+    McdCapabilitySnapshot *caps;
 
     DEBUG ("All initial clients have been inspected");
 
-    vas = _mcd_client_registry_dup_client_caps (clients);
+    caps = _mcd_client_registry_ref_capabilities (clients);
 
     g_hash_table_iter_init (&iter, self->priv->connections);
 
     while (g_hash_table_iter_next (&iter, &p, NULL))
     {
-        _mcd_connection_start_dispatching (p, vas);
+        _mcd_connection_start_dispatching (p, caps);
     }
 
-    g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
-    g_ptr_array_unref (vas);
+    _mcd_client_registry_forget_departed_handlers (clients,
+        _mcd_capability_snapshot_get_generation (caps));
+    _mcd_capability_snapshot_unref (caps);
 }
 
 static void
@@ -712,6 +939,7 @@ static void
 _mcd_dispatcher_dispose (GObject * object)
 {
     McdDispatcherPrivate *priv = MCD_DISPATCHER_PRIV (object);
+    guint i;
 
     if (priv->is_disposed)
     {
@@ -725,7 +953,29 @@ _mcd_dispatcher_dispose (GObject * object)
         tp_clear_pointer (&priv->operations, g_list_free);
     }
 
+    if (priv->dispatch_queue_source != 0)
+    {
+        g_source_remove (priv->dispatch_queue_source);
+        priv->dispatch_queue_source = 0;
+    }
+
+    for (i = 0; i < N_DISPATCH_PRIORITIES; i++)
+    {
+        QueuedChannel *qc;
+
+        while ((qc = g_queue_pop_head (&priv->dispatch_queues[i])) != NULL)
+            queued_channel_free (qc);
+    }
+
+    tp_clear_pointer (&priv->warm_channels, _mcd_lru_cache_free);
     tp_clear_object (&priv->handler_map);
+    tp_clear_pointer (&priv->timings, _mcd_dispatch_timings_unref);
+
+    if (priv->client_caps_source != 0)
+    {
+        g_source_remove (priv->client_caps_source);
+        priv->client_caps_source = 0;
+    }
 
     if (priv->clients != NULL)
     {
@@ -756,14 +1006,43 @@ _mcd_dispatcher_dispose (GObject * object)
     G_OBJECT_CLASS (mcd_dispatcher_parent_class)->dispose (object);
 }
 
-static void
-mcd_dispatcher_update_client_caps (McdDispatcher *self,
-                                   McdClientProxy *client)
+static gboolean
+mcd_dispatcher_push_client_caps_cb (gpointer data)
 {
-    GPtrArray *vas;
+    McdDispatcher *self = data;
+    McdCapabilitySnapshot *caps;
     GHashTableIter iter;
     gpointer k;
 
+    self->priv->client_caps_source = 0;
+
+    /* every connection gets the same snapshot, which includes all the
+     * changes since we were scheduled */
+    caps = _mcd_client_registry_ref_capabilities (self->priv->clients);
+
+    DEBUG ("pushing client caps generation %" G_GUINT64_FORMAT " to %u "
+           "connections", _mcd_capability_snapshot_get_generation (caps),
+           g_hash_table_size (self->priv->connections));
+
+    g_hash_table_iter_init (&iter, self->priv->connections);
+
+    while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+        _mcd_connection_update_client_caps (k, caps);
+    }
+
+    /* Only now has every connection seen the departures in this snapshot:
+     * a snapshot built for a single new connection doesn't count */
+    _mcd_client_registry_forget_departed_handlers (self->priv->clients,
+        _mcd_capability_snapshot_get_generation (caps));
+    _mcd_capability_snapshot_unref (caps);
+    return FALSE;
+}
+
+static void
+mcd_dispatcher_update_client_caps (McdDispatcher *self,
+                                   McdClientProxy *client)
+{
     /* If we haven't finished inspecting initial clients yet, we'll push all
      * the client caps into all connections when we do, so do nothing.
      *
@@ -775,18 +1054,29 @@ mcd_dispatcher_update_client_caps (McdDispatcher *self,
         return;
     }
 
-    vas = g_ptr_array_sized_new (1);
-    g_ptr_array_add (vas, _mcd_client_proxy_dup_handler_capabilities (client));
+    /* Several clients often change at once, for instance when they're
+     * all started at login, so wait a little while for the others rather
+     * than making every connection manager recalculate its capabilities
+     * for each one. */
+    if (self->priv->client_caps_source != 0)
+    {
+        DEBUG ("%s: client caps push already scheduled",
+               tp_proxy_get_bus_name (client));
+        return;
+    }
 
-    g_hash_table_iter_init (&iter, self->priv->connections);
+    DEBUG ("%s: pushing client caps in %ums", tp_proxy_get_bus_name (client),
+           self->priv->client_caps_delay);
 
-    while (g_hash_table_iter_next (&iter, &k, NULL))
+    if (self->priv->client_caps_delay == 0)
     {
-        _mcd_connection_update_client_caps (k, vas);
+        mcd_dispatcher_push_client_caps_cb (self);
+        return;
     }
 
-    g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
-    g_ptr_array_unref (vas);
+    self->priv->client_caps_source = g_timeout_add (
+        self->priv->client_caps_delay, mcd_dispatcher_push_client_caps_cb,
+        self);
 }
 
 static void
@@ -899,6 +1189,9 @@ static void
 mcd_dispatcher_init (McdDispatcher * dispatcher)
 {
     McdDispatcherPrivate *priv;
+    const gchar *delay;
+    const gchar *size;
+    guint warm_channels;
 
     priv = G_TYPE_INSTANCE_GET_PRIVATE (dispatcher, MCD_TYPE_DISPATCHER,
                                         McdDispatcherPrivate);
@@ -907,6 +1200,34 @@ mcd_dispatcher_init (McdDispatcher * dispatcher)
     priv->operation_list_active = FALSE;
 
     priv->connections = g_hash_table_new (NULL, NULL);
+    priv->timings = _mcd_dispatch_timings_new ();
+    priv->dispatch_budget = DISPATCH_BATCH_SIZE;
+
+    delay = g_getenv ("MC_CLIENT_CAPS_DELAY");
+
+    if (delay != NULL)
+        priv->client_caps_delay = strtoul (delay, NULL, 10);
+    else
+        priv->client_caps_delay = DEFAULT_CLIENT_CAPS_DELAY;
+
+    delay = g_getenv ("MC_HANDLER_DEADLINE");
+
+    if (delay != NULL)
+        priv->handler_deadline = strtoul (delay, NULL, 10);
+    else
+        priv->handler_deadline = DEFAULT_HANDLER_DEADLINE;
+
+    size = g_getenv ("MC_WARM_CHANNELS");
+
+    if (size != NULL)
+        warm_channels = strtoul (size, NULL, 10);
+    else
+        warm_channels = DEFAULT_WARM_CHANNELS;
+
+    if (warm_channels > 0)
+        priv->warm_channels = _mcd_lru_cache_new (warm_channels, g_str_hash,
+                                                  g_str_equal, g_free,
+                                                  warm_channel_free);
 
     /* idempotent, not guaranteed to have been called yet */
     _mcd_plugin_loader_init ();
@@ -923,44 +1244,126 @@ mcd_dispatcher_new (TpDBusDaemon *dbus_daemon, McdMaster *master)
     return obj;
 }
 
+static McdDispatchOperation *
+find_operation_from_channel (McdDispatcher *dispatcher,
+                             McdChannel *channel)
+{
+    GList *list;
+
+    g_return_val_if_fail (MCD_IS_CHANNEL (channel), NULL);
+    for (list = dispatcher->priv->operations; list != NULL; list = list->next)
+    {
+        McdDispatchOperation *op = list->data;
+
+        if (_mcd_dispatch_operation_has_channel (op, channel))
+            return op;
+    }
+    return NULL;
+}
+
+static void
+queued_channel_aborted_cb (McdChannel *channel,
+                           QueuedChannel *qc)
+{
+    McdDispatcherPrivate *priv = qc->dispatcher->priv;
+
+    DEBUG ("channel %p aborted while waiting to be dispatched", channel);
+    g_queue_remove (&priv->dispatch_queues[qc->priority], qc);
+    queued_channel_free (qc);
+}
+
+static DispatchPriority
+mcd_dispatcher_classify_channel (McdChannel *channel,
+                                 gboolean recovered)
+{
+    McdMission *parent = mcd_mission_get_parent ((McdMission *) channel);
+    TpChannel *tp_channel = mcd_channel_get_tp_channel (channel);
+    McdRequest *request = _mcd_channel_get_request (channel);
+
+    if (MCD_IS_CONNECTION (parent) && tp_channel != NULL)
+    {
+        McdConnection *connection = MCD_CONNECTION (parent);
+        TpHandle handle = tp_channel_get_handle (tp_channel, NULL);
+        const gchar *identifier = tp_channel_get_identifier (tp_channel);
+
+        if ((handle != 0 &&
+             _mcd_connection_target_handle_is_urgent (connection, handle)) ||
+            (!tp_str_empty (identifier) &&
+             _mcd_connection_target_id_is_urgent (connection, identifier)))
+            return DISPATCH_PRIORITY_EMERGENCY;
+    }
+
+    if (request != NULL &&
+        _mcd_request_get_user_action_time (request) !=
+            TP_USER_ACTION_TIME_NOT_USER_ACTION)
+        return DISPATCH_PRIORITY_USER_ACTION;
+
+    if (recovered)
+        return DISPATCH_PRIORITY_RECOVERED;
+
+    return DISPATCH_PRIORITY_INCOMING;
+}
+
+static void
+mcd_dispatcher_push_queued_channel (McdDispatcher *self,
+                                    QueuedChannel *qc)
+{
+    McdDispatcherPrivate *priv = self->priv;
+    GQueue *queue = &priv->dispatch_queues[qc->priority];
+
+    g_queue_push_tail (queue, qc);
+
+    if (queue->length > priv->dispatch_queue_peaks[qc->priority])
+        priv->dispatch_queue_peaks[qc->priority] = queue->length;
+
+    DEBUG ("channel %p queued as %s, behind %u", qc->channel,
+           dispatch_priority_names[qc->priority], queue->length - 1);
+}
+
+static QueuedChannel *
+mcd_dispatcher_find_queued_channel (McdDispatcher *self,
+                                    McdChannel *channel)
+{
+    guint i;
+
+    for (i = 0; i < N_DISPATCH_PRIORITIES; i++)
+    {
+        GList *list;
+
+        for (list = self->priv->dispatch_queues[i].head;
+             list != NULL;
+             list = list->next)
+        {
+            QueuedChannel *qc = list->data;
+
+            if (qc->channel == channel)
+                return qc;
+        }
+    }
+
+    return NULL;
+}
+
 /*
- * _mcd_dispatcher_add_channel:
+ * mcd_dispatcher_dispatch_channel:
  * @dispatcher: the #McdDispatcher.
- * @channel: (transfer none): a #McdChannel which must own a #TpChannel
+ * @channel: (transfer none): a #McdChannel which must own a #TpChannel,
+ *  and be in state %MCD_CHANNEL_STATUS_DISPATCHING
  * @requested: whether the channels were requested by MC.
  *
- * Add @channel to the dispatching state machine.
+ * Add @channel to the dispatching state machine, now that its turn has
+ * come.
  */
-void
-_mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
-                             McdChannel *channel,
-                             gboolean requested,
-                             gboolean only_observe)
+static void
+mcd_dispatcher_dispatch_channel (McdDispatcher *dispatcher,
+                                 McdChannel *channel,
+                                 gboolean requested)
 {
     TpChannel *tp_channel = NULL;
     GStrv possible_handlers;
     McdRequest *request = NULL;
     gboolean internal_request = FALSE;
 
-    g_return_if_fail (MCD_IS_DISPATCHER (dispatcher));
-    g_return_if_fail (MCD_IS_CHANNEL (channel));
-
-    DEBUG ("%s channel %p: %s",
-           requested ? "requested" : "unrequested",
-           channel,
-           mcd_channel_get_object_path (channel));
-
-    if (only_observe)
-    {
-        g_return_if_fail (requested);
-
-        /* these channels were requested "behind our back", so only call
-         * ObserveChannels on them */
-        _mcd_dispatcher_enter_state_machine (dispatcher, channel, NULL,
-                                             TRUE, TRUE);
-        return;
-    }
-
     /* The channel must have the TpChannel part of McdChannel's double life.
      * It might also have the McdRequest part. */
     tp_channel = mcd_channel_get_tp_channel (channel);
@@ -989,14 +1392,174 @@ _mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
                internal_request ? "internal" : "possible");
     }
 
-    _mcd_channel_set_status (channel, MCD_CHANNEL_STATUS_DISPATCHING);
-
     _mcd_dispatcher_enter_state_machine (dispatcher, channel,
         (const gchar * const *) possible_handlers, requested, FALSE);
 
     g_strfreev (possible_handlers);
 }
 
+static void
+mcd_dispatcher_dequeue_channel (McdDispatcher *self,
+                                QueuedChannel *qc)
+{
+    gchar *phase = g_strconcat (MCD_DISPATCH_PHASE_QUEUE_WAIT_PREFIX,
+                                dispatch_priority_names[qc->priority],
+                                NULL);
+
+    _mcd_dispatch_timings_record (self->priv->timings, phase,
+                                  g_get_monotonic_time () - qc->queued_time);
+    g_free (phase);
+
+    /* from here on, the CDO deals with the channel being aborted */
+    g_signal_handler_disconnect (qc->channel, qc->abort_id);
+    qc->abort_id = 0;
+
+    mcd_dispatcher_dispatch_channel (self, qc->channel, qc->requested);
+
+    if (qc->approved)
+    {
+        McdDispatchOperation *op = find_operation_from_channel (self,
+                                                                qc->channel);
+
+        if (op != NULL)
+        {
+            DEBUG ("channel %p is in CDO %p", qc->channel, op);
+            _mcd_dispatch_operation_approve (op, qc->preferred_handler);
+        }
+    }
+
+    queued_channel_free (qc);
+}
+
+static gboolean mcd_dispatcher_dispatch_queue_cb (gpointer data);
+
+/*
+ * Start dispatching channels from the queue, most urgent first, until it's
+ * empty or this main loop iteration's budget has run out.
+ */
+static void
+mcd_dispatcher_drain_dispatch_queue (McdDispatcher *self)
+{
+    McdDispatcherPrivate *priv = self->priv;
+
+    /* dispatching a channel can lead to another being queued, in which case
+     * the outer call will get round to it */
+    if (priv->draining_dispatch_queue)
+        return;
+
+    priv->draining_dispatch_queue = TRUE;
+
+    while (priv->dispatch_budget > 0)
+    {
+        QueuedChannel *qc = NULL;
+        guint i;
+
+        for (i = 0; i < N_DISPATCH_PRIORITIES && qc == NULL; i++)
+            qc = g_queue_pop_head (&priv->dispatch_queues[i]);
+
+        if (qc == NULL)
+            break;
+
+        priv->dispatch_budget--;
+        mcd_dispatcher_dequeue_channel (self, qc);
+    }
+
+    priv->draining_dispatch_queue = FALSE;
+
+    /* Give the budget back after the main loop has had a chance to deliver
+     * anything more urgent, and carry on from there. This is an idle so that
+     * D-Bus messages (and hence new channels) take precedence over the
+     * backlog. */
+    if (priv->dispatch_budget < DISPATCH_BATCH_SIZE &&
+        priv->dispatch_queue_source == 0)
+        priv->dispatch_queue_source = g_idle_add (
+            mcd_dispatcher_dispatch_queue_cb, self);
+}
+
+static gboolean
+mcd_dispatcher_dispatch_queue_cb (gpointer data)
+{
+    McdDispatcher *self = data;
+
+    self->priv->dispatch_queue_source = 0;
+    self->priv->dispatch_budget = DISPATCH_BATCH_SIZE;
+    mcd_dispatcher_drain_dispatch_queue (self);
+    return FALSE;
+}
+
+/*
+ * mcd_dispatcher_queue_channel:
+ * @dispatcher: the #McdDispatcher.
+ * @channel: (transfer none): a #McdChannel which must own a #TpChannel
+ * @requested: whether the channels were requested by MC.
+ * @recovered: whether the channel already existed when we started
+ *
+ * Put @channel in the queue for its priority class. It is dispatched
+ * immediately, unless too many channels have been dispatched already during
+ * this main loop iteration.
+ */
+static void
+mcd_dispatcher_queue_channel (McdDispatcher *dispatcher,
+                              McdChannel *channel,
+                              gboolean requested,
+                              gboolean recovered)
+{
+    QueuedChannel *qc = g_slice_new0 (QueuedChannel);
+
+    qc->dispatcher = dispatcher;
+    qc->channel = g_object_ref (channel);
+    qc->requested = requested;
+    qc->priority = mcd_dispatcher_classify_channel (channel, recovered);
+    qc->queued_time = g_get_monotonic_time ();
+
+    _mcd_channel_set_status (channel, MCD_CHANNEL_STATUS_DISPATCHING);
+
+    qc->abort_id = g_signal_connect (channel, "abort",
+                                     G_CALLBACK (queued_channel_aborted_cb),
+                                     qc);
+
+    mcd_dispatcher_push_queued_channel (dispatcher, qc);
+    mcd_dispatcher_drain_dispatch_queue (dispatcher);
+}
+
+/*
+ * _mcd_dispatcher_add_channel:
+ * @dispatcher: the #McdDispatcher.
+ * @channel: (transfer none): a #McdChannel which must own a #TpChannel
+ * @requested: whether the channels were requested by MC.
+ *
+ * Add @channel to the dispatching state machine, via the dispatch queue.
+ */
+void
+_mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
+                             McdChannel *channel,
+                             gboolean requested,
+                             gboolean only_observe)
+{
+    g_return_if_fail (MCD_IS_DISPATCHER (dispatcher));
+    g_return_if_fail (MCD_IS_CHANNEL (channel));
+
+    DEBUG ("%s channel %p: %s",
+           requested ? "requested" : "unrequested",
+           channel,
+           mcd_channel_get_object_path (channel));
+
+    if (only_observe)
+    {
+        g_return_if_fail (requested);
+
+        /* these channels were requested "behind our back", so only call
+         * ObserveChannels on them */
+        _mcd_dispatcher_enter_state_machine (dispatcher, channel, NULL,
+                                             TRUE, TRUE);
+        return;
+    }
+
+    g_return_if_fail (mcd_channel_get_tp_channel (channel) != NULL);
+
+    mcd_dispatcher_queue_channel (dispatcher, channel, requested, FALSE);
+}
+
 static void
 mcd_dispatcher_finish_reinvocation (McdChannel *request)
 {
@@ -1093,23 +1656,6 @@ finally:
     g_list_free (request_as_list);
 }
 
-static McdDispatchOperation *
-find_operation_from_channel (McdDispatcher *dispatcher,
-                             McdChannel *channel)
-{
-    GList *list;
-
-    g_return_val_if_fail (MCD_IS_CHANNEL (channel), NULL);
-    for (list = dispatcher->priv->operations; list != NULL; list = list->next)
-    {
-        McdDispatchOperation *op = list->data;
-
-        if (_mcd_dispatch_operation_has_channel (op, channel))
-            return op;
-    }
-    return NULL;
-}
-
 void
 _mcd_dispatcher_add_channel_request (McdDispatcher *dispatcher,
                                      McdChannel *channel, McdChannel *request)
@@ -1146,15 +1692,41 @@ _mcd_dispatcher_add_channel_request (McdDispatcher *dispatcher,
         }
         else if (status == MCD_CHANNEL_STATUS_DISPATCHING)
         {
-            McdDispatchOperation *op = find_operation_from_channel (dispatcher,
-                                                                    channel);
+            McdDispatchOperation *op;
+            QueuedChannel *qc = mcd_dispatcher_find_queued_channel (
+                dispatcher, channel);
             const gchar *preferred_handler =
               _mcd_channel_get_request_preferred_handler (request);
 
-            g_return_if_fail (op != NULL);
+            if (qc != NULL)
+            {
+                DEBUG ("channel %p is still queued", channel);
+
+                /* it will be approved when it gets a CDO */
+                qc->approved = TRUE;
+                g_free (qc->preferred_handler);
+                qc->preferred_handler = g_strdup (preferred_handler);
+
+                /* someone is waiting for it now, so it might deserve a
+                 * better place in the queue */
+                if (qc->priority > DISPATCH_PRIORITY_USER_ACTION &&
+                    _mcd_request_get_user_action_time (origin) !=
+                        TP_USER_ACTION_TIME_NOT_USER_ACTION)
+                {
+                    g_queue_remove (
+                        &dispatcher->priv->dispatch_queues[qc->priority], qc);
+                    qc->priority = DISPATCH_PRIORITY_USER_ACTION;
+                    mcd_dispatcher_push_queued_channel (dispatcher, qc);
+                }
+            }
+            else
+            {
+                op = find_operation_from_channel (dispatcher, channel);
+                g_return_if_fail (op != NULL);
 
-            DEBUG ("channel %p is in CDO %p", channel, op);
-            _mcd_dispatch_operation_approve (op, preferred_handler);
+                DEBUG ("channel %p is in CDO %p", channel, op);
+                _mcd_dispatch_operation_approve (op, preferred_handler);
+            }
         }
         DEBUG ("channel %p is proxying %p", request, channel);
     }
@@ -1203,7 +1775,7 @@ _mcd_dispatcher_recover_channel (McdDispatcher *dispatcher,
         DEBUG ("%s is unhandled, redispatching", path);
 
         requested = mcd_channel_is_requested (channel);
-        _mcd_dispatcher_add_channel (dispatcher, channel, requested, FALSE);
+        mcd_dispatcher_queue_channel (dispatcher, channel, requested, TRUE);
     }
 }
 
@@ -1237,6 +1809,76 @@ check_preferred_handler (const gchar *preferred_handler,
   return TRUE;
 }
 
+typedef struct
+{
+    const gchar *account_path;
+    const gchar *target_id;
+    TpHandle target_handle;
+} WarmChannelMatch;
+
+static gboolean
+warm_channel_matches_request (gpointer key G_GNUC_UNUSED,
+                              gpointer value,
+                              gpointer user_data)
+{
+    WarmChannel *warm = value;
+    WarmChannelMatch *match = user_data;
+    TpHandleType handle_type;
+    TpHandle handle;
+
+    if (!warm->owned || tp_strdiff (warm->account_path, match->account_path))
+        return FALSE;
+
+    if (match->target_id != NULL &&
+        (!tp_strdiff (warm->target_id, match->target_id) ||
+         !tp_strdiff (tp_channel_get_identifier (warm->channel),
+                      match->target_id)))
+        return TRUE;
+
+    handle = tp_channel_get_handle (warm->channel, &handle_type);
+
+    return (match->target_handle != 0 &&
+            handle_type == TP_HANDLE_TYPE_CONTACT &&
+            handle == match->target_handle);
+}
+
+/*
+ * If SendMessage is keeping a text channel for the target of @properties,
+ * and nobody else is handling it, close it: otherwise the request would
+ * be satisfied by a channel that we, rather than its requester, are
+ * handling. The channel will be closed before the request reaches the
+ * connection, because both go through the same D-Bus connection.
+ */
+static void
+mcd_dispatcher_forget_warm_channels (McdDispatcher *self,
+                                     const gchar *account_path,
+                                     GHashTable *properties)
+{
+    WarmChannelMatch match = { account_path, NULL, 0 };
+    guint n;
+
+    if (self->priv->warm_channels == NULL ||
+        tp_strdiff (tp_asv_get_string (properties,
+                                       TP_PROP_CHANNEL_CHANNEL_TYPE),
+                    TP_IFACE_CHANNEL_TYPE_TEXT))
+        return;
+
+    match.target_id = tp_asv_get_string (properties,
+                                         TP_PROP_CHANNEL_TARGET_ID);
+    match.target_handle = tp_asv_get_uint32 (properties,
+                                             TP_PROP_CHANNEL_TARGET_HANDLE,
+                                             NULL);
+
+    if (match.target_id == NULL && match.target_handle == 0)
+        return;
+
+    n = _mcd_lru_cache_foreach_remove (self->priv->warm_channels,
+                                       warm_channel_matches_request, &match);
+
+    if (n > 0)
+        DEBUG ("closed %u warm channel(s) to make way for a request", n);
+}
+
 static void
 dispatcher_request_channel (McdDispatcher *self,
                             const gchar *account_path,
@@ -1277,6 +1919,9 @@ dispatcher_request_channel (McdDispatcher *self,
     if (!check_preferred_handler (preferred_handler, &error))
         goto despair;
 
+    mcd_dispatcher_forget_warm_channels (self, account_path,
+                                         requested_properties);
+
     channel = _mcd_account_create_request (self->priv->clients,
                                            account, requested_properties,
                                            user_action_time, preferred_handler,
@@ -1497,8 +2142,8 @@ mcd_dispatcher_lost_connection (gpointer data,
 
 /* FIXME: this only needs to exist because McdConnection calls it in order
  * to preload caps before Connect */
-GPtrArray *
-_mcd_dispatcher_dup_client_caps (McdDispatcher *self)
+McdCapabilitySnapshot *
+_mcd_dispatcher_ref_client_caps (McdDispatcher *self)
 {
     g_return_val_if_fail (MCD_IS_DISPATCHER (self), NULL);
 
@@ -1508,7 +2153,7 @@ _mcd_dispatcher_dup_client_caps (McdDispatcher *self)
         return NULL;
     }
 
-    return _mcd_client_registry_dup_client_caps (self->priv->clients);
+    return _mcd_client_registry_ref_capabilities (self->priv->clients);
 }
 
 void
@@ -1526,13 +2171,11 @@ _mcd_dispatcher_add_connection (McdDispatcher *self,
 
     if (_mcd_client_registry_is_ready (self->priv->clients))
     {
-        GPtrArray *vas =
-            _mcd_client_registry_dup_client_caps (self->priv->clients);
-
-        _mcd_connection_start_dispatching (connection, vas);
+        McdCapabilitySnapshot *caps =
+            _mcd_client_registry_ref_capabilities (self->priv->clients);
 
-        g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
-        g_ptr_array_unref (vas);
+        _mcd_connection_start_dispatching (connection, caps);
+        _mcd_capability_snapshot_unref (caps);
     }
     /* else _mcd_connection_start_dispatching will be called when we're ready
      * for it */
@@ -1547,6 +2190,9 @@ typedef struct
     GPtrArray *payload;
     guint flags;
     guint tries;
+    /* TRUE once we have looked for a warm channel, which is only done
+     * once, and doesn't count as a try */
+    gboolean tried_warm;
     gboolean close_after;
     DBusGMethodInvocation *dbus_context;
 } MessageContext;
@@ -1634,6 +2280,207 @@ message_context_free (gpointer ctx)
     g_slice_free (MessageContext, context);
 }
 
+static gchar *
+warm_channel_key (const gchar *account_path,
+                  const gchar *target_id)
+{
+    return g_strdup_printf ("%s\n%s", account_path, target_id);
+}
+
+static void
+warm_channel_invalidated_cb (TpProxy *proxy,
+                             guint domain,
+                             gint code,
+                             gchar *message,
+                             gpointer data)
+{
+    WarmChannel *warm = data;
+
+    /* this also happens when the connection goes away */
+    DEBUG ("%s: %s", tp_proxy_get_object_path (proxy), message);
+
+    /* there's no need to close it, and telepathy-glib disconnects signal
+     * connections from invalidated proxies by itself */
+    warm->owned = FALSE;
+    warm->message_received = NULL;
+    _mcd_lru_cache_remove (warm->dispatcher->priv->warm_channels, warm->key);
+}
+
+static void
+warm_channel_message_received_cb (TpChannel *proxy,
+                                  const GPtrArray *message,
+                                  gpointer data,
+                                  GObject *weak G_GNUC_UNUSED)
+{
+    WarmChannel *warm = data;
+
+    /* Nobody else is handling the channel, so nobody would see the message.
+     * Closing it makes the connection manager respawn it with the message
+     * pending, and then it is dispatched like any other incoming channel. */
+    DEBUG ("%s received a message, closing it",
+           tp_proxy_get_object_path (proxy));
+    _mcd_lru_cache_remove (warm->dispatcher->priv->warm_channels, warm->key);
+}
+
+typedef struct
+{
+    McdDispatcher *dispatcher;
+    gchar *key;
+} WarmChannelCheck;
+
+static void
+warm_channel_check_free (gpointer p)
+{
+    WarmChannelCheck *check = p;
+
+    g_object_unref (check->dispatcher);
+    g_free (check->key);
+    g_slice_free (WarmChannelCheck, check);
+}
+
+static void
+warm_channel_got_pending_messages_cb (TpProxy *proxy,
+                                      const GValue *value,
+                                      const GError *error,
+                                      gpointer data,
+                                      GObject *weak G_GNUC_UNUSED)
+{
+    WarmChannelCheck *check = data;
+    McdLruCache *cache = check->dispatcher->priv->warm_channels;
+    WarmChannel *warm = NULL;
+    const GPtrArray *pending = NULL;
+
+    /* it might have been forgotten or replaced in the meantime */
+    if (cache == NULL ||
+        !_mcd_lru_cache_lookup (cache, check->key, (gpointer *) &warm) ||
+        warm->channel != (TpChannel *) proxy)
+        return;
+
+    if (error == NULL && G_VALUE_HOLDS (value,
+            TP_ARRAY_TYPE_MESSAGE_PART_LIST_LIST))
+        pending = g_value_get_boxed (value);
+
+    if (error != NULL)
+        DEBUG ("%s: %s", tp_proxy_get_object_path (proxy), error->message);
+
+    /* as in warm_channel_message_received_cb(), anything already waiting
+     * would never be seen unless the channel is closed and respawned */
+    if (pending == NULL || pending->len > 0)
+    {
+        DEBUG ("%s has pending messages, or we can't tell: closing it",
+               tp_proxy_get_object_path (proxy));
+        _mcd_lru_cache_remove (cache, check->key);
+    }
+}
+
+/*
+ * Keep @channel for the next message to the same target. If @owned, we
+ * are its handler, so it will be closed when it is forgotten, or as soon
+ * as it turns out to have pending messages.
+ *
+ * Returns: %TRUE if @channel was kept; if not, and @owned, the caller
+ *  should close it
+ */
+static gboolean
+mcd_dispatcher_keep_warm_channel (McdDispatcher *self,
+                                  const gchar *account_path,
+                                  const gchar *target_id,
+                                  TpChannel *channel,
+                                  gboolean owned)
+{
+    WarmChannel *warm = NULL;
+    GError *error = NULL;
+    gchar *key;
+
+    if (self->priv->warm_channels == NULL ||
+        tp_proxy_get_invalidated (channel) != NULL)
+        return FALSE;
+
+    key = warm_channel_key (account_path, target_id);
+
+    /* another message to the same target might have got there first */
+    if (_mcd_lru_cache_lookup (self->priv->warm_channels, key,
+                               (gpointer *) &warm) &&
+        warm->channel == channel && (warm->owned || !owned))
+    {
+        g_free (key);
+        return TRUE;
+    }
+
+    warm = g_slice_new0 (WarmChannel);
+    warm->dispatcher = self;
+    warm->key = g_strdup (key);
+    warm->account_path = g_strdup (account_path);
+    warm->target_id = g_strdup (target_id);
+    warm->channel = g_object_ref (channel);
+
+    if (owned)
+    {
+        warm->message_received =
+          tp_cli_channel_interface_messages_connect_to_message_received (
+              channel, warm_channel_message_received_cb, warm, NULL, NULL,
+              &error);
+
+        if (warm->message_received == NULL)
+        {
+            DEBUG ("not keeping %s: %s", tp_proxy_get_object_path (channel),
+                   error->message);
+            g_error_free (error);
+            warm_channel_free (warm);
+            g_free (key);
+            return FALSE;
+        }
+    }
+
+    warm->owned = owned;
+    warm->invalidated_id = g_signal_connect (channel, "invalidated",
+        G_CALLBACK (warm_channel_invalidated_cb), warm);
+
+    DEBUG ("keeping %s for %s", tp_proxy_get_object_path (channel), key);
+    /* this replaces and frees any entry for a different channel */
+    _mcd_lru_cache_insert (self->priv->warm_channels, g_strdup (key), warm);
+
+    /* Messages that arrived before we connected to MessageReceived are
+     * only visible as PendingMessages */
+    if (owned)
+    {
+        WarmChannelCheck *check = g_slice_new0 (WarmChannelCheck);
+
+        check->dispatcher = g_object_ref (self);
+        check->key = g_strdup (key);
+        tp_cli_dbus_properties_call_get (channel, -1,
+            TP_IFACE_CHANNEL_INTERFACE_MESSAGES, "PendingMessages",
+            warm_channel_got_pending_messages_cb, check,
+            warm_channel_check_free, NULL);
+    }
+
+    g_free (key);
+    return TRUE;
+}
+
+/* forget @channel if it is the one we were keeping for this target */
+static void
+mcd_dispatcher_forget_warm_channel (McdDispatcher *self,
+                                    const gchar *account_path,
+                                    const gchar *target_id,
+                                    TpChannel *channel)
+{
+    WarmChannel *warm = NULL;
+    gchar *key;
+
+    if (self->priv->warm_channels == NULL)
+        return;
+
+    key = warm_channel_key (account_path, target_id);
+
+    if (_mcd_lru_cache_lookup (self->priv->warm_channels, key,
+                               (gpointer *) &warm) &&
+        warm->channel == channel)
+        _mcd_lru_cache_remove (self->priv->warm_channels, key);
+
+    g_free (key);
+}
+
 static void
 send_message_submitted (TpChannel *proxy,
                         const gchar *token,
@@ -1652,6 +2499,14 @@ send_message_submitted (TpChannel *proxy,
     {
         mc_svc_channel_dispatcher_interface_messages_draft_return_from_send_message (context, token);
         message_context_set_return_context (message, NULL);
+
+        /* if we kept the channel for the next message, it will be closed
+         * when it's forgotten */
+        if (mcd_dispatcher_keep_warm_channel (message->dispatcher,
+                                              message->account_path,
+                                              message->target_id,
+                                              proxy, close_after))
+            close_after = FALSE;
     }
     else
     {
@@ -1669,6 +2524,158 @@ send_message_submitted (TpChannel *proxy,
 static void messages_send_message_start (DBusGMethodInvocation *context,
                                          MessageContext *message);
 
+static void
+send_message_warm_submitted (TpChannel *proxy,
+                             const gchar *token,
+                             const GError *error,
+                             gpointer data,
+                             GObject *weak G_GNUC_UNUSED)
+{
+    MessageContext *message = data;
+
+    if (error == NULL)
+    {
+        mc_svc_channel_dispatcher_interface_messages_draft_return_from_send_message (
+            message->dbus_context, token);
+        message_context_set_return_context (message, NULL);
+        message_context_free (message);
+        return;
+    }
+
+    DEBUG ("error: %s", error->message);
+
+    /* the connection manager rejected the message itself, so a new
+     * channel wouldn't help */
+    if (error->domain == TP_ERROR && tp_proxy_get_invalidated (proxy) == NULL)
+    {
+        message_context_return_error (message, error);
+        message_context_free (message);
+        return;
+    }
+
+    /* the channel went away under us: request a new one, as if it had
+     * never been there */
+    mcd_dispatcher_forget_warm_channel (message->dispatcher,
+                                        message->account_path,
+                                        message->target_id, proxy);
+    messages_send_message_start (message->dbus_context, message);
+}
+
+/*
+ * Returns: (transfer none): the channel we kept to the target of @message,
+ *  or %NULL if there isn't one we can use
+ */
+static WarmChannel *
+find_warm_channel (MessageContext *message)
+{
+    McdDispatcherPrivate *priv = message->dispatcher->priv;
+    WarmChannel *warm = NULL;
+    gchar *key;
+    gboolean found;
+
+    if (priv->warm_channels == NULL)
+        return NULL;
+
+    key = warm_channel_key (message->account_path, message->target_id);
+    found = _mcd_lru_cache_lookup (priv->warm_channels, key,
+                                   (gpointer *) &warm);
+    g_free (key);
+
+    /* we'd have been told if the channel or its connection was invalidated,
+     * but the signal might not have been delivered yet */
+    if (!found ||
+        tp_proxy_get_invalidated (warm->channel) != NULL ||
+        tp_proxy_get_invalidated (
+            tp_channel_borrow_connection (warm->channel)) != NULL)
+        return NULL;
+
+    return warm;
+}
+
+static void
+send_message_warm_ready_cb (McdRequest *request,
+                            gpointer data)
+{
+    MessageContext *message = data;
+    McdDispatcher *self = message->dispatcher;
+    GError *error = _mcd_request_dup_failure (request);
+    WarmChannel *warm;
+
+    g_signal_handlers_disconnect_by_func (request, send_message_warm_ready_cb,
+                                          data);
+
+    if (error != NULL)
+    {
+        DEBUG ("request policy said no: %s", error->message);
+        message_context_return_error (message, error);
+        message_context_free (message);
+        g_error_free (error);
+        return;
+    }
+
+    warm = find_warm_channel (message);
+
+    /* the channel might have gone away while we were waiting for the
+     * policy plugins; if so, request a new one */
+    if (warm == NULL)
+    {
+        _mcd_request_set_failure (request, TP_ERROR, TP_ERROR_CANCELLED,
+                                  "Kept channel went away");
+        messages_send_message_start (message->dbus_context, message);
+        return;
+    }
+
+    _mcd_dispatch_timings_count (self->priv->timings,
+                                 MCD_DISPATCH_COUNTER_SEND_MESSAGE_WARM);
+    _mcd_request_set_success (request, warm->channel);
+
+    DEBUG ("sending to %s", tp_proxy_get_object_path (warm->channel));
+    tp_cli_channel_interface_messages_call_send_message (warm->channel,
+        -1, message->payload, message->flags, send_message_warm_submitted,
+        message, NULL, NULL);
+}
+
+/*
+ * If we kept a channel to the target of @message, send it there, taking
+ * ownership of @message.
+ *
+ * Sending to a kept channel doesn't need a new channel, but it must still
+ * be allowed in the same way as requesting one would be, so we make a
+ * request for the channel we already have and let the request policy
+ * plugins, and any internal request already in flight on the account,
+ * delay or deny it; the message is only sent when the request proceeds.
+ *
+ * Returns: %TRUE if @message will be sent to a kept channel (or fail),
+ *  or %FALSE if we have to request a channel
+ */
+static gboolean
+send_message_to_warm_channel (MessageContext *message,
+                              McdAccount *account)
+{
+    McdRequest *request;
+    GHashTable *props;
+
+    if (find_warm_channel (message) == NULL)
+        return FALSE;
+
+    props = tp_asv_new (
+        TP_PROP_CHANNEL_CHANNEL_TYPE, G_TYPE_STRING,
+            TP_IFACE_CHANNEL_TYPE_TEXT,
+        TP_PROP_CHANNEL_TARGET_HANDLE_TYPE, G_TYPE_UINT,
+            TP_HANDLE_TYPE_CONTACT,
+        TP_PROP_CHANNEL_TARGET_ID, G_TYPE_STRING, message->target_id,
+        NULL);
+    request = _mcd_request_new (message->dispatcher->priv->clients, TRUE,
+                                account, props, time (NULL), NULL, NULL);
+    g_hash_table_unref (props);
+
+    g_signal_connect (request, "ready-to-request",
+                      G_CALLBACK (send_message_warm_ready_cb), message);
+    _mcd_request_proceed (request, NULL);
+    g_object_unref (request);
+    return TRUE;
+}
+
 static void
 send_message_got_channel (McdRequest *request,
                           McdChannel *channel,
@@ -1766,6 +2773,19 @@ messages_send_message_start (DBusGMethodInvocation *dbus_context,
         goto failure;
     }
 
+    /* only try once, in case the warm channel was what went wrong; that
+     * doesn't use up the retry in send_message_got_channel() */
+    if (!message->tried_warm)
+    {
+        message->tried_warm = TRUE;
+
+        if (send_message_to_warm_channel (message, account))
+            goto finished;
+    }
+
+    _mcd_dispatch_timings_count (self->priv->timings,
+                                 MCD_DISPATCH_COUNTER_SEND_MESSAGE_COLD);
+
     props = g_hash_table_new_full (g_str_hash, g_str_equal,
         NULL, (GDestroyNotify) g_value_unset);
 
@@ -1870,6 +2890,142 @@ messages_iface_init (gpointer iface, gpointer data G_GNUC_UNUSED)
 #undef IMPLEMENT
 }
 
+static void
+debug_add_histogram (const gchar *phase,
+                     const McdPhaseHistogram *histogram,
+                     gpointer user_data)
+{
+    GHashTable *histograms = user_data;
+    GArray *buckets = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+                                         MCD_DISPATCH_TIMINGS_N_BUCKETS);
+
+    g_array_append_vals (buckets, histogram->buckets,
+                         MCD_DISPATCH_TIMINGS_N_BUCKETS);
+
+    g_hash_table_insert (histograms, g_strdup (phase),
+        tp_value_array_build (4,
+            G_TYPE_UINT64, histogram->count,
+            G_TYPE_UINT64, histogram->total_usec,
+            G_TYPE_UINT64, histogram->max_usec,
+            DBUS_TYPE_G_UINT_ARRAY, buckets,
+            G_TYPE_INVALID));
+    g_array_unref (buckets);
+}
+
+static void
+debug_get_phase_histograms (McSvcChannelDispatcherInterfaceDebugDraft *iface,
+                            DBusGMethodInvocation *context)
+{
+    McdDispatcher *self = MCD_DISPATCHER (iface);
+    GArray *bounds = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+                                        MCD_DISPATCH_TIMINGS_N_BOUNDS);
+    GHashTable *histograms = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) g_value_array_free);
+
+    g_array_append_vals (bounds, _mcd_dispatch_timings_get_bucket_bounds (),
+                         MCD_DISPATCH_TIMINGS_N_BOUNDS);
+    _mcd_dispatch_timings_foreach (self->priv->timings, debug_add_histogram,
+                                   histograms);
+
+    mc_svc_channel_dispatcher_interface_debug_draft_return_from_get_phase_histograms (
+        context, bounds, histograms);
+
+    g_array_unref (bounds);
+    g_hash_table_unref (histograms);
+}
+
+static void
+debug_add_counter (const gchar *counter,
+                   guint64 value,
+                   gpointer user_data)
+{
+    GHashTable *counters = user_data;
+
+    g_hash_table_insert (counters, (gchar *) counter,
+                         tp_g_value_slice_new_uint64 (value));
+}
+
+static void
+debug_get_counters (McSvcChannelDispatcherInterfaceDebugDraft *iface,
+                    DBusGMethodInvocation *context)
+{
+    McdDispatcher *self = MCD_DISPATCHER (iface);
+    /* the keys are borrowed from the timings, or static */
+    GHashTable *counters = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, (GDestroyNotify) tp_g_value_slice_free);
+    guint64 hits, misses;
+
+    _mcd_dispatch_timings_foreach_counter (self->priv->timings,
+                                           debug_add_counter, counters);
+
+    _mcd_client_registry_get_prediction_stats (self->priv->clients, &hits,
+                                               &misses);
+
+    if (hits > 0)
+        debug_add_counter ("handler-prediction-hits", hits, counters);
+
+    if (misses > 0)
+        debug_add_counter ("handler-prediction-misses", misses, counters);
+
+    mc_svc_channel_dispatcher_interface_debug_draft_return_from_get_counters (
+        context, counters);
+    g_hash_table_unref (counters);
+}
+
+static void
+debug_get_dispatch_queues (McSvcChannelDispatcherInterfaceDebugDraft *iface,
+                           DBusGMethodInvocation *context)
+{
+    McdDispatcher *self = MCD_DISPATCHER (iface);
+    GHashTable *queues = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, (GDestroyNotify) g_value_array_free);
+    guint i;
+
+    for (i = 0; i < N_DISPATCH_PRIORITIES; i++)
+    {
+        g_hash_table_insert (queues, (gchar *) dispatch_priority_names[i],
+            tp_value_array_build (2,
+                G_TYPE_UINT, self->priv->dispatch_queues[i].length,
+                G_TYPE_UINT, self->priv->dispatch_queue_peaks[i],
+                G_TYPE_INVALID));
+    }
+
+    mc_svc_channel_dispatcher_interface_debug_draft_return_from_get_dispatch_queues (
+        context, queues);
+    g_hash_table_unref (queues);
+}
+
+static void
+debug_reset_phase_histograms (
+    McSvcChannelDispatcherInterfaceDebugDraft *iface,
+    DBusGMethodInvocation *context)
+{
+    McdDispatcher *self = MCD_DISPATCHER (iface);
+    guint i;
+
+    _mcd_dispatch_timings_reset (self->priv->timings);
+    _mcd_client_registry_reset_prediction_stats (self->priv->clients);
+
+    for (i = 0; i < N_DISPATCH_PRIORITIES; i++)
+        self->priv->dispatch_queue_peaks[i] =
+            self->priv->dispatch_queues[i].length;
+
+    mc_svc_channel_dispatcher_interface_debug_draft_return_from_reset_phase_histograms (
+        context);
+}
+
+static void
+debug_iface_init (gpointer iface, gpointer data G_GNUC_UNUSED)
+{
+#define IMPLEMENT(x) \
+  mc_svc_channel_dispatcher_interface_debug_draft_implement_##x (iface, debug_##x)
+    IMPLEMENT (get_phase_histograms);
+    IMPLEMENT (get_counters);
+    IMPLEMENT (get_dispatch_queues);
+    IMPLEMENT (reset_phase_histograms);
+#undef IMPLEMENT
+}
+
 typedef struct
 {
     McdDispatcher *self;
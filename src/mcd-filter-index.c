@@ -0,0 +1,385 @@
+/* Mission Control channel filter index - finds the channel filters that
+ * might match a channel without trying all of them
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Nearly every channel filter says which ChannelType, TargetHandleType
+ * and/or Requested it wants, and a channel can only match a filter if it
+ * has the same values for whichever of those the filter specifies. So we
+ * put each filter in a bucket identified by those three values, with a
+ * wildcard for any that the filter doesn't specify.
+ *
+ * To match a channel, we only need to look in the buckets where each of
+ * the three values is either the channel's own, or the wildcard: at most
+ * 2³ buckets. Each filter found there is then checked in full with
+ * _mcd_client_match_record(), so the index only has to avoid leaving
+ * out filters that could match; it's fine for a bucket to contain some
+ * that don't. In particular, a filter whose value for one of the three
+ * properties has an unexpected type goes in the wildcard bucket for that
+ * property.
+ */
+
+#include "config.h"
+#include "mcd-filter-index.h"
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-client-priv.h"
+
+enum {
+    KEY_CHANNEL_TYPE,
+    KEY_TARGET_HANDLE_TYPE,
+    KEY_REQUESTED,
+    N_KEYS
+};
+
+static const gchar * const key_properties[N_KEYS] = {
+    TP_PROP_CHANNEL_CHANNEL_TYPE,
+    TP_PROP_CHANNEL_TARGET_HANDLE_TYPE,
+    TP_PROP_CHANNEL_REQUESTED
+};
+
+struct _McdFilterIndex {
+    /* owned bucket name => owned GPtrArray of owned Entry */
+    GHashTable *buckets;
+};
+
+typedef struct {
+    /* borrowed; whatever the caller wants to get back from a match */
+    gpointer owner;
+    /* owned channel filter, see McdClientProxyPrivate */
+    GHashTable *filter;
+} Entry;
+
+static void
+entry_free (gpointer p)
+{
+  Entry *entry = p;
+
+  g_hash_table_unref (entry->filter);
+  g_slice_free (Entry, entry);
+}
+
+McdFilterIndex *
+_mcd_filter_index_new (void)
+{
+  McdFilterIndex *self = g_slice_new0 (McdFilterIndex);
+
+  self->buckets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_ptr_array_unref);
+  return self;
+}
+
+void
+_mcd_filter_index_free (McdFilterIndex *self)
+{
+  if (self == NULL)
+    return;
+
+  g_hash_table_unref (self->buckets);
+  g_slice_free (McdFilterIndex, self);
+}
+
+/* Returns the name of the bucket for @values, where NULL is the wildcard.
+ * Real values are prefixed with '=' so they can't be confused with it. */
+static gchar *
+bucket_name (gchar * const *values)
+{
+  GString *name = g_string_new ("");
+  guint i;
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      if (i > 0)
+        g_string_append_c (name, '\n');
+
+      if (values[i] != NULL)
+        {
+          g_string_append_c (name, '=');
+          g_string_append (name, values[i]);
+        }
+    }
+
+  return g_string_free (name, FALSE);
+}
+
+/* Returns the value @filter requires for the key property @i, in the same
+ * form as channel_key_value(), or NULL if it doesn't require one that we
+ * can index */
+static gchar *
+filter_key_value (GHashTable *filter,
+    guint i)
+{
+  const GValue *value = g_hash_table_lookup (filter, key_properties[i]);
+
+  if (value == NULL)
+    return NULL;
+
+  switch (i)
+    {
+      case KEY_CHANNEL_TYPE:
+        if (G_VALUE_HOLDS_STRING (value))
+          return g_value_dup_string (value);
+        break;
+
+      case KEY_TARGET_HANDLE_TYPE:
+        /* _mcd_client_match_property() compares integers by value, so a
+         * signed filter value can match an unsigned property */
+        if (G_VALUE_HOLDS_UINT64 (value))
+          return g_strdup_printf ("%" G_GUINT64_FORMAT,
+              g_value_get_uint64 (value));
+
+        if (G_VALUE_HOLDS_INT64 (value) && g_value_get_int64 (value) >= 0)
+          return g_strdup_printf ("%" G_GINT64_FORMAT,
+              g_value_get_int64 (value));
+        break;
+
+      case KEY_REQUESTED:
+        if (G_VALUE_HOLDS_BOOLEAN (value))
+          return g_strdup (g_value_get_boolean (value) ? "1" : "0");
+        break;
+
+      default:
+        g_assert_not_reached ();
+    }
+
+  return NULL;
+}
+
+static gchar *
+channel_key_value (McdMatchRecord *record,
+    gboolean assume_requested,
+    guint i)
+{
+  gboolean valid;
+  guint64 u;
+  gboolean b;
+
+  switch (i)
+    {
+      case KEY_CHANNEL_TYPE:
+        return g_strdup (_mcd_match_record_get_string (record,
+              key_properties[i]));
+
+      case KEY_TARGET_HANDLE_TYPE:
+        u = _mcd_match_record_get_uint64 (record, key_properties[i], &valid);
+
+        if (valid)
+          return g_strdup_printf ("%" G_GUINT64_FORMAT, u);
+        break;
+
+      case KEY_REQUESTED:
+        /* see _mcd_client_match_record() */
+        if (assume_requested)
+          return g_strdup ("1");
+
+        b = _mcd_match_record_get_boolean (record, key_properties[i],
+            &valid);
+
+        if (valid)
+          return g_strdup (b ? "1" : "0");
+        break;
+
+      default:
+        g_assert_not_reached ();
+    }
+
+  return NULL;
+}
+
+static void
+remove_owner (McdFilterIndex *self,
+    gpointer owner)
+{
+  GHashTableIter iter;
+  gpointer bucket_p;
+
+  g_hash_table_iter_init (&iter, self->buckets);
+
+  while (g_hash_table_iter_next (&iter, NULL, &bucket_p))
+    {
+      GPtrArray *bucket = bucket_p;
+      guint i;
+
+      for (i = bucket->len; i > 0; i--)
+        {
+          Entry *entry = g_ptr_array_index (bucket, i - 1);
+
+          if (entry->owner == owner)
+            g_ptr_array_remove_index_fast (bucket, i - 1);
+        }
+
+      if (bucket->len == 0)
+        g_hash_table_iter_remove (&iter);
+    }
+}
+
+/*
+ * _mcd_filter_index_set:
+ * @self: the index
+ * @owner: something to identify @filters, usually a #McdClientProxy
+ * @filters: (element-type GHashTable): channel filters, as returned by
+ *  _mcd_client_proxy_get_handler_filters() and so on, or %NULL
+ *
+ * Replace any filters previously added for @owner with @filters. The
+ * filters are reffed, not copied, so they must not be altered afterwards.
+ */
+void
+_mcd_filter_index_set (McdFilterIndex *self,
+    gpointer owner,
+    const GList *filters)
+{
+  const GList *iter;
+
+  g_return_if_fail (self != NULL);
+
+  remove_owner (self, owner);
+
+  for (iter = filters; iter != NULL; iter = iter->next)
+    {
+      Entry *entry = g_slice_new0 (Entry);
+      gchar *values[N_KEYS];
+      gchar *name;
+      GPtrArray *bucket;
+      guint i;
+
+      entry->owner = owner;
+      entry->filter = g_hash_table_ref (iter->data);
+
+      for (i = 0; i < N_KEYS; i++)
+        values[i] = filter_key_value (entry->filter, i);
+
+      name = bucket_name (values);
+      bucket = g_hash_table_lookup (self->buckets, name);
+
+      if (bucket == NULL)
+        {
+          bucket = g_ptr_array_new_with_free_func (entry_free);
+          g_hash_table_insert (self->buckets, name, bucket);
+        }
+      else
+        {
+          g_free (name);
+        }
+
+      g_ptr_array_add (bucket, entry);
+
+      for (i = 0; i < N_KEYS; i++)
+        g_free (values[i]);
+    }
+}
+
+static void
+match_bucket (GPtrArray *bucket,
+    McdMatchRecord *record,
+    gboolean assume_requested,
+    GHashTable *matches)
+{
+  guint i;
+
+  for (i = 0; i < bucket->len; i++)
+    {
+      Entry *entry = g_ptr_array_index (bucket, i);
+      guint best = GPOINTER_TO_UINT (g_hash_table_lookup (matches,
+            entry->owner));
+      GList single = { NULL, NULL, NULL };
+      guint quality;
+
+      /* as in _mcd_client_match_record(), don't bother checking a filter
+       * that couldn't beat what we already have for this owner */
+      if (g_hash_table_size (entry->filter) + 1 <= best)
+        continue;
+
+      single.data = entry->filter;
+      quality = _mcd_client_match_record (record, &single, assume_requested);
+
+      if (quality > best)
+        g_hash_table_insert (matches, entry->owner,
+            GUINT_TO_POINTER (quality));
+    }
+}
+
+/*
+ * _mcd_filter_index_match:
+ * @self: the index
+ * @record: a channel's immutable properties
+ * @assume_requested: as for _mcd_client_match_record()
+ *
+ * Returns: (transfer container): a map from each owner with a filter that
+ *  matches @record, to the quality of its best match, as returned by
+ *  _mcd_client_match_record(), converted with GUINT_TO_POINTER()
+ */
+GHashTable *
+_mcd_filter_index_match (McdFilterIndex *self,
+    McdMatchRecord *record,
+    gboolean assume_requested)
+{
+  GHashTable *matches = g_hash_table_new (NULL, NULL);
+  gchar *channel_values[N_KEYS];
+  guint combination;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, matches);
+  g_return_val_if_fail (record != NULL, matches);
+
+  for (i = 0; i < N_KEYS; i++)
+    channel_values[i] = channel_key_value (record, assume_requested, i);
+
+  /* bit i of the combination is set if we use the channel's value for key
+   * property i, and clear for the wildcard */
+  for (combination = 0; combination < (1 << N_KEYS); combination++)
+    {
+      gchar *values[N_KEYS];
+      gboolean possible = TRUE;
+      gchar *name;
+      GPtrArray *bucket;
+
+      for (i = 0; i < N_KEYS; i++)
+        {
+          if (combination & (1 << i))
+            {
+              /* a filter that requires a value for this property can't
+               * match a channel that doesn't have one */
+              if (channel_values[i] == NULL)
+                possible = FALSE;
+
+              values[i] = channel_values[i];
+            }
+          else
+            {
+              values[i] = NULL;
+            }
+        }
+
+      if (!possible)
+        continue;
+
+      name = bucket_name (values);
+      bucket = g_hash_table_lookup (self->buckets, name);
+      g_free (name);
+
+      if (bucket != NULL)
+        match_bucket (bucket, record, assume_requested, matches);
+    }
+
+  for (i = 0; i < N_KEYS; i++)
+    g_free (channel_values[i]);
+
+  return matches;
+}
@@ -0,0 +1,43 @@
+/* Mission Control channel filter index - finds the channel filters that
+ * might match a channel without trying all of them
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_FILTER_INDEX_H
+#define MCD_FILTER_INDEX_H
+
+#include <glib.h>
+
+#include "mcd-match-record.h"
+
+G_BEGIN_DECLS
+
+typedef struct _McdFilterIndex McdFilterIndex;
+
+G_GNUC_INTERNAL McdFilterIndex *_mcd_filter_index_new (void);
+G_GNUC_INTERNAL void _mcd_filter_index_free (McdFilterIndex *self);
+
+G_GNUC_INTERNAL void _mcd_filter_index_set (McdFilterIndex *self,
+    gpointer owner, const GList *filters);
+
+G_GNUC_INTERNAL GHashTable *_mcd_filter_index_match (McdFilterIndex *self,
+    McdMatchRecord *record, gboolean assume_requested);
+
+G_END_DECLS
+
+#endif /* MCD_FILTER_INDEX_H */
@@ -0,0 +1,288 @@
+/* Mission Control introspection scheduler - limits how many clients we
+ * ask about themselves at once, and how long we wait for each
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * When MC starts, every client on the bus and every activatable client
+ * needs introspecting, and the client registry isn't ready until they all
+ * are. A client with a .client file is introspected without waiting for
+ * anything, but one without has to be asked over D-Bus; if we ask all of
+ * them at once, they all compete with each other, and with the bus daemon
+ * activating them.
+ *
+ * So clients wait in a queue until one of a limited number of slots is
+ * free. Clients that are already running go first, since they're the ones
+ * that might already be handling channels; activatable clients wait until
+ * all of those have started. If a client doesn't become ready within the
+ * timeout, we stop waiting for it: it is treated as ready with whatever
+ * we know about it so far, and its slot goes to the next client. Any reply
+ * that turns up later still takes effect.
+ *
+ * The number of slots and the timeout (in milliseconds) can be set with
+ * MC_INTROSPECTION_CONCURRENCY and MC_INTROSPECTION_TIMEOUT.
+ */
+
+#include "config.h"
+#include "mcd-introspection-scheduler.h"
+
+#include <stdlib.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-client-priv.h"
+#include "mcd-debug.h"
+
+#define DEFAULT_CONCURRENCY 8
+#define DEFAULT_TIMEOUT 10000
+
+struct _McdIntrospectionScheduler {
+    gint refcount;
+    guint concurrency;
+    guint timeout;
+    /* borrowed McdClientProxy: running clients, then activatable clients,
+     * waiting for a slot. Clients hold a reference to us, and remove
+     * themselves when they're disposed, so we don't ref them. */
+    GQueue active_queue;
+    GQueue activatable_queue;
+    /* borrowed McdClientProxy => owned Job: clients being introspected */
+    GHashTable *running;
+    /* nonzero if we'll start more clients when the main loop is idle */
+    guint idle_id;
+};
+
+typedef struct {
+    McdIntrospectionScheduler *scheduler;
+    /* borrowed */
+    McdClientProxy *client;
+    guint timeout_id;
+    gulong ready_id;
+} Job;
+
+static void mcd_introspection_scheduler_start_soon (
+    McdIntrospectionScheduler *self);
+
+static void
+job_free (gpointer p)
+{
+  Job *job = p;
+
+  if (job->timeout_id != 0)
+    g_source_remove (job->timeout_id);
+
+  g_signal_handler_disconnect (job->client, job->ready_id);
+  g_slice_free (Job, job);
+}
+
+static guint
+getenv_uint (const gchar *name,
+    guint default_value)
+{
+  const gchar *value = g_getenv (name);
+
+  if (value != NULL)
+    return strtoul (value, NULL, 10);
+
+  return default_value;
+}
+
+McdIntrospectionScheduler *
+_mcd_introspection_scheduler_new (void)
+{
+  McdIntrospectionScheduler *self = g_slice_new0 (McdIntrospectionScheduler);
+
+  self->refcount = 1;
+  self->concurrency = getenv_uint ("MC_INTROSPECTION_CONCURRENCY",
+      DEFAULT_CONCURRENCY);
+  self->timeout = getenv_uint ("MC_INTROSPECTION_TIMEOUT", DEFAULT_TIMEOUT);
+
+  /* 0 would mean never starting anything */
+  if (self->concurrency == 0)
+    self->concurrency = 1;
+
+  g_queue_init (&self->active_queue);
+  g_queue_init (&self->activatable_queue);
+  self->running = g_hash_table_new_full (NULL, NULL, NULL, job_free);
+
+  DEBUG ("introspecting up to %u clients at a time, waiting up to %ums "
+      "for each", self->concurrency, self->timeout);
+  return self;
+}
+
+McdIntrospectionScheduler *
+_mcd_introspection_scheduler_ref (McdIntrospectionScheduler *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->refcount);
+  return self;
+}
+
+void
+_mcd_introspection_scheduler_unref (McdIntrospectionScheduler *self)
+{
+  if (self == NULL)
+    return;
+
+  if (!g_atomic_int_dec_and_test (&self->refcount))
+    return;
+
+  if (self->idle_id != 0)
+    g_source_remove (self->idle_id);
+
+  g_queue_clear (&self->active_queue);
+  g_queue_clear (&self->activatable_queue);
+  g_hash_table_unref (self->running);
+  g_slice_free (McdIntrospectionScheduler, self);
+}
+
+static void
+mcd_introspection_scheduler_ready_cb (McdClientProxy *client,
+    Job *job)
+{
+  McdIntrospectionScheduler *self = job->scheduler;
+
+  /* frees the job, and its slot */
+  g_hash_table_remove (self->running, client);
+  mcd_introspection_scheduler_start_soon (self);
+}
+
+static gboolean
+mcd_introspection_scheduler_timeout_cb (gpointer data)
+{
+  Job *job = data;
+
+  job->timeout_id = 0;
+
+  DEBUG ("%s: not ready after %ums, giving up on it",
+      tp_proxy_get_bus_name (job->client), job->scheduler->timeout);
+
+  /* this emits "ready", so the job is freed */
+  _mcd_client_proxy_give_up_introspection (job->client);
+  return FALSE;
+}
+
+static void
+mcd_introspection_scheduler_start (McdIntrospectionScheduler *self,
+    McdClientProxy *client)
+{
+  Job *job = g_slice_new0 (Job);
+
+  job->scheduler = self;
+  job->client = client;
+  job->ready_id = g_signal_connect (client, "ready",
+      G_CALLBACK (mcd_introspection_scheduler_ready_cb), job);
+
+  if (self->timeout > 0)
+    job->timeout_id = g_timeout_add (self->timeout,
+        mcd_introspection_scheduler_timeout_cb, job);
+
+  g_hash_table_insert (self->running, client, job);
+
+  /* if it has a .client file, this might finish straight away */
+  g_object_ref (client);
+  _mcd_client_proxy_start_introspection (client);
+  g_object_unref (client);
+}
+
+static gboolean
+mcd_introspection_scheduler_start_cb (gpointer data)
+{
+  McdIntrospectionScheduler *self = data;
+
+  self->idle_id = 0;
+
+  while (g_hash_table_size (self->running) < self->concurrency)
+    {
+      McdClientProxy *client = g_queue_pop_head (&self->active_queue);
+
+      if (client == NULL)
+        client = g_queue_pop_head (&self->activatable_queue);
+
+      if (client == NULL)
+        break;
+
+      /* nothing left to do, if it was already introspected before it
+       * was queued again */
+      if (_mcd_client_proxy_is_ready (client))
+        continue;
+
+      mcd_introspection_scheduler_start (self, client);
+    }
+
+  DEBUG ("%u clients being introspected, %u running and %u activatable "
+      "clients waiting", g_hash_table_size (self->running),
+      self->active_queue.length, self->activatable_queue.length);
+  return FALSE;
+}
+
+static void
+mcd_introspection_scheduler_start_soon (McdIntrospectionScheduler *self)
+{
+  if (self->idle_id == 0)
+    self->idle_id = g_idle_add_full (G_PRIORITY_HIGH,
+        mcd_introspection_scheduler_start_cb, self, NULL);
+}
+
+/*
+ * _mcd_introspection_scheduler_add:
+ * @self: the scheduler
+ * @client: a client that needs introspecting
+ *
+ * Introspect @client when a slot is free; it's OK to add the same client
+ * more than once.
+ */
+void
+_mcd_introspection_scheduler_add (McdIntrospectionScheduler *self,
+    McdClientProxy *client)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (MCD_IS_CLIENT_PROXY (client));
+
+  if (g_hash_table_contains (self->running, client) ||
+      g_queue_find (&self->active_queue, client) != NULL ||
+      g_queue_find (&self->activatable_queue, client) != NULL)
+    return;
+
+  if (_mcd_client_proxy_is_active (client))
+    g_queue_push_tail (&self->active_queue, client);
+  else
+    g_queue_push_tail (&self->activatable_queue, client);
+
+  mcd_introspection_scheduler_start_soon (self);
+}
+
+/*
+ * _mcd_introspection_scheduler_remove:
+ * @self: the scheduler
+ * @client: a client that is going away
+ *
+ * Forget about @client, whether it was waiting or being introspected.
+ */
+void
+_mcd_introspection_scheduler_remove (McdIntrospectionScheduler *self,
+    McdClientProxy *client)
+{
+  g_return_if_fail (self != NULL);
+
+  g_queue_remove (&self->active_queue, client);
+  g_queue_remove (&self->activatable_queue, client);
+
+  if (g_hash_table_remove (self->running, client))
+    mcd_introspection_scheduler_start_soon (self);
+}
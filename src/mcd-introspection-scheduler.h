@@ -0,0 +1,47 @@
+/* Mission Control introspection scheduler - limits how many clients we
+ * ask about themselves at once, and how long we wait for each
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_INTROSPECTION_SCHEDULER_H
+#define MCD_INTROSPECTION_SCHEDULER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _McdIntrospectionScheduler McdIntrospectionScheduler;
+
+/* defined in mcd-client-priv.h */
+struct _McdClientProxy;
+
+G_GNUC_INTERNAL McdIntrospectionScheduler *_mcd_introspection_scheduler_new (
+    void);
+G_GNUC_INTERNAL McdIntrospectionScheduler *_mcd_introspection_scheduler_ref (
+    McdIntrospectionScheduler *self);
+G_GNUC_INTERNAL void _mcd_introspection_scheduler_unref (
+    McdIntrospectionScheduler *self);
+
+G_GNUC_INTERNAL void _mcd_introspection_scheduler_add (
+    McdIntrospectionScheduler *self, struct _McdClientProxy *client);
+G_GNUC_INTERNAL void _mcd_introspection_scheduler_remove (
+    McdIntrospectionScheduler *self, struct _McdClientProxy *client);
+
+G_END_DECLS
+
+#endif /* MCD_INTROSPECTION_SCHEDULER_H */
@@ -0,0 +1,307 @@
+/* Mission Control keyfile journal - an append-only log of changes to a
+ * GKeyFile, so that small changes don't require rewriting all of it
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The journal is a text file with one record per line, fields separated
+ * by tabs:
+ *
+ *    S <group> <key> <value>     set @key to @value (already escaped)
+ *    D <group> <key>             remove @key
+ *    R <group>                   remove the whole of @group
+ *    C                           end of transaction
+ *
+ * Lines starting with '#' between transactions are ignored.
+ *
+ * Records only take effect when the C record that ends their transaction
+ * has been read. If we crash while appending, the tail of the file is a
+ * partial line or an incomplete transaction, which is ignored on replay.
+ *
+ * Replaying a journal onto a keyfile that already reflects some prefix of
+ * it gives the same result as replaying it onto the original, so it is
+ * safe to crash between writing a compacted base file and resetting the
+ * journal.
+ */
+
+#include "config.h"
+#include "mcd-keyfile-journal.h"
+
+#include <string.h>
+
+/* Don't bother compacting journals smaller than this */
+#define MIN_COMPACT_SIZE (64 * 1024)
+
+static gboolean
+is_valid_group (const gchar *group)
+{
+  const gchar *p;
+
+  if (group[0] == '\0')
+    return FALSE;
+
+  for (p = group; *p != '\0'; p++)
+    {
+      if (*p == '[' || *p == ']' || g_ascii_iscntrl (*p))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+is_valid_key (const gchar *key)
+{
+  gsize len = strlen (key);
+  const gchar *p;
+
+  if (len == 0 || key[0] == ' ' || key[len - 1] == ' ')
+    return FALSE;
+
+  for (p = key; *p != '\0'; p++)
+    {
+      if (*p == '=' || g_ascii_iscntrl (*p))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+is_valid_value (const gchar *value)
+{
+  return (strchr (value, '\n') == NULL && strchr (value, '\r') == NULL);
+}
+
+/*
+ * Record that @key in @group was set to @escaped_value.
+ *
+ * Returns: %TRUE on success, or %FALSE without changing @journal if the
+ *  record couldn't be replayed correctly (for instance because the value
+ *  contains a newline); the caller must then rewrite the keyfile in full
+ */
+gboolean
+mcd_keyfile_journal_append_set (GString *journal,
+    const gchar *group,
+    const gchar *key,
+    const gchar *escaped_value)
+{
+  if (!is_valid_group (group) || !is_valid_key (key) ||
+      !is_valid_value (escaped_value))
+    return FALSE;
+
+  g_string_append_printf (journal, "S\t%s\t%s\t%s\n", group, key,
+      escaped_value);
+  return TRUE;
+}
+
+/*
+ * Record the removal of @key from @group, or of the whole of @group if
+ * @key is %NULL.
+ *
+ * Returns: %TRUE on success, or %FALSE as for
+ *  mcd_keyfile_journal_append_set()
+ */
+gboolean
+mcd_keyfile_journal_append_remove (GString *journal,
+    const gchar *group,
+    const gchar *key)
+{
+  if (!is_valid_group (group) || (key != NULL && !is_valid_key (key)))
+    return FALSE;
+
+  if (key == NULL)
+    g_string_append_printf (journal, "R\t%s\n", group);
+  else
+    g_string_append_printf (journal, "D\t%s\t%s\n", group, key);
+
+  return TRUE;
+}
+
+void
+mcd_keyfile_journal_append_commit (GString *journal)
+{
+  g_string_append (journal, "C\n");
+}
+
+/* Returns the fields of the record in @line (which does not include the
+ * trailing newline), or %NULL if it isn't a well-formed record. */
+static gchar **
+parse_record (const gchar *line,
+    gsize len)
+{
+  gchar *copy;
+  gchar **fields;
+  guint n;
+  gboolean ok = FALSE;
+
+  /* this also rejects embedded NULs, which is what a torn write tends to
+   * leave behind on some filesystems */
+  if (len == 0 || !g_utf8_validate (line, len, NULL))
+    return NULL;
+
+  copy = g_strndup (line, len);
+  fields = g_strsplit (copy, "\t", 4);
+  g_free (copy);
+  n = g_strv_length (fields);
+
+  if (strlen (fields[0]) == 1)
+    {
+      switch (fields[0][0])
+        {
+          case 'S':
+            ok = (n == 4 && is_valid_group (fields[1]) &&
+                is_valid_key (fields[2]) && is_valid_value (fields[3]));
+            break;
+
+          case 'D':
+            ok = (n == 3 && is_valid_group (fields[1]) &&
+                is_valid_key (fields[2]));
+            break;
+
+          case 'R':
+            ok = (n == 2 && is_valid_group (fields[1]));
+            break;
+
+          case 'C':
+            ok = (n == 1);
+            break;
+        }
+    }
+
+  if (!ok)
+    {
+      g_strfreev (fields);
+      return NULL;
+    }
+
+  return fields;
+}
+
+static void
+apply_record (GKeyFile *keyfile,
+    gchar **fields)
+{
+  switch (fields[0][0])
+    {
+      case 'S':
+        g_key_file_set_value (keyfile, fields[1], fields[2], fields[3]);
+        break;
+
+      case 'D':
+        g_key_file_remove_key (keyfile, fields[1], fields[2], NULL);
+        break;
+
+      case 'R':
+        g_key_file_remove_group (keyfile, fields[1], NULL);
+        break;
+
+      default:
+        g_assert_not_reached ();
+    }
+}
+
+/*
+ * mcd_keyfile_journal_replay:
+ * @keyfile: the keyfile to apply changes to
+ * @data: the contents of a journal
+ * @len: the length of @data
+ * @n_transactions: (out) (allow-none): used to return the number of
+ *  transactions that were applied
+ *
+ * Apply every complete transaction at the beginning of @data to @keyfile.
+ * Reading stops at the first incomplete or malformed record.
+ *
+ * Returns: the length of the part of @data that was understood; if this
+ *  is less than @len, the rest must be discarded before anything else is
+ *  appended to the journal
+ */
+gsize
+mcd_keyfile_journal_replay (GKeyFile *keyfile,
+    const gchar *data,
+    gsize len,
+    guint *n_transactions)
+{
+  GPtrArray *pending = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_strfreev);
+  gsize valid = 0;
+  gsize pos = 0;
+  guint n = 0;
+
+  while (pos < len)
+    {
+      const gchar *line = data + pos;
+      const gchar *nl = memchr (line, '\n', len - pos);
+      gchar **fields;
+
+      /* a line without its newline was cut short */
+      if (nl == NULL)
+        break;
+
+      pos = (nl - data) + 1;
+
+      if (line[0] == '#' && pending->len == 0)
+        {
+          valid = pos;
+          continue;
+        }
+
+      fields = parse_record (line, nl - line);
+
+      if (fields == NULL)
+        break;
+
+      if (fields[0][0] == 'C')
+        {
+          guint i;
+
+          for (i = 0; i < pending->len; i++)
+            apply_record (keyfile, g_ptr_array_index (pending, i));
+
+          g_ptr_array_set_size (pending, 0);
+          g_strfreev (fields);
+          valid = pos;
+          n++;
+        }
+      else
+        {
+          g_ptr_array_add (pending, fields);
+        }
+    }
+
+  g_ptr_array_unref (pending);
+
+  if (n_transactions != NULL)
+    *n_transactions = n;
+
+  return valid;
+}
+
+/*
+ * Returns: %TRUE if a journal of length @journal_len should be folded
+ *  into a base file of length @base_len
+ */
+gboolean
+mcd_keyfile_journal_should_compact (gsize journal_len,
+    gsize base_len)
+{
+  /* Compacting costs a rewrite of the base file, so wait until the journal
+   * is at least that big: that way we never write more than about twice
+   * as much as the changes themselves. */
+  return (journal_len >= MAX (MIN_COMPACT_SIZE, base_len));
+}
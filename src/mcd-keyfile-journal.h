@@ -0,0 +1,50 @@
+/* Mission Control keyfile journal - an append-only log of changes to a
+ * GKeyFile, so that small changes don't require rewriting all of it
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_KEYFILE_JOURNAL_H
+#define MCD_KEYFILE_JOURNAL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* What an empty journal contains */
+#define MCD_KEYFILE_JOURNAL_HEADER "# Telepathy accounts journal\n"
+
+gboolean mcd_keyfile_journal_append_set (GString *journal,
+    const gchar *group,
+    const gchar *key,
+    const gchar *escaped_value);
+gboolean mcd_keyfile_journal_append_remove (GString *journal,
+    const gchar *group,
+    const gchar *key);
+void mcd_keyfile_journal_append_commit (GString *journal);
+
+gsize mcd_keyfile_journal_replay (GKeyFile *keyfile,
+    const gchar *data,
+    gsize len,
+    guint *n_transactions);
+
+gboolean mcd_keyfile_journal_should_compact (gsize journal_len,
+    gsize base_len);
+
+G_END_DECLS
+
+#endif /* MCD_KEYFILE_JOURNAL_H */
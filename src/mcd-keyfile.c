@@ -0,0 +1,1129 @@
+/* Mission Control keyfile value codec - conversion between GValue/GVariant
+ * and the textual value syntax used by GKeyFile
+ *
+ * Copyright © 2010 Nokia Corporation
+ * Copyright © 2010-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Historically, every value was converted by creating a throwaway
+ * GKeyFile, storing the value in it and reading it back. That is far too
+ * expensive for something we do for every attribute and parameter of
+ * every account, so this file implements the (small) subset of the
+ * GKeyFile value grammar we need directly: strings with backslash
+ * escapes, booleans, integers, doubles, and ';'-separated lists. The
+ * output is byte-for-byte what GKeyFile would have produced.
+ */
+
+#include "config.h"
+#include "mcd-keyfile.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-glib/telepathy-glib-dbus.h>
+
+#include "mcd-account.h"
+
+/* GKeyFile's default list separator, which we never change */
+#define LIST_SEPARATOR ';'
+
+/*
+ * Append @s to @buf, escaped as g_key_file_set_string() would escape it,
+ * or (if @in_list is %TRUE) as g_key_file_set_string_list() would escape
+ * one element of a list.
+ */
+static void
+escape_string_into (GString *buf,
+    const gchar *s,
+    gboolean in_list)
+{
+  gboolean leading_space = TRUE;
+  const gchar *p;
+
+  for (p = s; *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+          case ' ':
+            if (leading_space)
+              g_string_append (buf, "\\s");
+            else
+              g_string_append_c (buf, ' ');
+            break;
+
+          case '\t':
+            if (leading_space)
+              g_string_append (buf, "\\t");
+            else
+              g_string_append_c (buf, '\t');
+            break;
+
+          case '\n':
+            g_string_append (buf, "\\n");
+            break;
+
+          case '\r':
+            g_string_append (buf, "\\r");
+            break;
+
+          case '\\':
+            g_string_append (buf, "\\\\");
+            leading_space = FALSE;
+            break;
+
+          default:
+            if (in_list && *p == LIST_SEPARATOR)
+              {
+                g_string_append_c (buf, '\\');
+                g_string_append_c (buf, LIST_SEPARATOR);
+                /* GKeyFile does this too, so we have to */
+                leading_space = TRUE;
+              }
+            else
+              {
+                g_string_append_c (buf, *p);
+                leading_space = FALSE;
+              }
+            break;
+        }
+    }
+}
+
+/*
+ * Decode backslash escapes from @p into @buf, stopping at the end of
+ * the string or, if @in_list is %TRUE, at the first unescaped list
+ * separator. On success, *@end points to the character that stopped us.
+ */
+static gboolean
+unescape_string_into (GString *buf,
+    const gchar *p,
+    gboolean in_list,
+    const gchar **end,
+    GError **error)
+{
+  for (; *p != '\0'; p++)
+    {
+      if (in_list && *p == LIST_SEPARATOR)
+        break;
+
+      if (*p != '\\')
+        {
+          g_string_append_c (buf, *p);
+          continue;
+        }
+
+      p++;
+
+      switch (*p)
+        {
+          case 's':
+            g_string_append_c (buf, ' ');
+            break;
+
+          case 'n':
+            g_string_append_c (buf, '\n');
+            break;
+
+          case 't':
+            g_string_append_c (buf, '\t');
+            break;
+
+          case 'r':
+            g_string_append_c (buf, '\r');
+            break;
+
+          case '\\':
+            g_string_append_c (buf, '\\');
+            break;
+
+          case '\0':
+            g_set_error (error, G_KEY_FILE_ERROR,
+                G_KEY_FILE_ERROR_INVALID_VALUE,
+                "Key file contains escape character at end of line");
+            return FALSE;
+
+          default:
+            if (in_list && *p == LIST_SEPARATOR)
+              {
+                g_string_append_c (buf, LIST_SEPARATOR);
+              }
+            else
+              {
+                g_set_error (error, G_KEY_FILE_ERROR,
+                    G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Key file contains invalid escape sequence '\\%c'", *p);
+                return FALSE;
+              }
+            break;
+        }
+    }
+
+  *end = p;
+  return TRUE;
+}
+
+static gboolean
+check_utf8 (const gchar *escaped,
+    GError **error)
+{
+  if (g_utf8_validate (escaped, -1, NULL))
+    return TRUE;
+
+  g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_UNKNOWN_ENCODING,
+      "Key file contains a value which is not UTF-8");
+  return FALSE;
+}
+
+static gchar *
+unescape_string (const gchar *escaped,
+    GError **error)
+{
+  GString *buf;
+  const gchar *end;
+
+  if (!check_utf8 (escaped, error))
+    return NULL;
+
+  buf = g_string_sized_new (strlen (escaped));
+
+  if (!unescape_string_into (buf, escaped, FALSE, &end, error))
+    {
+      g_string_free (buf, TRUE);
+      return NULL;
+    }
+
+  return g_string_free (buf, FALSE);
+}
+
+/*
+ * Split @escaped into a list, the way g_key_file_get_string_list() does:
+ * every element terminated by a separator is kept, even if empty, but an
+ * unterminated trailing element is only kept if it is non-empty.
+ */
+static gchar **
+unescape_string_list (const gchar *escaped,
+    GError **error)
+{
+  GPtrArray *arr;
+  GString *buf;
+  const gchar *p = escaped;
+
+  if (!check_utf8 (escaped, error))
+    return NULL;
+
+  arr = g_ptr_array_new ();
+  buf = g_string_sized_new (strlen (escaped));
+
+  while (*p != '\0')
+    {
+      g_string_truncate (buf, 0);
+
+      if (!unescape_string_into (buf, p, TRUE, &p, error))
+        {
+          g_string_free (buf, TRUE);
+          g_ptr_array_add (arr, NULL);
+          g_strfreev ((gchar **) g_ptr_array_free (arr, FALSE));
+          return NULL;
+        }
+
+      if (*p == LIST_SEPARATOR)
+        {
+          g_ptr_array_add (arr, g_strndup (buf->str, buf->len));
+          p++;
+        }
+      else if (buf->len > 0)
+        {
+          g_ptr_array_add (arr, g_strndup (buf->str, buf->len));
+        }
+    }
+
+  g_string_free (buf, TRUE);
+  g_ptr_array_add (arr, NULL);
+  return (gchar **) g_ptr_array_free (arr, FALSE);
+}
+
+/* Like g_ascii_strtoll(), but with GKeyFile's rules about what surrounds
+ * the number, and with overflow detection. */
+static gboolean
+parse_signed (const gchar *text,
+    gint64 min,
+    gint64 max,
+    gint64 *out,
+    GError **error)
+{
+  gchar *end;
+  gint64 v;
+
+  errno = 0;
+  v = g_ascii_strtoll (text, &end, 10);
+
+  if (end == text || (*end != '\0' && !g_ascii_isspace (*end)))
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+          "Value '%s' cannot be interpreted as a number", text);
+      return FALSE;
+    }
+
+  if (errno == ERANGE || v < min || v > max)
+    {
+      g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+          "Integer value '%s' out of range", text);
+      return FALSE;
+    }
+
+  *out = v;
+  return TRUE;
+}
+
+static gboolean
+parse_unsigned (const gchar *text,
+    guint64 max,
+    guint64 *out,
+    GError **error)
+{
+  const gchar *p;
+  gchar *end;
+  guint64 v;
+
+  /* g_ascii_strtoull() silently accepts and negates "-1" */
+  for (p = text; g_ascii_isspace (*p); p++);
+
+  if (*p == '-')
+    {
+      g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+          "Integer value '%s' out of range", text);
+      return FALSE;
+    }
+
+  errno = 0;
+  v = g_ascii_strtoull (text, &end, 10);
+
+  if (end == text || (*end != '\0' && !g_ascii_isspace (*end)))
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+          "Value '%s' cannot be interpreted as a number", text);
+      return FALSE;
+    }
+
+  if (errno == ERANGE || v > max)
+    {
+      g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+          "Integer value '%s' out of range", text);
+      return FALSE;
+    }
+
+  *out = v;
+  return TRUE;
+}
+
+static gboolean
+parse_boolean (const gchar *text,
+    gboolean *out,
+    GError **error)
+{
+  gsize len = 0;
+  gsize i;
+
+  /* GKeyFile ignores trailing (but not leading) whitespace */
+  for (i = 0; text[i] != '\0'; i++)
+    {
+      if (!g_ascii_isspace (text[i]))
+        len = i + 1;
+    }
+
+  if ((len == 4 && strncmp (text, "true", 4) == 0) ||
+      (len == 1 && text[0] == '1'))
+    {
+      *out = TRUE;
+      return TRUE;
+    }
+
+  if ((len == 5 && strncmp (text, "false", 5) == 0) ||
+      (len == 1 && text[0] == '0'))
+    {
+      *out = FALSE;
+      return TRUE;
+    }
+
+  g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+      "Value '%s' cannot be interpreted as a boolean", text);
+  return FALSE;
+}
+
+static gboolean
+parse_double (const gchar *text,
+    gdouble *out,
+    GError **error)
+{
+  gchar *end;
+  gdouble v = g_ascii_strtod (text, &end);
+
+  if (end == text || *end != '\0')
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+          "Value '%s' cannot be interpreted as a float number", text);
+      return FALSE;
+    }
+
+  *out = v;
+  return TRUE;
+}
+
+static void
+append_double (GString *buf,
+    gdouble d)
+{
+  gchar tmp[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append (buf, g_ascii_dtostr (tmp, sizeof (tmp), d));
+}
+
+/*
+ * @escaped: a keyfile-escaped string
+ * @value: a #GValue initialized with a supported #GType
+ * @error: used to raise an error if %FALSE is returned
+ *
+ * Try to interpret @escaped as a value of the type of @value. If we can,
+ * write the resulting value into @value and return %TRUE.
+ *
+ * Returns: %TRUE if @escaped could be interpreted as a value of that type
+ */
+gboolean
+mcd_keyfile_unescape_value (const gchar *escaped,
+    GValue *value,
+    GError **error)
+{
+  GType type;
+  gint64 s;
+  guint64 u;
+
+  g_return_val_if_fail (escaped != NULL, FALSE);
+  g_return_val_if_fail (G_IS_VALUE (value), FALSE);
+
+  type = G_VALUE_TYPE (value);
+
+  switch (type)
+    {
+      case G_TYPE_STRING:
+          {
+            gchar *v_string = unescape_string (escaped, error);
+
+            if (v_string == NULL)
+              return FALSE;
+
+            g_value_take_string (value, v_string);
+            return TRUE;
+          }
+
+      case G_TYPE_INT:
+        if (!parse_signed (escaped, G_MININT32, G_MAXINT32, &s, error))
+          return FALSE;
+
+        g_value_set_int (value, s);
+        return TRUE;
+
+      case G_TYPE_INT64:
+        if (!parse_signed (escaped, G_MININT64, G_MAXINT64, &s, error))
+          return FALSE;
+
+        g_value_set_int64 (value, s);
+        return TRUE;
+
+      case G_TYPE_UINT:
+        if (!parse_unsigned (escaped, G_MAXUINT32, &u, error))
+          return FALSE;
+
+        g_value_set_uint (value, u);
+        return TRUE;
+
+      case G_TYPE_UCHAR:
+        if (!parse_unsigned (escaped, G_MAXUINT8, &u, error))
+          return FALSE;
+
+        g_value_set_uchar (value, u);
+        return TRUE;
+
+      case G_TYPE_UINT64:
+        if (!parse_unsigned (escaped, G_MAXUINT64, &u, error))
+          return FALSE;
+
+        g_value_set_uint64 (value, u);
+        return TRUE;
+
+      case G_TYPE_BOOLEAN:
+          {
+            gboolean v_bool;
+
+            if (!parse_boolean (escaped, &v_bool, error))
+              return FALSE;
+
+            g_value_set_boolean (value, v_bool);
+            return TRUE;
+          }
+
+      case G_TYPE_DOUBLE:
+          {
+            gdouble v_double;
+
+            if (!parse_double (escaped, &v_double, error))
+              return FALSE;
+
+            g_value_set_double (value, v_double);
+            return TRUE;
+          }
+
+      default:
+        break;
+    }
+
+  if (type == G_TYPE_STRV)
+    {
+      gchar **v = unescape_string_list (escaped, error);
+
+      if (v == NULL)
+        return FALSE;
+
+      g_value_take_boxed (value, v);
+      return TRUE;
+    }
+  else if (type == DBUS_TYPE_G_OBJECT_PATH)
+    {
+      gchar *v_string = unescape_string (escaped, error);
+
+      if (v_string == NULL)
+        return FALSE;
+
+      if (!tp_dbus_check_valid_object_path (v_string, NULL))
+        {
+          g_set_error (error, MCD_ACCOUNT_ERROR,
+              MCD_ACCOUNT_ERROR_GET_PARAMETER,
+              "Invalid object path %s", v_string);
+          g_free (v_string);
+          return FALSE;
+        }
+
+      g_value_take_boxed (value, v_string);
+      return TRUE;
+    }
+  else if (type == TP_ARRAY_TYPE_OBJECT_PATH_LIST)
+    {
+      gchar **v = unescape_string_list (escaped, error);
+      gchar **iter;
+      GPtrArray *arr;
+
+      if (v == NULL)
+        return FALSE;
+
+      for (iter = v; *iter != NULL; iter++)
+        {
+          if (!g_variant_is_object_path (*iter))
+            {
+              g_set_error (error, MCD_ACCOUNT_ERROR,
+                  MCD_ACCOUNT_ERROR_GET_PARAMETER,
+                  "Invalid object path %s stored in keyfile", *iter);
+              g_strfreev (v);
+              return FALSE;
+            }
+        }
+
+      arr = g_ptr_array_sized_new (g_strv_length (v));
+
+      /* transfer ownership from v to arr */
+      for (iter = v; *iter != NULL; iter++)
+        g_ptr_array_add (arr, *iter);
+
+      /* not g_strfreev - the strings' ownership has been transferred */
+      g_free (v);
+
+      g_value_take_boxed (value, arr);
+      return TRUE;
+    }
+  else if (type == TP_STRUCT_TYPE_SIMPLE_PRESENCE)
+    {
+      gchar **v = unescape_string_list (escaped, error);
+      gboolean ret = FALSE;
+
+      if (v == NULL)
+        return FALSE;
+
+      if (g_strv_length (v) != 3)
+        {
+          g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
+              "Invalid simple-presence structure stored in keyfile");
+        }
+      else if (!parse_unsigned (v[0], G_MAXUINT32, &u, NULL))
+        {
+          g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
+              "Invalid presence type stored in keyfile: %s", v[0]);
+        }
+      else
+        {
+          /* a syntactically valid simple presence */
+          g_value_take_boxed (value,
+              tp_value_array_build (3,
+                G_TYPE_UINT, (guint) u,
+                G_TYPE_STRING, v[1],
+                G_TYPE_STRING, v[2],
+                G_TYPE_INVALID));
+          ret = TRUE;
+        }
+
+      g_strfreev (v);
+      return ret;
+    }
+  else
+    {
+      gchar *message = g_strdup_printf ("cannot unescape value: "
+          "unknown type %s", g_type_name (type));
+
+      g_warning ("%s: %s", G_STRFUNC, message);
+      g_set_error (error, MCD_ACCOUNT_ERROR,
+          MCD_ACCOUNT_ERROR_GET_PARAMETER, "%s", message);
+      g_free (message);
+      return FALSE;
+    }
+}
+
+/*
+ * @value: a populated #GValue of a supported #GType
+ *
+ * Escape the contents of @value to go in a #GKeyFile. Return the
+ * value that would go in the keyfile, or %NULL if the type of @value
+ * is not supported.
+ *
+ * For instance, for a boolean value TRUE this would return "true",
+ * and for a string containing one space, it would return "\s".
+ */
+gchar *
+mcd_keyfile_escape_value (const GValue *value)
+{
+  GString *buf;
+
+  g_return_val_if_fail (G_IS_VALUE (value), NULL);
+
+  buf = g_string_new ("");
+
+  switch (G_VALUE_TYPE (value))
+    {
+      case G_TYPE_STRING:
+        escape_string_into (buf, g_value_get_string (value), FALSE);
+        break;
+
+      case G_TYPE_UINT:
+        g_string_append_printf (buf, "%u", g_value_get_uint (value));
+        break;
+
+      case G_TYPE_INT:
+        g_string_append_printf (buf, "%d", g_value_get_int (value));
+        break;
+
+      case G_TYPE_BOOLEAN:
+        g_string_append (buf, g_value_get_boolean (value) ? "true" : "false");
+        break;
+
+      case G_TYPE_UCHAR:
+        g_string_append_printf (buf, "%u", g_value_get_uchar (value));
+        break;
+
+      case G_TYPE_UINT64:
+        g_string_append_printf (buf, "%" G_GUINT64_FORMAT,
+            g_value_get_uint64 (value));
+        break;
+
+      case G_TYPE_INT64:
+        g_string_append_printf (buf, "%" G_GINT64_FORMAT,
+            g_value_get_int64 (value));
+        break;
+
+      case G_TYPE_DOUBLE:
+        append_double (buf, g_value_get_double (value));
+        break;
+
+      default:
+        if (G_VALUE_HOLDS (value, G_TYPE_STRV))
+          {
+            gchar **strings = g_value_get_boxed (value);
+
+            for (; strings != NULL && *strings != NULL; strings++)
+              {
+                escape_string_into (buf, *strings, TRUE);
+                g_string_append_c (buf, LIST_SEPARATOR);
+              }
+          }
+        else if (G_VALUE_HOLDS (value, DBUS_TYPE_G_OBJECT_PATH))
+          {
+            escape_string_into (buf, g_value_get_boxed (value), FALSE);
+          }
+        else if (G_VALUE_HOLDS (value, TP_ARRAY_TYPE_OBJECT_PATH_LIST))
+          {
+            GPtrArray *arr = g_value_get_boxed (value);
+            guint i;
+
+            for (i = 0; i < arr->len; i++)
+              {
+                escape_string_into (buf, g_ptr_array_index (arr, i), TRUE);
+                g_string_append_c (buf, LIST_SEPARATOR);
+              }
+          }
+        else if (G_VALUE_HOLDS (value, TP_STRUCT_TYPE_SIMPLE_PRESENCE))
+          {
+            guint type;
+            const gchar *status;
+            const gchar *message;
+
+            tp_value_array_unpack (g_value_get_boxed (value), 3,
+                &type, &status, &message);
+
+            g_string_append_printf (buf, "%u%c", type, LIST_SEPARATOR);
+            escape_string_into (buf, status, TRUE);
+            g_string_append_c (buf, LIST_SEPARATOR);
+            escape_string_into (buf, message, TRUE);
+            g_string_append_c (buf, LIST_SEPARATOR);
+          }
+        else
+          {
+            g_warning ("Unexpected param type %s",
+                G_VALUE_TYPE_NAME (value));
+            g_string_free (buf, TRUE);
+            return NULL;
+          }
+    }
+
+  return g_string_free (buf, FALSE);
+}
+
+/* Append a variant of basic type to @buf. Return %FALSE if unsupported. */
+static gboolean
+escape_basic_variant_into (GString *buf,
+    GVariant *variant,
+    gboolean in_list)
+{
+  switch (g_variant_classify (variant))
+    {
+      case G_VARIANT_CLASS_STRING:
+      case G_VARIANT_CLASS_OBJECT_PATH:
+      case G_VARIANT_CLASS_SIGNATURE:
+        escape_string_into (buf, g_variant_get_string (variant, NULL),
+            in_list);
+        return TRUE;
+
+      case G_VARIANT_CLASS_BOOLEAN:
+        g_string_append (buf, g_variant_get_boolean (variant) ?
+            "true" : "false");
+        return TRUE;
+
+      case G_VARIANT_CLASS_BYTE:
+        g_string_append_printf (buf, "%u", g_variant_get_byte (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_INT16:
+        g_string_append_printf (buf, "%d", g_variant_get_int16 (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_UINT16:
+        g_string_append_printf (buf, "%u", g_variant_get_uint16 (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_INT32:
+        g_string_append_printf (buf, "%d", g_variant_get_int32 (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_UINT32:
+        g_string_append_printf (buf, "%u", g_variant_get_uint32 (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_INT64:
+        g_string_append_printf (buf, "%" G_GINT64_FORMAT,
+            g_variant_get_int64 (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_UINT64:
+        g_string_append_printf (buf, "%" G_GUINT64_FORMAT,
+            g_variant_get_uint64 (variant));
+        return TRUE;
+
+      case G_VARIANT_CLASS_DOUBLE:
+        append_double (buf, g_variant_get_double (variant));
+        return TRUE;
+
+      default:
+        return FALSE;
+    }
+}
+
+/*
+ * @variant: a #GVariant of a supported type
+ *
+ * Escape the contents of @variant to go in a #GKeyFile, without going
+ * via a #GValue. Basic types, arrays of basic types and tuples of basic
+ * types (such as the (uss) of a simple presence) are supported.
+ *
+ * Returns: the value that would go in the keyfile, or %NULL if the type
+ *  is not supported
+ */
+gchar *
+mcd_keyfile_escape_variant (GVariant *variant)
+{
+  GString *buf;
+  gboolean ok = TRUE;
+
+  g_return_val_if_fail (variant != NULL, NULL);
+
+  buf = g_string_new ("");
+
+  if (g_variant_is_of_type (variant, G_VARIANT_TYPE_ARRAY) ||
+      g_variant_is_of_type (variant, G_VARIANT_TYPE_TUPLE))
+    {
+      GVariantIter iter;
+      GVariant *child;
+
+      g_variant_iter_init (&iter, variant);
+
+      while (ok && (child = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          ok = escape_basic_variant_into (buf, child, TRUE);
+          g_string_append_c (buf, LIST_SEPARATOR);
+          g_variant_unref (child);
+        }
+    }
+  else
+    {
+      ok = escape_basic_variant_into (buf, variant, FALSE);
+    }
+
+  if (!ok)
+    {
+      gchar *printed = g_variant_print (variant, TRUE);
+
+      g_warning ("Unable to translate variant %s", printed);
+      g_free (printed);
+      g_string_free (buf, TRUE);
+      return NULL;
+    }
+
+  return g_string_free (buf, FALSE);
+}
+
+static void
+set_unsupported_type_error (const GVariantType *type,
+    GError **error)
+{
+  gchar *printed = g_variant_type_dup_string (type);
+
+  g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+      "cannot unescape value: unsupported type %s", printed);
+  g_free (printed);
+}
+
+/*
+ * Interpret @text as a basic type. If @is_escaped is %FALSE, @text has
+ * already been unescaped (it's an element of a list). Returns a floating
+ * reference.
+ */
+static GVariant *
+unescape_basic_variant (const gchar *text,
+    gboolean is_escaped,
+    const GVariantType *type,
+    GError **error)
+{
+  gint64 s;
+  guint64 u;
+
+  switch (g_variant_type_peek_string (type)[0])
+    {
+      case 's':
+      case 'o':
+      case 'g':
+          {
+            gchar *v_string;
+            GVariant *ret = NULL;
+
+            if (is_escaped)
+              v_string = unescape_string (text, error);
+            else
+              v_string = g_strdup (text);
+
+            if (v_string == NULL)
+              return NULL;
+
+            if (g_variant_type_equal (type, G_VARIANT_TYPE_STRING))
+              return g_variant_new_take_string (v_string);
+
+            if (g_variant_type_equal (type, G_VARIANT_TYPE_OBJECT_PATH) &&
+                g_variant_is_object_path (v_string))
+              ret = g_variant_new_object_path (v_string);
+            else if (g_variant_type_equal (type, G_VARIANT_TYPE_SIGNATURE) &&
+                g_variant_is_signature (v_string))
+              ret = g_variant_new_signature (v_string);
+            else
+              g_set_error (error, MCD_ACCOUNT_ERROR,
+                  MCD_ACCOUNT_ERROR_GET_PARAMETER,
+                  "Invalid object path or signature %s stored in keyfile",
+                  v_string);
+
+            g_free (v_string);
+            return ret;
+          }
+
+      case 'b':
+          {
+            gboolean b;
+
+            if (!parse_boolean (text, &b, error))
+              return NULL;
+
+            return g_variant_new_boolean (b);
+          }
+
+      case 'y':
+        if (!parse_unsigned (text, G_MAXUINT8, &u, error))
+          return NULL;
+
+        return g_variant_new_byte (u);
+
+      case 'n':
+        if (!parse_signed (text, G_MININT16, G_MAXINT16, &s, error))
+          return NULL;
+
+        return g_variant_new_int16 (s);
+
+      case 'q':
+        if (!parse_unsigned (text, G_MAXUINT16, &u, error))
+          return NULL;
+
+        return g_variant_new_uint16 (u);
+
+      case 'i':
+        if (!parse_signed (text, G_MININT32, G_MAXINT32, &s, error))
+          return NULL;
+
+        return g_variant_new_int32 (s);
+
+      case 'u':
+        if (!parse_unsigned (text, G_MAXUINT32, &u, error))
+          return NULL;
+
+        return g_variant_new_uint32 (u);
+
+      case 'x':
+        if (!parse_signed (text, G_MININT64, G_MAXINT64, &s, error))
+          return NULL;
+
+        return g_variant_new_int64 (s);
+
+      case 't':
+        if (!parse_unsigned (text, G_MAXUINT64, &u, error))
+          return NULL;
+
+        return g_variant_new_uint64 (u);
+
+      case 'd':
+          {
+            gdouble d;
+
+            if (!parse_double (text, &d, error))
+              return NULL;
+
+            return g_variant_new_double (d);
+          }
+
+      default:
+        set_unsupported_type_error (type, error);
+        return NULL;
+    }
+}
+
+/*
+ * @escaped: a keyfile-escaped string
+ * @type: the desired type, which must be a basic type, an array of a basic
+ *  type or a tuple of basic types
+ * @error: used to raise an error if %NULL is returned
+ *
+ * Try to interpret @escaped as a value of type @type, without going
+ * via a #GValue.
+ *
+ * Returns: a floating reference to a #GVariant, or %NULL on error
+ */
+GVariant *
+mcd_keyfile_unescape_variant (const gchar *escaped,
+    const GVariantType *type,
+    GError **error)
+{
+  GVariantBuilder builder;
+  const GVariantType *member = NULL;
+  gchar **v;
+  gchar **iter;
+
+  g_return_val_if_fail (escaped != NULL, NULL);
+  g_return_val_if_fail (type != NULL, NULL);
+
+  if (g_variant_type_is_basic (type))
+    return unescape_basic_variant (escaped, TRUE, type, error);
+
+  if (g_variant_type_is_array (type))
+    {
+      if (!g_variant_type_is_basic (g_variant_type_element (type)))
+        goto unsupported;
+    }
+  else if (g_variant_type_is_tuple (type))
+    {
+      for (member = g_variant_type_first (type);
+          member != NULL;
+          member = g_variant_type_next (member))
+        {
+          if (!g_variant_type_is_basic (member))
+            goto unsupported;
+        }
+
+      member = g_variant_type_first (type);
+    }
+  else
+    {
+      goto unsupported;
+    }
+
+  v = unescape_string_list (escaped, error);
+
+  if (v == NULL)
+    return NULL;
+
+  if (g_variant_type_is_tuple (type) &&
+      g_strv_length (v) != g_variant_type_n_items (type))
+    {
+      g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+          "Invalid structure with %u members stored in keyfile",
+          g_strv_length (v));
+      g_strfreev (v);
+      return NULL;
+    }
+
+  g_variant_builder_init (&builder, type);
+
+  for (iter = v; *iter != NULL; iter++)
+    {
+      GVariant *child = unescape_basic_variant (*iter, FALSE,
+          member != NULL ? member : g_variant_type_element (type), error);
+
+      if (child == NULL)
+        {
+          g_variant_builder_clear (&builder);
+          g_strfreev (v);
+          return NULL;
+        }
+
+      g_variant_builder_add_value (&builder, child);
+
+      if (member != NULL)
+        member = g_variant_type_next (member);
+    }
+
+  g_strfreev (v);
+  return g_variant_builder_end (&builder);
+
+unsupported:
+  set_unsupported_type_error (type, error);
+  return NULL;
+}
+
+/*
+ * mcd_keyfile_get_value:
+ * @keyfile: A #GKeyFile
+ * @group: name of a group
+ * @key: name of a key
+ * @value: location to return the value, initialized to the right #GType
+ * @error: a place to store any #GError<!-- -->s that occur
+ */
+gboolean
+mcd_keyfile_get_value (GKeyFile *keyfile,
+    const gchar *group,
+    const gchar *key,
+    GValue *value,
+    GError **error)
+{
+  gchar *escaped;
+  gboolean ret;
+
+  g_return_val_if_fail (keyfile != NULL, FALSE);
+  g_return_val_if_fail (group != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (G_IS_VALUE (value), FALSE);
+
+  escaped = g_key_file_get_value (keyfile, group, key, error);
+
+  if (escaped == NULL)
+    return FALSE;
+
+  ret = mcd_keyfile_unescape_value (escaped, value, error);
+  g_free (escaped);
+  return ret;
+}
+
+/*
+ * mcd_keyfile_set_value:
+ * @keyfile: a keyfile
+ * @name: the name of a group
+ * @key: the key in the group
+ * @value: the value to be stored (or %NULL to erase it)
+ *
+ * Copies and stores the supplied @value (or removes it if %NULL) to the
+ * internal cache.
+ *
+ * Returns: a #gboolean indicating whether the cache actually required an
+ * update (so that the caller can decide whether to request a commit to
+ * long term storage or not). %TRUE indicates the cache was updated and
+ * may not be in sync with the store any longer, %FALSE indicates we already
+ * held the value supplied.
+ */
+gboolean
+mcd_keyfile_set_value (GKeyFile *keyfile,
+    const gchar *name,
+    const gchar *key,
+    const GValue *value)
+{
+  gchar *old;
+  gchar *new = NULL;
+  gboolean updated;
+
+  g_return_val_if_fail (name != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  old = g_key_file_get_value (keyfile, name, key, NULL);
+
+  if (value != NULL)
+    {
+      new = mcd_keyfile_escape_value (value);
+
+      if (new == NULL)
+        {
+          g_free (old);
+          return FALSE;
+        }
+    }
+
+  updated = tp_strdiff (old, new);
+
+  if (new == NULL)
+    g_key_file_remove_key (keyfile, name, key, NULL);
+  else if (updated)
+    g_key_file_set_value (keyfile, name, key, new);
+
+  g_free (new);
+  g_free (old);
+  return updated;
+}
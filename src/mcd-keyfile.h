@@ -0,0 +1,51 @@
+/* Mission Control keyfile value codec - conversion between GValue/GVariant
+ * and the textual value syntax used by GKeyFile
+ *
+ * Copyright © 2010 Nokia Corporation
+ * Copyright © 2010-2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_KEYFILE_H
+#define MCD_KEYFILE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+gboolean mcd_keyfile_get_value (GKeyFile *keyfile,
+    const gchar *group,
+    const gchar *key,
+    GValue *value,
+    GError **error);
+gboolean mcd_keyfile_set_value (GKeyFile *keyfile,
+    const gchar *name,
+    const gchar *key,
+    const GValue *value);
+
+gchar *mcd_keyfile_escape_value (const GValue *value);
+gboolean mcd_keyfile_unescape_value (const gchar *escaped,
+    GValue *value,
+    GError **error);
+
+gchar *mcd_keyfile_escape_variant (GVariant *variant);
+GVariant *mcd_keyfile_unescape_variant (const gchar *escaped,
+    const GVariantType *type,
+    GError **error);
+
+G_END_DECLS
+
+#endif /* MCD_KEYFILE_H */
@@ -0,0 +1,302 @@
+/* Mission Control LRU cache - a hash table with a size limit, which
+ * forgets whatever was used least recently
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The entries are kept in a GQueue, most recently used first, and the hash
+ * table maps each key to its link in the queue; so looking up, inserting,
+ * and evicting the least recently used entry are all O(1).
+ */
+
+#include "config.h"
+#include "mcd-lru-cache.h"
+
+typedef struct {
+    gpointer key;
+    gpointer value;
+} Entry;
+
+struct _McdLruCache {
+    guint max_size;
+    GDestroyNotify key_destroy_func;
+    GDestroyNotify value_destroy_func;
+    /* borrowed key (the one in the Entry) => borrowed link in @entries */
+    GHashTable *links;
+    /* owned Entry, most recently used first */
+    GQueue entries;
+
+    guint64 hits;
+    guint64 misses;
+    guint64 evictions;
+};
+
+/*
+ * _mcd_lru_cache_new:
+ * @max_size: the most entries to keep, which must be positive
+ * @hash_func: as for g_hash_table_new()
+ * @key_equal_func: as for g_hash_table_new()
+ * @key_destroy_func: (allow-none): called on each key when its entry is
+ *  replaced, removed or evicted
+ * @value_destroy_func: (allow-none): called on each value likewise
+ */
+McdLruCache *
+_mcd_lru_cache_new (guint max_size,
+    GHashFunc hash_func,
+    GEqualFunc key_equal_func,
+    GDestroyNotify key_destroy_func,
+    GDestroyNotify value_destroy_func)
+{
+  McdLruCache *self;
+
+  g_return_val_if_fail (max_size > 0, NULL);
+
+  self = g_slice_new0 (McdLruCache);
+  self->max_size = max_size;
+  self->key_destroy_func = key_destroy_func;
+  self->value_destroy_func = value_destroy_func;
+  self->links = g_hash_table_new (hash_func, key_equal_func);
+  g_queue_init (&self->entries);
+  return self;
+}
+
+static void
+entry_free (McdLruCache *self,
+    Entry *entry)
+{
+  if (self->key_destroy_func != NULL)
+    self->key_destroy_func (entry->key);
+
+  if (self->value_destroy_func != NULL)
+    self->value_destroy_func (entry->value);
+
+  g_slice_free (Entry, entry);
+}
+
+void
+_mcd_lru_cache_free (McdLruCache *self)
+{
+  if (self == NULL)
+    return;
+
+  _mcd_lru_cache_remove_all (self);
+  g_hash_table_unref (self->links);
+  g_slice_free (McdLruCache, self);
+}
+
+/*
+ * _mcd_lru_cache_lookup:
+ * @self: the cache
+ * @key: a key
+ * @value: (out) (allow-none) (transfer none): used to return the value,
+ *  which may be %NULL
+ *
+ * Look up @key, and if it's there, make it the most recently used entry.
+ *
+ * Returns: %TRUE if @key was found
+ */
+gboolean
+_mcd_lru_cache_lookup (McdLruCache *self,
+    gconstpointer key,
+    gpointer *value)
+{
+  GList *link;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  link = g_hash_table_lookup (self->links, key);
+
+  if (link == NULL)
+    {
+      self->misses++;
+      return FALSE;
+    }
+
+  self->hits++;
+
+  if (link != self->entries.head)
+    {
+      g_queue_unlink (&self->entries, link);
+      g_queue_push_head_link (&self->entries, link);
+    }
+
+  if (value != NULL)
+    *value = ((Entry *) link->data)->value;
+
+  return TRUE;
+}
+
+/*
+ * _mcd_lru_cache_insert:
+ * @self: the cache
+ * @key: (transfer full): a key
+ * @value: (transfer full) (allow-none): its value
+ *
+ * Add @key as the most recently used entry, replacing any existing entry
+ * with an equal key, and evicting the least recently used entry if the
+ * cache is full.
+ */
+void
+_mcd_lru_cache_insert (McdLruCache *self,
+    gpointer key,
+    gpointer value)
+{
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+
+  _mcd_lru_cache_remove (self, key);
+
+  if (self->entries.length >= self->max_size)
+    {
+      entry = g_queue_pop_tail (&self->entries);
+      g_hash_table_remove (self->links, entry->key);
+      entry_free (self, entry);
+      self->evictions++;
+    }
+
+  entry = g_slice_new (Entry);
+  entry->key = key;
+  entry->value = value;
+  g_queue_push_head (&self->entries, entry);
+  g_hash_table_insert (self->links, key, self->entries.head);
+}
+
+/*
+ * Returns: %TRUE if @key was in the cache
+ */
+gboolean
+_mcd_lru_cache_remove (McdLruCache *self,
+    gconstpointer key)
+{
+  GList *link;
+  Entry *entry;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  link = g_hash_table_lookup (self->links, key);
+
+  if (link == NULL)
+    return FALSE;
+
+  entry = link->data;
+  g_hash_table_remove (self->links, entry->key);
+  g_queue_delete_link (&self->entries, link);
+  entry_free (self, entry);
+  return TRUE;
+}
+
+/*
+ * _mcd_lru_cache_foreach_remove:
+ * @self: the cache
+ * @func: called with each key, its value and @user_data, and returns
+ *  %TRUE if the entry should be removed
+ * @user_data: passed to @func
+ *
+ * Like g_hash_table_foreach_remove(). @func must not modify the cache.
+ *
+ * Returns: how many entries were removed
+ */
+guint
+_mcd_lru_cache_foreach_remove (McdLruCache *self,
+    GHRFunc func,
+    gpointer user_data)
+{
+  GList *link, *next;
+  guint removed = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  for (link = self->entries.head; link != NULL; link = next)
+    {
+      Entry *entry = link->data;
+
+      next = link->next;
+
+      if (func (entry->key, entry->value, user_data))
+        {
+          g_hash_table_remove (self->links, entry->key);
+          g_queue_delete_link (&self->entries, link);
+          entry_free (self, entry);
+          removed++;
+        }
+    }
+
+  return removed;
+}
+
+void
+_mcd_lru_cache_remove_all (McdLruCache *self)
+{
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_remove_all (self->links);
+
+  while ((entry = g_queue_pop_head (&self->entries)) != NULL)
+    entry_free (self, entry);
+}
+
+guint
+_mcd_lru_cache_size (McdLruCache *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->entries.length;
+}
+
+/*
+ * _mcd_lru_cache_get_stats:
+ * @self: the cache
+ * @hits: (out) (allow-none): how many lookups found their key
+ * @misses: (out) (allow-none): how many lookups didn't
+ * @evictions: (out) (allow-none): how many entries were forgotten to make
+ *  room for others
+ *
+ * Counted since the cache was created, or since
+ * _mcd_lru_cache_reset_stats() was called.
+ */
+void
+_mcd_lru_cache_get_stats (McdLruCache *self,
+    guint64 *hits,
+    guint64 *misses,
+    guint64 *evictions)
+{
+  g_return_if_fail (self != NULL);
+
+  if (hits != NULL)
+    *hits = self->hits;
+
+  if (misses != NULL)
+    *misses = self->misses;
+
+  if (evictions != NULL)
+    *evictions = self->evictions;
+}
+
+void
+_mcd_lru_cache_reset_stats (McdLruCache *self)
+{
+  g_return_if_fail (self != NULL);
+
+  self->hits = 0;
+  self->misses = 0;
+  self->evictions = 0;
+}
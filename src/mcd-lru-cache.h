@@ -0,0 +1,52 @@
+/* Mission Control LRU cache - a hash table with a size limit, which
+ * forgets whatever was used least recently
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_LRU_CACHE_H
+#define MCD_LRU_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _McdLruCache McdLruCache;
+
+G_GNUC_INTERNAL McdLruCache *_mcd_lru_cache_new (guint max_size,
+    GHashFunc hash_func, GEqualFunc key_equal_func,
+    GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func);
+G_GNUC_INTERNAL void _mcd_lru_cache_free (McdLruCache *self);
+
+G_GNUC_INTERNAL gboolean _mcd_lru_cache_lookup (McdLruCache *self,
+    gconstpointer key, gpointer *value);
+G_GNUC_INTERNAL void _mcd_lru_cache_insert (McdLruCache *self,
+    gpointer key, gpointer value);
+G_GNUC_INTERNAL gboolean _mcd_lru_cache_remove (McdLruCache *self,
+    gconstpointer key);
+G_GNUC_INTERNAL guint _mcd_lru_cache_foreach_remove (McdLruCache *self,
+    GHRFunc func, gpointer user_data);
+G_GNUC_INTERNAL void _mcd_lru_cache_remove_all (McdLruCache *self);
+G_GNUC_INTERNAL guint _mcd_lru_cache_size (McdLruCache *self);
+
+G_GNUC_INTERNAL void _mcd_lru_cache_get_stats (McdLruCache *self,
+    guint64 *hits, guint64 *misses, guint64 *evictions);
+G_GNUC_INTERNAL void _mcd_lru_cache_reset_stats (McdLruCache *self);
+
+G_END_DECLS
+
+#endif /* MCD_LRU_CACHE_H */
@@ -172,6 +172,11 @@ _mcd_master_dispose (GObject * object)
     }
     priv->is_disposed = TRUE;
 
+    /* Other objects might keep the account manager alive after this, but
+     * we're shutting down, so write out any pending changes now */
+    if (priv->account_manager != NULL)
+        _mcd_account_manager_flush_conf (priv->account_manager);
+
     tp_clear_object (&priv->account_manager);
     tp_clear_object (&priv->dbus_daemon);
     tp_clear_object (&priv->dispatcher);
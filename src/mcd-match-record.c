@@ -0,0 +1,355 @@
+/* Mission Control match record - a channel's immutable properties,
+ * decoded once so that they can be matched against many channel filters
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Looking a property up in an a{sv} is a linear search by string
+ * comparison, and each tp_vardict_get_*() call then has to work out how to
+ * convert it. A channel is matched against the filters of every client
+ * while it's being dispatched, so we do that once: properties are looked
+ * up by quark, and each one already has its value in every form that a
+ * filter could ask for.
+ *
+ * The accessors behave exactly like the tp_vardict_get_*() function of
+ * the same name.
+ */
+
+#include "config.h"
+#include "mcd-match-record.h"
+
+struct _McdMatchRecord {
+    /* GQuark property name => owned MatchValue */
+    GHashTable *values;
+};
+
+typedef struct {
+    /* owned, with the outer 'v' removed */
+    GVariant *variant;
+    /* borrowed from @variant if it's a string or object path */
+    const gchar *string;
+    const gchar *object_path;
+    /* valid if @variant is a boolean */
+    gboolean boolean;
+    gboolean boolean_valid;
+    /* valid if @variant is an integer in range */
+    guint64 uint64;
+    gboolean uint64_valid;
+    gint64 int64;
+    gboolean int64_valid;
+} MatchValue;
+
+static void
+match_value_free (gpointer p)
+{
+  MatchValue *value = p;
+
+  g_variant_unref (value->variant);
+  g_slice_free (MatchValue, value);
+}
+
+static void
+match_value_set_signed (MatchValue *value,
+    gint64 i)
+{
+  value->int64 = i;
+  value->int64_valid = TRUE;
+
+  if (i >= 0)
+    {
+      value->uint64 = i;
+      value->uint64_valid = TRUE;
+    }
+}
+
+static void
+match_value_set_unsigned (MatchValue *value,
+    guint64 u)
+{
+  value->uint64 = u;
+  value->uint64_valid = TRUE;
+
+  if (u <= G_MAXINT64)
+    {
+      value->int64 = u;
+      value->int64_valid = TRUE;
+    }
+}
+
+static MatchValue *
+match_value_new (GVariant *variant)
+{
+  MatchValue *value = g_slice_new0 (MatchValue);
+
+  value->variant = g_variant_ref (variant);
+
+  switch (g_variant_classify (variant))
+    {
+      case G_VARIANT_CLASS_STRING:
+        value->string = g_variant_get_string (variant, NULL);
+        break;
+
+      case G_VARIANT_CLASS_OBJECT_PATH:
+        value->object_path = g_variant_get_string (variant, NULL);
+        break;
+
+      case G_VARIANT_CLASS_BOOLEAN:
+        value->boolean = g_variant_get_boolean (variant);
+        value->boolean_valid = TRUE;
+        break;
+
+      case G_VARIANT_CLASS_BYTE:
+        match_value_set_unsigned (value, g_variant_get_byte (variant));
+        break;
+
+      case G_VARIANT_CLASS_UINT16:
+        match_value_set_unsigned (value, g_variant_get_uint16 (variant));
+        break;
+
+      case G_VARIANT_CLASS_UINT32:
+        match_value_set_unsigned (value, g_variant_get_uint32 (variant));
+        break;
+
+      case G_VARIANT_CLASS_UINT64:
+        match_value_set_unsigned (value, g_variant_get_uint64 (variant));
+        break;
+
+      case G_VARIANT_CLASS_INT16:
+        match_value_set_signed (value, g_variant_get_int16 (variant));
+        break;
+
+      case G_VARIANT_CLASS_INT32:
+        match_value_set_signed (value, g_variant_get_int32 (variant));
+        break;
+
+      case G_VARIANT_CLASS_INT64:
+        match_value_set_signed (value, g_variant_get_int64 (variant));
+        break;
+
+      default:
+        /* filters can't match anything else */
+        break;
+    }
+
+  return value;
+}
+
+/*
+ * _mcd_match_record_new:
+ * @channel_properties: a %G_VARIANT_TYPE_VARDICT, usually a channel's
+ *  immutable properties
+ *
+ * Returns: (transfer full): a match record for @channel_properties, to be
+ *  freed with _mcd_match_record_free()
+ */
+McdMatchRecord *
+_mcd_match_record_new (GVariant *channel_properties)
+{
+  McdMatchRecord *self;
+  GVariantIter iter;
+  const gchar *property;
+  GVariant *variant;
+
+  g_return_val_if_fail (g_variant_is_of_type (channel_properties,
+        G_VARIANT_TYPE_VARDICT), NULL);
+
+  self = g_slice_new0 (McdMatchRecord);
+  self->values = g_hash_table_new_full (NULL, NULL, NULL, match_value_free);
+
+  g_variant_iter_init (&iter, channel_properties);
+
+  while (g_variant_iter_loop (&iter, "{&sv}", &property, &variant))
+    {
+      GQuark quark = g_quark_from_string (property);
+
+      /* like g_variant_lookup_value(), the first one wins if there are
+       * duplicates */
+      if (g_hash_table_lookup (self->values, GUINT_TO_POINTER (quark)) ==
+          NULL)
+        g_hash_table_insert (self->values, GUINT_TO_POINTER (quark),
+            match_value_new (variant));
+    }
+
+  return self;
+}
+
+void
+_mcd_match_record_free (McdMatchRecord *self)
+{
+  if (self == NULL)
+    return;
+
+  g_hash_table_unref (self->values);
+  g_slice_free (McdMatchRecord, self);
+}
+
+static GQuark
+match_record_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("mcd-match-record");
+
+  return quark;
+}
+
+/*
+ * _mcd_match_record_for_tp_channel:
+ * @channel: a channel
+ *
+ * Returns: (transfer none): a match record for @channel's immutable
+ *  properties, which lasts as long as @channel does, or %NULL if it has
+ *  no immutable properties
+ */
+McdMatchRecord *
+_mcd_match_record_for_tp_channel (TpChannel *channel)
+{
+  McdMatchRecord *self;
+  GVariant *properties;
+
+  g_return_val_if_fail (TP_IS_CHANNEL (channel), NULL);
+
+  self = g_object_get_qdata ((GObject *) channel, match_record_quark ());
+
+  if (self != NULL)
+    return self;
+
+  properties = tp_channel_dup_immutable_properties (channel);
+
+  if (properties == NULL)
+    return NULL;
+
+  self = _mcd_match_record_new (properties);
+  g_variant_unref (properties);
+  g_object_set_qdata_full ((GObject *) channel, match_record_quark (), self,
+      (GDestroyNotify) _mcd_match_record_free);
+  return self;
+}
+
+static MatchValue *
+match_record_lookup (McdMatchRecord *self,
+    const gchar *property)
+{
+  /* if nothing has ever interned @property, no channel has it */
+  GQuark quark = g_quark_try_string (property);
+
+  if (quark == 0)
+    return NULL;
+
+  return g_hash_table_lookup (self->values, GUINT_TO_POINTER (quark));
+}
+
+const gchar *
+_mcd_match_record_get_string (McdMatchRecord *self,
+    const gchar *property)
+{
+  MatchValue *value;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  value = match_record_lookup (self, property);
+  return (value == NULL ? NULL : value->string);
+}
+
+const gchar *
+_mcd_match_record_get_object_path (McdMatchRecord *self,
+    const gchar *property)
+{
+  MatchValue *value;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  value = match_record_lookup (self, property);
+  return (value == NULL ? NULL : value->object_path);
+}
+
+gboolean
+_mcd_match_record_get_boolean (McdMatchRecord *self,
+    const gchar *property,
+    gboolean *valid)
+{
+  MatchValue *value;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  value = match_record_lookup (self, property);
+
+  if (value == NULL || !value->boolean_valid)
+    {
+      if (valid != NULL)
+        *valid = FALSE;
+
+      return FALSE;
+    }
+
+  if (valid != NULL)
+    *valid = TRUE;
+
+  return value->boolean;
+}
+
+guint64
+_mcd_match_record_get_uint64 (McdMatchRecord *self,
+    const gchar *property,
+    gboolean *valid)
+{
+  MatchValue *value;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  value = match_record_lookup (self, property);
+
+  if (value == NULL || !value->uint64_valid)
+    {
+      if (valid != NULL)
+        *valid = FALSE;
+
+      return 0;
+    }
+
+  if (valid != NULL)
+    *valid = TRUE;
+
+  return value->uint64;
+}
+
+gint64
+_mcd_match_record_get_int64 (McdMatchRecord *self,
+    const gchar *property,
+    gboolean *valid)
+{
+  MatchValue *value;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  value = match_record_lookup (self, property);
+
+  if (value == NULL || !value->int64_valid)
+    {
+      if (valid != NULL)
+        *valid = FALSE;
+
+      return 0;
+    }
+
+  if (valid != NULL)
+    *valid = TRUE;
+
+  return value->int64;
+}
@@ -0,0 +1,52 @@
+/* Mission Control match record - a channel's immutable properties,
+ * decoded once so that they can be matched against many channel filters
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MCD_MATCH_RECORD_H
+#define MCD_MATCH_RECORD_H
+
+#include <glib.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _McdMatchRecord McdMatchRecord;
+
+G_GNUC_INTERNAL McdMatchRecord *_mcd_match_record_new (
+    GVariant *channel_properties);
+G_GNUC_INTERNAL void _mcd_match_record_free (McdMatchRecord *self);
+
+G_GNUC_INTERNAL McdMatchRecord *_mcd_match_record_for_tp_channel (
+    TpChannel *channel);
+
+G_GNUC_INTERNAL const gchar *_mcd_match_record_get_string (
+    McdMatchRecord *self, const gchar *property);
+G_GNUC_INTERNAL const gchar *_mcd_match_record_get_object_path (
+    McdMatchRecord *self, const gchar *property);
+G_GNUC_INTERNAL gboolean _mcd_match_record_get_boolean (
+    McdMatchRecord *self, const gchar *property, gboolean *valid);
+G_GNUC_INTERNAL guint64 _mcd_match_record_get_uint64 (
+    McdMatchRecord *self, const gchar *property, gboolean *valid);
+G_GNUC_INTERNAL gint64 _mcd_match_record_get_int64 (
+    McdMatchRecord *self, const gchar *property, gboolean *valid);
+
+G_END_DECLS
+
+#endif /* MCD_MATCH_RECORD_H */
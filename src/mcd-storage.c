@@ -26,11 +26,15 @@
 #include "mcd-account.h"
 #include "mcd-account-config.h"
 #include "mcd-debug.h"
+#include "mcd-keyfile.h"
 #include "mcd-misc.h"
 #include "plugin-loader.h"
 
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
 
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
@@ -49,6 +53,15 @@
 
 #define MAX_KEY_LENGTH (DBUS_MAXIMUM_NAME_LENGTH + 6)
 
+/* Bump the last component if the snapshot's contents change meaning; the
+ * snapshot is in native byte order, so that's part of the version too. */
+#define SNAPSHOT_VERSION \
+  PACKAGE_VERSION "/" G_STRINGIFY (G_BYTE_ORDER) "/1"
+/* (version, [(plugin, stamp)], {account: (attributes, parameters,
+ * escaped parameters, secrets)}) */
+#define SNAPSHOT_ACCOUNT_TYPE "(a{sv}a{sv}a{ss}as)"
+#define SNAPSHOT_TYPE "(sa(ss)a{s" SNAPSHOT_ACCOUNT_TYPE "})"
+
 static GList *stores = NULL;
 static void sort_and_cache_plugins (void);
 
@@ -67,10 +80,97 @@ G_DEFINE_TYPE_WITH_CODE (McdStorage, mcd_storage,
     G_TYPE_OBJECT,
     G_IMPLEMENT_INTERFACE (MCP_TYPE_ACCOUNT_MANAGER, plugin_iface_init))
 
+static struct {
+    const gchar *type;
+    const gchar *name;
+} known_attributes[] = {
+    /* Please keep this sorted by type, then by name. */
+
+    /* Structs */
+      { "(uss)", MC_ACCOUNTS_KEY_AUTOMATIC_PRESENCE },
+
+    /* Array of object path */
+      { "ao", MC_ACCOUNTS_KEY_SUPERSEDES },
+
+    /* Array of string */
+      { "as", MC_ACCOUNTS_KEY_URI_SCHEMES },
+
+    /* Booleans */
+      { "b", MC_ACCOUNTS_KEY_ALWAYS_DISPATCH },
+      { "b", MC_ACCOUNTS_KEY_CONNECT_AUTOMATICALLY },
+      { "b", MC_ACCOUNTS_KEY_ENABLED },
+      { "b", MC_ACCOUNTS_KEY_HAS_BEEN_ONLINE },
+      { "b", MC_ACCOUNTS_KEY_HIDDEN },
+
+    /* Strings */
+      { "s", MC_ACCOUNTS_KEY_AUTO_PRESENCE_MESSAGE },
+      { "s", MC_ACCOUNTS_KEY_AUTO_PRESENCE_STATUS },
+      { "s", MC_ACCOUNTS_KEY_AVATAR_MIME },
+      { "s", MC_ACCOUNTS_KEY_AVATAR_TOKEN },
+      { "s", MC_ACCOUNTS_KEY_DISPLAY_NAME },
+      { "s", MC_ACCOUNTS_KEY_ICON },
+      { "s", MC_ACCOUNTS_KEY_MANAGER },
+      { "s", MC_ACCOUNTS_KEY_NICKNAME },
+      { "s", MC_ACCOUNTS_KEY_NORMALIZED_NAME },
+      { "s", MC_ACCOUNTS_KEY_PROTOCOL },
+      { "s", MC_ACCOUNTS_KEY_SERVICE },
+
+    /* Integers */
+      { "u", MC_ACCOUNTS_KEY_AUTO_PRESENCE_TYPE },
+
+      { NULL, NULL }
+};
+
+/* Number of entries in known_attributes[], not counting the terminator */
+#define N_KNOWN_ATTRIBUTES (G_N_ELEMENTS (known_attributes) - 1)
+
+typedef struct {
+    /* owned GVariant, or NULL to delete the setting */
+    GVariant *variant;
+    /* owned, the same as @variant but escaped as if for a keyfile */
+    gchar *escaped;
+    gboolean secret;
+} McdStorageChange;
+
+static void
+mcd_storage_change_free (gpointer p)
+{
+  McdStorageChange *change = p;
+
+  tp_clear_pointer (&change->variant, g_variant_unref);
+  g_free (change->escaped);
+  g_slice_free (McdStorageChange, change);
+}
+
+typedef struct {
+    /* number of mcd_storage_begin() calls not yet matched by
+     * mcd_storage_end() */
+    guint depth;
+    /* owned strings, the keys of @changes in the order they were first
+     * changed */
+    GPtrArray *keys;
+    /* borrowed string from @keys => owned McdStorageChange */
+    GHashTable *changes;
+} McdStorageBatch;
+
+static void
+mcd_storage_batch_free (McdStorageBatch *batch)
+{
+  g_hash_table_unref (batch->changes);
+  g_ptr_array_unref (batch->keys);
+  g_slice_free (McdStorageBatch, batch);
+}
+
 typedef struct {
-    /* owned string => GVariant
-     * e.g. { 'DisplayName': <'Frederick Bloggs'> } */
-    GHashTable *attributes;
+    /* owned GVariant for each entry in known_attributes[], or NULL
+     * e.g. [index of DisplayName] = <'Frederick Bloggs'> */
+    GVariant *known_attributes[N_KNOWN_ATTRIBUTES];
+    /* number of non-NULL entries in @known_attributes */
+    guint n_known_attributes;
+    /* owned string => owned GVariant for attributes not in
+     * known_attributes[], or NULL if there are none yet
+     * e.g. { 'condition-ip': <'192.0.2.1'> } */
+    GHashTable *other_attributes;
     /* owned string => owned GVariant
      * e.g. { 'account': <'fred@example.com'>, 'password': <'foo'> } */
     GHashTable *parameters;
@@ -81,14 +181,25 @@ typedef struct {
     /* set of owned strings
      * e.g. { 'password': 'password' } */
     GHashTable *secrets;
+    /* borrowed (plugins are never unloaded): the plugin that stores this
+     * account, or NULL if we don't know yet */
+    McpAccountStorage *owner;
+    /* owned, changes not yet passed to plugins because we're between
+     * mcd_storage_begin() and mcd_storage_end(), or NULL */
+    McdStorageBatch *batch;
 } McdStorageAccount;
 
 static void
 mcd_storage_account_free (gpointer p)
 {
   McdStorageAccount *sa = p;
+  guint i;
 
-  g_hash_table_unref (sa->attributes);
+  for (i = 0; i < N_KNOWN_ATTRIBUTES; i++)
+    tp_clear_pointer (&sa->known_attributes[i], g_variant_unref);
+
+  tp_clear_pointer (&sa->other_attributes, g_hash_table_unref);
+  tp_clear_pointer (&sa->batch, mcd_storage_batch_free);
   g_hash_table_unref (sa->parameters);
   g_hash_table_unref (sa->escaped_parameters);
   g_hash_table_unref (sa->secrets);
@@ -100,6 +211,8 @@ mcd_storage_init (McdStorage *self)
 {
   self->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, mcd_storage_account_free);
+  self->commits = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
 }
 
 static void
@@ -111,11 +224,17 @@ storage_finalize (GObject *object)
 
   g_hash_table_unref (self->accounts);
   self->accounts = NULL;
+  /* every queued commit holds a ref to us, so there can't be any left */
+  g_warn_if_fail (g_hash_table_size (self->commits) == 0);
+  tp_clear_pointer (&self->commits, g_hash_table_unref);
 
   if (finalize != NULL)
     finalize (object);
 }
 
+static GVariant *storage_dup_stamps (void);
+static void storage_save_snapshot (McdStorage *self, GVariant *stamps);
+
 static void
 storage_dispose (GObject *object)
 {
@@ -123,6 +242,24 @@ storage_dispose (GObject *object)
   GObjectFinalizeFunc dispose =
     G_OBJECT_CLASS (mcd_storage_parent_class)->dispose;
 
+  /* If the accounts have changed since the snapshot was taken, take
+   * another, so that the next startup can use it; but not if some plugin
+   * failed to commit, because then the snapshot might describe accounts
+   * that aren't really in long term storage */
+  if (self->snapshot_stamps != NULL)
+    {
+      GVariant *stamps = storage_dup_stamps ();
+
+      if (self->commit_failed)
+        DEBUG ("not saving snapshot: a commit failed since loading");
+      else if (stamps != NULL &&
+          !g_variant_equal (stamps, self->snapshot_stamps))
+        storage_save_snapshot (self, stamps);
+
+      tp_clear_pointer (&stamps, g_variant_unref);
+      tp_clear_pointer (&self->snapshot_stamps, g_variant_unref);
+    }
+
   tp_clear_object (&self->dbusd);
 
   if (dispose != NULL)
@@ -191,31 +328,6 @@ mcd_storage_new (TpDBusDaemon *dbus_daemon)
       NULL);
 }
 
-static gchar *
-mcd_keyfile_escape_variant (GVariant *variant)
-{
-  GValue value = G_VALUE_INIT;
-  gchar *ret;
-
-  dbus_g_value_parse_g_variant (variant, &value);
-
-  if (G_IS_VALUE (&value))
-    {
-      ret = mcd_keyfile_escape_value (&value);
-      g_value_unset (&value);
-    }
-  else
-    {
-      gchar *printed = g_variant_print (variant, TRUE);
-
-      ret = NULL;
-      g_warning ("Unable to translate variant %s", printed);
-      g_free (printed);
-    }
-
-  return ret;
-}
-
 static McdStorageAccount *
 lookup_account (McdStorage *self,
     const gchar *account)
@@ -231,9 +343,7 @@ ensure_account (McdStorage *self,
 
   if (sa == NULL)
     {
-      sa = g_slice_new (McdStorageAccount);
-      sa->attributes = g_hash_table_new_full (g_str_hash, g_str_equal,
-          g_free, (GDestroyNotify) g_variant_unref);
+      sa = g_slice_new0 (McdStorageAccount);
       sa->parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
           g_free, (GDestroyNotify) g_variant_unref);
       sa->escaped_parameters = g_hash_table_new_full (g_str_hash, g_str_equal,
@@ -246,6 +356,143 @@ ensure_account (McdStorage *self,
   return sa;
 }
 
+/* Returns the index of @attribute in known_attributes[], or -1. This is on
+ * the path of every attribute get and set, so look it up once per
+ * operation and pass it to the storage_account_*_attribute() functions. */
+static gint
+known_attribute_index (const gchar *attribute)
+{
+  static GHashTable *indices = NULL;
+  guint i;
+
+  /* nearly every caller uses the MC_ACCOUNTS_KEY_* constants, which are
+   * usually the very same strings as ours, so try that before hashing */
+  for (i = 0; i < N_KNOWN_ATTRIBUTES; i++)
+    {
+      if (attribute == known_attributes[i].name)
+        return i;
+    }
+
+  if (g_once_init_enter (&indices))
+    {
+      GHashTable *tmp = g_hash_table_new (g_str_hash, g_str_equal);
+
+      for (i = 0; i < N_KNOWN_ATTRIBUTES; i++)
+        g_hash_table_insert (tmp, (gchar *) known_attributes[i].name,
+            GUINT_TO_POINTER (i + 1));
+
+      g_once_init_leave (&indices, tmp);
+    }
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (indices, attribute)) - 1;
+}
+
+/* @known is the result of known_attribute_index (@attribute) */
+static GVariant *
+storage_account_get_attribute (McdStorageAccount *sa,
+    gint known,
+    const gchar *attribute)
+{
+  if (known >= 0)
+    return sa->known_attributes[known];
+
+  if (sa->other_attributes == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (sa->other_attributes, attribute);
+}
+
+/* @known is the result of known_attribute_index (@attribute); @value is a
+ * new reference, or %NULL to remove @attribute */
+static void
+storage_account_take_attribute (McdStorageAccount *sa,
+    gint known,
+    const gchar *attribute,
+    GVariant *value)
+{
+  if (known >= 0)
+    {
+      if (sa->known_attributes[known] != NULL)
+        {
+          g_variant_unref (sa->known_attributes[known]);
+          sa->n_known_attributes--;
+        }
+
+      sa->known_attributes[known] = value;
+
+      if (value != NULL)
+        sa->n_known_attributes++;
+    }
+  else if (value != NULL)
+    {
+      if (sa->other_attributes == NULL)
+        sa->other_attributes = g_hash_table_new_full (g_str_hash,
+            g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+
+      g_hash_table_insert (sa->other_attributes, g_strdup (attribute),
+          value);
+    }
+  else if (sa->other_attributes != NULL)
+    {
+      g_hash_table_remove (sa->other_attributes, attribute);
+    }
+}
+
+static gboolean
+storage_account_has_attributes (McdStorageAccount *sa)
+{
+  return (sa->n_known_attributes > 0 ||
+      (sa->other_attributes != NULL &&
+       g_hash_table_size (sa->other_attributes) > 0));
+}
+
+typedef struct {
+    McdStorageAccount *sa;
+    guint next_known;
+    GHashTableIter other;
+} AttributeIter;
+
+static void
+attribute_iter_init (AttributeIter *iter,
+    McdStorageAccount *sa)
+{
+  iter->sa = sa;
+  iter->next_known = 0;
+
+  if (sa->other_attributes != NULL)
+    g_hash_table_iter_init (&iter->other, sa->other_attributes);
+}
+
+/* Sets @name and @value (both borrowed) to the next attribute of the
+ * account and returns %TRUE, or returns %FALSE at the end. */
+static gboolean
+attribute_iter_next (AttributeIter *iter,
+    const gchar **name,
+    GVariant **value)
+{
+  gpointer k, v;
+
+  while (iter->next_known < N_KNOWN_ATTRIBUTES)
+    {
+      guint i = iter->next_known++;
+
+      if (iter->sa->known_attributes[i] != NULL)
+        {
+          *name = known_attributes[i].name;
+          *value = iter->sa->known_attributes[i];
+          return TRUE;
+        }
+    }
+
+  if (iter->sa->other_attributes == NULL ||
+      !g_hash_table_iter_next (&iter->other, &k, &v))
+    return FALSE;
+
+  *name = k;
+  *value = v;
+  return TRUE;
+}
+
 static gchar *
 get_value (const McpAccountManager *ma,
     const gchar *account,
@@ -254,7 +501,6 @@ get_value (const McpAccountManager *ma,
   McdStorage *self = MCD_STORAGE (ma);
   McdStorageAccount *sa = lookup_account (self, account);
   GVariant *variant;
-  gchar *ret;
 
   if (sa == NULL)
     return NULL;
@@ -265,9 +511,7 @@ get_value (const McpAccountManager *ma,
 
       if (variant != NULL)
         {
-          ret = mcd_keyfile_escape_variant (variant);
-          g_variant_unref (variant);
-          return ret;
+          return mcd_keyfile_escape_variant (variant);
         }
       else
         {
@@ -279,13 +523,12 @@ get_value (const McpAccountManager *ma,
     }
   else
     {
-      variant = g_hash_table_lookup (sa->attributes, key);
+      variant = storage_account_get_attribute (sa,
+          known_attribute_index (key), key);
 
       if (variant != NULL)
         {
-          ret = mcd_keyfile_escape_variant (variant);
-          g_variant_unref (variant);
-          return ret;
+          return mcd_keyfile_escape_variant (variant);
         }
       else
         {
@@ -294,57 +537,14 @@ get_value (const McpAccountManager *ma,
     }
 }
 
-static struct {
-    const gchar *type;
-    const gchar *name;
-} known_attributes[] = {
-    /* Please keep this sorted by type, then by name. */
-
-    /* Structs */
-      { "(uss)", MC_ACCOUNTS_KEY_AUTOMATIC_PRESENCE },
-
-    /* Array of object path */
-      { "ao", MC_ACCOUNTS_KEY_SUPERSEDES },
-
-    /* Array of string */
-      { "as", MC_ACCOUNTS_KEY_URI_SCHEMES },
-
-    /* Booleans */
-      { "b", MC_ACCOUNTS_KEY_ALWAYS_DISPATCH },
-      { "b", MC_ACCOUNTS_KEY_CONNECT_AUTOMATICALLY },
-      { "b", MC_ACCOUNTS_KEY_ENABLED },
-      { "b", MC_ACCOUNTS_KEY_HAS_BEEN_ONLINE },
-      { "b", MC_ACCOUNTS_KEY_HIDDEN },
-
-    /* Strings */
-      { "s", MC_ACCOUNTS_KEY_AUTO_PRESENCE_MESSAGE },
-      { "s", MC_ACCOUNTS_KEY_AUTO_PRESENCE_STATUS },
-      { "s", MC_ACCOUNTS_KEY_AVATAR_MIME },
-      { "s", MC_ACCOUNTS_KEY_AVATAR_TOKEN },
-      { "s", MC_ACCOUNTS_KEY_DISPLAY_NAME },
-      { "s", MC_ACCOUNTS_KEY_ICON },
-      { "s", MC_ACCOUNTS_KEY_MANAGER },
-      { "s", MC_ACCOUNTS_KEY_NICKNAME },
-      { "s", MC_ACCOUNTS_KEY_NORMALIZED_NAME },
-      { "s", MC_ACCOUNTS_KEY_PROTOCOL },
-      { "s", MC_ACCOUNTS_KEY_SERVICE },
-
-    /* Integers */
-      { "u", MC_ACCOUNTS_KEY_AUTO_PRESENCE_TYPE },
-
-      { NULL, NULL }
-};
 
-const gchar *
-mcd_storage_get_attribute_type (const gchar *attribute)
+/* @known is the result of known_attribute_index (@attribute) */
+static const gchar *
+known_attribute_type (gint known,
+    const gchar *attribute)
 {
-  guint i;
-
-  for (i = 0; known_attributes[i].type != NULL; i++)
-    {
-      if (!tp_strdiff (attribute, known_attributes[i].name))
-        return known_attributes[i].type;
-    }
+  if (known >= 0)
+    return known_attributes[known].type;
 
   /* special case for mcd-account-conditions.c */
   if (g_str_has_prefix (attribute, "condition-"))
@@ -353,6 +553,12 @@ mcd_storage_get_attribute_type (const gchar *attribute)
   return NULL;
 }
 
+const gchar *
+mcd_storage_get_attribute_type (const gchar *attribute)
+{
+  return known_attribute_type (known_attribute_index (attribute), attribute);
+}
+
 gboolean
 mcd_storage_init_value_for_attribute (GValue *value,
     const gchar *attribute)
@@ -406,6 +612,26 @@ mcd_storage_init_value_for_attribute (GValue *value,
   return FALSE;
 }
 
+/*
+ * The type of the #GVariant we store for @attribute, consistent with
+ * mcd_storage_init_value_for_attribute(), or %NULL if unknown.
+ */
+static const GVariantType *
+attribute_variant_type (gint known,
+    const gchar *attribute)
+{
+  const gchar *s = known_attribute_type (known, attribute);
+
+  if (s == NULL)
+    return NULL;
+
+  /* mcd_storage_init_value_for_attribute() uses G_TYPE_INT for these */
+  if (!tp_strdiff (s, "u"))
+    return G_VARIANT_TYPE_INT32;
+
+  return G_VARIANT_TYPE (s);
+}
+
 static gboolean
 mcpa_init_value_for_attribute (const McpAccountManager *mcpa,
     GValue *value,
@@ -425,14 +651,10 @@ mcpa_set_attribute (const McpAccountManager *ma,
   McdStorageAccount *sa = ensure_account (self, account);
 
   if (value != NULL)
-    {
-      g_hash_table_insert (sa->attributes, g_strdup (attribute),
-          g_variant_ref_sink (value));
-    }
-  else
-    {
-      g_hash_table_remove (sa->attributes, attribute);
-    }
+    g_variant_ref_sink (value);
+
+  storage_account_take_attribute (sa, known_attribute_index (attribute),
+      attribute, value);
 }
 
 static void
@@ -479,35 +701,39 @@ set_value (const McpAccountManager *ma,
     }
   else
     {
+      gint known = known_attribute_index (key);
+
       if (value != NULL)
         {
-          GValue tmp = G_VALUE_INIT;
+          const GVariantType *type = attribute_variant_type (known, key);
+          GVariant *variant;
           GError *error = NULL;
 
-          if (!mcd_storage_init_value_for_attribute (&tmp, key))
+          if (type == NULL)
             {
               g_warning ("Not sure what the type of '%s' is, assuming string",
                   key);
-              g_value_init (&tmp, G_TYPE_STRING);
+              type = G_VARIANT_TYPE_STRING;
             }
 
-          if (mcd_keyfile_unescape_value (value, &tmp, &error))
+          variant = mcd_keyfile_unescape_variant (value, type, &error);
+
+          if (variant != NULL)
             {
-              g_hash_table_insert (sa->attributes, g_strdup (key),
-                  g_variant_ref_sink (dbus_g_value_build_g_variant (&tmp)));
-              g_value_unset (&tmp);
+              storage_account_take_attribute (sa, known, key,
+                  g_variant_ref_sink (variant));
             }
           else
             {
               g_warning ("Could not decode attribute '%s':'%s' from plugin: %s",
                   key, value, error->message);
               g_error_free (error);
-              g_hash_table_remove (sa->attributes, key);
+              storage_account_take_attribute (sa, known, key, NULL);
             }
         }
       else
         {
-          g_hash_table_remove (sa->attributes, key);
+          storage_account_take_attribute (sa, known, key, NULL);
         }
     }
 }
@@ -522,13 +748,16 @@ list_keys (const McpAccountManager *ma,
 
   if (sa != NULL)
     {
+      AttributeIter attr_iter;
       GHashTableIter iter;
+      const gchar *name;
+      GVariant *value;
       gpointer k;
 
-      g_hash_table_iter_init (&iter, sa->attributes);
+      attribute_iter_init (&attr_iter, sa);
 
-      while (g_hash_table_iter_next (&iter, &k, NULL))
-        g_ptr_array_add (ret, g_strdup (k));
+      while (attribute_iter_next (&attr_iter, &name, &value))
+        g_ptr_array_add (ret, g_strdup (name));
 
       g_hash_table_iter_init (&iter, sa->parameters);
 
@@ -712,57 +941,562 @@ mcd_storage_connect_signal (const gchar *signame,
 }
 
 /*
- * mcd_storage_load:
- * @storage: An object implementing the #McdStorage interface
- *
- * Load the long term account settings storage into our internal cache.
- * Should only really be called during startup, ie before our DBus names
- * have been claimed and other people might be relying on responses from us.
+ * The snapshot is a serialized GVariant of SNAPSHOT_TYPE containing the
+ * decoded contents of self->accounts. When MC starts, if the files the
+ * plugins loaded their accounts from haven't changed since it was written,
+ * we use the snapshot instead of decoding every account again. It's
+ * mapped into memory, so values we never look at are never read.
  */
-void
-mcd_storage_load (McdStorage *self)
+static gchar *
+snapshot_filename (void)
 {
-  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
-  GList *store = NULL;
-
-  g_return_if_fail (MCD_IS_STORAGE (self));
+  return g_build_filename (g_get_user_cache_dir (), "telepathy",
+      "mission-control", "accounts.snapshot", NULL);
+}
 
-  sort_and_cache_plugins ();
+/* Returns a new a(ss) describing the current state of every plugin's
+ * backing store, or %NULL if some plugin can't describe it, in which case
+ * a snapshot can't be trusted. */
+static GVariant *
+storage_dup_stamps (void)
+{
+  GVariantBuilder builder;
+  GList *store;
 
-  store = g_list_last (stores);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
 
-  /* fetch accounts stored in plugins, in reverse priority so higher prio *
-   * plugins can overwrite lower prio ones' account data                  */
-  while (store != NULL)
+  for (store = stores; store != NULL; store = g_list_next (store))
     {
-      GList *account;
       McpAccountStorage *plugin = store->data;
-      GList *stored = mcp_account_storage_list (plugin, ma);
-      const gchar *pname = mcp_account_storage_name (plugin);
-      const gint prio = mcp_account_storage_priority (plugin);
+      gchar *stamp;
 
-      DEBUG ("listing from plugin %s [prio: %d]", pname, prio);
-      for (account = stored; account != NULL; account = g_list_next (account))
+      if (!MCD_IS_ACCOUNT_MANAGER_DEFAULT (plugin))
         {
-          gchar *name = account->data;
-
-          DEBUG ("fetching %s from plugin %s [prio: %d]", name, pname, prio);
-          mcd_storage_add_account_from_plugin (self, plugin, name);
-          g_free (name);
+          DEBUG ("plugin %s can't tell us whether its accounts changed",
+              mcp_account_storage_name (plugin));
+          g_variant_builder_clear (&builder);
+          return NULL;
         }
 
-      /* already freed the contents, just need to free the list itself */
-      g_list_free (stored);
-      store = g_list_previous (store);
+      stamp = mcd_account_manager_default_dup_stamp (
+          MCD_ACCOUNT_MANAGER_DEFAULT (plugin));
+      g_variant_builder_add (&builder, "(ss)",
+          mcp_account_storage_name (plugin), stamp);
+      g_free (stamp);
     }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
 }
 
-/*
- * mcd_storage_dup_accounts:
- * @storage: An object implementing the #McdStorage interface
- * @n: place for the number of accounts to be written to (or %NULL)
- *
- * Returns: a newly allocated GStrv containing the unique account names,
+static GVariant *
+storage_account_to_variant (McdStorageAccount *sa)
+{
+  GVariantBuilder attributes, parameters, escaped, secrets;
+  AttributeIter attr_iter;
+  GHashTableIter iter;
+  const gchar *name;
+  GVariant *value;
+  gpointer k, v;
+
+  g_variant_builder_init (&attributes, G_VARIANT_TYPE_VARDICT);
+  attribute_iter_init (&attr_iter, sa);
+
+  while (attribute_iter_next (&attr_iter, &name, &value))
+    g_variant_builder_add (&attributes, "{sv}", name, value);
+
+  g_variant_builder_init (&parameters, G_VARIANT_TYPE_VARDICT);
+  g_hash_table_iter_init (&iter, sa->parameters);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    g_variant_builder_add (&parameters, "{sv}", k, v);
+
+  g_variant_builder_init (&escaped, G_VARIANT_TYPE ("a{ss}"));
+  g_hash_table_iter_init (&iter, sa->escaped_parameters);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    g_variant_builder_add (&escaped, "{ss}", k, v);
+
+  g_variant_builder_init (&secrets, G_VARIANT_TYPE_STRING_ARRAY);
+  g_hash_table_iter_init (&iter, sa->secrets);
+
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    g_variant_builder_add (&secrets, "s", k);
+
+  return g_variant_new ("(a{sv}a{sv}a{ss}as)", &attributes, &parameters,
+      &escaped, &secrets);
+}
+
+/* Like g_file_set_contents(), but the file is only ever readable by the
+ * user, even while it's being written: the snapshot has everyone's
+ * passwords in it, and the cache directory might be shared. */
+static gboolean
+storage_write_private_file (const gchar *filename,
+    const gchar *data,
+    gsize len,
+    GError **error)
+{
+  gchar *tmp_name = g_strconcat (filename, ".XXXXXX", NULL);
+  int fd;
+
+  /* this creates it with mode 0600 */
+  fd = g_mkstemp (tmp_name);
+
+  if (fd < 0)
+    goto error;
+
+  while (len > 0)
+    {
+      gssize n = write (fd, data, len);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          goto error;
+        }
+
+      data += n;
+      len -= n;
+    }
+
+  if (close (fd) != 0)
+    {
+      fd = -1;
+      goto error;
+    }
+
+  fd = -1;
+
+  if (g_rename (tmp_name, filename) != 0)
+    goto error;
+
+  g_free (tmp_name);
+  return TRUE;
+
+error:
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+      "Unable to write %s: %s", filename, g_strerror (errno));
+
+  if (fd >= 0)
+    close (fd);
+
+  g_unlink (tmp_name);
+  g_free (tmp_name);
+  return FALSE;
+}
+
+static void
+storage_save_snapshot (McdStorage *self,
+    GVariant *stamps)
+{
+  GVariantBuilder accounts;
+  GHashTableIter iter;
+  gpointer k, v;
+  GVariant *snapshot;
+  gchar *filename = snapshot_filename ();
+  gchar *dir = g_path_get_dirname (filename);
+  GError *error = NULL;
+
+  g_variant_builder_init (&accounts,
+      G_VARIANT_TYPE ("a{s" SNAPSHOT_ACCOUNT_TYPE "}"));
+  g_hash_table_iter_init (&iter, self->accounts);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    g_variant_builder_add (&accounts, "{s@" SNAPSHOT_ACCOUNT_TYPE "}", k,
+        storage_account_to_variant (v));
+
+  snapshot = g_variant_ref_sink (g_variant_new ("(s@a(ss)a{s"
+        SNAPSHOT_ACCOUNT_TYPE "})", SNAPSHOT_VERSION, stamps, &accounts));
+
+  if (!mcd_ensure_directory (dir, &error) ||
+      !storage_write_private_file (filename, g_variant_get_data (snapshot),
+        g_variant_get_size (snapshot), &error))
+    {
+      DEBUG ("Unable to save account snapshot: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      DEBUG ("Saved snapshot of %u accounts to %s",
+          g_hash_table_size (self->accounts), filename);
+      tp_clear_pointer (&self->snapshot_stamps, g_variant_unref);
+      self->snapshot_stamps = g_variant_ref (stamps);
+    }
+
+  g_variant_unref (snapshot);
+  g_free (dir);
+  g_free (filename);
+}
+
+/* Returns the a{s(...)} of accounts from the snapshot on disk, if it was
+ * taken when the plugins' data looked like @stamps, or %NULL. */
+static GVariant *
+storage_map_snapshot (GVariant *stamps)
+{
+  gchar *filename = snapshot_filename ();
+  GMappedFile *mapped;
+  GBytes *bytes;
+  GVariant *snapshot;
+  GVariant *snapshot_stamps;
+  GVariant *ret = NULL;
+  const gchar *version;
+  GError *error = NULL;
+
+  mapped = g_mapped_file_new (filename, FALSE, &error);
+
+  if (mapped == NULL)
+    {
+      DEBUG ("No account snapshot: %s", error->message);
+      g_error_free (error);
+      g_free (filename);
+      return NULL;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+  /* untrusted, so that a corrupt file can't do any harm */
+  snapshot = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (SNAPSHOT_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (snapshot, 0, "&s", &version);
+  snapshot_stamps = g_variant_get_child_value (snapshot, 1);
+
+  if (tp_strdiff (version, SNAPSHOT_VERSION))
+    DEBUG ("Ignoring snapshot %s from version '%s'", filename, version);
+  else if (!g_variant_equal (stamps, snapshot_stamps))
+    DEBUG ("Ignoring out-of-date snapshot %s", filename);
+  else
+    ret = g_variant_get_child_value (snapshot, 2);
+
+  g_variant_unref (snapshot_stamps);
+  g_variant_unref (snapshot);
+  g_free (filename);
+  return ret;
+}
+
+static void
+storage_restore_account (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account,
+    GVariant *data)
+{
+  McdStorageAccount *sa = ensure_account (self, account);
+  GVariantIter *attributes, *parameters, *escaped, *secrets;
+  const gchar *k, *v;
+  GVariant *value;
+
+  g_variant_get (data, SNAPSHOT_ACCOUNT_TYPE, &attributes, &parameters,
+      &escaped, &secrets);
+
+  /* the variants we keep point into the mapped file */
+  while (g_variant_iter_next (attributes, "{&sv}", &k, &value))
+    storage_account_take_attribute (sa, known_attribute_index (k), k,
+        value);
+
+  while (g_variant_iter_next (parameters, "{&sv}", &k, &value))
+    g_hash_table_insert (sa->parameters, g_strdup (k), value);
+
+  while (g_variant_iter_next (escaped, "{&s&s}", &k, &v))
+    g_hash_table_insert (sa->escaped_parameters, g_strdup (k), g_strdup (v));
+
+  while (g_variant_iter_next (secrets, "&s", &k))
+    g_hash_table_add (sa->secrets, g_strdup (k));
+
+  g_variant_iter_free (attributes);
+  g_variant_iter_free (parameters);
+  g_variant_iter_free (escaped);
+  g_variant_iter_free (secrets);
+
+  sa->owner = plugin;
+}
+
+static void
+storage_plugin_deleted_cb (McpAccountStorage *plugin,
+    const gchar *account,
+    gpointer user_data)
+{
+  McdStorage *self = MCD_STORAGE (user_data);
+  McdStorageAccount *sa = lookup_account (self, account);
+
+  /* If the account is still around (e.g. another plugin has a copy),
+   * find out who has it next time we need to know */
+  if (sa != NULL && sa->owner == plugin)
+    sa->owner = NULL;
+}
+
+/*
+ * Fetch the accounts that each plugin listed into our cache. @listed
+ * contains a list of account names for each plugin, in reverse priority
+ * order (the same order as g_list_last (stores) and so on), so that
+ * higher priority plugins can overwrite lower priority ones' account
+ * data. The lists are freed.
+ */
+static void
+storage_fetch_listed (McdStorage *self,
+    GPtrArray *listed)
+{
+  GList *store = NULL;
+  GVariant *stamps;
+  GVariant *snapshot = NULL;
+  GHashTable *from_snapshot = NULL;
+  guint i;
+
+  for (store = stores; store != NULL; store = g_list_next (store))
+    {
+      /* "created" is taken care of by mcd_storage_add_account_from_plugin */
+      g_signal_connect_object (store->data, "deleted",
+          G_CALLBACK (storage_plugin_deleted_cb), self, 0);
+    }
+
+  /* Now that every plugin has loaded its accounts, we can tell whether
+   * they're the same as last time */
+  stamps = storage_dup_stamps ();
+
+  if (stamps != NULL)
+    snapshot = storage_map_snapshot (stamps);
+
+  if (snapshot != NULL)
+    {
+      GVariantIter iter;
+      const gchar *name;
+      GVariant *data;
+
+      from_snapshot = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+          (GDestroyNotify) g_variant_unref);
+      g_variant_iter_init (&iter, snapshot);
+
+      while (g_variant_iter_next (&iter, "{&s@" SNAPSHOT_ACCOUNT_TYPE "}",
+            &name, &data))
+        g_hash_table_insert (from_snapshot, (gchar *) name, data);
+    }
+
+  for (store = g_list_last (stores), i = 0;
+      store != NULL;
+      store = g_list_previous (store), i++)
+    {
+      GList *account;
+      McpAccountStorage *plugin = store->data;
+      GList *stored = g_ptr_array_index (listed, i);
+      const gchar *pname = mcp_account_storage_name (plugin);
+      const gint prio = mcp_account_storage_priority (plugin);
+
+      for (account = stored; account != NULL; account = g_list_next (account))
+        {
+          gchar *name = account->data;
+          GVariant *data = NULL;
+
+          if (from_snapshot != NULL)
+            data = g_hash_table_lookup (from_snapshot, name);
+
+          if (data != NULL)
+            {
+              DEBUG ("restoring %s from snapshot", name);
+              storage_restore_account (self, plugin, name, data);
+            }
+          else
+            {
+              DEBUG ("fetching %s from plugin %s [prio: %d]", name, pname,
+                  prio);
+              mcd_storage_add_account_from_plugin (self, plugin, name);
+            }
+
+          g_free (name);
+        }
+
+      /* already freed the contents, just need to free the list itself */
+      g_list_free (stored);
+    }
+
+  /* the keys point into the snapshot, so this has to go first */
+  tp_clear_pointer (&from_snapshot, g_hash_table_unref);
+
+  if (snapshot != NULL)
+    {
+      self->snapshot_stamps = g_variant_ref (stamps);
+      g_variant_unref (snapshot);
+    }
+  else if (stamps != NULL)
+    {
+      storage_save_snapshot (self, stamps);
+    }
+
+  tp_clear_pointer (&stamps, g_variant_unref);
+}
+
+/*
+ * mcd_storage_load:
+ * @storage: An object implementing the #McdStorage interface
+ *
+ * Load the long term account settings storage into our internal cache.
+ * Should only really be called during startup, ie before our DBus names
+ * have been claimed and other people might be relying on responses from us.
+ */
+void
+mcd_storage_load (McdStorage *self)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  GList *store = NULL;
+  GPtrArray *listed;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  sort_and_cache_plugins ();
+
+  listed = g_ptr_array_new ();
+
+  for (store = g_list_last (stores);
+      store != NULL;
+      store = g_list_previous (store))
+    {
+      McpAccountStorage *plugin = store->data;
+
+      DEBUG ("listing from plugin %s [prio: %d]",
+          mcp_account_storage_name (plugin),
+          mcp_account_storage_priority (plugin));
+      g_ptr_array_add (listed, mcp_account_storage_list (plugin, ma));
+    }
+
+  storage_fetch_listed (self, listed);
+  g_ptr_array_unref (listed);
+}
+
+typedef struct {
+    /* one list of account names per plugin, in reverse priority order */
+    GPtrArray *listed;
+    /* number of plugins that haven't finished listing yet */
+    guint pending;
+} LoadData;
+
+static void
+load_data_free (gpointer p)
+{
+  LoadData *data = p;
+
+  g_ptr_array_unref (data->listed);
+  g_slice_free (LoadData, data);
+}
+
+typedef struct {
+    GTask *task;
+    guint index;
+} ListClosure;
+
+static void
+storage_list_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  McpAccountStorage *plugin = MCP_ACCOUNT_STORAGE (source);
+  ListClosure *closure = user_data;
+  GTask *task = closure->task;
+  LoadData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+  GList *stored;
+
+  stored = mcp_account_storage_list_finish (plugin, result, &error);
+
+  if (error != NULL)
+    {
+      WARNING ("plugin %s failed to list accounts: %s",
+          mcp_account_storage_name (plugin), error->message);
+      g_error_free (error);
+    }
+
+  DEBUG ("plugin %s listed %u accounts", mcp_account_storage_name (plugin),
+      g_list_length (stored));
+  g_ptr_array_index (data->listed, closure->index) = stored;
+  g_slice_free (ListClosure, closure);
+
+  if (--data->pending == 0)
+    {
+      storage_fetch_listed (g_task_get_source_object (task), data->listed);
+      g_task_return_boolean (task, TRUE);
+    }
+
+  g_object_unref (task);
+}
+
+/*
+ * mcd_storage_load_async:
+ * @storage: An object implementing the #McdStorage interface
+ * @callback: called when all the accounts have been loaded
+ * @user_data: data for @callback
+ *
+ * Like mcd_storage_load(), but without blocking while plugins list their
+ * accounts. All the plugins are asked at once; the accounts are then
+ * loaded in priority order as usual.
+ */
+void
+mcd_storage_load_async (McdStorage *self,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  GTask *task;
+  LoadData *data;
+  GList *store;
+  guint i;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  sort_and_cache_plugins ();
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, mcd_storage_load_async);
+  data = g_slice_new0 (LoadData);
+  data->listed = g_ptr_array_new ();
+  g_ptr_array_set_size (data->listed, g_list_length (stores));
+  /* don't finish until we've started listing from every plugin */
+  data->pending = 1;
+  g_task_set_task_data (task, data, load_data_free);
+
+  for (store = g_list_last (stores), i = 0;
+      store != NULL;
+      store = g_list_previous (store), i++)
+    {
+      McpAccountStorage *plugin = store->data;
+      ListClosure *closure = g_slice_new (ListClosure);
+
+      DEBUG ("listing from plugin %s [prio: %d]",
+          mcp_account_storage_name (plugin),
+          mcp_account_storage_priority (plugin));
+
+      closure->task = g_object_ref (task);
+      closure->index = i;
+      data->pending++;
+      mcp_account_storage_list_async (plugin, ma, NULL, storage_list_cb,
+          closure);
+    }
+
+  if (--data->pending == 0)
+    {
+      storage_fetch_listed (self, data->listed);
+      g_task_return_boolean (task, TRUE);
+    }
+
+  g_object_unref (task);
+}
+
+gboolean
+mcd_storage_load_finish (McdStorage *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result,
+        mcd_storage_load_async), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/*
+ * mcd_storage_dup_accounts:
+ * @storage: An object implementing the #McdStorage interface
+ * @n: place for the number of accounts to be written to (or %NULL)
+ *
+ * Returns: a newly allocated GStrv containing the unique account names,
  * which must be freed by the caller with g_strfreev().
  */
 GStrv
@@ -779,7 +1513,7 @@ mcd_storage_dup_accounts (McdStorage *self,
     {
       McdStorageAccount *sa = v;
 
-      if (g_hash_table_size (sa->attributes) > 0)
+      if (storage_account_has_attributes (sa))
         g_ptr_array_add (ret, g_strdup (k));
     }
 
@@ -807,13 +1541,14 @@ mcd_storage_dup_attributes (McdStorage *self,
 
   if (sa != NULL)
     {
-      GHashTableIter iter;
-      gpointer k;
+      AttributeIter iter;
+      const gchar *name;
+      GVariant *value;
 
-      g_hash_table_iter_init (&iter, sa->attributes);
+      attribute_iter_init (&iter, sa);
 
-      while (g_hash_table_iter_next (&iter, &k, NULL))
-        g_ptr_array_add (ret, g_strdup (k));
+      while (attribute_iter_next (&iter, &name, &value))
+        g_ptr_array_add (ret, g_strdup (name));
     }
 
   g_ptr_array_add (ret, NULL);
@@ -839,52 +1574,185 @@ mcd_storage_get_plugin (McdStorage *self,
 {
   GList *store = stores;
   McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  McdStorageAccount *sa;
   McpAccountStorage *owner = NULL;
 
   g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
   g_return_val_if_fail (account != NULL, NULL);
 
-  for (; store != NULL && owner == NULL; store = g_list_next (store))
+  sa = lookup_account (self, account);
+
+  if (sa != NULL && sa->owner != NULL)
+    return sa->owner;
+
+  for (; store != NULL && owner == NULL; store = g_list_next (store))
+    {
+      McpAccountStorage *plugin = store->data;
+
+      if (mcp_account_storage_owns (plugin, ma, account))
+        owner = plugin;
+    }
+
+  if (sa != NULL)
+    sa->owner = owner;
+
+  return owner;
+}
+
+/*
+ * mcd_storage_dup_string:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: unique name of the account
+ * @attribute: name of the attribute to be retrieved (which must not be a
+ *  parameter)
+ *
+ * Returns: a newly allocated gchar * which must be freed with g_free().
+ */
+gchar *
+mcd_storage_dup_string (McdStorage *self,
+    const gchar *account,
+    const gchar *attribute)
+{
+  GValue tmp = G_VALUE_INIT;
+  gchar *ret;
+
+  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
+  g_return_val_if_fail (account != NULL, NULL);
+  g_return_val_if_fail (attribute != NULL, NULL);
+  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), NULL);
+
+  g_value_init (&tmp, G_TYPE_STRING);
+
+  if (!mcd_storage_get_attribute (self, account, attribute, &tmp, NULL))
+    return NULL;
+
+  ret = g_value_dup_string (&tmp);
+  g_value_unset (&tmp);
+  return ret;
+}
+
+/*
+ * If @variant is of an integer type, return %TRUE and put its value in
+ * *@s (if it is negative) or *@u (if not).
+ */
+static gboolean
+variant_get_integer (GVariant *variant,
+    gboolean *negative,
+    gint64 *s,
+    guint64 *u)
+{
+  switch (g_variant_classify (variant))
+    {
+      case G_VARIANT_CLASS_BYTE:
+        *s = g_variant_get_byte (variant);
+        break;
+
+      case G_VARIANT_CLASS_INT16:
+        *s = g_variant_get_int16 (variant);
+        break;
+
+      case G_VARIANT_CLASS_UINT16:
+        *s = g_variant_get_uint16 (variant);
+        break;
+
+      case G_VARIANT_CLASS_INT32:
+        *s = g_variant_get_int32 (variant);
+        break;
+
+      case G_VARIANT_CLASS_UINT32:
+        *s = g_variant_get_uint32 (variant);
+        break;
+
+      case G_VARIANT_CLASS_INT64:
+        *s = g_variant_get_int64 (variant);
+        break;
+
+      case G_VARIANT_CLASS_UINT64:
+        *negative = FALSE;
+        *u = g_variant_get_uint64 (variant);
+        return TRUE;
+
+      default:
+        return FALSE;
+    }
+
+  *negative = (*s < 0);
+  *u = (*negative ? 0 : (guint64) *s);
+  return TRUE;
+}
+
+static gboolean
+mcd_storage_coerce_integer_to_value (gboolean negative,
+    gint64 s,
+    guint64 u,
+    GValue *value,
+    GError **error)
+{
+  gint64 min = 0;
+  guint64 max;
+
+  switch (G_VALUE_TYPE (value))
+    {
+      case G_TYPE_INT:
+        min = G_MININT32;
+        max = G_MAXINT32;
+        break;
+
+      case G_TYPE_INT64:
+        min = G_MININT64;
+        max = G_MAXINT64;
+        break;
+
+      case G_TYPE_UINT:
+        max = G_MAXUINT32;
+        break;
+
+      case G_TYPE_UINT64:
+        max = G_MAXUINT64;
+        break;
+
+      case G_TYPE_UCHAR:
+        max = G_MAXUINT8;
+        break;
+
+      default:
+        g_return_val_if_reached (FALSE);
+    }
+
+  if ((negative && s < min) || (!negative && u > max))
     {
-      McpAccountStorage *plugin = store->data;
-
-      if (mcp_account_storage_owns (plugin, ma, account))
-        owner = plugin;
+      g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+          "Integer value out of range for %s", G_VALUE_TYPE_NAME (value));
+      return FALSE;
     }
 
-  return owner;
-}
+  if (!negative)
+    s = u;
 
-/*
- * mcd_storage_dup_string:
- * @storage: An object implementing the #McdStorage interface
- * @account: unique name of the account
- * @attribute: name of the attribute to be retrieved (which must not be a
- *  parameter)
- *
- * Returns: a newly allocated gchar * which must be freed with g_free().
- */
-gchar *
-mcd_storage_dup_string (McdStorage *self,
-    const gchar *account,
-    const gchar *attribute)
-{
-  GValue tmp = G_VALUE_INIT;
-  gchar *ret;
+  switch (G_VALUE_TYPE (value))
+    {
+      case G_TYPE_INT:
+        g_value_set_int (value, s);
+        break;
 
-  g_return_val_if_fail (MCD_IS_STORAGE (self), NULL);
-  g_return_val_if_fail (account != NULL, NULL);
-  g_return_val_if_fail (attribute != NULL, NULL);
-  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), NULL);
+      case G_TYPE_INT64:
+        g_value_set_int64 (value, s);
+        break;
 
-  g_value_init (&tmp, G_TYPE_STRING);
+      case G_TYPE_UINT:
+        g_value_set_uint (value, u);
+        break;
 
-  if (!mcd_storage_get_attribute (self, account, attribute, &tmp, NULL))
-    return NULL;
+      case G_TYPE_UINT64:
+        g_value_set_uint64 (value, u);
+        break;
 
-  ret = g_value_dup_string (&tmp);
-  g_value_unset (&tmp);
-  return ret;
+      case G_TYPE_UCHAR:
+        g_value_set_uchar (value, u);
+        break;
+    }
+
+  return TRUE;
 }
 
 static gboolean
@@ -895,22 +1763,67 @@ mcd_storage_coerce_variant_to_value (GVariant *variant,
   GValue tmp = G_VALUE_INIT;
   gboolean ret;
   gchar *escaped;
+  gboolean negative;
+  gint64 s;
+  guint64 u;
+
+  /* The common cases: we have the right type, or a differently-sized
+   * integer. Neither needs to be turned into a string and back. */
+  switch (G_VALUE_TYPE (value))
+    {
+      case G_TYPE_STRING:
+        if (g_variant_is_of_type (variant, G_VARIANT_TYPE_STRING))
+          {
+            g_value_set_string (value, g_variant_get_string (variant, NULL));
+            return TRUE;
+          }
+        break;
+
+      case G_TYPE_BOOLEAN:
+        if (g_variant_is_of_type (variant, G_VARIANT_TYPE_BOOLEAN))
+          {
+            g_value_set_boolean (value, g_variant_get_boolean (variant));
+            return TRUE;
+          }
+        break;
+
+      case G_TYPE_INT:
+      case G_TYPE_INT64:
+      case G_TYPE_UINT:
+      case G_TYPE_UINT64:
+      case G_TYPE_UCHAR:
+        if (variant_get_integer (variant, &negative, &s, &u))
+          return mcd_storage_coerce_integer_to_value (negative, s, u, value,
+              error);
+        break;
+
+      default:
+        dbus_g_value_parse_g_variant (variant, &tmp);
+
+        if (G_VALUE_TYPE (&tmp) == G_VALUE_TYPE (value))
+          {
+            memcpy (value, &tmp, sizeof (tmp));
+            return TRUE;
+          }
+
+        if (G_IS_VALUE (&tmp))
+          g_value_unset (&tmp);
+    }
 
-  dbus_g_value_parse_g_variant (variant, &tmp);
+  /* Anything else (e.g. a string that is meant to be a number) goes via
+   * the keyfile syntax, which is what plugins would have given us */
+  escaped = mcd_keyfile_escape_variant (variant);
 
-  if (G_VALUE_TYPE (&tmp) == G_VALUE_TYPE (value))
+  if (escaped == NULL)
     {
-      memcpy (value, &tmp, sizeof (tmp));
-      return TRUE;
+      g_set_error (error, MCD_ACCOUNT_ERROR, MCD_ACCOUNT_ERROR_GET_PARAMETER,
+          "Unable to convert %s to %s", g_variant_get_type_string (variant),
+          G_VALUE_TYPE_NAME (value));
+      return FALSE;
     }
 
-  /* This is really pretty stupid but it'll do for now.
-   * FIXME: implement a better similar-type-coercion mechanism than
-   * round-tripping through a GKeyFile. */
-  escaped = mcd_keyfile_escape_value (&tmp);
   ret = mcd_keyfile_unescape_value (escaped, value, error);
   g_free (escaped);
-  g_value_unset (&tmp);
   return ret;
 }
 
@@ -946,7 +1859,8 @@ mcd_storage_get_attribute (McdStorage *self,
       return FALSE;
     }
 
-  variant = g_hash_table_lookup (sa->attributes, attribute);
+  variant = storage_account_get_attribute (sa,
+      known_attribute_index (attribute), attribute);
 
   if (variant == NULL)
     {
@@ -1018,346 +1932,6 @@ mcpa_unescape_value_from_keyfile (const McpAccountManager *unused G_GNUC_UNUSED,
   return mcd_keyfile_unescape_value (escaped, value, error);
 }
 
-/*
- * @escaped: a keyfile-escaped string
- * @value: a #GValue initialized with a supported #GType
- * @error: used to raise an error if %FALSE is returned
- *
- * Try to interpret @escaped as a value of the type of @value. If we can,
- * write the resulting value into @value and return %TRUE.
- *
- * Returns: %TRUE if @escaped could be interpreted as a value of that type
- */
-gboolean
-mcd_keyfile_unescape_value (const gchar *escaped,
-    GValue *value,
-    GError **error)
-{
-  GKeyFile *keyfile;
-  gboolean ret;
-
-  g_return_val_if_fail (escaped != NULL, FALSE);
-  g_return_val_if_fail (G_IS_VALUE (value), FALSE);
-
-  keyfile = g_key_file_new ();
-  g_key_file_set_value (keyfile, "g", "k", escaped);
-  ret = mcd_keyfile_get_value (keyfile, "g", "k", value, error);
-  g_key_file_free (keyfile);
-  return ret;
-}
-
-/*
- * mcd_keyfile_get_value:
- * @keyfile: A #GKeyFile
- * @group: name of a group
- * @key: name of a key
- * @value: location to return the value, initialized to the right #GType
- * @error: a place to store any #GError<!-- -->s that occur
- */
-gboolean
-mcd_keyfile_get_value (GKeyFile *keyfile,
-    const gchar *group,
-    const gchar *key,
-    GValue *value,
-    GError **error)
-{
-  gboolean ret = FALSE;
-  GType type;
-
-  g_return_val_if_fail (keyfile != NULL, FALSE);
-  g_return_val_if_fail (group != NULL, FALSE);
-  g_return_val_if_fail (key != NULL, FALSE);
-  g_return_val_if_fail (G_IS_VALUE (value), FALSE);
-
-  type = G_VALUE_TYPE (value);
-
-  switch (type)
-    {
-      case G_TYPE_STRING:
-          {
-            gchar *v_string = g_key_file_get_string (keyfile, group,
-                key, error);
-
-            if (v_string != NULL)
-              {
-                g_value_take_string (value, v_string);
-                ret = TRUE;
-              }
-            /* else error is already set */
-          }
-        break;
-
-      case G_TYPE_INT:
-          {
-            GError *e = NULL;
-            gint v_int = g_key_file_get_integer (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else
-              {
-                g_value_set_int (value, v_int);
-                ret = TRUE;
-              }
-          }
-        break;
-
-      case G_TYPE_INT64:
-          {
-            GError *e = NULL;
-            gint64 v_int = g_key_file_get_int64 (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else
-              {
-                g_value_set_int64 (value, v_int);
-                ret = TRUE;
-              }
-          }
-        break;
-
-      case G_TYPE_UINT:
-          {
-            GError *e = NULL;
-            guint64 v_uint = g_key_file_get_uint64 (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else if (v_uint > G_MAXUINT32)
-              {
-                g_set_error (error, MCD_ACCOUNT_ERROR,
-                    MCD_ACCOUNT_ERROR_GET_PARAMETER,
-                    "Parameter '%s' out of range for an unsigned 32-bit "
-                    "integer: %" G_GUINT64_FORMAT, key, v_uint);
-              }
-            else
-              {
-                g_value_set_uint (value, v_uint);
-                ret = TRUE;
-              }
-          }
-        break;
-
-    case G_TYPE_UCHAR:
-          {
-            GError *e = NULL;
-            gint v_int = g_key_file_get_integer (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else if (v_int < 0 || v_int > 0xFF)
-              {
-                g_set_error (error, MCD_ACCOUNT_ERROR,
-                    MCD_ACCOUNT_ERROR_GET_PARAMETER,
-                    "Parameter '%s' out of range for an unsigned byte: "
-                    "%d", key, v_int);
-              }
-            else
-              {
-                g_value_set_uchar (value, v_int);
-                ret = TRUE;
-              }
-          }
-        break;
-
-      case G_TYPE_UINT64:
-          {
-            GError *e = NULL;
-            guint64 v_uint = g_key_file_get_uint64 (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else
-              {
-                g_value_set_uint64 (value, v_uint);
-                ret = TRUE;
-              }
-          }
-        break;
-
-      case G_TYPE_BOOLEAN:
-          {
-            GError *e = NULL;
-            gboolean v_bool = g_key_file_get_boolean (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else
-              {
-                g_value_set_boolean (value, v_bool);
-                ret = TRUE;
-              }
-          }
-        break;
-
-      case G_TYPE_DOUBLE:
-          {
-            GError *e = NULL;
-            gdouble v_double = g_key_file_get_double (keyfile, group,
-                key, &e);
-
-            if (e != NULL)
-              {
-                g_propagate_error (error, e);
-              }
-            else
-              {
-                g_value_set_double (value, v_double);
-                ret = TRUE;
-              }
-          }
-        break;
-
-      default:
-        if (type == G_TYPE_STRV)
-          {
-            gchar **v = g_key_file_get_string_list (keyfile, group,
-                key, NULL, error);
-
-            if (v != NULL)
-              {
-                g_value_take_boxed (value, v);
-                ret = TRUE;
-              }
-          }
-        else if (type == DBUS_TYPE_G_OBJECT_PATH)
-          {
-            gchar *v_string = g_key_file_get_string (keyfile, group,
-                key, error);
-
-            if (v_string == NULL)
-              {
-                /* do nothing, error is already set */
-              }
-            else if (!tp_dbus_check_valid_object_path (v_string, NULL))
-              {
-                g_set_error (error, MCD_ACCOUNT_ERROR,
-                    MCD_ACCOUNT_ERROR_GET_PARAMETER,
-                    "Invalid object path %s", v_string);
-                g_free (v_string);
-              }
-            else
-              {
-                g_value_take_boxed (value, v_string);
-                ret = TRUE;
-              }
-          }
-        else if (type == TP_ARRAY_TYPE_OBJECT_PATH_LIST)
-          {
-            gchar **v = g_key_file_get_string_list (keyfile, group,
-                key, NULL, error);
-
-            if (v != NULL)
-              {
-                gchar **iter;
-                GPtrArray *arr = g_ptr_array_new ();
-
-                for (iter = v; iter != NULL && *iter != NULL; iter++)
-                  {
-                    if (!g_variant_is_object_path (*iter))
-                      {
-                        g_set_error (error, MCD_ACCOUNT_ERROR,
-                            MCD_ACCOUNT_ERROR_GET_PARAMETER,
-                            "Invalid object path %s stored in keyfile", *iter);
-                        g_strfreev (v);
-                        v = NULL;
-                        break;
-                      }
-                  }
-
-                for (iter = v; iter != NULL && *iter != NULL; iter++)
-                  {
-                    /* transfer ownership from v to arr */
-                    g_ptr_array_add (arr, *iter);
-                  }
-
-                /* not g_strfreev - the strings' ownership has been
-                 * transferred */
-                g_free (v);
-
-                g_value_take_boxed (value, arr);
-                ret = TRUE;
-              }
-          }
-        else if (type == TP_STRUCT_TYPE_SIMPLE_PRESENCE)
-          {
-            gchar **v = g_key_file_get_string_list (keyfile, group,
-                key, NULL, error);
-
-            if (v == NULL)
-              {
-                /* error is already set, do nothing */
-              }
-            else if (g_strv_length (v) != 3)
-              {
-                g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
-                    "Invalid simple-presence structure stored in keyfile");
-              }
-            else
-              {
-                guint64 u;
-                gchar *endptr;
-
-                errno = 0;
-                u = g_ascii_strtoull (v[0], &endptr, 10);
-
-                if (errno != 0 || *endptr != '\0' || u > G_MAXUINT32)
-                  {
-                    g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
-                        "Invalid presence type stored in keyfile: %s", v[0]);
-                  }
-                else
-                  {
-                    /* a syntactically valid simple presence */
-                    g_value_take_boxed (value,
-                        tp_value_array_build (3,
-                          G_TYPE_UINT, (guint) u,
-                          G_TYPE_STRING, v[1],
-                          G_TYPE_STRING, v[2],
-                          G_TYPE_INVALID));
-                    ret = TRUE;
-                  }
-              }
-
-            g_strfreev (v);
-          }
-        else
-          {
-            gchar *message =
-              g_strdup_printf ("cannot get key %s from group %s: "
-                  "unknown type %s",
-                  key, group, g_type_name (type));
-
-            g_warning ("%s: %s", G_STRFUNC, message);
-            g_set_error (error, MCD_ACCOUNT_ERROR,
-                MCD_ACCOUNT_ERROR_GET_PARAMETER,
-                "%s", message);
-            g_free (message);
-          }
-    }
-
-  return ret;
-}
-
 /*
  * mcd_storage_get_boolean:
  * @storage: An object implementing the #McdStorage interface
@@ -1397,21 +1971,82 @@ mcd_storage_get_boolean (McdStorage *self,
 gint
 mcd_storage_get_integer (McdStorage *self,
     const gchar *account,
-    const gchar *attribute)
+    const gchar *attribute)
+{
+  GValue tmp = G_VALUE_INIT;
+
+  g_return_val_if_fail (MCD_IS_STORAGE (self), 0);
+  g_return_val_if_fail (account != NULL, 0);
+  g_return_val_if_fail (attribute != NULL, 0);
+  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), 0);
+
+  g_value_init (&tmp, G_TYPE_INT);
+
+  if (!mcd_storage_get_attribute (self, account, attribute, &tmp, NULL))
+    return FALSE;
+
+  return g_value_get_int (&tmp);
+}
+
+/* Offer @key to @plugin. Returns %TRUE if @plugin stored it. */
+static gboolean
+update_one_storage (McdStorage *self,
+    McpAccountStorage *plugin,
+    const gchar *account,
+    const gchar *key,
+    GVariant *variant,
+    const gchar *escaped,
+    gboolean secret)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  const gchar *pn = mcp_account_storage_name (plugin);
+  gboolean parameter = g_str_has_prefix (key, "param-");
+  gboolean done;
+
+  if (variant != NULL && !parameter &&
+      mcp_account_storage_set_attribute (plugin, ma, account, key, variant,
+        MCP_ATTRIBUTE_FLAG_NONE))
+    {
+      DEBUG ("MCP:%s -> store attribute %s.%s", pn, account, key);
+      return TRUE;
+    }
+
+  if (variant != NULL && parameter &&
+      mcp_account_storage_set_parameter (plugin, ma, account, key + 6,
+        variant,
+        secret ? MCP_PARAMETER_FLAG_SECRET : MCP_PARAMETER_FLAG_NONE))
+    {
+      DEBUG ("MCP:%s -> store parameter %s.%s", pn, account, key);
+      return TRUE;
+    }
+
+  done = mcp_account_storage_set (plugin, ma, account, key, escaped);
+  DEBUG ("MCP:%s -> %s %s.%s", pn, done ? "store" : "ignore", account, key);
+  return done;
+}
+
+/* Tell every plugin with lower priority than @owner to delete @key, as
+ * happens when @owner is found by asking each plugin in turn, so that a
+ * stale copy can't come back the next time accounts are loaded. */
+static void
+delete_from_lower_storage (McdStorage *self,
+    McpAccountStorage *owner,
+    const gchar *account,
+    const gchar *key)
 {
-  GValue tmp = G_VALUE_INIT;
-
-  g_return_val_if_fail (MCD_IS_STORAGE (self), 0);
-  g_return_val_if_fail (account != NULL, 0);
-  g_return_val_if_fail (attribute != NULL, 0);
-  g_return_val_if_fail (!g_str_has_prefix (attribute, "param-"), 0);
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  GList *store = g_list_find (stores, owner);
 
-  g_value_init (&tmp, G_TYPE_INT);
+  g_return_if_fail (store != NULL);
 
-  if (!mcd_storage_get_attribute (self, account, attribute, &tmp, NULL))
-    return FALSE;
+  for (store = g_list_next (store); store != NULL; store = g_list_next (store))
+    {
+      McpAccountStorage *plugin = store->data;
 
-  return g_value_get_int (&tmp);
+      DEBUG ("MCP:%s -> delete %s.%s", mcp_account_storage_name (plugin),
+          account, key);
+      mcp_account_storage_delete (plugin, ma, account, key);
+    }
 }
 
 static void
@@ -1424,12 +2059,56 @@ update_storage (McdStorage *self,
 {
   GList *store;
   gboolean done = FALSE;
-  gboolean parameter = g_str_has_prefix (key, "param-");
   McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  McdStorageAccount *sa = lookup_account (self, account);
 
   if (secret)
     mcd_storage_make_secret (self, account, key);
 
+  /* Between mcd_storage_begin() and mcd_storage_end(), just remember the
+   * latest value of each setting */
+  if (sa != NULL && sa->batch != NULL)
+    {
+      McdStorageChange *change = g_hash_table_lookup (sa->batch->changes,
+          key);
+
+      if (change == NULL)
+        {
+          gchar *k = g_strdup (key);
+
+          change = g_slice_new0 (McdStorageChange);
+          g_ptr_array_add (sa->batch->keys, k);
+          g_hash_table_insert (sa->batch->changes, k, change);
+        }
+
+      tp_clear_pointer (&change->variant, g_variant_unref);
+      g_free (change->escaped);
+
+      change->variant = (variant == NULL ? NULL : g_variant_ref (variant));
+      change->escaped = g_strdup (escaped);
+      change->secret = secret;
+      return;
+    }
+
+  /* If we know which plugin has the account, it's the only one that needs
+   * to be offered a new value; the plugins below it are still told to
+   * delete theirs. Deletions still go to every plugin below, in case an
+   * older copy of the setting is lying around elsewhere. */
+  if (sa != NULL && sa->owner != NULL && escaped != NULL)
+    {
+      if (update_one_storage (self, sa->owner, account, key, variant,
+            escaped, secret))
+        {
+          delete_from_lower_storage (self, sa->owner, account, key);
+          return;
+        }
+
+      /* It doesn't want it after all: fall back to asking everyone */
+      DEBUG ("MCP:%s refused %s.%s, asking other plugins",
+          mcp_account_storage_name (sa->owner), account, key);
+      sa->owner = NULL;
+    }
+
   /* we're deleting, which is unconditional, no need to check if anyone *
    * claims this setting for themselves                                 */
   if (escaped == NULL)
@@ -1438,33 +2117,22 @@ update_storage (McdStorage *self,
   for (store = stores; store != NULL; store = g_list_next (store))
     {
       McpAccountStorage *plugin = store->data;
-      const gchar *pn = mcp_account_storage_name (plugin);
 
       if (done)
         {
-          DEBUG ("MCP:%s -> delete %s.%s", pn, account, key);
+          DEBUG ("MCP:%s -> delete %s.%s", mcp_account_storage_name (plugin),
+              account, key);
           mcp_account_storage_delete (plugin, ma, account, key);
         }
-      else if (variant != NULL && !parameter &&
-          mcp_account_storage_set_attribute (plugin, ma, account, key, variant,
-            MCP_ATTRIBUTE_FLAG_NONE))
-        {
-          done = TRUE;
-          DEBUG ("MCP:%s -> store attribute %s.%s", pn, account, key);
-        }
-      else if (variant != NULL && parameter &&
-          mcp_account_storage_set_parameter (plugin, ma, account, key + 6,
-            variant,
-            secret ? MCP_PARAMETER_FLAG_SECRET : MCP_PARAMETER_FLAG_NONE))
+      else if (update_one_storage (self, plugin, account, key, variant,
+            escaped, secret))
         {
           done = TRUE;
-          DEBUG ("MCP:%s -> store parameter %s.%s", pn, account, key);
-        }
-      else
-        {
-          done = mcp_account_storage_set (plugin, ma, account, key, escaped);
-          DEBUG ("MCP:%s -> %s %s.%s",
-              pn, done ? "store" : "ignore", account, key);
+
+          /* the highest-priority plugin to accept a setting for an account
+           * has the account from now on */
+          if (sa != NULL)
+            sa->owner = plugin;
         }
     }
 }
@@ -1538,6 +2206,7 @@ mcd_storage_set_attribute (McdStorage *self,
     const GValue *value)
 {
   McdStorageAccount *sa;
+  gint known;
   GVariant *old_v;
   GVariant *new_v;
   gboolean updated = FALSE;
@@ -1554,18 +2223,19 @@ mcd_storage_set_attribute (McdStorage *self,
   else
     new_v = NULL;
 
-  old_v = g_hash_table_lookup (sa->attributes, attribute);
+  known = known_attribute_index (attribute);
+  old_v = storage_account_get_attribute (sa, known, attribute);
 
   if (!mcd_nullable_variant_equal (old_v, new_v))
     {
       gchar *escaped = NULL;
 
-      /* First put it in the attributes hash table. (Watch out, this might
+      /* First put it in the account's attributes. (Watch out, this might
        * invalidate old_v.) */
       if (new_v == NULL)
-        g_hash_table_remove (sa->attributes, attribute);
+        storage_account_take_attribute (sa, known, attribute, NULL);
       else
-        g_hash_table_insert (sa->attributes, g_strdup (attribute),
+        storage_account_take_attribute (sa, known, attribute,
             g_variant_ref (new_v));
 
       /* OK now we have to escape it in a stupid way for plugins */
@@ -1663,30 +2333,6 @@ mcpa_escape_value_for_keyfile (const McpAccountManager *unused G_GNUC_UNUSED,
   return mcd_keyfile_escape_value (value);
 }
 
-/*
- * @value: a populated #GValue of a supported #GType
- *
- * Escape the contents of @value to go in a #GKeyFile. Return the
- * value that would go in the keyfile.
- *
- * For instance, for a boolean value TRUE this would return "true",
- * and for a string containing one space, it would return "\s".
- */
-gchar *
-mcd_keyfile_escape_value (const GValue *value)
-{
-  GKeyFile *keyfile;
-  gchar *ret;
-
-  g_return_val_if_fail (G_IS_VALUE (value), NULL);
-
-  keyfile = g_key_file_new ();
-  mcd_keyfile_set_value (keyfile, "g", "k", value);
-  ret = g_key_file_get_value (keyfile, "g", "k", NULL);
-  g_key_file_free (keyfile);
-  return ret;
-}
-
 static gchar *
 mcpa_escape_variant_for_keyfile (const McpAccountManager *unused G_GNUC_UNUSED,
     GVariant *variant)
@@ -1694,148 +2340,6 @@ mcpa_escape_variant_for_keyfile (const McpAccountManager *unused G_GNUC_UNUSED,
   return mcd_keyfile_escape_variant (variant);
 }
 
-/*
- * mcd_keyfile_set_value:
- * @keyfile: a keyfile
- * @name: the name of a group
- * @key: the key in the group
- * @value: the value to be stored (or %NULL to erase it)
- *
- * Copies and stores the supplied @value (or removes it if %NULL) to the
- * internal cache.
- *
- * Returns: a #gboolean indicating whether the cache actually required an
- * update (so that the caller can decide whether to request a commit to
- * long term storage or not). %TRUE indicates the cache was updated and
- * may not be in sync with the store any longer, %FALSE indicates we already
- * held the value supplied.
- */
-gboolean
-mcd_keyfile_set_value (GKeyFile *keyfile,
-    const gchar *name,
-    const gchar *key,
-    const GValue *value)
-{
-  g_return_val_if_fail (name != NULL, FALSE);
-  g_return_val_if_fail (key != NULL, FALSE);
-
-  if (value == NULL)
-    {
-      gchar *old = g_key_file_get_value (keyfile, name, key, NULL);
-      gboolean updated = (old != NULL);
-
-      g_free (old);
-      g_key_file_remove_key (keyfile, name, key, NULL);
-      return updated;
-    }
-  else
-    {
-      gboolean updated = FALSE;
-      gchar *old = g_key_file_get_value (keyfile, name, key, NULL);
-      gchar *new = NULL;
-      gchar *buf = NULL;
-
-      switch (G_VALUE_TYPE (value))
-        {
-          case G_TYPE_STRING:
-            g_key_file_set_string (keyfile, name, key,
-                g_value_get_string (value));
-            break;
-
-          case G_TYPE_UINT:
-            buf = g_strdup_printf ("%u", g_value_get_uint (value));
-            break;
-
-          case G_TYPE_INT:
-            g_key_file_set_integer (keyfile, name, key,
-                g_value_get_int (value));
-            break;
-
-          case G_TYPE_BOOLEAN:
-            g_key_file_set_boolean (keyfile, name, key,
-                g_value_get_boolean (value));
-            break;
-
-          case G_TYPE_UCHAR:
-            buf = g_strdup_printf ("%u", g_value_get_uchar (value));
-            break;
-
-          case G_TYPE_UINT64:
-            buf = g_strdup_printf ("%" G_GUINT64_FORMAT,
-                                   g_value_get_uint64 (value));
-            break;
-
-          case G_TYPE_INT64:
-            buf = g_strdup_printf ("%" G_GINT64_FORMAT,
-                                   g_value_get_int64 (value));
-            break;
-
-          case G_TYPE_DOUBLE:
-            g_key_file_set_double (keyfile, name, key,
-                g_value_get_double (value));
-            break;
-
-          default:
-            if (G_VALUE_HOLDS (value, G_TYPE_STRV))
-              {
-                gchar **strings = g_value_get_boxed (value);
-
-                g_key_file_set_string_list (keyfile, name, key,
-                    (const gchar **)strings,
-                    g_strv_length (strings));
-              }
-            else if (G_VALUE_HOLDS (value, DBUS_TYPE_G_OBJECT_PATH))
-              {
-                g_key_file_set_string (keyfile, name, key,
-                    g_value_get_boxed (value));
-              }
-            else if (G_VALUE_HOLDS (value, TP_ARRAY_TYPE_OBJECT_PATH_LIST))
-              {
-                GPtrArray *arr = g_value_get_boxed (value);
-
-                g_key_file_set_string_list (keyfile, name, key,
-                    (const gchar * const *) arr->pdata, arr->len);
-              }
-            else if (G_VALUE_HOLDS (value, TP_STRUCT_TYPE_SIMPLE_PRESENCE))
-              {
-                guint type;
-                /* enough for "4294967296" + \0 */
-                gchar printf_buf[11];
-                const gchar * strv[4] = { NULL, NULL, NULL, NULL };
-
-                tp_value_array_unpack (g_value_get_boxed (value), 3,
-                    &type,
-                    &(strv[1]),
-                    &(strv[2]));
-                g_snprintf (printf_buf, sizeof (printf_buf), "%u", type);
-                strv[0] = printf_buf;
-
-                g_key_file_set_string_list (keyfile, name, key, strv, 3);
-              }
-            else
-              {
-                g_warning ("Unexpected param type %s",
-                    G_VALUE_TYPE_NAME (value));
-                return FALSE;
-              }
-        }
-
-      if (buf != NULL)
-        g_key_file_set_string (keyfile, name, key, buf);
-
-      new = g_key_file_get_value (keyfile, name, key, NULL);
-
-      if (tp_strdiff (old, new))
-        updated = TRUE;
-
-      g_free (new);
-      g_free (buf);
-      g_free (old);
-
-      return updated;
-    }
-}
-
 /*
  * mcd_storage_create_account:
  * @storage: An object implementing the #McdStorage interface
@@ -1876,8 +2380,13 @@ mcd_storage_create_account (McdStorage *self,
 
           if (!tp_strdiff (mcp_account_storage_provider (plugin), provider))
             {
-              return mcp_account_storage_create (plugin, ma, manager,
+              gchar *ret = mcp_account_storage_create (plugin, ma, manager,
                   protocol, params, error);
+
+              if (ret != NULL)
+                ensure_account (self, ret)->owner = plugin;
+
+              return ret;
             }
         }
 
@@ -1977,6 +2486,142 @@ mcd_storage_delete_account (McdStorage *self,
     }
 }
 
+/*
+ * mcd_storage_begin:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: the unique name of an account
+ *
+ * Start gathering changes to @account's attributes and parameters, so
+ * that they can be passed to the plugin that stores @account in one go
+ * by mcd_storage_end(). Our cache is updated immediately, as usual.
+ * Calls can be nested.
+ */
+void
+mcd_storage_begin (McdStorage *self,
+    const gchar *account)
+{
+  McdStorageAccount *sa;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_return_if_fail (account != NULL);
+
+  sa = ensure_account (self, account);
+
+  if (sa->batch == NULL)
+    {
+      sa->batch = g_slice_new0 (McdStorageBatch);
+      sa->batch->keys = g_ptr_array_new_with_free_func (g_free);
+      sa->batch->changes = g_hash_table_new_full (g_str_hash, g_str_equal,
+          NULL, mcd_storage_change_free);
+    }
+
+  sa->batch->depth++;
+}
+
+/*
+ * mcd_storage_end:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: the unique name of an account
+ *
+ * Undo one call to mcd_storage_begin(). When the outermost call is undone,
+ * pass the changes made since then to the plugins. This does not commit
+ * them to long term storage: mcd_storage_commit() is still required.
+ */
+void
+mcd_storage_end (McdStorage *self,
+    const gchar *account)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (self);
+  McdStorageAccount *sa;
+  McdStorageBatch *batch;
+  gboolean batched = FALSE;
+  guint i;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+  g_return_if_fail (account != NULL);
+
+  sa = lookup_account (self, account);
+
+  /* the account might have been deleted in the meantime, in which case
+   * there's nothing left to do */
+  if (sa == NULL || sa->batch == NULL)
+    return;
+
+  if (--sa->batch->depth > 0)
+    return;
+
+  batch = sa->batch;
+  sa->batch = NULL;
+
+  /* If we know which plugin has the account, offer it everything at once.
+   * Secret parameters are left out: a{smv} has nowhere to put
+   * MCP_PARAMETER_FLAG_SECRET, so they are stored one by one below. */
+  if (sa->owner != NULL && batch->keys->len > 0)
+    {
+      GVariantBuilder builder;
+      GVariant *changes;
+      guint n = 0;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{smv}"));
+
+      for (i = 0; i < batch->keys->len; i++)
+        {
+          const gchar *key = g_ptr_array_index (batch->keys, i);
+          McdStorageChange *change = g_hash_table_lookup (batch->changes,
+              key);
+
+          if (change->secret)
+            continue;
+
+          g_variant_builder_add (&builder, "{smv}", key, change->variant);
+          n++;
+        }
+
+      changes = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+      if (n > 0)
+        batched = mcp_account_storage_set_batch (sa->owner, ma, account,
+            changes);
+
+      g_variant_unref (changes);
+
+      DEBUG ("MCP:%s -> %s %u changes to %s",
+          mcp_account_storage_name (sa->owner),
+          batched ? "store" : "can't store batch of", n, account);
+    }
+
+  for (i = 0; i < batch->keys->len; i++)
+    {
+      const gchar *key = g_ptr_array_index (batch->keys, i);
+      McdStorageChange *change = g_hash_table_lookup (batch->changes, key);
+      GList *store;
+
+      /* Otherwise do it the slow way */
+      if (!batched || change->secret)
+        {
+          update_storage (self, account, key, change->variant, change->escaped,
+              change->secret);
+          continue;
+        }
+
+      /* as in update_storage(), plugins below the owner forget their copy
+       * of a new value, and deletions go to everyone */
+      if (change->variant != NULL)
+        {
+          delete_from_lower_storage (self, sa->owner, account, key);
+          continue;
+        }
+
+      for (store = stores; store != NULL; store = g_list_next (store))
+        {
+          if (store->data != sa->owner)
+            mcp_account_storage_delete (store->data, ma, account, key);
+        }
+    }
+
+  mcd_storage_batch_free (batch);
+}
+
 /*
  * mcd_storage_commit:
  * @storage: An object implementing the #McdStorage interface
@@ -1998,19 +2643,209 @@ mcd_storage_commit (McdStorage *self, const gchar *account)
       McpAccountStorage *plugin = store->data;
       const gchar *pname = mcp_account_storage_name (plugin);
 
+      gboolean ok;
+
       if (account != NULL)
         {
           DEBUG ("flushing plugin %s %s to long term storage", pname, account);
-          mcp_account_storage_commit_one (plugin, ma, account);
+          ok = mcp_account_storage_commit_one (plugin, ma, account);
         }
       else
         {
           DEBUG ("flushing plugin %s to long term storage", pname);
-          mcp_account_storage_commit (plugin, ma);
+          ok = mcp_account_storage_commit (plugin, ma);
+        }
+
+      if (!ok)
+        {
+          DEBUG ("plugin %s failed to commit", pname);
+          self->commit_failed = TRUE;
         }
     }
 }
 
+typedef struct {
+    /* owned, the account to commit, or NULL for all accounts */
+    gchar *account;
+    /* number of plugins that haven't finished committing yet */
+    guint pending;
+    /* the first error, if any */
+    GError *error;
+} CommitData;
+
+static void
+commit_data_free (gpointer p)
+{
+  CommitData *data = p;
+
+  g_free (data->account);
+  g_clear_error (&data->error);
+  g_slice_free (CommitData, data);
+}
+
+static void storage_commit_start (GTask *task);
+
+static void
+storage_commit_done (GTask *task)
+{
+  McdStorage *self;
+  CommitData *data = g_task_get_task_data (task);
+  gchar *key;
+  GQueue *queue;
+  GTask *next;
+
+  if (--data->pending > 0)
+    return;
+
+  /* popping the task might release the last ref to either of these */
+  self = g_object_ref (g_task_get_source_object (task));
+  key = g_strdup (data->account == NULL ? "" : data->account);
+
+  if (data->error != NULL)
+    {
+      g_task_return_error (task, data->error);
+      data->error = NULL;
+    }
+  else
+    {
+      g_task_return_boolean (task, TRUE);
+    }
+
+  /* let the next commit for the same account proceed, if any */
+  queue = g_hash_table_lookup (self->commits, key);
+  g_assert (queue != NULL);
+  g_assert (g_queue_peek_head (queue) == task);
+  g_object_unref (g_queue_pop_head (queue));
+  next = g_queue_peek_head (queue);
+
+  if (next == NULL)
+    {
+      g_queue_free (queue);
+      g_hash_table_remove (self->commits, key);
+    }
+  else
+    {
+      storage_commit_start (next);
+    }
+
+  g_free (key);
+  g_object_unref (self);
+}
+
+static void
+storage_commit_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  McpAccountStorage *plugin = MCP_ACCOUNT_STORAGE (source);
+  GTask *task = user_data;
+  McdStorage *self = g_task_get_source_object (task);
+  CommitData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  if (!mcp_account_storage_commit_finish (plugin, result, &error))
+    {
+      DEBUG ("plugin %s failed to commit: %s",
+          mcp_account_storage_name (plugin), error->message);
+      self->commit_failed = TRUE;
+
+      if (data->error == NULL)
+        data->error = error;
+      else
+        g_error_free (error);
+    }
+
+  storage_commit_done (task);
+  g_object_unref (task);
+}
+
+static void
+storage_commit_start (GTask *task)
+{
+  McpAccountManager *ma = MCP_ACCOUNT_MANAGER (
+      g_task_get_source_object (task));
+  CommitData *data = g_task_get_task_data (task);
+  GList *store;
+
+  /* don't finish until we've started committing every plugin */
+  data->pending = 1;
+
+  for (store = stores; store != NULL; store = g_list_next (store))
+    {
+      McpAccountStorage *plugin = store->data;
+
+      DEBUG ("flushing plugin %s %s to long term storage",
+          mcp_account_storage_name (plugin),
+          data->account == NULL ? "(all accounts)" : data->account);
+      data->pending++;
+      mcp_account_storage_commit_async (plugin, ma, data->account, NULL,
+          storage_commit_cb, g_object_ref (task));
+    }
+
+  storage_commit_done (task);
+}
+
+/*
+ * mcd_storage_commit_async:
+ * @storage: An object implementing the #McdStorage interface
+ * @account: (allow-none): the unique name of an account, or %NULL for
+ *  all accounts
+ * @callback: called when every plugin has finished
+ * @user_data: data for @callback
+ *
+ * Like mcd_storage_commit(), but without blocking while plugins write to
+ * long term storage. All the plugins are asked at once, but a commit
+ * doesn't start until the previous commit for the same @account has
+ * finished, so a plugin never has two commits for one account in flight.
+ */
+void
+mcd_storage_commit_async (McdStorage *self,
+    const gchar *account,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  const gchar *key = (account == NULL ? "" : account);
+  GTask *task;
+  CommitData *data;
+  GQueue *queue;
+
+  g_return_if_fail (MCD_IS_STORAGE (self));
+
+  task = g_task_new (self, NULL, callback, user_data);
+  g_task_set_source_tag (task, mcd_storage_commit_async);
+  data = g_slice_new0 (CommitData);
+  data->account = g_strdup (account);
+  g_task_set_task_data (task, data, commit_data_free);
+
+  /* the queue takes ownership of the task */
+  queue = g_hash_table_lookup (self->commits, key);
+
+  if (queue != NULL)
+    {
+      DEBUG ("a commit for %s is already in progress, queueing another",
+          account == NULL ? "(all accounts)" : account);
+      g_queue_push_tail (queue, task);
+      return;
+    }
+
+  queue = g_queue_new ();
+  g_hash_table_insert (self->commits, g_strdup (key), queue);
+  g_queue_push_tail (queue, task);
+  storage_commit_start (task);
+}
+
+gboolean
+mcd_storage_commit_finish (McdStorage *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result,
+        mcd_storage_commit_async), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /*
  * mcd_storage_set_strv:
  * @storage: An object implementing the #McdStorage interface
@@ -2098,5 +2933,6 @@ mcd_storage_add_account_from_plugin (McdStorage *self,
       return FALSE;
     }
 
+  ensure_account (self, account)->owner = plugin;
   return TRUE;
 }
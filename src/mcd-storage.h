@@ -32,6 +32,16 @@ typedef struct {
   TpDBusDaemon *dbusd;
   /* owned string => owned McdStorageAccount */
   GHashTable *accounts;
+  /* owned a(ss) describing the plugins' data when the snapshot on disk
+   * was taken, or NULL if we can't take one */
+  GVariant *snapshot_stamps;
+  /* owned string (an account name, or "" for all accounts) => owned GQueue
+   * of owned GTask from mcd_storage_commit_async(); the head of each queue
+   * is in progress, the rest wait for it */
+  GHashTable *commits;
+  /* TRUE if a plugin has failed to commit since the accounts were loaded,
+   * in which case its stamp might not match what it really stored */
+  gboolean commit_failed;
 } McdStorage;
 
 typedef struct _McdStorageClass McdStorageClass;
@@ -63,6 +73,12 @@ void mcd_storage_connect_signal (const gchar *signal,
     gpointer user_data);
 
 void mcd_storage_load (McdStorage *storage);
+void mcd_storage_load_async (McdStorage *storage,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean mcd_storage_load_finish (McdStorage *storage,
+    GAsyncResult *result,
+    GError **error);
 
 GStrv mcd_storage_dup_accounts (McdStorage *storage, gsize *n);
 
@@ -100,7 +116,17 @@ gchar *mcd_storage_create_account (McdStorage *storage,
 
 void mcd_storage_delete_account (McdStorage *storage, const gchar *account);
 
+void mcd_storage_begin (McdStorage *storage, const gchar *account);
+void mcd_storage_end (McdStorage *storage, const gchar *account);
+
 void mcd_storage_commit (McdStorage *storage, const gchar *account);
+void mcd_storage_commit_async (McdStorage *storage,
+    const gchar *account,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean mcd_storage_commit_finish (McdStorage *storage,
+    GAsyncResult *result,
+    GError **error);
 
 gchar *mcd_storage_dup_string (McdStorage *storage,
     const gchar *account,
@@ -135,21 +161,6 @@ gboolean mcd_storage_add_account_from_plugin (McdStorage *storage,
     McpAccountStorage *plugin,
     const gchar *account);
 
-gboolean mcd_keyfile_get_value (GKeyFile *keyfile,
-    const gchar *group,
-    const gchar *key,
-    GValue *value,
-    GError **error);
-gboolean mcd_keyfile_set_value (GKeyFile *keyfile,
-    const gchar *name,
-    const gchar *key,
-    const GValue *value);
-
-gchar *mcd_keyfile_escape_value (const GValue *value);
-gboolean mcd_keyfile_unescape_value (const gchar *escaped,
-    GValue *value,
-    GError **error);
-
 const gchar *mcd_storage_get_attribute_type (const gchar *attribute);
 gboolean mcd_storage_init_value_for_attribute (GValue *value,
     const gchar *attribute);
@@ -984,7 +984,7 @@ _mcd_request_cancel (McdRequest *self,
 static TpClient *
 guess_request_handler (McdRequest *self)
 {
-  GList *sorted_handlers;
+  McdClientProxy *predicted;
   GVariant *properties;
 
   if (!tp_str_empty (self->preferred_handler))
@@ -997,20 +997,11 @@ guess_request_handler (McdRequest *self)
     }
 
   properties = mcd_request_dup_properties (self);
-  sorted_handlers = _mcd_client_registry_list_possible_handlers (
-      self->clients, self->preferred_handler, properties,
-      NULL, NULL);
+  predicted = _mcd_client_registry_predict_handler (self->clients,
+      self->preferred_handler, properties);
   g_variant_unref (properties);
 
-  if (sorted_handlers != NULL)
-    {
-      McdClientProxy *first = sorted_handlers->data;
-
-      g_list_free (sorted_handlers);
-      return (TpClient *) first;
-    }
-
-  return NULL;
+  return (TpClient *) predicted;
 }
 
 void
@@ -0,0 +1,172 @@
+/*
+ * client-file-benchmark: how long it takes to find and parse a large
+ * number of .client files, as the client registry does at startup, with
+ * and without the cache left behind by the previous run
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-client-file-index.h"
+
+#define DEFAULT_CLIENTS 200
+#define ITERATIONS 5
+
+static void
+write_clients (const gchar *dir,
+    guint n_clients)
+{
+  guint i;
+
+  g_mkdir_with_parents (dir, 0700);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      gchar *filename = g_strdup_printf ("%s/Client%u.client", dir, i);
+      gchar *data = g_strdup_printf (
+          "[" TP_IFACE_CLIENT "]\n"
+          "Interfaces=" TP_IFACE_CLIENT_HANDLER ";"
+            TP_IFACE_CLIENT_OBSERVER ";\n"
+          "\n"
+          "[" TP_IFACE_CLIENT_HANDLER "]\n"
+          "BypassApproval=%s\n"
+          "\n"
+          "[" TP_IFACE_CLIENT_HANDLER ".HandlerChannelFilter 0]\n"
+          TP_PROP_CHANNEL_CHANNEL_TYPE " s=" TP_IFACE_CHANNEL_TYPE_TEXT "\n"
+          TP_PROP_CHANNEL_TARGET_HANDLE_TYPE " u=1\n"
+          "\n"
+          "[" TP_IFACE_CLIENT_HANDLER ".HandlerChannelFilter 1]\n"
+          TP_PROP_CHANNEL_CHANNEL_TYPE " s="
+            TP_IFACE_CHANNEL_TYPE_STREAM_TUBE "\n"
+          TP_PROP_CHANNEL_TYPE_STREAM_TUBE_SERVICE " s=x-service-%u\n"
+          "\n"
+          "[" TP_IFACE_CLIENT_OBSERVER ".ObserverChannelFilter 0]\n"
+          TP_PROP_CHANNEL_CHANNEL_TYPE " s=" TP_IFACE_CHANNEL_TYPE_CALL "\n"
+          TP_PROP_CHANNEL_REQUESTED " b=false\n"
+          "\n"
+          "[" TP_IFACE_CLIENT_HANDLER ".Capabilities]\n"
+          "com.example.Token%u=true\n",
+          (i % 2) ? "true" : "false", i, i);
+
+      if (!g_file_set_contents (filename, data, -1, NULL))
+        g_error ("unable to write %s", filename);
+
+      g_free (data);
+      g_free (filename);
+    }
+}
+
+/* Returns how long it took to look up every client, in microseconds */
+static gint64
+load (guint n_clients)
+{
+  gint64 start = g_get_monotonic_time ();
+  McdClientFileIndex *index = _mcd_client_file_index_new ();
+  gint64 elapsed;
+  guint i;
+
+  for (i = 0; i < n_clients; i++)
+    {
+      gchar *name = g_strdup_printf ("Client%u", i);
+
+      if (_mcd_client_file_index_lookup (index, name) == NULL)
+        g_error ("no .client file found for %s", name);
+
+      g_free (name);
+    }
+
+  elapsed = g_get_monotonic_time () - start;
+
+  /* as the client registry does when it's ready; not counted, because
+   * it happens after startup */
+  _mcd_client_file_index_save_cache (index);
+  _mcd_client_file_index_unref (index);
+  return elapsed;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint n_clients = DEFAULT_CLIENTS;
+  gchar *tmpdir;
+  gchar *clients_dir;
+  gchar *cache_home;
+  gchar *cache;
+  gint64 parse = 0, cached = 0;
+  guint i;
+
+  if (argc > 1)
+    n_clients = atoi (argv[1]);
+
+  g_type_init ();
+
+  tmpdir = g_dir_make_tmp ("mc-client-file-benchmark-XXXXXX", NULL);
+  clients_dir = g_build_filename (tmpdir, "clients", NULL);
+  cache_home = g_build_filename (tmpdir, "cache", NULL);
+  cache = g_build_filename (cache_home, "telepathy", "mission-control",
+      "clients.cache", NULL);
+
+  g_setenv ("MC_CLIENTS_DIR", clients_dir, TRUE);
+  g_setenv ("XDG_DATA_HOME", tmpdir, TRUE);
+  g_setenv ("XDG_DATA_DIRS", tmpdir, TRUE);
+  g_setenv ("XDG_CACHE_HOME", cache_home, TRUE);
+
+  write_clients (clients_dir, n_clients);
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      g_unlink (cache);
+      parse += load (n_clients);
+      cached += load (n_clients);
+    }
+
+  g_print ("%8s %12s %12s\n", "clients", "parse-ms", "cache-ms");
+  g_print ("%8u %12.2f %12.2f\n", n_clients,
+      parse / (ITERATIONS * 1000.0), cached / (ITERATIONS * 1000.0));
+
+  if (!g_file_test (cache, G_FILE_TEST_EXISTS))
+    g_printerr ("warning: no cache was written, so both columns measure "
+        "the same thing\n");
+
+  g_unlink (cache);
+
+  for (i = 0; i < n_clients; i++)
+    {
+      gchar *filename = g_strdup_printf ("%s/Client%u.client", clients_dir,
+          i);
+
+      g_unlink (filename);
+      g_free (filename);
+    }
+
+  g_free (cache);
+  g_free (cache_home);
+  g_free (clients_dir);
+  g_free (tmpdir);
+  return 0;
+}
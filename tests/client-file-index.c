@@ -0,0 +1,425 @@
+/*
+ * Regression test for the .client file index: it must find the same file
+ * as searching the directories in order would, and notice when files
+ * appear, change and disappear; and for its cache
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <utime.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-client-file-index.h"
+
+/* how long to wait for the file monitor to tell us about a change */
+#define TIMEOUT_USEC (5 * G_USEC_PER_SEC)
+
+static gchar *clients_dir;
+static gchar *data_clients_dir;
+
+static gchar *
+write_client (const gchar *dir,
+    const gchar *name,
+    const gchar *interfaces,
+    const gchar *extra)
+{
+  gchar *path = g_strdup_printf ("%s/%s.client", dir, name);
+  gchar *contents = g_strdup_printf (
+      "[" TP_IFACE_CLIENT "]\n"
+      "Interfaces=%s;\n"
+      "\n"
+      "[" TP_IFACE_CLIENT_HANDLER ".HandlerChannelFilter 0]\n"
+      TP_PROP_CHANNEL_CHANNEL_TYPE " s=" TP_IFACE_CHANNEL_TYPE_TEXT "\n"
+      TP_PROP_CHANNEL_TARGET_HANDLE_TYPE " u=1\n"
+      "%s",
+      interfaces, extra);
+
+  g_assert (g_file_set_contents (path, contents, -1, NULL));
+  g_free (contents);
+  return path;
+}
+
+/* Returns TRUE if looking up @name gives a file with @bypass_approval, or
+ * no file if @present is FALSE, before the timeout */
+static gboolean
+wait_for (McdClientFileIndex *index,
+    const gchar *name,
+    gboolean present,
+    gboolean bypass_approval)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_USEC;
+
+  while (g_get_monotonic_time () < deadline)
+    {
+      const McdClientFile *file = _mcd_client_file_index_lookup (index,
+          name);
+
+      if (!present && file == NULL)
+        return TRUE;
+
+      if (present && file != NULL &&
+          file->bypass_approval == bypass_approval)
+        return TRUE;
+
+      g_usleep (G_USEC_PER_SEC / 100);
+
+      while (g_main_context_iteration (NULL, FALSE))
+        ;
+    }
+
+  return FALSE;
+}
+
+static void
+test_parse (void)
+{
+  McdClientFileIndex *index;
+  const McdClientFile *file;
+  gchar *path;
+  GHashTable *filter;
+
+  path = write_client (clients_dir, "Parsed",
+      TP_IFACE_CLIENT_HANDLER ";" TP_IFACE_CLIENT_OBSERVER,
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassApproval=true\n"
+      "\n[" TP_IFACE_CLIENT_HANDLER ".Capabilities]\n"
+      "com.example.Foo=true\n");
+  index = _mcd_client_file_index_new ();
+
+  file = _mcd_client_file_index_lookup (index, "Parsed");
+  g_assert (file != NULL);
+  g_assert (tp_strv_contains ((const gchar * const *) file->interfaces,
+        TP_IFACE_CLIENT_HANDLER));
+  g_assert (file->bypass_approval);
+  g_assert (!file->bypass_observers);
+  g_assert_cmpuint (g_strv_length (file->capability_tokens), ==, 1);
+  g_assert_cmpstr (file->capability_tokens[0], ==, "com.example.Foo");
+
+  /* only the filters for interfaces it says it has */
+  g_assert (file->approver_filters == NULL);
+  g_assert (file->observer_filters == NULL);
+  g_assert_cmpuint (g_list_length (file->handler_filters), ==, 1);
+  filter = file->handler_filters->data;
+  g_assert_cmpuint (g_hash_table_size (filter), ==, 2);
+  g_assert_cmpstr (tp_asv_get_string (filter, TP_PROP_CHANNEL_CHANNEL_TYPE),
+      ==, TP_IFACE_CHANNEL_TYPE_TEXT);
+  g_assert_cmpuint (tp_asv_get_uint64 (filter,
+        TP_PROP_CHANNEL_TARGET_HANDLE_TYPE, NULL), ==, 1);
+
+  /* the same parsed file is used every time */
+  g_assert (_mcd_client_file_index_lookup (index, "Parsed") == file);
+
+  g_assert (_mcd_client_file_index_lookup (index, "Missing") == NULL);
+
+  _mcd_client_file_index_unref (index);
+  g_unlink (path);
+  g_free (path);
+}
+
+/* $MC_CLIENTS_DIR wins over $XDG_DATA_HOME */
+static void
+test_precedence (void)
+{
+  McdClientFileIndex *index;
+  const McdClientFile *file;
+  gchar *first = write_client (clients_dir, "Both",
+      TP_IFACE_CLIENT_HANDLER,
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassApproval=true\n");
+  gchar *second = write_client (data_clients_dir, "Both",
+      TP_IFACE_CLIENT_HANDLER, "");
+
+  index = _mcd_client_file_index_new ();
+  file = _mcd_client_file_index_lookup (index, "Both");
+  g_assert (file != NULL);
+  g_assert (file->bypass_approval);
+
+  /* when it's deleted, the other one takes over */
+  g_unlink (first);
+  g_assert (wait_for (index, "Both", TRUE, FALSE));
+
+  _mcd_client_file_index_unref (index);
+  g_unlink (second);
+  g_free (first);
+  g_free (second);
+}
+
+/* Something that isn't a regular file doesn't hide a later directory's
+ * .client file */
+static void
+test_not_regular (void)
+{
+  McdClientFileIndex *index;
+  const McdClientFile *file;
+  gchar *first = g_build_filename (clients_dir, "NotAFile.client", NULL);
+  gchar *second = write_client (data_clients_dir, "NotAFile",
+      TP_IFACE_CLIENT_HANDLER,
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassApproval=true\n");
+
+  g_assert_cmpint (g_mkdir (first, 0700), ==, 0);
+
+  index = _mcd_client_file_index_new ();
+  file = _mcd_client_file_index_lookup (index, "NotAFile");
+  g_assert (file != NULL);
+  g_assert (file->bypass_approval);
+  _mcd_client_file_index_unref (index);
+
+  g_rmdir (first);
+  g_unlink (second);
+  g_free (first);
+  g_free (second);
+}
+
+static void
+test_changes (void)
+{
+  McdClientFileIndex *index = _mcd_client_file_index_new ();
+  gchar *path;
+
+  g_assert (_mcd_client_file_index_lookup (index, "Changing") == NULL);
+
+  path = write_client (data_clients_dir, "Changing",
+      TP_IFACE_CLIENT_HANDLER, "");
+  g_assert (wait_for (index, "Changing", TRUE, FALSE));
+
+  g_free (write_client (data_clients_dir, "Changing",
+      TP_IFACE_CLIENT_HANDLER,
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassApproval=true\n"));
+  g_assert (wait_for (index, "Changing", TRUE, TRUE));
+
+  g_unlink (path);
+  g_assert (wait_for (index, "Changing", FALSE, FALSE));
+
+  _mcd_client_file_index_unref (index);
+  g_free (path);
+}
+
+/* What one index parsed, the next can load from the cache, unless the
+ * file has changed in the meantime */
+static void
+test_cache (void)
+{
+  McdClientFileIndex *index;
+  const McdClientFile *file;
+  gchar *path = write_client (clients_dir, "Cached",
+      TP_IFACE_CLIENT_HANDLER ";" TP_IFACE_CLIENT_APPROVER,
+      "\n[" TP_IFACE_CLIENT_APPROVER ".ApproverChannelFilter 0]\n"
+      TP_PROP_CHANNEL_TARGET_HANDLE_TYPE " u=2\n"
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassObservers=true\n");
+  gchar *cache = g_build_filename (g_get_user_cache_dir (), "telepathy",
+      "mission-control", "clients.cache", NULL);
+  GHashTable *filter;
+  GStatBuf st;
+  struct utimbuf times;
+
+  g_unlink (cache);
+
+  index = _mcd_client_file_index_new ();
+  g_assert (_mcd_client_file_index_lookup (index, "Cached") != NULL);
+  _mcd_client_file_index_save_cache (index);
+  _mcd_client_file_index_unref (index);
+  g_assert (g_file_test (cache, G_FILE_TEST_IS_REGULAR));
+
+  index = _mcd_client_file_index_new ();
+  file = _mcd_client_file_index_lookup (index, "Cached");
+  g_assert (file != NULL);
+  g_assert_cmpuint (g_strv_length (file->interfaces), ==, 2);
+  g_assert (file->bypass_observers);
+  g_assert (!file->bypass_approval);
+  g_assert (file->capability_tokens == NULL);
+  g_assert (file->observer_filters == NULL);
+  g_assert_cmpuint (g_list_length (file->handler_filters), ==, 1);
+  g_assert_cmpuint (g_list_length (file->approver_filters), ==, 1);
+  filter = file->approver_filters->data;
+  g_assert_cmpuint (g_hash_table_size (filter), ==, 1);
+  g_assert_cmpuint (tp_asv_get_uint64 (filter,
+        TP_PROP_CHANNEL_TARGET_HANDLE_TYPE, NULL), ==, 2);
+  _mcd_client_file_index_unref (index);
+
+  /* a different size means the cached copy is out of date */
+  g_free (write_client (clients_dir, "Cached", TP_IFACE_CLIENT_HANDLER, ""));
+
+  index = _mcd_client_file_index_new ();
+  file = _mcd_client_file_index_lookup (index, "Cached");
+  g_assert (file != NULL);
+  g_assert_cmpuint (g_strv_length (file->interfaces), ==, 1);
+  g_assert (!file->bypass_observers);
+  g_assert (file->approver_filters == NULL);
+  _mcd_client_file_index_unref (index);
+
+  /* so does a file that was replaced by one of the same size, even if its
+   * mtime is the same to the second */
+  g_free (write_client (clients_dir, "Cached", TP_IFACE_CLIENT_HANDLER,
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassApproval=0\n"));
+  g_assert (g_stat (path, &st) == 0);
+
+  index = _mcd_client_file_index_new ();
+  file = _mcd_client_file_index_lookup (index, "Cached");
+  g_assert (file != NULL);
+  g_assert (!file->bypass_approval);
+  _mcd_client_file_index_save_cache (index);
+  _mcd_client_file_index_unref (index);
+
+  g_free (write_client (clients_dir, "Cached", TP_IFACE_CLIENT_HANDLER,
+      "\n[" TP_IFACE_CLIENT_HANDLER "]\nBypassApproval=1\n"));
+  times.actime = st.st_atime;
+  times.modtime = st.st_mtime;
+  g_assert (g_utime (path, &times) == 0);
+
+  index = _mcd_client_file_index_new ();
+  file = _mcd_client_file_index_lookup (index, "Cached");
+  g_assert (file != NULL);
+  g_assert (file->bypass_approval);
+  _mcd_client_file_index_unref (index);
+
+  g_unlink (cache);
+  g_unlink (path);
+  g_free (cache);
+  g_free (path);
+}
+
+/* Returns TRUE if the cache on disk mentions @path */
+static gboolean
+cache_mentions (const gchar *cache,
+    const gchar *path)
+{
+  gchar *contents;
+  gsize len;
+  gsize path_len = strlen (path);
+  gsize i;
+  gboolean found = FALSE;
+
+  g_assert (g_file_get_contents (cache, &contents, &len, NULL));
+
+  for (i = 0; i + path_len <= len && !found; i++)
+    found = (memcmp (contents + i, path, path_len) == 0);
+
+  g_free (contents);
+  return found;
+}
+
+/* Files that have gone away aren't carried over into the next cache */
+static void
+test_cache_prune (void)
+{
+  McdClientFileIndex *index;
+  gchar *kept = write_client (clients_dir, "Kept", TP_IFACE_CLIENT_HANDLER,
+      "");
+  gchar *gone = write_client (clients_dir, "Gone", TP_IFACE_CLIENT_HANDLER,
+      "");
+  gchar *added;
+  gchar *cache = g_build_filename (g_get_user_cache_dir (), "telepathy",
+      "mission-control", "clients.cache", NULL);
+
+  g_unlink (cache);
+
+  index = _mcd_client_file_index_new ();
+  g_assert (_mcd_client_file_index_lookup (index, "Kept") != NULL);
+  g_assert (_mcd_client_file_index_lookup (index, "Gone") != NULL);
+  _mcd_client_file_index_save_cache (index);
+  _mcd_client_file_index_unref (index);
+  g_assert (cache_mentions (cache, kept));
+  g_assert (cache_mentions (cache, gone));
+
+  g_unlink (gone);
+  /* a file that isn't in the cache yet, so the cache is saved again */
+  added = write_client (clients_dir, "Added", TP_IFACE_CLIENT_HANDLER, "");
+
+  index = _mcd_client_file_index_new ();
+  g_assert (_mcd_client_file_index_lookup (index, "Added") != NULL);
+  _mcd_client_file_index_save_cache (index);
+  _mcd_client_file_index_unref (index);
+  g_assert (cache_mentions (cache, added));
+  /* not looked up in this run, but still there */
+  g_assert (cache_mentions (cache, kept));
+  g_assert (!cache_mentions (cache, gone));
+
+  g_unlink (cache);
+  g_unlink (kept);
+  g_unlink (added);
+  g_free (cache);
+  g_free (kept);
+  g_free (gone);
+  g_free (added);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  gchar *tmpdir;
+  gchar *data_home;
+  gchar *cache_home;
+  gchar *path;
+  int ret;
+
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  tmpdir = g_dir_make_tmp ("mc-client-file-index-XXXXXX", NULL);
+  g_assert (tmpdir != NULL);
+  clients_dir = g_build_filename (tmpdir, "clients", NULL);
+  data_home = g_build_filename (tmpdir, "data", NULL);
+  data_clients_dir = g_build_filename (data_home, "telepathy", "clients",
+      NULL);
+  g_mkdir_with_parents (clients_dir, 0700);
+  g_mkdir_with_parents (data_clients_dir, 0700);
+
+  g_setenv ("MC_CLIENTS_DIR", clients_dir, TRUE);
+  g_setenv ("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv ("XDG_DATA_DIRS", tmpdir, TRUE);
+  cache_home = g_build_filename (tmpdir, "cache", NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_home, TRUE);
+
+  g_test_add_func ("/client-file-index/parse", test_parse);
+  g_test_add_func ("/client-file-index/precedence", test_precedence);
+  g_test_add_func ("/client-file-index/not-regular", test_not_regular);
+  g_test_add_func ("/client-file-index/changes", test_changes);
+  g_test_add_func ("/client-file-index/cache", test_cache);
+  g_test_add_func ("/client-file-index/cache-prune", test_cache_prune);
+
+  ret = g_test_run ();
+
+  g_rmdir (data_clients_dir);
+  g_rmdir (clients_dir);
+  path = g_build_filename (data_home, "telepathy", NULL);
+  g_rmdir (path);
+  g_free (path);
+  g_rmdir (data_home);
+  path = g_build_filename (cache_home, "telepathy", "mission-control",
+      NULL);
+  g_rmdir (path);
+  g_free (path);
+  path = g_build_filename (cache_home, "telepathy", NULL);
+  g_rmdir (path);
+  g_free (path);
+  g_rmdir (cache_home);
+  g_rmdir (tmpdir);
+  g_free (data_clients_dir);
+  g_free (clients_dir);
+  g_free (data_home);
+  g_free (cache_home);
+  g_free (tmpdir);
+  return ret;
+}
@@ -0,0 +1,331 @@
+/*
+ * Regression test for the channel filter index: it must find exactly the
+ * same matches, with the same quality, as trying every filter; and for
+ * the match records it uses, which must behave like tp_vardict_get_*()
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-client-priv.h"
+#include "mcd-filter-index.h"
+
+#define N_OWNERS 200
+#define N_CHANNELS 1000
+#define EXTRA_PROPERTY "org.example.Channel.Interface.Extra.Colour"
+
+static const gchar * const channel_types[] = {
+    TP_IFACE_CHANNEL_TYPE_TEXT,
+    TP_IFACE_CHANNEL_TYPE_CALL,
+    TP_IFACE_CHANNEL_TYPE_FILE_TRANSFER,
+    TP_IFACE_CHANNEL_TYPE_STREAM_TUBE,
+    NULL
+};
+
+static const gchar * const colours[] = { "red", "green", NULL };
+
+static const gchar *
+pick (GRand *rand,
+    const gchar * const *strv)
+{
+  return strv[g_rand_int_range (rand, 0, g_strv_length ((gchar **) strv))];
+}
+
+/* The sort of filters clients really have, plus a few odd ones to make
+ * sure they end up in the wildcard buckets */
+static GHashTable *
+random_filter (GRand *rand)
+{
+  GHashTable *filter = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) tp_g_value_slice_free);
+  GValue *value;
+
+  if (g_rand_boolean (rand))
+    {
+      if (g_rand_int_range (rand, 0, 20) == 0)
+        {
+          value = tp_g_value_slice_new_static_object_path (
+              "/not/a/string");
+        }
+      else
+        {
+          value = tp_g_value_slice_new_static_string (
+              pick (rand, channel_types));
+        }
+
+      g_hash_table_insert (filter, g_strdup (TP_PROP_CHANNEL_CHANNEL_TYPE),
+          value);
+    }
+
+  if (g_rand_boolean (rand))
+    {
+      switch (g_rand_int_range (rand, 0, 4))
+        {
+          case 0:
+            value = tp_g_value_slice_new_int64 (-1);
+            break;
+
+          case 1:
+            value = tp_g_value_slice_new_int64 (
+                g_rand_int_range (rand, 0, 3));
+            break;
+
+          default:
+            value = tp_g_value_slice_new_uint64 (
+                g_rand_int_range (rand, 0, 3));
+            break;
+        }
+
+      g_hash_table_insert (filter,
+          g_strdup (TP_PROP_CHANNEL_TARGET_HANDLE_TYPE), value);
+    }
+
+  if (g_rand_boolean (rand))
+    g_hash_table_insert (filter, g_strdup (TP_PROP_CHANNEL_REQUESTED),
+        tp_g_value_slice_new_boolean (g_rand_boolean (rand)));
+
+  if (g_rand_int_range (rand, 0, 4) == 0)
+    g_hash_table_insert (filter, g_strdup (EXTRA_PROPERTY),
+        tp_g_value_slice_new_static_string (pick (rand, colours)));
+
+  return filter;
+}
+
+static GVariant *
+random_channel (GRand *rand)
+{
+  GVariantDict dict;
+
+  g_variant_dict_init (&dict, NULL);
+
+  if (g_rand_int_range (rand, 0, 10) != 0)
+    g_variant_dict_insert (&dict, TP_PROP_CHANNEL_CHANNEL_TYPE, "s",
+        pick (rand, channel_types));
+
+  if (g_rand_int_range (rand, 0, 10) != 0)
+    g_variant_dict_insert (&dict, TP_PROP_CHANNEL_TARGET_HANDLE_TYPE, "u",
+        (guint32) g_rand_int_range (rand, 0, 3));
+
+  if (g_rand_int_range (rand, 0, 10) != 0)
+    g_variant_dict_insert (&dict, TP_PROP_CHANNEL_REQUESTED, "b",
+        g_rand_boolean (rand));
+
+  if (g_rand_boolean (rand))
+    g_variant_dict_insert (&dict, EXTRA_PROPERTY, "s", pick (rand, colours));
+
+  return g_variant_ref_sink (g_variant_dict_end (&dict));
+}
+
+static void
+free_filters (gpointer p)
+{
+  g_list_free_full (p, (GDestroyNotify) g_hash_table_unref);
+}
+
+static void
+check_matches (McdFilterIndex *index,
+    GList **filters,
+    GVariant *channel,
+    gboolean assume_requested)
+{
+  McdMatchRecord *record = _mcd_match_record_new (channel);
+  GHashTable *matches = _mcd_filter_index_match (index, record,
+      assume_requested);
+  guint n_expected = 0;
+  guint i;
+
+  for (i = 0; i < N_OWNERS; i++)
+    {
+      guint expected = _mcd_client_match_filters (channel, filters[i],
+          assume_requested);
+      gpointer owner = GUINT_TO_POINTER (i + 1);
+
+      g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (matches,
+              owner)), ==, expected);
+
+      if (expected > 0)
+        n_expected++;
+    }
+
+  /* ... and nothing else */
+  g_assert_cmpuint (g_hash_table_size (matches), ==, n_expected);
+  g_hash_table_unref (matches);
+  _mcd_match_record_free (record);
+}
+
+static void
+test_same_as_linear (void)
+{
+  GRand *rand = g_rand_new_with_seed (42);
+  McdFilterIndex *index = _mcd_filter_index_new ();
+  GList *filters[N_OWNERS];
+  guint i, j;
+
+  for (i = 0; i < N_OWNERS; i++)
+    {
+      guint n = g_rand_int_range (rand, 0, 4);
+
+      filters[i] = NULL;
+
+      for (j = 0; j < n; j++)
+        filters[i] = g_list_prepend (filters[i], random_filter (rand));
+
+      _mcd_filter_index_set (index, GUINT_TO_POINTER (i + 1), filters[i]);
+    }
+
+  for (i = 0; i < N_CHANNELS; i++)
+    {
+      GVariant *channel = random_channel (rand);
+
+      check_matches (index, filters, channel, FALSE);
+      check_matches (index, filters, channel, TRUE);
+      g_variant_unref (channel);
+
+      /* clients come and go, and change their filters */
+      if (i % 10 == 0)
+        {
+          guint which = g_rand_int_range (rand, 0, N_OWNERS);
+
+          free_filters (filters[which]);
+          filters[which] = NULL;
+
+          if (g_rand_boolean (rand))
+            filters[which] = g_list_prepend (NULL, random_filter (rand));
+
+          _mcd_filter_index_set (index, GUINT_TO_POINTER (which + 1),
+              filters[which]);
+        }
+    }
+
+  _mcd_filter_index_free (index);
+
+  for (i = 0; i < N_OWNERS; i++)
+    free_filters (filters[i]);
+
+  g_rand_free (rand);
+}
+
+/* The empty filter matches everything, even a channel with no
+ * properties at all. */
+static void
+test_empty_filter (void)
+{
+  McdFilterIndex *index = _mcd_filter_index_new ();
+  GList *filters = g_list_prepend (NULL, g_hash_table_new (g_str_hash,
+        g_str_equal));
+  GVariant *channel = g_variant_ref_sink (g_variant_new ("a{sv}", NULL));
+  McdMatchRecord *record = _mcd_match_record_new (channel);
+  GHashTable *matches;
+
+  _mcd_filter_index_set (index, &filters, filters);
+  matches = _mcd_filter_index_match (index, record, FALSE);
+  g_assert_cmpuint (g_hash_table_size (matches), ==, 1);
+  g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (matches,
+          &filters)), ==, 1);
+  g_hash_table_unref (matches);
+
+  /* removing it */
+  _mcd_filter_index_set (index, &filters, NULL);
+  matches = _mcd_filter_index_match (index, record, FALSE);
+  g_assert_cmpuint (g_hash_table_size (matches), ==, 0);
+  g_hash_table_unref (matches);
+
+  _mcd_match_record_free (record);
+  g_variant_unref (channel);
+  free_filters (filters);
+  _mcd_filter_index_free (index);
+}
+
+/* Every property, looked up as every type a filter could want, gives the
+ * same answer from a record as from the vardict. */
+static void
+test_record (void)
+{
+  static const gchar * const properties[] = { "s", "o", "b", "y", "q", "u",
+      "t", "n-neg", "n", "i-neg", "i", "x-neg", "x", "t-huge", "as",
+      "missing", NULL };
+  GVariantDict dict;
+  GVariant *channel;
+  McdMatchRecord *record;
+  guint i;
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "s", "s", "string");
+  g_variant_dict_insert (&dict, "o", "o", "/object/path");
+  g_variant_dict_insert (&dict, "b", "b", TRUE);
+  g_variant_dict_insert (&dict, "y", "y", 42);
+  g_variant_dict_insert (&dict, "q", "q", 42);
+  g_variant_dict_insert (&dict, "u", "u", 42);
+  g_variant_dict_insert (&dict, "t", "t", (guint64) 42);
+  g_variant_dict_insert (&dict, "n-neg", "n", -42);
+  g_variant_dict_insert (&dict, "n", "n", 42);
+  g_variant_dict_insert (&dict, "i-neg", "i", -42);
+  g_variant_dict_insert (&dict, "i", "i", 42);
+  g_variant_dict_insert (&dict, "x-neg", "x", (gint64) -42);
+  g_variant_dict_insert (&dict, "x", "x", (gint64) 42);
+  g_variant_dict_insert (&dict, "t-huge", "t", G_MAXUINT64);
+  g_variant_dict_insert (&dict, "as", "^as", properties);
+  channel = g_variant_ref_sink (g_variant_dict_end (&dict));
+  record = _mcd_match_record_new (channel);
+
+  for (i = 0; properties[i] != NULL; i++)
+    {
+      const gchar *p = properties[i];
+      gboolean expected_valid, valid;
+
+      g_assert_cmpstr (_mcd_match_record_get_string (record, p), ==,
+          tp_vardict_get_string (channel, p));
+      g_assert_cmpstr (_mcd_match_record_get_object_path (record, p), ==,
+          tp_vardict_get_object_path (channel, p));
+
+      g_assert_cmpint (_mcd_match_record_get_boolean (record, p, &valid),
+          ==, tp_vardict_get_boolean (channel, p, &expected_valid));
+      g_assert_cmpint (valid, ==, expected_valid);
+
+      g_assert_cmpuint (_mcd_match_record_get_uint64 (record, p, &valid),
+          ==, tp_vardict_get_uint64 (channel, p, &expected_valid));
+      g_assert_cmpint (valid, ==, expected_valid);
+
+      g_assert_cmpint (_mcd_match_record_get_int64 (record, p, &valid),
+          ==, tp_vardict_get_int64 (channel, p, &expected_valid));
+      g_assert_cmpint (valid, ==, expected_valid);
+    }
+
+  _mcd_match_record_free (record);
+  g_variant_unref (channel);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/filter-index/same-as-linear", test_same_as_linear);
+  g_test_add_func ("/filter-index/empty-filter", test_empty_filter);
+  g_test_add_func ("/match-record/same-as-vardict", test_record);
+
+  return g_test_run ();
+}
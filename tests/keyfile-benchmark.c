@@ -0,0 +1,235 @@
+/*
+ * keyfile-benchmark: compare the keyfile value codec with the old
+ * approach of round-tripping every value through a throwaway GKeyFile
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-glib/telepathy-glib-dbus.h>
+
+#include "mcd-keyfile.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+/* A plausible mix of what an account's attributes and parameters look
+ * like: mostly short strings, some booleans and integers, a few lists */
+static const struct {
+    const gchar *type;
+    const gchar *escaped;
+} values[] = {
+    { "s", "gabble" },
+    { "s", "jabber" },
+    { "s", "fred@example.com" },
+    { "s", "Frederick\\sBloggs" },
+    { "s", "im-jabber" },
+    { "b", "true" },
+    { "b", "false" },
+    { "u", "5222" },
+    { "i", "2" },
+    { "t", "1234567890123" },
+    { "as", "xmpp;jabber;" },
+    { "ao", "/org/freedesktop/Telepathy/Account/gabble/jabber/old0;" },
+    { "(uss)", "2;available;Around\\sand\\sabout;" },
+    { NULL, NULL }
+};
+
+/* What mcd_keyfile_unescape_value() used to do */
+static GVariant *
+unescape_via_keyfile (const gchar *escaped,
+    const GVariantType *type)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  GVariant *ret = NULL;
+  const gchar *s = g_variant_type_peek_string (type);
+
+  g_key_file_set_value (keyfile, "g", "k", escaped);
+
+  if (g_variant_type_is_basic (type))
+    {
+      switch (s[0])
+        {
+          case 's':
+            ret = g_variant_new_take_string (
+                g_key_file_get_string (keyfile, "g", "k", NULL));
+            break;
+
+          case 'b':
+            ret = g_variant_new_boolean (
+                g_key_file_get_boolean (keyfile, "g", "k", NULL));
+            break;
+
+          case 'i':
+            ret = g_variant_new_int32 (
+                g_key_file_get_integer (keyfile, "g", "k", NULL));
+            break;
+
+          case 'u':
+            ret = g_variant_new_uint32 (
+                g_key_file_get_uint64 (keyfile, "g", "k", NULL));
+            break;
+
+          case 't':
+            ret = g_variant_new_uint64 (
+                g_key_file_get_uint64 (keyfile, "g", "k", NULL));
+            break;
+        }
+    }
+  else
+    {
+      gchar **strv = g_key_file_get_string_list (keyfile, "g", "k", NULL,
+          NULL);
+
+      if (s[0] == '(')
+        ret = g_variant_new ("(uss)", (guint) atoi (strv[0]), strv[1],
+            strv[2]);
+      else if (s[1] == 'o')
+        ret = g_variant_new_objv ((const gchar * const *) strv, -1);
+      else
+        ret = g_variant_new_strv ((const gchar * const *) strv, -1);
+
+      g_strfreev (strv);
+    }
+
+  g_key_file_free (keyfile);
+  return ret;
+}
+
+/* What mcd_keyfile_escape_value() used to do */
+static gchar *
+escape_via_keyfile (GVariant *variant)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  gchar *ret;
+
+  if (g_variant_is_of_type (variant, G_VARIANT_TYPE_STRING))
+    {
+      g_key_file_set_string (keyfile, "g", "k",
+          g_variant_get_string (variant, NULL));
+    }
+  else if (g_variant_is_of_type (variant, G_VARIANT_TYPE_BOOLEAN))
+    {
+      g_key_file_set_boolean (keyfile, "g", "k",
+          g_variant_get_boolean (variant));
+    }
+  else if (g_variant_type_is_basic (g_variant_get_type (variant)))
+    {
+      gchar *printed = g_variant_print (variant, FALSE);
+
+      g_key_file_set_string (keyfile, "g", "k", printed);
+      g_free (printed);
+    }
+  else
+    {
+      GPtrArray *arr = g_ptr_array_new_with_free_func (g_free);
+      GVariantIter iter;
+      GVariant *child;
+
+      g_variant_iter_init (&iter, variant);
+
+      while ((child = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          if (g_variant_is_of_type (child, G_VARIANT_TYPE_UINT32))
+            g_ptr_array_add (arr, g_strdup_printf ("%u",
+                  g_variant_get_uint32 (child)));
+          else
+            g_ptr_array_add (arr,
+                g_strdup (g_variant_get_string (child, NULL)));
+
+          g_variant_unref (child);
+        }
+
+      g_key_file_set_string_list (keyfile, "g", "k",
+          (const gchar * const *) arr->pdata, arr->len);
+      g_ptr_array_unref (arr);
+    }
+
+  ret = g_key_file_get_value (keyfile, "g", "k", NULL);
+  g_key_file_free (keyfile);
+  return ret;
+}
+
+static gdouble
+run (guint iterations,
+    gboolean use_codec)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i, j;
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; values[j].type != NULL; j++)
+        {
+          const GVariantType *type = G_VARIANT_TYPE (values[j].type);
+          GVariant *v;
+          gchar *escaped;
+
+          if (use_codec)
+            v = mcd_keyfile_unescape_variant (values[j].escaped, type, NULL);
+          else
+            v = unescape_via_keyfile (values[j].escaped, type);
+
+          g_variant_ref_sink (v);
+
+          if (use_codec)
+            escaped = mcd_keyfile_escape_variant (v);
+          else
+            escaped = escape_via_keyfile (v);
+
+          g_free (escaped);
+          g_variant_unref (v);
+        }
+    }
+
+  return (g_get_monotonic_time () - start) / 1e6;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint iterations = DEFAULT_ITERATIONS;
+  guint n_values = G_N_ELEMENTS (values) - 1;
+  gdouble keyfile_time, codec_time;
+
+  g_type_init ();
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+
+  /* warm up the type system, allocator etc. */
+  run (iterations / 100 + 1, FALSE);
+  run (iterations / 100 + 1, TRUE);
+
+  keyfile_time = run (iterations, FALSE);
+  codec_time = run (iterations, TRUE);
+
+  g_print ("%u round-trips of %u values each\n", iterations, n_values);
+  g_print ("GKeyFile: %.3fs (%.0f values/s)\n", keyfile_time,
+      iterations * n_values / keyfile_time);
+  g_print ("codec:    %.3fs (%.0f values/s)\n", codec_time,
+      iterations * n_values / codec_time);
+  g_print ("speedup:  %.1fx\n", keyfile_time / codec_time);
+
+  return 0;
+}
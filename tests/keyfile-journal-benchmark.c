@@ -0,0 +1,190 @@
+/*
+ * keyfile-journal-benchmark: compare how many bytes are written to disk
+ * when committing small changes to accounts.cfg by rewriting it, and by
+ * appending to a journal which is compacted from time to time
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "mcd-keyfile-journal.h"
+
+#define DEFAULT_CHANGES 10000
+
+static const guint account_counts[] = { 1, 10, 100, 1000, 0 };
+
+static GKeyFile *
+make_accounts (guint n_accounts)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  guint i;
+
+  for (i = 0; i < n_accounts; i++)
+    {
+      gchar *group = g_strdup_printf ("gabble/jabber/user%u_40example_2ecom0",
+          i);
+      gchar *account = g_strdup_printf ("user%u@example.com", i);
+
+      g_key_file_set_value (keyfile, group, "manager", "gabble");
+      g_key_file_set_value (keyfile, group, "protocol", "jabber");
+      g_key_file_set_value (keyfile, group, "Icon", "im-jabber");
+      g_key_file_set_value (keyfile, group, "Service", "google-talk");
+      g_key_file_set_value (keyfile, group, "DisplayName", account);
+      g_key_file_set_value (keyfile, group, "Nickname", "User");
+      g_key_file_set_value (keyfile, group, "Enabled", "true");
+      g_key_file_set_value (keyfile, group, "ConnectAutomatically", "true");
+      g_key_file_set_value (keyfile, group, "AutomaticPresence",
+          "2;available;;");
+      g_key_file_set_value (keyfile, group, "param-account", account);
+      g_key_file_set_value (keyfile, group, "param-server",
+          "talk.google.com");
+      g_key_file_set_value (keyfile, group, "param-port", "5223");
+      g_key_file_set_value (keyfile, group, "param-old-ssl", "true");
+
+      g_free (account);
+      g_free (group);
+    }
+
+  return keyfile;
+}
+
+static gsize
+keyfile_size (GKeyFile *keyfile)
+{
+  gsize len;
+  gchar *data = g_key_file_to_data (keyfile, &len, NULL);
+
+  g_free (data);
+  return len;
+}
+
+static gchar *
+pick_group (guint n_accounts,
+    guint change)
+{
+  return g_strdup_printf ("gabble/jabber/user%u_40example_2ecom0",
+      change % n_accounts);
+}
+
+/* Each change sets the Nickname of one account, and is committed on its
+ * own, like a user editing their accounts one thing at a time. */
+static void
+run (guint n_accounts,
+    guint n_changes)
+{
+  GKeyFile *keyfile = make_accounts (n_accounts);
+  GString *journal = g_string_new ("");
+  guint64 logical = 0;
+  guint64 rewrite_bytes = 0;
+  guint64 journal_bytes = 0;
+  gsize journal_len = strlen (MCD_KEYFILE_JOURNAL_HEADER);
+  gsize base_len = keyfile_size (keyfile);
+  guint compactions = 0;
+  gint64 rewrite_time, journal_time, start;
+  guint i;
+
+  /* whole-file rewrite: what _commit used to do every time */
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_changes; i++)
+    {
+      gchar *group = pick_group (n_accounts, i);
+      gchar *nick = g_strdup_printf ("Nick%u", i);
+
+      g_key_file_set_value (keyfile, group, "Nickname", nick);
+      /* the size of "key=value\n" is as small as this change can be */
+      logical += strlen ("Nickname") + strlen (nick) + 2;
+      rewrite_bytes += keyfile_size (keyfile);
+
+      g_free (nick);
+      g_free (group);
+    }
+
+  rewrite_time = g_get_monotonic_time () - start;
+
+  g_key_file_free (keyfile);
+  keyfile = make_accounts (n_accounts);
+
+  /* journal, compacted when mcd_keyfile_journal_should_compact() says so */
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_changes; i++)
+    {
+      gchar *group = pick_group (n_accounts, i);
+      gchar *nick = g_strdup_printf ("Nick%u", i);
+
+      g_key_file_set_value (keyfile, group, "Nickname", nick);
+
+      g_string_truncate (journal, 0);
+      mcd_keyfile_journal_append_set (journal, group, "Nickname", nick);
+      mcd_keyfile_journal_append_commit (journal);
+      journal_bytes += journal->len;
+      journal_len += journal->len;
+
+      if (mcd_keyfile_journal_should_compact (journal_len, base_len))
+        {
+          base_len = keyfile_size (keyfile);
+          journal_bytes += base_len + strlen (MCD_KEYFILE_JOURNAL_HEADER);
+          journal_len = strlen (MCD_KEYFILE_JOURNAL_HEADER);
+          compactions++;
+        }
+
+      g_free (nick);
+      g_free (group);
+    }
+
+  journal_time = g_get_monotonic_time () - start;
+
+  g_print ("%8u %12.1f %12.1f %12u %10.1f %10.1f\n", n_accounts,
+      (gdouble) rewrite_bytes / logical,
+      (gdouble) journal_bytes / logical,
+      compactions,
+      rewrite_time / (gdouble) n_changes,
+      journal_time / (gdouble) n_changes);
+
+  g_string_free (journal, TRUE);
+  g_key_file_free (keyfile);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint n_changes = DEFAULT_CHANGES;
+  guint i;
+
+  if (argc > 1)
+    n_changes = atoi (argv[1]);
+
+  g_print ("%u single-key commits; amplification is bytes written per "
+      "byte changed\n", n_changes);
+  g_print ("%8s %12s %12s %12s %10s %10s\n", "accounts", "rewrite-amp",
+      "journal-amp", "compactions", "rewrite-us", "journal-us");
+
+  for (i = 0; account_counts[i] != 0; i++)
+    run (account_counts[i], n_changes);
+
+  return 0;
+}
@@ -0,0 +1,353 @@
+/*
+ * Regression test for the keyfile journal, in particular that a journal
+ * whose tail was lost in a crash is replayed safely
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "mcd-keyfile-journal.h"
+
+#define BASE \
+  "# Telepathy accounts\n" \
+  "[gabble/jabber/fred0]\n" \
+  "manager=gabble\n" \
+  "protocol=jabber\n" \
+  "param-account=fred@example.com\n" \
+  "DisplayName=Fred\n" \
+  "\n" \
+  "[salut/local_xmpp/fred0]\n" \
+  "manager=salut\n" \
+  "protocol=local-xmpp\n" \
+  "param-nickname=fred\n"
+
+#define N_TRANSACTIONS 4
+
+/* Build a journal with a few transactions of various kinds, and also
+ * return the offset at which each transaction ends, and what the keyfile
+ * should look like after each one. */
+static gchar *
+build_journal (gsize *ends,
+    gchar **states)
+{
+  GString *journal = g_string_new (MCD_KEYFILE_JOURNAL_HEADER);
+  GKeyFile *keyfile = g_key_file_new ();
+  guint i;
+
+  g_key_file_load_from_data (keyfile, BASE, -1, G_KEY_FILE_KEEP_COMMENTS,
+      NULL);
+  ends[0] = journal->len;
+  states[0] = g_key_file_to_data (keyfile, NULL, NULL);
+
+  for (i = 1; i <= N_TRANSACTIONS; i++)
+    {
+      switch (i)
+        {
+          case 1:
+            mcd_keyfile_journal_append_set (journal, "gabble/jabber/fred0",
+                "DisplayName", "Frederick\\sBloggs");
+            g_key_file_set_value (keyfile, "gabble/jabber/fred0",
+                "DisplayName", "Frederick\\sBloggs");
+            mcd_keyfile_journal_append_set (journal, "gabble/jabber/fred0",
+                "Nickname", "fred\twith a tab");
+            g_key_file_set_value (keyfile, "gabble/jabber/fred0",
+                "Nickname", "fred\twith a tab");
+            break;
+
+          case 2:
+            mcd_keyfile_journal_append_remove (journal,
+                "salut/local_xmpp/fred0", NULL);
+            g_key_file_remove_group (keyfile, "salut/local_xmpp/fred0",
+                NULL);
+            break;
+
+          case 3:
+            mcd_keyfile_journal_append_set (journal,
+                "haze/msn/fred_40example_2ecom0", "manager", "haze");
+            g_key_file_set_value (keyfile, "haze/msn/fred_40example_2ecom0",
+                "manager", "haze");
+            mcd_keyfile_journal_append_set (journal,
+                "haze/msn/fred_40example_2ecom0", "Enabled", "true");
+            g_key_file_set_value (keyfile, "haze/msn/fred_40example_2ecom0",
+                "Enabled", "true");
+            break;
+
+          case 4:
+            mcd_keyfile_journal_append_remove (journal,
+                "gabble/jabber/fred0", "Nickname");
+            g_key_file_remove_key (keyfile, "gabble/jabber/fred0",
+                "Nickname", NULL);
+            mcd_keyfile_journal_append_set (journal,
+                "haze/msn/fred_40example_2ecom0", "Enabled", "false");
+            g_key_file_set_value (keyfile, "haze/msn/fred_40example_2ecom0",
+                "Enabled", "false");
+            break;
+
+          default:
+            g_assert_not_reached ();
+        }
+
+      mcd_keyfile_journal_append_commit (journal);
+      ends[i] = journal->len;
+      states[i] = g_key_file_to_data (keyfile, NULL, NULL);
+    }
+
+  g_key_file_free (keyfile);
+  return g_string_free (journal, FALSE);
+}
+
+/* Replay @len bytes of @data onto the base keyfile, and return the
+ * result, serialized. */
+static gchar *
+replay (const gchar *data,
+    gsize len,
+    gsize *valid,
+    guint *n)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  gchar *ret;
+
+  g_key_file_load_from_data (keyfile, BASE, -1, G_KEY_FILE_KEEP_COMMENTS,
+      NULL);
+  *valid = mcd_keyfile_journal_replay (keyfile, data, len, n);
+  ret = g_key_file_to_data (keyfile, NULL, NULL);
+  g_key_file_free (keyfile);
+  return ret;
+}
+
+static void
+test_replay (void)
+{
+  gsize ends[N_TRANSACTIONS + 1];
+  gchar *states[N_TRANSACTIONS + 1];
+  gchar *journal = build_journal (ends, states);
+  gchar *result;
+  gsize valid;
+  guint n, i;
+
+  result = replay (journal, strlen (journal), &valid, &n);
+  g_assert_cmpuint (n, ==, N_TRANSACTIONS);
+  g_assert_cmpuint (valid, ==, strlen (journal));
+  g_assert_cmpstr (result, ==, states[N_TRANSACTIONS]);
+  g_free (result);
+
+  for (i = 0; i <= N_TRANSACTIONS; i++)
+    g_free (states[i]);
+
+  g_free (journal);
+}
+
+/* Every possible point at which a crash could have cut the journal short
+ * gives us exactly the transactions that were complete at that point. */
+static void
+test_truncated (void)
+{
+  gsize ends[N_TRANSACTIONS + 1];
+  gchar *states[N_TRANSACTIONS + 1];
+  gchar *journal = build_journal (ends, states);
+  gsize len = strlen (journal);
+  gsize cut;
+  guint i;
+
+  for (cut = 0; cut <= len; cut++)
+    {
+      guint expected = 0;
+      gchar *result;
+      gsize valid;
+      guint n;
+
+      while (expected < N_TRANSACTIONS && ends[expected + 1] <= cut)
+        expected++;
+
+      result = replay (journal, cut, &valid, &n);
+
+      g_assert_cmpuint (n, ==, expected);
+      g_assert_cmpstr (result, ==, states[expected]);
+
+      /* a cut in the middle of the header loses the header too */
+      if (cut < ends[0])
+        g_assert_cmpuint (valid, ==, 0);
+      else
+        g_assert_cmpuint (valid, ==, ends[expected]);
+
+      g_free (result);
+    }
+
+  for (i = 0; i <= N_TRANSACTIONS; i++)
+    g_free (states[i]);
+
+  g_free (journal);
+}
+
+/* Some filesystems leave a torn write as a block of NULs, or garbage. */
+static void
+test_damaged_tail (void)
+{
+  static const gchar * const tails[] = {
+      "\0\0\0\0\0\0\0\0\n",
+      "S\tgabble/jabber/fred0\tDisplayName\tTorn\nC",
+      "S\tgabble/jabber/fred0\n",
+      "X\tgabble/jabber/fred0\nC\n",
+      "S\t\tDisplayName\tTorn\nC\n",
+      "S\tgabble/jabber/fred0\tDisplay=Name\tTorn\nC\n",
+      "C\tsurplus\n",
+      "\n",
+      "\xff\xfe\n",
+      NULL
+  };
+  gsize ends[N_TRANSACTIONS + 1];
+  gchar *states[N_TRANSACTIONS + 1];
+  gchar *journal = build_journal (ends, states);
+  guint i;
+
+  for (i = 0; tails[i] != NULL; i++)
+    {
+      GString *damaged = g_string_new (journal);
+      gchar *result;
+      gsize valid;
+      guint n;
+
+      /* the NULs are part of the data, so can't use g_string_append */
+      if (i == 0)
+        g_string_append_len (damaged, tails[i], 9);
+      else
+        g_string_append (damaged, tails[i]);
+
+      /* a perfectly good transaction after the damage must be ignored too,
+       * because we can no longer be sure what came before it */
+      mcd_keyfile_journal_append_set (damaged, "gabble/jabber/fred0",
+          "DisplayName", "Too late");
+      mcd_keyfile_journal_append_commit (damaged);
+
+      result = replay (damaged->str, damaged->len, &valid, &n);
+      g_assert_cmpuint (n, ==, N_TRANSACTIONS);
+      g_assert_cmpuint (valid, ==, ends[N_TRANSACTIONS]);
+      g_assert_cmpstr (result, ==, states[N_TRANSACTIONS]);
+
+      g_free (result);
+      g_string_free (damaged, TRUE);
+    }
+
+  for (i = 0; i <= N_TRANSACTIONS; i++)
+    g_free (states[i]);
+
+  g_free (journal);
+}
+
+/* If we crash after compacting but before resetting the journal, the old
+ * journal is replayed on top of the compacted file; that must be a
+ * no-op. */
+static void
+test_idempotent (void)
+{
+  gsize ends[N_TRANSACTIONS + 1];
+  gchar *states[N_TRANSACTIONS + 1];
+  gchar *journal = build_journal (ends, states);
+  guint i;
+
+  for (i = 0; i <= N_TRANSACTIONS; i++)
+    {
+      GKeyFile *keyfile = g_key_file_new ();
+      gchar *result;
+      guint n;
+
+      /* the base was compacted after transaction i, and then we replay
+       * everything */
+      g_assert (g_key_file_load_from_data (keyfile, states[i], -1,
+            G_KEY_FILE_KEEP_COMMENTS, NULL));
+      mcd_keyfile_journal_replay (keyfile, journal, strlen (journal), &n);
+      g_assert_cmpuint (n, ==, N_TRANSACTIONS);
+
+      result = g_key_file_to_data (keyfile, NULL, NULL);
+      g_assert_cmpstr (result, ==, states[N_TRANSACTIONS]);
+
+      g_free (result);
+      g_key_file_free (keyfile);
+    }
+
+  for (i = 0; i <= N_TRANSACTIONS; i++)
+    g_free (states[i]);
+
+  g_free (journal);
+}
+
+/* Records that couldn't be replayed correctly are refused, rather than
+ * being dropped silently, so the caller can rewrite the keyfile instead */
+static void
+test_invalid (void)
+{
+  GString *journal = g_string_new (MCD_KEYFILE_JOURNAL_HEADER);
+
+  g_assert (!mcd_keyfile_journal_append_set (journal, "gabble/jabber/fred0",
+        "DisplayName", "two\nlines"));
+  g_assert (!mcd_keyfile_journal_append_set (journal, "[bad group]",
+        "DisplayName", "Fred"));
+  g_assert (!mcd_keyfile_journal_append_set (journal, "gabble/jabber/fred0",
+        "bad=key", "Fred"));
+  g_assert (!mcd_keyfile_journal_append_remove (journal, "",
+        "DisplayName"));
+  g_assert (!mcd_keyfile_journal_append_remove (journal, "[bad group]",
+        NULL));
+  g_assert_cmpstr (journal->str, ==, MCD_KEYFILE_JOURNAL_HEADER);
+
+  g_assert (mcd_keyfile_journal_append_set (journal, "gabble/jabber/fred0",
+        "DisplayName", "Fred"));
+  g_assert (mcd_keyfile_journal_append_remove (journal, "gabble/jabber/fred0",
+        NULL));
+  g_assert_cmpstr (journal->str, ==, MCD_KEYFILE_JOURNAL_HEADER
+      "S\tgabble/jabber/fred0\tDisplayName\tFred\n"
+      "R\tgabble/jabber/fred0\n");
+
+  g_string_free (journal, TRUE);
+}
+
+static void
+test_should_compact (void)
+{
+  /* small journals are never worth compacting */
+  g_assert (!mcd_keyfile_journal_should_compact (100, 0));
+  g_assert (!mcd_keyfile_journal_should_compact (100, 50));
+  /* ... but big ones are, once they reach the size of the base file */
+  g_assert (mcd_keyfile_journal_should_compact (1024 * 1024, 1024));
+  g_assert (!mcd_keyfile_journal_should_compact (1024 * 1024,
+        4 * 1024 * 1024));
+  g_assert (mcd_keyfile_journal_should_compact (4 * 1024 * 1024,
+        4 * 1024 * 1024));
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/keyfile-journal/replay", test_replay);
+  g_test_add_func ("/keyfile-journal/truncated", test_truncated);
+  g_test_add_func ("/keyfile-journal/damaged-tail", test_damaged_tail);
+  g_test_add_func ("/keyfile-journal/idempotent", test_idempotent);
+  g_test_add_func ("/keyfile-journal/invalid", test_invalid);
+  g_test_add_func ("/keyfile-journal/should-compact", test_should_compact);
+
+  return g_test_run ();
+}
@@ -25,7 +25,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
-#include "mcd-storage.h"
+#include "mcd-keyfile.h"
 
 typedef enum {
     FAILS = 1,
@@ -130,19 +130,14 @@ struct {
     gint64 unescaped;
     Flags flags;
 } int64_tests[] = {
-#if 0
-    /* This actually "succeeds". tp_g_key_file_get_int64() and _uint64(),
-     * and the copy of them that was merged in GLib, don't detect overflow */
+    /* GKeyFile doesn't detect overflow here, but our own parser does */
     { "-9223372036854775809", 0, FAILS },
-#endif
     { "-9223372036854775808", G_MININT64, 0 },
     { "-1", -1, 0 },
     { "0", 0, 0 },
     { "1", 1, 0 },
     { "9223372036854775807", G_GINT64_CONSTANT (9223372036854775807), 0 },
-#if 0
     { "9223372036854775808", 0, FAILS },
-#endif
     { "x", 0, FAILS },
     { NULL, 0, 0 }
 };
@@ -152,17 +147,13 @@ struct {
     guint64 unescaped;
     Flags flags;
 } uint64_tests[] = {
-#if 0
     { "-1", 0, FAILS },
-#endif
     { "0", 0, 0 },
     { "1", 1, 0 },
     { "9223372036854775807", G_GUINT64_CONSTANT (9223372036854775807), 0 },
     { "9223372036854775808", G_GUINT64_CONSTANT (9223372036854775808), 0 },
     { "18446744073709551615", G_GUINT64_CONSTANT (18446744073709551615), 0 },
-#if 0
     { "18446744073709551616", 0, FAILS },
-#endif
     { "x", 0, FAILS },
     { NULL, 0, 0 }
 };
@@ -204,6 +195,14 @@ struct {
     { "\\s", " ", 0 },
     { "\\s ", "  ", NOT_NORMALIZED },
     { "\\t", "\t", 0 },
+    { "a b", "a b", 0 },
+    { "\\s\\sa\tb ", "  a\tb ", 0 },
+    { "back\\\\slash", "back\\slash", 0 },
+    { "two\\nlines\\r", "two\nlines\r", 0 },
+    { ";", ";", 0 },
+    { "\\;", NULL, FAILS },
+    { "\\x", NULL, FAILS },
+    { "trailing\\", NULL, FAILS },
     { NULL, NULL, 0 }
 };
 
@@ -324,6 +323,144 @@ test_uss (void)
   g_value_unset (&unescaped);
 }
 
+/* The same things, but going directly to and from GVariant */
+struct {
+    const gchar *type;
+    const gchar *escaped;
+    /* in GVariant text format, or NULL if @escaped is meant to be invalid */
+    const gchar *unescaped;
+} variant_tests[] = {
+    { "s", "lol", "'lol'" },
+    { "s", "\\s\\tx y", "' \tx y'" },
+    { "s", "\\x", NULL },
+    { "o", "/foo", "'/foo'" },
+    { "o", "x", NULL },
+    { "b", "true", "true" },
+    { "b", "false", "false" },
+    { "b", "2", NULL },
+    { "y", "255", "255" },
+    { "y", "256", NULL },
+    { "i", "-2147483648", "-2147483648" },
+    { "i", "2147483648", NULL },
+    { "u", "4294967295", "4294967295" },
+    { "u", "-1", NULL },
+    { "x", "-9223372036854775808", "-9223372036854775808" },
+    { "x", "9223372036854775808", NULL },
+    { "t", "18446744073709551615", "18446744073709551615" },
+    { "d", "0.5", "0.5" },
+    { "as", "x;\\t;z;", "['x', '\t', 'z']" },
+    { "as", "", "@as []" },
+    { "as", "\\s;;", "[' ', '']" },
+    { "ao", "/x;/;", "['/x', '/']" },
+    { "ao", "/x;y;", NULL },
+    { "au", "1;2;", "[1, 2]" },
+    { "(uss)", "2;available;\\;;", "(2, 'available', ';')" },
+    { "(uss)", "2;available;", NULL },
+    { "(uss)", "x;available;;", NULL },
+    { "a{sv}", "", NULL },
+    { NULL, NULL, NULL }
+};
+
+static void
+test_variant (void)
+{
+  guint i;
+
+  for (i = 0; variant_tests[i].type != NULL; i++)
+    {
+      const GVariantType *type = G_VARIANT_TYPE (variant_tests[i].type);
+      GVariant *unescaped;
+      GVariant *expected;
+      gchar *escaped;
+      GError *error = NULL;
+
+      unescaped = mcd_keyfile_unescape_variant (variant_tests[i].escaped,
+          type, &error);
+
+      if (variant_tests[i].unescaped == NULL)
+        {
+          if (unescaped != NULL || error == NULL)
+            g_error ("Interpreting '%s' as %s was meant to fail",
+                variant_tests[i].escaped, variant_tests[i].type);
+
+          g_error_free (error);
+          continue;
+        }
+
+      if (error != NULL)
+        g_error ("Interpreting '%s' as %s was meant to succeed: %s",
+            variant_tests[i].escaped, variant_tests[i].type, error->message);
+
+      g_assert (unescaped != NULL);
+      g_variant_ref_sink (unescaped);
+      g_assert (g_variant_is_of_type (unescaped, type));
+
+      expected = g_variant_parse (type, variant_tests[i].unescaped,
+          NULL, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (g_variant_equal (unescaped, expected));
+
+      escaped = mcd_keyfile_escape_variant (unescaped);
+      g_assert_cmpstr (escaped, ==, variant_tests[i].escaped);
+
+      g_free (escaped);
+      g_variant_unref (expected);
+      g_variant_unref (unescaped);
+    }
+}
+
+/* The GValue and GVariant code paths must agree with each other and with
+ * GKeyFile itself, which used to be how we did this */
+static void
+test_same_as_keyfile (void)
+{
+  static const gchar * const strings[] = { "", " x", "x ", "\t\tx\ty",
+      "a\\b", "a;b", " ;  ;", "line\nline\r", "\xc3\xa9t\xc3\xa9", NULL };
+  GKeyFile *keyfile = g_key_file_new ();
+  guint i;
+
+  for (i = 0; strings[i] != NULL; i++)
+    {
+      GValue value = G_VALUE_INIT;
+      GVariant *variant;
+      gchar *from_value;
+      gchar *from_variant;
+      gchar *from_keyfile;
+      const gchar *list[] = { strings[i], strings[i], NULL };
+
+      g_key_file_set_string (keyfile, "g", "k", strings[i]);
+      from_keyfile = g_key_file_get_value (keyfile, "g", "k", NULL);
+
+      g_value_init (&value, G_TYPE_STRING);
+      g_value_set_static_string (&value, strings[i]);
+      from_value = mcd_keyfile_escape_value (&value);
+      g_value_unset (&value);
+
+      variant = g_variant_ref_sink (g_variant_new_string (strings[i]));
+      from_variant = mcd_keyfile_escape_variant (variant);
+      g_variant_unref (variant);
+
+      g_assert_cmpstr (from_value, ==, from_keyfile);
+      g_assert_cmpstr (from_variant, ==, from_keyfile);
+      g_free (from_keyfile);
+      g_free (from_value);
+      g_free (from_variant);
+
+      g_key_file_set_string_list (keyfile, "g", "k", list, 2);
+      from_keyfile = g_key_file_get_value (keyfile, "g", "k", NULL);
+
+      variant = g_variant_ref_sink (g_variant_new_strv (list, -1));
+      from_variant = mcd_keyfile_escape_variant (variant);
+      g_variant_unref (variant);
+
+      g_assert_cmpstr (from_variant, ==, from_keyfile);
+      g_free (from_keyfile);
+      g_free (from_variant);
+    }
+
+  g_key_file_free (keyfile);
+}
+
 int
 main (int argc,
       char **argv)
@@ -347,5 +484,8 @@ main (int argc,
   g_test_add_func ("/keyfile/ao", test_ao);
   g_test_add_func ("/keyfile/uss", test_uss);
 
+  g_test_add_func ("/keyfile/variant", test_variant);
+  g_test_add_func ("/keyfile/same-as-keyfile", test_same_as_keyfile);
+
   return g_test_run ();
 }
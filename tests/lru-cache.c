@@ -0,0 +1,213 @@
+/*
+ * Regression test for the LRU cache: it must forget the least recently
+ * used entry when it's full, and free everything it forgets
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "mcd-lru-cache.h"
+
+static guint values_freed = 0;
+
+static void
+value_free (gpointer p)
+{
+  values_freed++;
+  g_free (p);
+}
+
+static McdLruCache *
+new_cache (guint max_size)
+{
+  values_freed = 0;
+  return _mcd_lru_cache_new (max_size, g_str_hash, g_str_equal, g_free,
+      value_free);
+}
+
+static void
+insert (McdLruCache *cache,
+    const gchar *key,
+    const gchar *value)
+{
+  _mcd_lru_cache_insert (cache, g_strdup (key), g_strdup (value));
+}
+
+static const gchar *
+lookup (McdLruCache *cache,
+    const gchar *key)
+{
+  gpointer value = NULL;
+
+  if (!_mcd_lru_cache_lookup (cache, key, &value))
+    return NULL;
+
+  g_assert (value != NULL);
+  return value;
+}
+
+static void
+test_evict (void)
+{
+  McdLruCache *cache = new_cache (3);
+  guint64 hits, misses, evictions;
+
+  insert (cache, "a", "1");
+  insert (cache, "b", "2");
+  insert (cache, "c", "3");
+  g_assert_cmpuint (_mcd_lru_cache_size (cache), ==, 3);
+
+  /* "a" is now the most recently used, so "b" goes first */
+  g_assert_cmpstr (lookup (cache, "a"), ==, "1");
+  insert (cache, "d", "4");
+  g_assert_cmpuint (_mcd_lru_cache_size (cache), ==, 3);
+  g_assert_cmpuint (values_freed, ==, 1);
+  g_assert_cmpstr (lookup (cache, "b"), ==, NULL);
+  g_assert_cmpstr (lookup (cache, "a"), ==, "1");
+  g_assert_cmpstr (lookup (cache, "c"), ==, "3");
+  g_assert_cmpstr (lookup (cache, "d"), ==, "4");
+
+  /* then "a", which has been used least recently since */
+  insert (cache, "e", "5");
+  g_assert_cmpstr (lookup (cache, "a"), ==, NULL);
+  g_assert_cmpstr (lookup (cache, "c"), ==, "3");
+
+  _mcd_lru_cache_get_stats (cache, &hits, &misses, &evictions);
+  g_assert_cmpuint (hits, ==, 5);
+  g_assert_cmpuint (misses, ==, 2);
+  g_assert_cmpuint (evictions, ==, 2);
+
+  _mcd_lru_cache_reset_stats (cache);
+  _mcd_lru_cache_get_stats (cache, &hits, &misses, &evictions);
+  g_assert_cmpuint (hits, ==, 0);
+  g_assert_cmpuint (misses, ==, 0);
+  g_assert_cmpuint (evictions, ==, 0);
+
+  _mcd_lru_cache_free (cache);
+  g_assert_cmpuint (values_freed, ==, 5);
+}
+
+static void
+test_replace (void)
+{
+  McdLruCache *cache = new_cache (2);
+
+  insert (cache, "a", "1");
+  insert (cache, "b", "2");
+  insert (cache, "a", "one");
+  g_assert_cmpuint (_mcd_lru_cache_size (cache), ==, 2);
+  g_assert_cmpuint (values_freed, ==, 1);
+
+  /* replacing "a" made it the most recently used */
+  insert (cache, "c", "3");
+  g_assert_cmpstr (lookup (cache, "a"), ==, "one");
+  g_assert_cmpstr (lookup (cache, "b"), ==, NULL);
+
+  _mcd_lru_cache_free (cache);
+  g_assert_cmpuint (values_freed, ==, 4);
+}
+
+static void
+test_remove (void)
+{
+  McdLruCache *cache = new_cache (10);
+  gpointer value = GUINT_TO_POINTER (0xdeadbeef);
+
+  insert (cache, "a", "1");
+  insert (cache, "b", "2");
+
+  g_assert (_mcd_lru_cache_remove (cache, "a"));
+  g_assert (!_mcd_lru_cache_remove (cache, "a"));
+  g_assert_cmpuint (values_freed, ==, 1);
+  g_assert_cmpstr (lookup (cache, "a"), ==, NULL);
+  g_assert_cmpstr (lookup (cache, "b"), ==, "2");
+
+  /* NULL is a valid value, distinct from absence */
+  _mcd_lru_cache_insert (cache, g_strdup ("nothing"), NULL);
+  g_assert (_mcd_lru_cache_lookup (cache, "nothing", &value));
+  g_assert (value == NULL);
+
+  _mcd_lru_cache_remove_all (cache);
+  g_assert_cmpuint (_mcd_lru_cache_size (cache), ==, 0);
+  g_assert_cmpuint (values_freed, ==, 3);
+  g_assert_cmpstr (lookup (cache, "b"), ==, NULL);
+  g_assert (!_mcd_lru_cache_lookup (cache, "nothing", NULL));
+
+  _mcd_lru_cache_free (cache);
+  g_assert_cmpuint (values_freed, ==, 3);
+}
+
+static gboolean
+value_is_even (gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+  return (atoi (value) % 2) == 0;
+}
+
+static void
+test_foreach_remove (void)
+{
+  McdLruCache *cache = new_cache (4);
+
+  insert (cache, "a", "1");
+  insert (cache, "b", "2");
+  insert (cache, "c", "3");
+  insert (cache, "d", "4");
+
+  g_assert_cmpuint (_mcd_lru_cache_foreach_remove (cache, value_is_even,
+        NULL), ==, 2);
+  g_assert_cmpuint (_mcd_lru_cache_size (cache), ==, 2);
+  g_assert_cmpuint (values_freed, ==, 2);
+  g_assert_cmpstr (lookup (cache, "b"), ==, NULL);
+  g_assert_cmpstr (lookup (cache, "d"), ==, NULL);
+
+  /* the survivors keep their order: "a" is still the least recently used */
+  insert (cache, "e", "5");
+  insert (cache, "f", "7");
+  insert (cache, "g", "9");
+  g_assert_cmpstr (lookup (cache, "a"), ==, NULL);
+  g_assert_cmpstr (lookup (cache, "c"), ==, "3");
+
+  g_assert_cmpuint (_mcd_lru_cache_foreach_remove (cache, value_is_even,
+        NULL), ==, 0);
+
+  _mcd_lru_cache_free (cache);
+  g_assert_cmpuint (values_freed, ==, 7);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lru-cache/evict", test_evict);
+  g_test_add_func ("/lru-cache/replace", test_replace);
+  g_test_add_func ("/lru-cache/remove", test_remove);
+  g_test_add_func ("/lru-cache/foreach-remove", test_foreach_remove);
+
+  return g_test_run ();
+}
@@ -0,0 +1,529 @@
+/*
+ * storage-benchmark: time the McdStorage operations that Mission Control
+ * performs most often, against synthetic account databases of various
+ * sizes, and print the results as tab-separated values
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * Usage: storage-benchmark [N_ACCOUNTS...]
+ *
+ * The default backend reads accounts.cfg once per process, so each size
+ * is measured by a child process (storage-benchmark --run N), and this
+ * process just collects their output. Each line after the header is:
+ *
+ *    accounts <TAB> operation <TAB> count <TAB> total-us <TAB> us-per-op
+ *
+ * Operations:
+ *    load              mcd_storage_load() parsing accounts.cfg
+ *    load-snapshot     mcd_storage_load() from the snapshot of the above
+ *    get-attribute     mcd_storage_get_attribute() of a random attribute
+ *    get-parameter     mcd_storage_get_parameter() of a random parameter
+ *    set-commit        mcd_storage_set_string() and set_parameter() on a
+ *                      random account, then mcd_storage_commit() of it
+ *    delete-commit     mcd_storage_delete_account() and
+ *                      mcd_storage_commit() of a random account
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "mcd-storage.h"
+
+#define N_GETS 100000
+#define N_SETS 500
+#define N_DELETES 100
+/* so that runs are comparable */
+#define SEED 0x5eed
+
+static const guint default_sizes[] = { 100, 1000, 10000, 50000, 0 };
+
+typedef struct {
+    const gchar *name;
+    GType type;
+    /* the value as it appears in the keyfile, with "#" standing for the
+     * account number */
+    const gchar *value;
+} Param;
+
+/* A mix of the sort of accounts people really have: all have a few
+ * parameters, of various types, and some have quite a lot. */
+typedef struct {
+    const gchar *manager;
+    const gchar *protocol;
+    const gchar *icon;
+    const Param *params;
+} Template;
+
+static const Param jabber_params[] = {
+    { "account", G_TYPE_STRING, "user#@example.com" },
+    { "server", G_TYPE_STRING, "talk.google.com" },
+    { "port", G_TYPE_UINT, "5223" },
+    { "old-ssl", G_TYPE_BOOLEAN, "true" },
+    { "require-encryption", G_TYPE_BOOLEAN, "true" },
+    { "resource", G_TYPE_STRING, "laptop#" },
+    { "fallback-conference-server", G_TYPE_STRING,
+        "conference.example.com" },
+    { NULL }
+};
+
+static const Param irc_params[] = {
+    { "account", G_TYPE_STRING, "nick#" },
+    { "server", G_TYPE_STRING, "irc.example.net" },
+    { "port", G_TYPE_UINT, "6667" },
+    { "username", G_TYPE_STRING, "user#" },
+    { "fullname", G_TYPE_STRING, "Some\\sUser\\s#" },
+    { "charset", G_TYPE_STRING, "UTF-8" },
+    { "use-ssl", G_TYPE_BOOLEAN, "false" },
+    { NULL }
+};
+
+static const Param msn_params[] = {
+    { "account", G_TYPE_STRING, "user#@example.net" },
+    { "password", G_TYPE_STRING, "hunter#" },
+    { NULL }
+};
+
+static const Param local_xmpp_params[] = {
+    { "nickname", G_TYPE_STRING, "user#" },
+    { "first-name", G_TYPE_STRING, "Some" },
+    { "last-name", G_TYPE_STRING, "User#" },
+    { "published-name", G_TYPE_STRING, "Some\\sUser\\s#" },
+    { NULL }
+};
+
+static const Param sip_params[] = {
+    { "account", G_TYPE_STRING, "sip:user#@example.org" },
+    { "auth-user", G_TYPE_STRING, "user#" },
+    { "password", G_TYPE_STRING, "hunter#" },
+    { "proxy-host", G_TYPE_STRING, "sip.example.org" },
+    { "port", G_TYPE_UINT, "5060" },
+    { "transport", G_TYPE_STRING, "tcp" },
+    { "keepalive-interval", G_TYPE_UINT, "#" },
+    { "discover-stun", G_TYPE_BOOLEAN, "false" },
+    { NULL }
+};
+
+static const Template templates[] = {
+    { "gabble", "jabber", "im-jabber", jabber_params },
+    { "gabble", "jabber", "im-google-talk", jabber_params },
+    { "idle", "irc", "im-irc", irc_params },
+    { "haze", "msn", "im-msn", msn_params },
+    { "salut", "local_xmpp", "im-local-xmpp", local_xmpp_params },
+    { "sofiasip", "sip", "im-sip", sip_params },
+    { NULL }
+};
+
+#define N_TEMPLATES (G_N_ELEMENTS (templates) - 1)
+
+static const gchar * const attributes[] = {
+    "manager", "protocol", "Icon", "DisplayName", "Nickname", "Enabled",
+    "ConnectAutomatically", "AutomaticPresence",
+    NULL
+};
+
+static const Template *
+account_template (guint i)
+{
+  return &templates[i % N_TEMPLATES];
+}
+
+static gchar *
+account_name (guint i)
+{
+  const Template *t = account_template (i);
+
+  return g_strdup_printf ("%s/%s/account%u", t->manager, t->protocol, i);
+}
+
+static void
+append_param_value (GString *data,
+    const Param *p,
+    guint i)
+{
+  const gchar *number = strchr (p->value, '#');
+
+  switch (p->type)
+    {
+      case G_TYPE_STRING:
+        if (number == NULL)
+          {
+            g_string_append (data, p->value);
+          }
+        else
+          {
+            g_string_append_len (data, p->value, number - p->value);
+            g_string_append_printf (data, "%u", i);
+            g_string_append (data, number + 1);
+          }
+        break;
+
+      case G_TYPE_UINT:
+        if (number == NULL)
+          g_string_append (data, p->value);
+        else
+          g_string_append_printf (data, "%u", i);
+        break;
+
+      case G_TYPE_BOOLEAN:
+        g_string_append (data, p->value);
+        break;
+
+      default:
+        g_assert_not_reached ();
+    }
+}
+
+static gchar *
+write_accounts (const gchar *data_home,
+    guint n_accounts)
+{
+  gchar *dir = g_build_filename (data_home, "telepathy", "mission-control",
+      NULL);
+  gchar *filename = g_build_filename (dir, "accounts.cfg", NULL);
+  GString *data = g_string_new ("# Telepathy accounts\n");
+  guint i;
+
+  for (i = 0; i < n_accounts; i++)
+    {
+      const Template *t = account_template (i);
+      gchar *name = account_name (i);
+      const Param *p;
+
+      g_string_append_printf (data,
+          "[%s]\n"
+          "manager=%s\n"
+          "protocol=%s\n"
+          "Icon=%s\n"
+          "DisplayName=Account\\s%u\n"
+          "Nickname=User\\s%u\n"
+          "Enabled=%s\n"
+          "ConnectAutomatically=%s\n"
+          "AutomaticPresence=2;available;;\n",
+          name, t->manager, t->protocol, t->icon, i, i,
+          (i % 7 == 0 ? "false" : "true"),
+          (i % 3 == 0 ? "false" : "true"));
+
+      /* only accounts that have been used have these */
+      if (i % 2 == 0)
+        g_string_append (data,
+            "HasBeenOnline=true\n"
+            "NormalizedName=user@example.com\n");
+
+      for (p = t->params; p->name != NULL; p++)
+        {
+          g_string_append_printf (data, "param-%s=", p->name);
+          append_param_value (data, p, i);
+          g_string_append_c (data, '\n');
+        }
+
+      g_string_append_c (data, '\n');
+      g_free (name);
+    }
+
+  g_mkdir_with_parents (dir, 0700);
+
+  if (!g_file_set_contents (filename, data->str, data->len, NULL))
+    g_error ("unable to write %s", filename);
+
+  g_string_free (data, TRUE);
+  g_free (dir);
+  return filename;
+}
+
+static void
+report (guint n_accounts,
+    const gchar *operation,
+    guint count,
+    gint64 elapsed)
+{
+  g_print ("%u\t%s\t%u\t%" G_GINT64_FORMAT "\t%.3f\n", n_accounts,
+      operation, count, elapsed, elapsed / (gdouble) count);
+}
+
+static McdStorage *
+load (guint n_accounts,
+    const gchar *operation)
+{
+  McdStorage *storage = mcd_storage_new (NULL);
+  gint64 start = g_get_monotonic_time ();
+  gint64 elapsed;
+  gsize n;
+  GStrv accounts;
+
+  mcd_storage_load (storage);
+  elapsed = g_get_monotonic_time () - start;
+
+  accounts = mcd_storage_dup_accounts (storage, &n);
+
+  if (n != n_accounts)
+    g_error ("expected %u accounts, got %" G_GSIZE_FORMAT, n_accounts, n);
+
+  g_strfreev (accounts);
+  report (n_accounts, operation, 1, elapsed);
+  return storage;
+}
+
+static void
+get_attributes (McdStorage *storage,
+    GRand *rand,
+    guint n_accounts)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < N_GETS; i++)
+    {
+      guint which = g_rand_int_range (rand, 0, n_accounts);
+      const gchar *attribute = attributes[g_rand_int_range (rand, 0,
+          G_N_ELEMENTS (attributes) - 1)];
+      gchar *account = account_name (which);
+      GValue value = G_VALUE_INIT;
+
+      mcd_storage_init_value_for_attribute (&value, attribute);
+
+      if (!mcd_storage_get_attribute (storage, account, attribute, &value,
+            NULL))
+        g_error ("%s has no %s", account, attribute);
+
+      g_value_unset (&value);
+      g_free (account);
+    }
+
+  report (n_accounts, "get-attribute", N_GETS,
+      g_get_monotonic_time () - start);
+}
+
+static void
+get_parameters (McdStorage *storage,
+    GRand *rand,
+    guint n_accounts)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < N_GETS; i++)
+    {
+      guint which = g_rand_int_range (rand, 0, n_accounts);
+      const Param *params = account_template (which)->params;
+      const Param *p;
+      gchar *account = account_name (which);
+      GValue value = G_VALUE_INIT;
+      guint n_params = 0;
+
+      while (params[n_params].name != NULL)
+        n_params++;
+
+      p = &params[g_rand_int_range (rand, 0, n_params)];
+      g_value_init (&value, p->type);
+
+      if (!mcd_storage_get_parameter (storage, account, p->name, &value,
+            NULL))
+        g_error ("%s has no parameter %s", account, p->name);
+
+      g_value_unset (&value);
+      g_free (account);
+    }
+
+  report (n_accounts, "get-parameter", N_GETS,
+      g_get_monotonic_time () - start);
+}
+
+/* What happens when the user edits an account: a couple of changes, which
+ * are then committed to disk. */
+static void
+set_and_commit (McdStorage *storage,
+    GRand *rand,
+    guint n_accounts)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < N_SETS; i++)
+    {
+      guint which = g_rand_int_range (rand, 0, n_accounts);
+      const Param *p = &account_template (which)->params[0];
+      gchar *account = account_name (which);
+      gchar *nickname = g_strdup_printf ("Nick %u", i);
+      GValue value = G_VALUE_INIT;
+
+      g_value_init (&value, G_TYPE_STRING);
+      g_value_take_string (&value, g_strdup_printf ("changed%u", i));
+
+      mcd_storage_set_string (storage, account, "Nickname", nickname);
+      mcd_storage_set_parameter (storage, account, p->name, &value, FALSE);
+      mcd_storage_commit (storage, account);
+
+      g_value_unset (&value);
+      g_free (nickname);
+      g_free (account);
+    }
+
+  report (n_accounts, "set-commit", N_SETS, g_get_monotonic_time () - start);
+}
+
+static void
+delete_and_commit (McdStorage *storage,
+    GRand *rand,
+    guint n_accounts)
+{
+  guint n_deletes = MIN (N_DELETES, n_accounts / 2);
+  gint64 elapsed = 0;
+  guint i;
+
+  for (i = 0; i < n_deletes; i++)
+    {
+      gchar *account = NULL;
+      gint64 start;
+
+      /* pick one we haven't deleted yet, without counting the search */
+      do
+        {
+          g_free (account);
+          account = account_name (g_rand_int_range (rand, 0, n_accounts));
+        }
+      while (g_hash_table_lookup (storage->accounts, account) == NULL);
+
+      start = g_get_monotonic_time ();
+      mcd_storage_delete_account (storage, account);
+      mcd_storage_commit (storage, account);
+      elapsed += g_get_monotonic_time () - start;
+
+      g_free (account);
+    }
+
+  if (n_deletes > 0)
+    report (n_accounts, "delete-commit", n_deletes, elapsed);
+}
+
+static void
+run (guint n_accounts)
+{
+  gchar *tmpdir;
+  gchar *data_home;
+  gchar *accounts;
+  gchar *journal;
+  gchar *snapshot;
+  McdStorage *storage;
+  GRand *rand = g_rand_new_with_seed (SEED);
+
+  tmpdir = g_dir_make_tmp ("mc-storage-benchmark-XXXXXX", NULL);
+  data_home = g_build_filename (tmpdir, "data", NULL);
+  snapshot = g_build_filename (tmpdir, "telepathy", "mission-control",
+      "accounts.snapshot", NULL);
+
+  g_setenv ("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv ("XDG_DATA_DIRS", data_home, TRUE);
+  g_setenv ("XDG_CACHE_HOME", tmpdir, TRUE);
+  /* only the default backend */
+  g_setenv ("MC_FILTER_PLUGIN_DIR", tmpdir, TRUE);
+
+  accounts = write_accounts (data_home, n_accounts);
+  journal = g_strconcat (accounts, ".journal", NULL);
+
+  /* the first load includes the default backend parsing accounts.cfg, as
+   * happens when MC starts; disposing of it writes a snapshot */
+  storage = load (n_accounts, "load");
+  g_object_unref (storage);
+
+  storage = load (n_accounts, "load-snapshot");
+
+  get_attributes (storage, rand, n_accounts);
+  get_parameters (storage, rand, n_accounts);
+  set_and_commit (storage, rand, n_accounts);
+  delete_and_commit (storage, rand, n_accounts);
+
+  g_object_unref (storage);
+  g_rand_free (rand);
+  g_unlink (snapshot);
+  g_unlink (journal);
+  g_unlink (accounts);
+  g_free (journal);
+  g_free (accounts);
+  g_free (snapshot);
+  g_free (data_home);
+  g_free (tmpdir);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GArray *sizes = g_array_new (FALSE, FALSE, sizeof (guint));
+  gint status = 0;
+  guint i;
+
+  g_type_init ();
+
+  if (argc == 3 && !tp_strdiff (argv[1], "--run"))
+    {
+      run (atoi (argv[2]));
+      return 0;
+    }
+
+  for (i = 1; i < (guint) argc; i++)
+    {
+      guint n = atoi (argv[i]);
+
+      g_array_append_val (sizes, n);
+    }
+
+  if (sizes->len == 0)
+    {
+      for (i = 0; default_sizes[i] != 0; i++)
+        g_array_append_val (sizes, default_sizes[i]);
+    }
+
+  g_print ("accounts\toperation\tcount\ttotal-us\tus-per-op\n");
+
+  for (i = 0; i < sizes->len; i++)
+    {
+      gchar *n = g_strdup_printf ("%u", g_array_index (sizes, guint, i));
+      gchar *child_argv[] = { argv[0], "--run", n, NULL };
+      gchar *out = NULL;
+      GError *error = NULL;
+      gint child_status;
+
+      if (!g_spawn_sync (NULL, child_argv, NULL, G_SPAWN_DEFAULT, NULL,
+            NULL, &out, NULL, &child_status, &error))
+        g_error ("unable to run %s: %s", argv[0], error->message);
+
+      g_print ("%s", out);
+      fflush (stdout);
+
+      if (!g_spawn_check_exit_status (child_status, NULL))
+        {
+          g_printerr ("benchmark with %s accounts failed\n", n);
+          status = 1;
+        }
+
+      g_free (out);
+      g_free (n);
+    }
+
+  g_array_unref (sizes);
+  return status;
+}
@@ -0,0 +1,151 @@
+/*
+ * storage-memory-report: how much heap McdStorage uses per account once
+ * a large number of accounts has been loaded
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "mcd-storage.h"
+
+#define DEFAULT_ACCOUNTS 10000
+
+static gchar *
+write_accounts (const gchar *data_home,
+    guint n_accounts)
+{
+  gchar *dir = g_build_filename (data_home, "telepathy", "mission-control",
+      NULL);
+  gchar *filename = g_build_filename (dir, "accounts.cfg", NULL);
+  GString *data = g_string_new ("# Telepathy accounts\n");
+  guint i;
+
+  for (i = 0; i < n_accounts; i++)
+    g_string_append_printf (data,
+        "[gabble/jabber/user%u_40example_2ecom0]\n"
+        "manager=gabble\n"
+        "protocol=jabber\n"
+        "Icon=im-jabber\n"
+        "Service=google-talk\n"
+        "DisplayName=user%u@example.com\n"
+        "Nickname=User\\s%u\n"
+        "NormalizedName=user%u@example.com\n"
+        "Enabled=true\n"
+        "ConnectAutomatically=true\n"
+        "HasBeenOnline=true\n"
+        "AutomaticPresence=2;available;;\n"
+        "condition-ip-address=192.0.2.1\n"
+        "param-account=user%u@example.com\n"
+        "param-server=talk.google.com\n"
+        "param-port=5223\n"
+        "param-old-ssl=true\n"
+        "\n", i, i, i, i, i);
+
+  g_mkdir_with_parents (dir, 0700);
+
+  if (!g_file_set_contents (filename, data->str, data->len, NULL))
+    g_error ("unable to write %s", filename);
+
+  g_string_free (data, TRUE);
+  g_free (dir);
+  return filename;
+}
+
+static gsize
+heap_in_use (void)
+{
+#if defined (__GLIBC__) && __GLIBC_PREREQ (2, 33)
+  return mallinfo2 ().uordblks;
+#elif defined (__GLIBC__)
+  return (guint) mallinfo ().uordblks;
+#else
+  return 0;
+#endif
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint n_accounts = DEFAULT_ACCOUNTS;
+  gchar *tmpdir;
+  gchar *data_home;
+  gchar *snapshot;
+  gchar *accounts;
+  McdStorage *storage;
+  gsize before, after;
+
+  if (argc > 1)
+    n_accounts = atoi (argv[1]);
+
+  g_type_init ();
+
+  tmpdir = g_dir_make_tmp ("mc-storage-memory-XXXXXX", NULL);
+  data_home = g_build_filename (tmpdir, "data", NULL);
+  snapshot = g_build_filename (tmpdir, "telepathy", "mission-control",
+      "accounts.snapshot", NULL);
+
+  g_setenv ("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv ("XDG_DATA_DIRS", data_home, TRUE);
+  g_setenv ("XDG_CACHE_HOME", tmpdir, TRUE);
+  g_setenv ("MC_FILTER_PLUGIN_DIR", tmpdir, TRUE);
+
+  accounts = write_accounts (data_home, n_accounts);
+
+  /* The default backend keeps its own copy of accounts.cfg, which isn't
+   * what we're measuring: make it load that first. */
+  storage = mcd_storage_new (NULL);
+  mcd_storage_load (storage);
+  g_object_unref (storage);
+
+  /* Decode every account, rather than restoring them from the snapshot,
+   * whose values are mostly in the mapped file and not the heap */
+  g_unlink (snapshot);
+
+  before = heap_in_use ();
+  storage = mcd_storage_new (NULL);
+  mcd_storage_load (storage);
+  after = heap_in_use ();
+
+  if (before == 0 && after == 0)
+    g_error ("don't know how to measure the heap on this platform");
+
+  g_print ("%8s %14s %16s\n", "accounts", "storage-bytes", "bytes/account");
+  g_print ("%8u %14" G_GSIZE_FORMAT " %16.1f\n", n_accounts,
+      after - before, (after - before) / (gdouble) n_accounts);
+
+  g_object_unref (storage);
+  g_unlink (snapshot);
+  g_unlink (accounts);
+  g_free (accounts);
+  g_free (snapshot);
+  g_free (data_home);
+  g_free (tmpdir);
+  return 0;
+}
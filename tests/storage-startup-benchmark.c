@@ -0,0 +1,158 @@
+/*
+ * storage-startup-benchmark: how long McdStorage takes to load a large
+ * number of accounts, with and without the snapshot left behind by the
+ * previous run
+ *
+ * Copyright © 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "mcd-storage.h"
+
+#define DEFAULT_ACCOUNTS 1000
+#define ITERATIONS 5
+
+static gchar *
+write_accounts (const gchar *data_home,
+    guint n_accounts)
+{
+  gchar *dir = g_build_filename (data_home, "telepathy", "mission-control",
+      NULL);
+  gchar *filename = g_build_filename (dir, "accounts.cfg", NULL);
+  GString *data = g_string_new ("# Telepathy accounts\n");
+  guint i;
+
+  for (i = 0; i < n_accounts; i++)
+    g_string_append_printf (data,
+        "[gabble/jabber/user%u_40example_2ecom0]\n"
+        "manager=gabble\n"
+        "protocol=jabber\n"
+        "Icon=im-jabber\n"
+        "Service=google-talk\n"
+        "DisplayName=user%u@example.com\n"
+        "Nickname=User\\s%u\n"
+        "Enabled=true\n"
+        "ConnectAutomatically=true\n"
+        "AutomaticPresence=2;available;;\n"
+        "param-account=user%u@example.com\n"
+        "param-server=talk.google.com\n"
+        "param-port=5223\n"
+        "param-old-ssl=true\n"
+        "\n", i, i, i, i);
+
+  g_mkdir_with_parents (dir, 0700);
+
+  if (!g_file_set_contents (filename, data->str, data->len, NULL))
+    g_error ("unable to write %s", filename);
+
+  g_string_free (data, TRUE);
+  g_free (dir);
+  return filename;
+}
+
+/* Returns how long it took to load, in microseconds */
+static gint64
+load (guint n_accounts)
+{
+  McdStorage *storage = mcd_storage_new (NULL);
+  gint64 start = g_get_monotonic_time ();
+  gint64 elapsed;
+  GStrv accounts;
+
+  mcd_storage_load (storage);
+  elapsed = g_get_monotonic_time () - start;
+
+  accounts = mcd_storage_dup_accounts (storage, NULL);
+
+  if (g_strv_length (accounts) != n_accounts)
+    g_error ("expected %u accounts, got %u", n_accounts,
+        g_strv_length (accounts));
+
+  g_strfreev (accounts);
+  g_object_unref (storage);
+  return elapsed;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint n_accounts = DEFAULT_ACCOUNTS;
+  gchar *tmpdir;
+  gchar *data_home;
+  gchar *cache_home;
+  gchar *accounts;
+  gchar *snapshot;
+  gint64 parse = 0, mapped = 0;
+  guint i;
+
+  if (argc > 1)
+    n_accounts = atoi (argv[1]);
+
+  g_type_init ();
+
+  tmpdir = g_dir_make_tmp ("mc-storage-benchmark-XXXXXX", NULL);
+  data_home = g_build_filename (tmpdir, "data", NULL);
+  cache_home = g_build_filename (tmpdir, "cache", NULL);
+  snapshot = g_build_filename (cache_home, "telepathy", "mission-control",
+      "accounts.snapshot", NULL);
+
+  g_setenv ("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv ("XDG_CACHE_HOME", cache_home, TRUE);
+  g_setenv ("XDG_DATA_DIRS", data_home, TRUE);
+  /* only the default backend, otherwise there's no snapshot */
+  g_setenv ("MC_FILTER_PLUGIN_DIR", tmpdir, TRUE);
+
+  accounts = write_accounts (data_home, n_accounts);
+
+  /* The first load reads accounts.cfg; the backend keeps it in memory
+   * afterwards, so don't count that one. */
+  load (n_accounts);
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      /* this also includes writing a new snapshot, as MC would */
+      g_unlink (snapshot);
+      parse += load (n_accounts);
+      mapped += load (n_accounts);
+    }
+
+  g_print ("%8s %12s %12s\n", "accounts", "parse-ms", "snapshot-ms");
+  g_print ("%8u %12.2f %12.2f\n", n_accounts,
+      parse / (ITERATIONS * 1000.0), mapped / (ITERATIONS * 1000.0));
+
+  if (!g_file_test (snapshot, G_FILE_TEST_EXISTS))
+    g_printerr ("warning: no snapshot was written, so both columns measure "
+        "the same thing\n");
+
+  g_unlink (snapshot);
+  g_unlink (accounts);
+  g_free (accounts);
+  g_free (snapshot);
+  g_free (cache_home);
+  g_free (data_home);
+  g_free (tmpdir);
+  return 0;
+}
@@ -0,0 +1,87 @@
+# Copyright (C) 2009-2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test: when UpdateParameters() changes several parameters at
+once, they are passed to the storage plugin in a batch, but secret
+parameters are still stored with MCP_PARAMETER_FLAG_SECRET.
+"""
+
+import dbus
+
+from servicetest import EventPattern, call_async, assertEquals
+from mctest import exec_test, create_fakecm_account
+import constants as cs
+
+def test(q, bus, mc, **kwargs):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    (cm_name_ref, account) = create_fakecm_account(q, bus, mc, params)
+    account_path = account.__dbus_object_path__
+    account_tail = account_path[len(cs.ACCOUNT_PATH_PREFIX):]
+
+    # the password is secret (see fakecm.manager), so it must never be
+    # part of a batch, which has no way to say so
+    q.forbid_events([
+        EventPattern('dbus-signal',
+            interface=cs.TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
+            signal='DeferringSetBatch',
+            predicate=(lambda e: 'param-password' in e.args[1])),
+        ])
+
+    call_async(q, account, 'UpdateParameters',
+            {
+                'password': 'hunter2',
+                'nickname': 'albinoblacksheep',
+                'secret-mushroom': '/Amanita muscaria/',
+            },
+            [],
+            dbus_interface=cs.ACCOUNT)
+
+    batch, update, _ = q.expect_many(
+        EventPattern('dbus-signal',
+            interface=cs.TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
+            signal='DeferringSetBatch'),
+        EventPattern('dbus-method-call',
+            interface=cs.TEST_DBUS_ACCOUNT_SERVICE_IFACE,
+            method='UpdateParameters'),
+        EventPattern('dbus-return', method='UpdateParameters'),
+        )
+
+    assertEquals(account_path, batch.args[0])
+    assertEquals(set(['param-nickname', 'param-secret-mushroom']),
+            set(batch.args[1]))
+
+    assertEquals(account_tail, update.args[0])
+    assertEquals({
+                'password': 'hunter2',
+                'nickname': 'albinoblacksheep',
+                'secret-mushroom': '/Amanita muscaria/',
+            }, update.args[1])
+    assertEquals({}, update.args[2])
+    assertEquals({
+                'password': cs.PARAM_FLAG_SECRET,
+                'nickname': 0,
+                'secret-mushroom': 0,
+            }, update.args[3])
+    assertEquals([], update.args[4])
+
+    assertEquals('hunter2',
+            account.Get(cs.ACCOUNT, 'Parameters',
+                dbus_interface=cs.PROPERTIES_IFACE)['password'])
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,111 @@
+# Test for the journalled mode of the default storage backend.
+#
+# Copyright (C) 2009-2010 Nokia Corporation
+# Copyright (C) 2009-2013 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import os
+import os.path
+
+import dbus
+
+from servicetest import assertEquals, assertNotEquals
+from mctest import (
+    exec_test, get_fakecm_account, keyfile_read, tell_mc_to_die,
+    resuscitate_mc
+    )
+import constants as cs
+
+JOURNAL_HEADER = '# Telepathy accounts journal\n'
+
+def test(q, bus, mc):
+    mc_dir = os.path.join(os.environ['XDG_DATA_HOME'],
+            'telepathy', 'mission-control')
+    key_file_name = os.path.join(mc_dir, 'accounts.cfg')
+    journal_name = key_file_name + '.journal'
+
+    name = 'fakecm/fakeprotocol/dontdivert_40example_2ecom0'
+    path = cs.ACCOUNT_PATH_PREFIX + name
+
+    tell_mc_to_die(q, bus)
+
+    if not os.path.isdir(mc_dir):
+        os.makedirs(mc_dir, 0700)
+
+    open(key_file_name, 'w').write(
+r"""# Telepathy accounts
+[%s]
+manager=fakecm
+protocol=fakeprotocol
+param-account=dontdivert@example.com
+DisplayName=From the base file
+""" % name)
+
+    # The existence of the journal opts in to this mode. It ends with a
+    # transaction that we crashed while writing, which must be ignored.
+    open(journal_name, 'w').write(JOURNAL_HEADER +
+        'S\t%s\tDisplayName\tFrom\\sthe journal\n' % name +
+        'C\n' +
+        'S\t%s\tNickname\tTorn\n' % name +
+        'S\t%s\tDisplayName\tTo' % name)
+
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    assertEquals([path], properties.get('ValidAccounts'))
+
+    account = get_fakecm_account(bus, mc, path)
+    account_props = dbus.Interface(account, cs.PROPERTIES_IFACE)
+    assertEquals('From the journal',
+            account_props.Get(cs.ACCOUNT, 'DisplayName'))
+    assertNotEquals('Torn', account_props.Get(cs.ACCOUNT, 'Nickname'))
+
+    # Because the journal was damaged, the next change starts a new one
+    # and folds everything into the base file
+    account_props.Set(cs.ACCOUNT, 'Nickname', 'Fred')
+
+    tell_mc_to_die(q, bus)
+
+    kf = keyfile_read(key_file_name)
+    assertEquals('From\\sthe journal', kf[name]['DisplayName'])
+    assertEquals('Fred', kf[name]['Nickname'])
+    journal = open(journal_name).read()
+    assert journal.startswith(JOURNAL_HEADER), journal
+    assert 'Torn' not in journal, journal
+
+    # From now on, changes are just appended to the journal
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    account = get_fakecm_account(bus, mc, path)
+    account_props = dbus.Interface(account, cs.PROPERTIES_IFACE)
+    account_props.Set(cs.ACCOUNT, 'DisplayName', 'Appended')
+
+    tell_mc_to_die(q, bus)
+
+    kf = keyfile_read(key_file_name)
+    assertEquals('From\\sthe journal', kf[name]['DisplayName'])
+    journal = open(journal_name).read()
+    assert journal.startswith(JOURNAL_HEADER), journal
+    assert ('S\t%s\tDisplayName\tAppended\n' % name) in journal, journal
+    assert journal.endswith('C\n'), journal
+
+    # ... and replayed when we start up again
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    account = get_fakecm_account(bus, mc, path)
+    account_props = dbus.Interface(account, cs.PROPERTIES_IFACE)
+    assertEquals('Appended', account_props.Get(cs.ACCOUNT, 'DisplayName'))
+    assertEquals('Fred', account_props.Get(cs.ACCOUNT, 'Nickname'))
+
+if __name__ == '__main__':
+    exec_test(test, {}, timeout=10, use_fake_accounts_service=False)
@@ -0,0 +1,102 @@
+# Test for migrating from the journalled mode of the default storage
+# backend to the per-account layout. run-test.sh sets MC_SHARDED_ACCOUNTS
+# for this test.
+#
+# Copyright (C) 2009-2010 Nokia Corporation
+# Copyright (C) 2009-2013 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import os
+import os.path
+
+import dbus
+
+from servicetest import assertEquals
+from mctest import (
+    exec_test, get_fakecm_account, keyfile_read, tell_mc_to_die,
+    resuscitate_mc
+    )
+import constants as cs
+
+JOURNAL_HEADER = '# Telepathy accounts journal\n'
+
+def test(q, bus, mc):
+    mc_dir = os.path.join(os.environ['XDG_DATA_HOME'],
+            'telepathy', 'mission-control')
+    key_file_name = os.path.join(mc_dir, 'accounts.cfg')
+    journal_name = key_file_name + '.journal'
+    shard_dir = os.path.join(mc_dir, 'accounts.d')
+
+    name = 'fakecm/fakeprotocol/dontdivert_40example_2ecom0'
+    path = cs.ACCOUNT_PATH_PREFIX + name
+
+    tell_mc_to_die(q, bus)
+
+    if not os.path.isdir(mc_dir):
+        os.makedirs(mc_dir, 0700)
+
+    open(key_file_name, 'w').write(
+r"""# Telepathy accounts
+[%s]
+manager=fakecm
+protocol=fakeprotocol
+param-account=dontdivert@example.com
+DisplayName=From the base file
+""" % name)
+
+    # Some changes were only ever written to the journal
+    open(journal_name, 'w').write(JOURNAL_HEADER +
+        'S\t%s\tDisplayName\tFrom\\sthe journal\n' % name +
+        'S\t%s\tNickname\tJournalled\n' % name +
+        'C\n')
+
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    assertEquals([path], properties.get('ValidAccounts'))
+
+    account = get_fakecm_account(bus, mc, path)
+    account_props = dbus.Interface(account, cs.PROPERTIES_IFACE)
+    assertEquals('From the journal',
+            account_props.Get(cs.ACCOUNT, 'DisplayName'))
+    assertEquals('Journalled', account_props.Get(cs.ACCOUNT, 'Nickname'))
+
+    # The first write migrates everything to the per-account layout,
+    # including what was in the journal, and only then deletes the old files
+    account_props.Set(cs.ACCOUNT, 'Icon', 'im-fake')
+
+    tell_mc_to_die(q, bus)
+
+    assert not os.path.exists(key_file_name)
+    assert not os.path.exists(journal_name)
+
+    shards = os.listdir(shard_dir)
+    assertEquals(1, len(shards))
+    kf = keyfile_read(os.path.join(shard_dir, shards[0]))
+    assertEquals('From\\sthe journal', kf[name]['DisplayName'])
+    assertEquals('Journalled', kf[name]['Nickname'])
+    assertEquals('im-fake', kf[name]['Icon'])
+
+    # ... and it's all still there when we start up again
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    account = get_fakecm_account(bus, mc, path)
+    account_props = dbus.Interface(account, cs.PROPERTIES_IFACE)
+    assertEquals('From the journal',
+            account_props.Get(cs.ACCOUNT, 'DisplayName'))
+    assertEquals('Journalled', account_props.Get(cs.ACCOUNT, 'Nickname'))
+    assertEquals('im-fake', account_props.Get(cs.ACCOUNT, 'Icon'))
+
+if __name__ == '__main__':
+    exec_test(test, {}, timeout=10, use_fake_accounts_service=False)
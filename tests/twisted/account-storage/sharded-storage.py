@@ -0,0 +1,133 @@
+# Test for the one-file-per-account layout of the default storage backend.
+#
+# Copyright (C) 2009-2010 Nokia Corporation
+# Copyright (C) 2009-2013 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+import os
+import os.path
+
+import dbus
+
+from servicetest import assertEquals
+from mctest import (
+    exec_test, get_fakecm_account, keyfile_read, tell_mc_to_die,
+    resuscitate_mc
+    )
+import constants as cs
+
+def read_shards(shard_dir):
+    """Return { account: (filename, { key: value }) } for every
+    per-account file."""
+    ret = {}
+
+    for basename in os.listdir(shard_dir):
+        filename = os.path.join(shard_dir, basename)
+        kf = keyfile_read(filename)
+        del kf[None]
+        assertEquals(1, len(kf))
+        group, values = kf.items()[0]
+        ret[group] = (filename, values)
+
+    return ret
+
+def test(q, bus, mc):
+    mc_dir = os.path.join(os.environ['XDG_DATA_HOME'],
+            'telepathy', 'mission-control')
+    key_file_name = os.path.join(mc_dir, 'accounts.cfg')
+    shard_dir = os.path.join(mc_dir, 'accounts.d')
+
+    first = 'fakecm/fakeprotocol/dontdivert1_40example_2ecom0'
+    second = 'fakecm/fakeprotocol/dontdivert2_40example_2ecom0'
+    first_path = cs.ACCOUNT_PATH_PREFIX + first
+    second_path = cs.ACCOUNT_PATH_PREFIX + second
+
+    tell_mc_to_die(q, bus)
+
+    # Start with the usual monolithic file, and opt in to the sharded
+    # layout by creating the directory
+    if not os.path.isdir(mc_dir):
+        os.makedirs(mc_dir, 0700)
+
+    open(key_file_name, 'w').write(
+r"""# Telepathy accounts
+[%s]
+manager=fakecm
+protocol=fakeprotocol
+param-account=dontdivert1@example.com
+DisplayName=First account
+
+[%s]
+manager=fakecm
+protocol=fakeprotocol
+param-account=dontdivert2@example.com
+DisplayName=Second account
+""" % (first, second))
+    os.mkdir(shard_dir, 0700)
+
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    assertEquals(sorted([first_path, second_path]),
+            sorted(properties.get('ValidAccounts')))
+
+    account = get_fakecm_account(bus, mc, first_path)
+    account.Set(cs.ACCOUNT, 'DisplayName', 'Renamed',
+            dbus_interface=cs.PROPERTIES_IFACE)
+
+    tell_mc_to_die(q, bus)
+
+    # The first write split every account out into its own file, and the
+    # monolithic file went away
+    assert not os.path.exists(key_file_name)
+    shards = read_shards(shard_dir)
+    assertEquals(sorted([first, second]), sorted(shards.keys()))
+    assertEquals('Renamed', shards[first][1]['DisplayName'])
+    assertEquals('Second account', shards[second][1]['DisplayName'])
+    assertEquals('dontdivert2@example.com',
+            shards[second][1]['param-account'])
+
+    second_inode = os.stat(shards[second][0]).st_ino
+
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    assertEquals(sorted([first_path, second_path]),
+            sorted(properties.get('ValidAccounts')))
+
+    # From now on, changing one account only rewrites that account's file
+    account = get_fakecm_account(bus, mc, first_path)
+    account.Set(cs.ACCOUNT, 'Nickname', 'Fred',
+            dbus_interface=cs.PROPERTIES_IFACE)
+
+    tell_mc_to_die(q, bus)
+
+    shards = read_shards(shard_dir)
+    assertEquals('Fred', shards[first][1]['Nickname'])
+    assertEquals(second_inode, os.stat(shards[second][0]).st_ino)
+    assert not os.path.exists(key_file_name)
+
+    # Deleting an account deletes its file
+    account_manager, properties, interfaces = resuscitate_mc(q, bus, mc)
+    account = get_fakecm_account(bus, mc, second_path)
+    assert account.Remove(dbus_interface=cs.ACCOUNT) is None
+    q.expect('dbus-signal', path=cs.AM_PATH, signal='AccountRemoved',
+            interface=cs.AM, args=[second_path])
+
+    tell_mc_to_die(q, bus)
+
+    shards = read_shards(shard_dir)
+    assertEquals([first], shards.keys())
+
+if __name__ == '__main__':
+    exec_test(test, {}, timeout=10, use_fake_accounts_service=False)
@@ -74,7 +74,8 @@ def test(q, bus, mc):
         filters = {}
         tokens = {}
 
-        assert len(structs) == 3
+        # only Handlers are included, so not the Logger
+        assert len(structs) == 2
 
         for struct in structs:
             assert struct[0] not in filters
@@ -131,13 +132,17 @@ def test(q, bus, mc):
     # wait for MC to download the properties
     expect_client_setup(q, [irssi])
 
+    # The CM is given the capabilities of every Handler again, now
+    # including Irssi
     e = q.expect('dbus-method-call', handled=False,
         interface=cs.CONN_IFACE_CONTACT_CAPS,
         method='UpdateCapabilities')
 
-    assert len(e.args[0]) == 1
-    struct = e.args[0][0]
-    assert struct[0] == cs.CLIENT + '.Irssi'
+    structs = dict((struct[0], struct) for struct in e.args[0])
+    assert len(e.args[0]) == 3
+    assert cs.CLIENT + '.MediaCall' in structs
+    assert cs.CLIENT + '.AbiWord' in structs
+    struct = structs[cs.CLIENT + '.Irssi']
     assert struct[1] == [irssi_fixed_properties]
     assert struct[2] == []
 
@@ -151,9 +156,9 @@ def test(q, bus, mc):
         interface=cs.CONN_IFACE_CONTACT_CAPS,
         method='UpdateCapabilities')
 
-    assert len(e.args[0]) == 1
-    struct = e.args[0][0]
-    assert struct[0] == cs.CLIENT + '.Irssi'
+    structs = dict((struct[0], struct) for struct in e.args[0])
+    assert len(e.args[0]) == 3
+    struct = structs[cs.CLIENT + '.Irssi']
     assert struct[1] == []
     assert struct[2] == []
 
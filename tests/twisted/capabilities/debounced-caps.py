@@ -0,0 +1,106 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Start a lot of Handlers while a lot of connections are online, and
+check that MC combines their capabilities into fewer UpdateCapabilities
+calls than there are Handlers, reporting how many it made.
+"""
+
+import sys
+import time
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, expect_client_setup
+import constants as cs
+
+N_CONNECTIONS = 20
+N_HANDLERS = 30
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def test(q, bus, mc):
+    conns = []
+
+    for n in range(N_CONNECTIONS):
+        params = dbus.Dictionary({"account": "someguy%d@example.com" % n,
+            "password": "secrecy"}, signature='sv')
+        cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+        conn, before = enable_fakecm_account(q, bus, mc, account, params,
+                extra_interfaces=[cs.CONN_IFACE_CONTACT_CAPS],
+                expect_before_connect=[
+                    EventPattern('dbus-method-call', handled=False,
+                        interface=cs.CONN_IFACE_CONTACT_CAPS,
+                        method='UpdateCapabilities'),
+                    ])
+        q.dbus_return(before.message, signature='')
+        conns.append(conn)
+
+    # connection path => number of calls, and the clients in the last one
+    calls = dict((conn.object_path, 0) for conn in conns)
+    latest = dict((conn.object_path, set()) for conn in conns)
+
+    def update_capabilities(e):
+        calls[e.path] += 1
+        latest[e.path] = set(struct[0] for struct in e.args[0])
+        q.dbus_return(e.message, signature='')
+
+    q.add_dbus_method_impl(update_capabilities,
+            interface=cs.CONN_IFACE_CONTACT_CAPS,
+            method='UpdateCapabilities')
+
+    names = [cs.CLIENT + '.Handler%d' % i for i in range(N_HANDLERS)]
+
+    def all_pushed():
+        for path in latest:
+            for name in names:
+                if name not in latest[path]:
+                    return False
+
+        return True
+
+    start = time.time()
+    handlers = [SimulatedClient(q, bus, 'Handler%d' % i,
+            handle=[text_fixed_properties], cap_tokens=[])
+        for i in range(N_HANDLERS)]
+
+    # wait for MC to download the properties
+    expect_client_setup(q, handlers)
+
+    while not all_pushed():
+        q.expect('dbus-method-call', interface=cs.CONN_IFACE_CONTACT_CAPS,
+                method='UpdateCapabilities')
+
+    elapsed = time.time() - start
+
+    for path in calls:
+        # one per handler would mean nothing was combined
+        assert calls[path] < N_HANDLERS, (path, calls[path])
+
+    print >> sys.stderr, ("%d handlers, %d connections: %d "
+            "UpdateCapabilities calls (at most %d per connection), %.1fms" %
+            (N_HANDLERS, N_CONNECTIONS, sum(calls.values()),
+                max(calls.values()), elapsed * 1000))
+
+if __name__ == '__main__':
+    exec_test(test, {})
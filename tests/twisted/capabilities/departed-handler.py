@@ -0,0 +1,110 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test: if a Handler exits, and a new connection is given a
+capabilities snapshot before the change is pushed to the existing
+connections, the existing connections must still be told that the Handler
+has gone.
+"""
+
+import dbus
+import dbus.bus
+
+from servicetest import EventPattern
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, expect_client_setup
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+IRSSI = cs.CLIENT + '.Irssi'
+LATE = cs.CLIENT + '.Late'
+
+def connect(q, bus, mc, n):
+    params = dbus.Dictionary({"account": "someguy%d@example.com" % n,
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn, before = enable_fakecm_account(q, bus, mc, account, params,
+            extra_interfaces=[cs.CONN_IFACE_CONTACT_CAPS],
+            expect_before_connect=[
+                EventPattern('dbus-method-call', handled=False,
+                    interface=cs.CONN_IFACE_CONTACT_CAPS,
+                    method='UpdateCapabilities'),
+                ])
+    q.dbus_return(before.message, signature='')
+    return conn, dict((struct[0], struct) for struct in before.args[0])
+
+def test(q, bus, mc):
+    irssi_bus = dbus.bus.BusConnection()
+    irssi_bus.set_exit_on_disconnect(False)   # we'll disconnect later
+    q.attach_to_bus(irssi_bus)
+    irssi = SimulatedClient(q, irssi_bus, 'Irssi',
+            handle=[text_fixed_properties], cap_tokens=[])
+    expect_client_setup(q, [irssi])
+
+    conn1, structs = connect(q, bus, mc, 1)
+    assert structs[IRSSI][1] == [text_fixed_properties], structs
+
+    # Irssi exits
+    irssi.release_name()
+    del irssi
+    irssi_bus.flush()
+    irssi_bus.close()
+
+    # Before that is pushed to conn1, another connection comes online and
+    # is given a snapshot which already says Irssi has gone...
+    conn2, structs = connect(q, bus, mc, 2)
+    assert structs[IRSSI][1] == [], structs
+    assert structs[IRSSI][2] == [], structs
+
+    def update_capabilities(e):
+        q.dbus_return(e.message, signature='')
+
+    q.add_dbus_method_impl(update_capabilities,
+            interface=cs.CONN_IFACE_CONTACT_CAPS,
+            method='UpdateCapabilities')
+
+    # ... and a new Handler changes the capabilities again
+    late = SimulatedClient(q, bus, 'Late',
+            handle=[text_fixed_properties], cap_tokens=[])
+    expect_client_setup(q, [late])
+
+    # conn1 must still be told that Irssi has gone, whether that comes
+    # before or together with the news about the new Handler
+    told_irssi_gone = False
+
+    while True:
+        e = q.expect('dbus-method-call', path=conn1.object_path,
+                interface=cs.CONN_IFACE_CONTACT_CAPS,
+                method='UpdateCapabilities')
+        structs = dict((struct[0], struct) for struct in e.args[0])
+
+        if IRSSI in structs:
+            assert structs[IRSSI][1] == [], structs
+            assert structs[IRSSI][2] == [], structs
+            told_irssi_gone = True
+
+        if LATE in structs:
+            break
+
+    assert told_irssi_gone
+
+if __name__ == '__main__':
+    exec_test(test, {})
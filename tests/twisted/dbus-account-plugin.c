@@ -1184,6 +1184,64 @@ test_dbus_account_plugin_set_parameter (McpAccountStorage *storage,
   return TRUE;
 }
 
+static gboolean
+test_dbus_account_plugin_set_batch (McpAccountStorage *storage,
+    McpAccountManager *am,
+    const gchar *account_name,
+    GVariant *changes)
+{
+  TestDBusAccountPlugin *self = TEST_DBUS_ACCOUNT_PLUGIN (storage);
+  Account *account = lookup_account (self, account_name);
+  GVariantBuilder as_builder;
+  GVariantIter iter;
+  const gchar *key;
+  GVariant *value;
+
+  g_return_val_if_fail (account_name != NULL, FALSE);
+
+  DEBUG ("%s", account_name);
+
+  if (!self->active || account == NULL ||
+      (account->flags & UNCOMMITTED_DELETION))
+    return FALSE;
+
+  g_variant_builder_init (&as_builder, G_VARIANT_TYPE_STRING_ARRAY);
+  g_variant_iter_init (&iter, changes);
+
+  while (g_variant_iter_next (&iter, "{&smv}", &key, &value))
+    {
+      g_variant_builder_add (&as_builder, "s", key);
+      tp_clear_pointer (&value, g_variant_unref);
+    }
+
+  /* tell the test which settings came in one go, then store them just as
+   * if they had been set individually */
+  g_dbus_connection_emit_signal (self->bus, NULL,
+      TEST_DBUS_ACCOUNT_PLUGIN_PATH, TEST_DBUS_ACCOUNT_PLUGIN_IFACE,
+      "DeferringSetBatch",
+      g_variant_new_parsed ("(%o, %@as)", account->path,
+        g_variant_builder_end (&as_builder)),
+      NULL);
+
+  g_variant_iter_init (&iter, changes);
+
+  while (g_variant_iter_next (&iter, "{&smv}", &key, &value))
+    {
+      if (value == NULL)
+        test_dbus_account_plugin_delete (storage, am, account_name, key);
+      else if (g_str_has_prefix (key, "param-"))
+        test_dbus_account_plugin_set_parameter (storage, am, account_name,
+            key + 6, value, MCP_PARAMETER_FLAG_NONE);
+      else
+        test_dbus_account_plugin_set_attribute (storage, am, account_name,
+            key, value, MCP_ATTRIBUTE_FLAG_NONE);
+
+      tp_clear_pointer (&value, g_variant_unref);
+    }
+
+  return TRUE;
+}
+
 static gboolean
 test_dbus_account_plugin_commit (const McpAccountStorage *storage,
     const McpAccountManager *am)
@@ -1599,6 +1657,7 @@ account_storage_iface_init (McpAccountStorageIface *iface)
   iface->set = test_dbus_account_plugin_set;
   iface->set_attribute = test_dbus_account_plugin_set_attribute;
   iface->set_parameter = test_dbus_account_plugin_set_parameter;
+  iface->set_batch = test_dbus_account_plugin_set_batch;
   iface->list = test_dbus_account_plugin_list;
   iface->ready = test_dbus_account_plugin_ready;
   iface->delete = test_dbus_account_plugin_delete;
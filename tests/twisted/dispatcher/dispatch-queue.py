@@ -0,0 +1,181 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for dispatching a burst of channels through the
+dispatch queue, which only lets a limited number through per main loop
+iteration, and for an emergency channel overtaking such a backlog.
+"""
+
+import dbus
+
+from servicetest import EventPattern, sync_dbus
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
+        expect_client_setup
+import constants as cs
+
+N_CHANNELS = 25
+# must match DISPATCH_BATCH_SIZE in mcd-dispatcher.c
+BATCH_SIZE = 10
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def text_channel(conn, contact):
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = contact
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, contact)
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = contact
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, contact)
+    channel_properties[cs.CHANNEL + '.Requested'] = False
+    channel_properties[cs.CHANNEL + '.Interfaces'] = \
+            dbus.Array(signature='s')
+    return SimulatedChannel(conn, channel_properties)
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn, e = enable_fakecm_account(q, bus, mc, account, params,
+            extra_interfaces=[cs.CONN_IFACE_SERVICE_POINT],
+            expect_after_connect=[
+                EventPattern('dbus-method-call', method='Get',
+                    args=[cs.CONN_IFACE_SERVICE_POINT, 'KnownServicePoints']),
+                ])
+
+    e_numbers = ['911', '112']
+    points = dbus.Array([((cs.SERVICE_POINT_TYPE_EMERGENCY, 'urn:service:sos'),
+                          e_numbers)], signature='((us)as)')
+    q.dbus_return(e.message, points, signature='v')
+
+    # MC looks up the handles for these numbers
+    q.expect_many(*[EventPattern('dbus-method-call', path=conn.object_path,
+            interface=cs.CONN, method='RequestHandles',
+            args=[cs.HT_CONTACT, [num]],
+            handled=True) for num in e_numbers])
+
+    client = SimulatedClient(q, bus, 'Empathy',
+            handle=[text_fixed_properties], bypass_approval=True)
+    expect_client_setup(q, [client])
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+    cd_debug.ResetPhaseHistograms()
+
+    queues = cd_debug.GetDispatchQueues()
+    assert sorted(queues.keys()) == \
+            ['emergency', 'incoming', 'recovered', 'user-action'], queues
+
+    for depth, peak in queues.values():
+        assert depth == 0, queues
+        assert peak == 0, queues
+
+    channels = [text_channel(conn, 'contact%d' % i)
+            for i in range(N_CHANNELS)]
+
+    # all at once, so MC can't dispatch them all in one go
+    conn.NewChannels(channels)
+
+    # every channel is dispatched eventually
+    handled = set()
+
+    for chan in channels:
+        e = q.expect('dbus-method-call',
+                path=client.object_path,
+                interface=cs.HANDLER, method='HandleChannels',
+                handled=False)
+        assert len(e.args[2]) == 1, e.args
+        handled.add(e.args[2][0][0])
+        q.dbus_return(e.message, signature='')
+
+    assert handled == set([c.object_path for c in channels]), handled
+
+    sync_dbus(bus, q, mc)
+
+    queues = cd_debug.GetDispatchQueues()
+    depth, peak = queues['incoming']
+    assert depth == 0, queues
+    # some of them had to wait
+    assert 1 < peak < N_CHANNELS, queues
+
+    for c in ('emergency', 'user-action', 'recovered'):
+        assert queues[c] == (0, 0), queues
+
+    bounds, histograms = cd_debug.GetPhaseHistograms()
+    assert histograms['queue-wait:incoming'][0] == N_CHANNELS, histograms
+    assert histograms['total'][0] == N_CHANNELS, histograms
+
+    # resetting brings the peaks down to the current depths
+    cd_debug.ResetPhaseHistograms()
+    queues = cd_debug.GetDispatchQueues()
+    assert queues['incoming'] == (0, 0), queues
+
+    for chan in channels:
+        chan.close()
+
+    sync_dbus(bus, q, mc)
+
+    # Now a burst of ordinary channels with an emergency call at the end:
+    # only the first batch can go through before the emergency channel is
+    # queued, and it must be dispatched before the rest of the backlog
+    channels = [text_channel(conn, 'backlog%d' % i)
+            for i in range(N_CHANNELS)]
+    emergency = text_channel(conn, '911')
+    conn.NewChannels(channels + [emergency])
+
+    order = []
+
+    for i in range(N_CHANNELS + 1):
+        e = q.expect('dbus-method-call',
+                path=client.object_path,
+                interface=cs.HANDLER, method='HandleChannels',
+                handled=False)
+        assert len(e.args[2]) == 1, e.args
+        order.append(e.args[2][0][0])
+        q.dbus_return(e.message, signature='')
+
+    assert sorted(order) == \
+            sorted([c.object_path for c in channels + [emergency]]), order
+    position = order.index(emergency.object_path)
+    # at most the first batch and whatever was already in flight can beat
+    # it; the rest of the backlog has to wait
+    assert position <= BATCH_SIZE, (position, order)
+
+    sync_dbus(bus, q, mc)
+
+    bounds, histograms = cd_debug.GetPhaseHistograms()
+    assert histograms['queue-wait:emergency'][0] == 1, histograms
+    assert histograms['queue-wait:incoming'][0] == N_CHANNELS, histograms
+    assert histograms['total'][0] == N_CHANNELS + 1, histograms
+
+    queues = cd_debug.GetDispatchQueues()
+    depth, peak = queues['emergency']
+    assert depth == 0, queues
+    assert peak == 1, queues
+
+    for chan in channels + [emergency]:
+        chan.close()
+
+    sync_dbus(bus, q, mc)
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,125 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for the dispatch phase histograms on the
+ChannelDispatcher's Debug interface.
+"""
+
+import dbus
+
+from servicetest import EventPattern, call_async
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
+        expect_client_setup
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    client = SimulatedClient(q, bus, 'Empathy',
+            observe=[text_fixed_properties], approve=[text_fixed_properties],
+            handle=[text_fixed_properties], bypass_approval=False)
+    expect_client_setup(q, [client])
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+
+    # nothing has been dispatched yet
+    cd_debug.ResetPhaseHistograms()
+    bounds, histograms = cd_debug.GetPhaseHistograms()
+    assert len(bounds) > 0, bounds
+    assert list(bounds) == sorted(bounds), bounds
+    assert histograms == {}, histograms
+
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.Requested'] = False
+    channel_properties[cs.CHANNEL + '.Interfaces'] = dbus.Array(signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties)
+    chan.announce()
+
+    e = q.expect('dbus-method-call',
+            path=client.object_path,
+            interface=cs.OBSERVER, method='ObserveChannels',
+            handled=False)
+    cdo_path = e.args[3]
+    q.dbus_return(e.message, signature='')
+
+    e = q.expect('dbus-method-call',
+            path=client.object_path,
+            interface=cs.APPROVER, method='AddDispatchOperation',
+            handled=False)
+    q.dbus_return(e.message, signature='')
+
+    cdo = bus.get_object(cs.CD, cdo_path)
+    cdo_iface = dbus.Interface(cdo, cs.CDO)
+    call_async(q, cdo_iface, 'HandleWith', client.bus_name)
+
+    e = q.expect('dbus-method-call',
+            path=client.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    q.dbus_return(e.message, signature='')
+
+    q.expect_many(
+            EventPattern('dbus-return', method='HandleWith'),
+            EventPattern('dbus-signal', interface=cs.CDO, signal='Finished'),
+            )
+
+    bounds, histograms = cd_debug.GetPhaseHistograms()
+
+    for phase in ('observers', 'add-dispatch-operation', 'approval',
+            'handler-selection', 'handle-channels', 'total',
+            'observer:' + client.bus_name, 'approver:' + client.bus_name):
+        assert phase in histograms, (phase, histograms)
+        count, total, max_usec, buckets = histograms[phase]
+        assert count == 1, (phase, histograms[phase])
+        assert max_usec == total, (phase, histograms[phase])
+        assert len(buckets) == len(bounds) + 1, (phase, histograms[phase])
+        assert sum(buckets) == count, (phase, histograms[phase])
+
+    # no plugin delayed it
+    assert 'plugin-delay' not in histograms, histograms
+
+    # the whole thing took at least as long as any part of it
+    for phase in histograms:
+        assert histograms[phase][1] <= histograms['total'][1], \
+                (phase, histograms)
+
+    cd_debug.ResetPhaseHistograms()
+    bounds, histograms = cd_debug.GetPhaseHistograms()
+    assert histograms == {}, histograms
+
+    chan.close()
+
+if __name__ == '__main__':
+    exec_test(test, {})
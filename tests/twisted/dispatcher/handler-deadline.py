@@ -0,0 +1,98 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for giving up on a Handler that doesn't reply to
+HandleChannels, and trying the next one. This relies on run-test.sh
+setting MC_HANDLER_DEADLINE to less than the test timeout for this test.
+"""
+
+import dbus
+
+from servicetest import sync_dbus
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
+        expect_client_setup
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    # Wedged's filter is more specific, so it's tried first
+    wedged_filter = dbus.Dictionary(text_fixed_properties, signature='sv')
+    wedged_filter[cs.CHANNEL + '.Requested'] = False
+    wedged = SimulatedClient(q, bus, 'Wedged',
+            handle=[wedged_filter], bypass_approval=True)
+    good = SimulatedClient(q, bus, 'Good',
+            handle=[text_fixed_properties], bypass_approval=True)
+    expect_client_setup(q, [wedged, good])
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+    cd_debug.ResetPhaseHistograms()
+
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = 'juliet'
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel_properties[cs.CHANNEL + '.Requested'] = False
+    channel_properties[cs.CHANNEL + '.Interfaces'] = dbus.Array(signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties)
+    chan.announce()
+
+    # Wedged is asked first, and never gets round to replying...
+    stuck = q.expect('dbus-method-call',
+            path=wedged.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+
+    # ... so after a while, Good is asked instead
+    e = q.expect('dbus-method-call',
+            path=good.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    assert e.args[2] == stuck.args[2], (e.args, stuck.args)
+    q.dbus_return(e.message, signature='')
+
+    # Wedged wakes up, far too late, and says it has taken the channel.
+    # Now two Handlers think they have it, so MC closes it.
+    q.dbus_return(stuck.message, signature='')
+    q.expect('dbus-method-call', path=chan.object_path,
+            interface=cs.CHANNEL, method='Close', handled=True)
+    sync_dbus(bus, q, mc)
+
+    assert cd_debug.GetCounters() == {
+            'handler-timeout:' + wedged.bus_name: 1,
+            }
+
+    bounds, histograms = cd_debug.GetPhaseHistograms()
+    assert histograms['total'][0] == 1, histograms
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,135 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for introspecting the clients that are already running
+when MC starts: no more than MC_INTROSPECTION_CONCURRENCY of them are asked
+at once, and one that never answers doesn't stop the client registry from
+becoming ready after MC_INTROSPECTION_TIMEOUT (see run-test.sh.in for both).
+"""
+
+import dbus
+
+from servicetest import EventPattern, sync_dbus
+from mctest import exec_test, SimulatedConnection, SimulatedClient, \
+        create_fakecm_account, expect_client_setup, MC
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def is_client_setup(e):
+    if e.method == 'Get' and e.args == [cs.CLIENT, 'Interfaces']:
+        return True
+    if e.method == 'GetAll' and e.args == [cs.CLIENT]:
+        return True
+    return False
+
+def introspection(path):
+    return EventPattern('dbus-method-call', path=path,
+            interface=cs.PROPERTIES_IFACE, handled=False,
+            predicate=is_client_setup)
+
+def answer(q, client, e):
+    interfaces = dbus.Array([cs.OBSERVER], signature='s')
+
+    if e.method == 'Get':
+        q.dbus_return(e.message, interfaces, signature='v')
+    else:
+        q.dbus_return(e.message,
+                dbus.Dictionary({'Interfaces': interfaces}, signature='sv'),
+                signature='a{sv}')
+
+    expect_client_setup(q, [client], got_interfaces_already=True)
+
+def test(q, bus, unused, **kwargs):
+    # Three clients are already running, and none of them has a .client
+    # file, so they have to be asked about themselves. One of them never
+    # answers.
+    clients = {}
+
+    for name in ('Stuck', 'Empathy', 'Kopete'):
+        client = SimulatedClient(q, bus, name,
+                observe=[text_fixed_properties],
+                implement_get_interfaces=False)
+        clients[client.object_path] = client
+
+    stuck = clients[cs.tp_path_prefix + '/Client/Stuck']
+    any_client = EventPattern('dbus-method-call',
+            interface=cs.PROPERTIES_IFACE, handled=False,
+            predicate=lambda e: e.path in clients and is_client_setup(e))
+
+    # service-activate MC; it asks two of the clients about themselves...
+    mc = MC(q, bus, wait_for_names=False)
+    pending = mc.wait_for_names(any_client, any_client)
+    asked = set([e.path for e in pending])
+    assert len(asked) == 2, asked
+
+    # ... and the third has to wait for a slot
+    waiting, = [path for path in clients if path not in asked]
+    forbidden = [introspection(waiting)]
+    q.forbid_events(forbidden)
+    sync_dbus(bus, q, mc)
+    q.unforbid_events(forbidden)
+
+    # Each client that answers frees its slot for the one that's waiting
+    while pending:
+        e = pending.pop(0)
+
+        if e.path == stuck.object_path:
+            continue
+
+        answer(q, clients[e.path], e)
+
+        if waiting is not None:
+            pending.append(q.expect_many(introspection(waiting))[0])
+            waiting = None
+
+    # The stuck client still hasn't answered, but once MC has given up
+    # waiting for it, the client registry is ready, so connections start
+    # looking for channels to dispatch
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    account.Properties.Set(cs.ACCOUNT, 'Enabled', True)
+    account.Properties.Set(cs.ACCOUNT, 'RequestedPresence',
+            dbus.Struct((dbus.UInt32(cs.PRESENCE_TYPE_AVAILABLE),
+                'available', ''), signature='uss'))
+
+    e = q.expect('dbus-method-call', method='RequestConnection',
+            args=['fakeprotocol', params],
+            destination=cs.tp_name_prefix + '.ConnectionManager.fakecm',
+            path=cs.tp_path_prefix + '/ConnectionManager/fakecm',
+            interface=cs.tp_name_prefix + '.ConnectionManager',
+            handled=False)
+    conn = SimulatedConnection(q, bus, 'fakecm', 'fakeprotocol', 'the_conn',
+            'myself')
+    q.dbus_return(e.message, conn.bus_name, conn.object_path, signature='so')
+
+    q.expect('dbus-method-call', method='Connect',
+            path=conn.object_path, handled=True)
+    conn.StatusChanged(cs.CONN_STATUS_CONNECTED, cs.CONN_STATUS_REASON_NONE)
+
+    q.expect('dbus-method-call',
+            interface=cs.PROPERTIES_IFACE, method='GetAll',
+            args=[cs.CONN_IFACE_REQUESTS],
+            path=conn.object_path, handled=True)
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False, use_fake_accounts_service=True,
+            pass_kwargs=True)
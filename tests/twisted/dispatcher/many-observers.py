@@ -0,0 +1,114 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Dispatch incoming Text channels to a lot of Observers, checking that
+they all get the same arguments, and report how long the fan-out takes.
+"""
+
+import sys
+import time
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
+        expect_client_setup
+import constants as cs
+
+N_OBSERVERS = 50
+N_CHANNELS = 10
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    observers = [SimulatedClient(q, bus, 'Observer%d' % i,
+            observe=[text_fixed_properties])
+        for i in range(N_OBSERVERS)]
+    handler = SimulatedClient(q, bus, 'Handler',
+            handle=[text_fixed_properties], bypass_approval=True)
+
+    # wait for MC to download the properties
+    expect_client_setup(q, observers + [handler])
+
+    timings = []
+
+    for n in range(N_CHANNELS):
+        jid = 'juliet%d' % n
+
+        channel_properties = dbus.Dictionary(text_fixed_properties,
+                signature='sv')
+        channel_properties[cs.CHANNEL + '.TargetID'] = jid
+        channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+                conn.ensure_handle(cs.HT_CONTACT, jid)
+        channel_properties[cs.CHANNEL + '.InitiatorID'] = jid
+        channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+                conn.ensure_handle(cs.HT_CONTACT, jid)
+        channel_properties[cs.CHANNEL + '.Requested'] = False
+        channel_properties[cs.CHANNEL + '.Interfaces'] = \
+                dbus.Array(signature='s')
+
+        chan = SimulatedChannel(conn, channel_properties)
+
+        start = time.time()
+        chan.announce()
+
+        events = q.expect_many(*[EventPattern('dbus-method-call',
+                    path=o.object_path,
+                    interface=cs.OBSERVER, method='ObserveChannels',
+                    handled=False)
+                for o in observers])
+        timings.append(time.time() - start)
+
+        e = events[0]
+        assert e.args[0] == account.object_path, e.args
+        assert e.args[1] == conn.object_path, e.args
+        assert e.args[3] == '/', e.args     # no approval needed
+        assert e.args[4] == [], e.args      # no requests satisfied
+        assert e.args[2] == [(chan.object_path, channel_properties)], e.args
+
+        for other in events[1:]:
+            assert other.args == e.args, (other.args, e.args)
+
+        for other in events:
+            q.dbus_return(other.message, signature='')
+
+        e = q.expect('dbus-method-call',
+                path=handler.object_path,
+                interface=cs.HANDLER, method='HandleChannels',
+                handled=False)
+        q.dbus_return(e.message, signature='')
+
+        chan.close()
+
+    timings.sort()
+    print >> sys.stderr, ("ObserveChannels to %d observers: "
+            "min %.1fms, median %.1fms, max %.1fms" %
+            (N_OBSERVERS, timings[0] * 1000,
+                timings[len(timings) // 2] * 1000, timings[-1] * 1000))
+
+if __name__ == '__main__':
+    exec_test(test, {})
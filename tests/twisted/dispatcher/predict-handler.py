@@ -0,0 +1,123 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for remembering which Handler is predicted to get the
+channel for a request: a repeated request uses the remembered Handler, but
+once that Handler's filters go away, the prediction is worked out again.
+"""
+
+import dbus
+
+from servicetest import EventPattern, call_async, sync_dbus
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, expect_client_setup
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def request_text(q, bus, account, conn, expected_handler):
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+
+    request = dbus.Dictionary({
+            cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+            cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+            cs.CHANNEL + '.TargetID': 'juliet',
+            }, signature='sv')
+    call_async(q, cd, 'CreateChannel',
+            account.object_path, request, dbus.Int64(1238582606), "",
+            dbus_interface=cs.CD)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    request_path = ret.value[0]
+
+    cr = bus.get_object(cs.AM, request_path)
+    cr.Proceed(dbus_interface=cs.CR)
+
+    # the predicted Handler is told about the request
+    cm_request_call, add_request_call = q.expect_many(
+            EventPattern('dbus-method-call',
+                interface=cs.CONN_IFACE_REQUESTS, method='CreateChannel',
+                path=conn.object_path, args=[request], handled=False),
+            EventPattern('dbus-method-call', handled=False,
+                interface=cs.CLIENT_IFACE_REQUESTS,
+                method='AddRequest', path=expected_handler.object_path),
+            )
+    assert add_request_call.args[0] == request_path
+    q.dbus_return(add_request_call.message, signature='')
+
+    # we don't need the channel itself
+    q.dbus_raise(cm_request_call.message, cs.NOT_AVAILABLE, 'No')
+    q.expect_many(
+            EventPattern('dbus-method-call',
+                interface=cs.CLIENT_IFACE_REQUESTS,
+                method='RemoveRequest', path=expected_handler.object_path,
+                predicate=lambda e: e.args[0] == request_path),
+            EventPattern('dbus-signal', path=request_path,
+                interface=cs.CR, signal='Failed'),
+            )
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    # both can handle the channel, but BypassApproval makes Empathy the
+    # more likely one
+    empathy = SimulatedClient(q, bus, 'Empathy',
+            handle=[text_fixed_properties], bypass_approval=True)
+    kopete = SimulatedClient(q, bus, 'Kopete',
+            handle=[text_fixed_properties], bypass_approval=False)
+    expect_client_setup(q, [empathy, kopete])
+
+    def remove_request(e):
+        q.dbus_return(e.message, signature='')
+
+    q.add_dbus_method_impl(remove_request,
+            interface=cs.CLIENT_IFACE_REQUESTS, method='RemoveRequest')
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+    cd_debug.ResetPhaseHistograms()
+
+    # the first request has to look at the filters
+    request_text(q, bus, account, conn, empathy)
+    counters = cd_debug.GetCounters()
+    assert 'handler-prediction-hits' not in counters, counters
+    assert counters['handler-prediction-misses'] == 1, counters
+
+    # an identical request re-uses the prediction
+    request_text(q, bus, account, conn, empathy)
+    counters = cd_debug.GetCounters()
+    assert counters['handler-prediction-hits'] == 1, counters
+    assert counters['handler-prediction-misses'] == 1, counters
+
+    # Empathy exits, taking its filters with it
+    empathy.release_name()
+    del empathy
+    sync_dbus(bus, q, mc)
+
+    # so the next prediction can't be the remembered one
+    request_text(q, bus, account, conn, kopete)
+    counters = cd_debug.GetCounters()
+    assert counters['handler-prediction-hits'] == 1, counters
+    assert counters['handler-prediction-misses'] == 2, counters
+
+if __name__ == '__main__':
+    exec_test(test, {})
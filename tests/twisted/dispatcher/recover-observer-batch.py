@@ -0,0 +1,122 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for recovering an Observer when there are a lot of
+channels: it should get one ObserveChannels call per connection, not one
+per channel.
+"""
+
+import time
+
+import dbus
+import dbus.bus
+
+from servicetest import EventPattern, sync_dbus
+from mctest import exec_test, SimulatedClient, \
+        create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
+        expect_client_setup
+import constants as cs
+
+N_CHANNELS = 500
+
+# generous, to allow for slow machines; one call per channel would take
+# far longer than this under valgrind
+MAX_SECONDS = 4
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    kopete = SimulatedClient(q, bus, 'Kopete',
+            handle=[text_fixed_properties], bypass_approval=True)
+    expect_client_setup(q, [kopete])
+
+    channels = []
+
+    for i in range(N_CHANNELS):
+        contact = 'contact%d' % i
+        channel_properties = dbus.Dictionary(text_fixed_properties,
+                signature='sv')
+        channel_properties[cs.CHANNEL + '.TargetID'] = contact
+        channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+                conn.ensure_handle(cs.HT_CONTACT, contact)
+        channel_properties[cs.CHANNEL + '.InitiatorID'] = contact
+        channel_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+                conn.ensure_handle(cs.HT_CONTACT, contact)
+        channel_properties[cs.CHANNEL + '.Requested'] = False
+        channel_properties[cs.CHANNEL + '.Interfaces'] = \
+                dbus.Array(signature='s')
+        channels.append(SimulatedChannel(conn, channel_properties))
+
+    conn.NewChannels(channels)
+
+    # Kopete handles them all, so they're all long-lived channels that a
+    # newly-started Observer would want to know about
+    for chan in channels:
+        e = q.expect('dbus-method-call',
+                path=kopete.object_path,
+                interface=cs.HANDLER, method='HandleChannels',
+                handled=False)
+        q.dbus_return(e.message, signature='')
+
+    sync_dbus(bus, q, mc)
+
+    # A logger with Recover=True starts up
+    logger_bus = dbus.bus.BusConnection()
+    q.attach_to_bus(logger_bus)
+
+    started = time.time()
+    logger = SimulatedClient(q, logger_bus, 'Logger',
+            observe=[text_fixed_properties], wants_recovery=True)
+    expect_client_setup(q, [logger])
+
+    e = q.expect('dbus-method-call',
+            path=logger.object_path,
+            interface=cs.OBSERVER, method='ObserveChannels',
+            handled=False)
+    elapsed = time.time() - started
+
+    assert e.args[0] == account.object_path, e.args
+    assert e.args[1] == conn.object_path, e.args
+    assert e.args[4] == [], e.args      # no requests satisfied
+    assert e.args[5]['recovering'] == 1, e.args
+
+    recovered = [c[0] for c in e.args[2]]
+    assert len(recovered) == N_CHANNELS, len(recovered)
+    assert sorted(recovered) == sorted([c.object_path for c in channels])
+    assert elapsed < MAX_SECONDS, elapsed
+
+    # ... and that was the only call
+    forbidden = [EventPattern('dbus-method-call',
+            path=logger.object_path,
+            interface=cs.OBSERVER, method='ObserveChannels')]
+    q.forbid_events(forbidden)
+
+    q.dbus_return(e.message, bus=logger_bus, signature='')
+    sync_dbus(bus, q, mc)
+
+    q.unforbid_events(forbidden)
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -25,7 +25,7 @@ import dbus.bus
 import dbus.service
 
 from servicetest import EventPattern, tp_name_prefix, tp_path_prefix, \
-        call_async, sync_dbus
+        call_async, sync_dbus, assertEquals, assertSameSets
 from mctest import exec_test, SimulatedConnection, SimulatedClient, \
         create_fakecm_account, enable_fakecm_account, SimulatedChannel, \
         expect_client_setup
@@ -276,40 +276,28 @@ def test(q, bus, mc):
             )
     empathy_unique_name = e.args[2]
 
-    e1, e2 = q.expect_many(
-            EventPattern('dbus-method-call',
-                path=empathy.object_path,
-                interface=cs.OBSERVER, method='ObserveChannels',
-                predicate=lambda e: e.args[2][0][0] == chan.object_path,
-                handled=False),
-            EventPattern('dbus-method-call',
-                path=empathy.object_path,
-                interface=cs.OBSERVER, method='ObserveChannels',
-                predicate=lambda e: e.args[2][0][0] == chan2.object_path,
-                handled=False),
-            )
-
-    assert e1.args[0] == account.object_path, e1.args
-    assert e1.args[1] == conn.object_path, e1.args
-    assert e1.args[4] == [], e1.args      # no requests satisfied
-    assert e1.args[5]['recovering'] == 1, e1.args # due to observer recovery
-    channels = e1.args[2]
-    assert len(channels) == 1, channels
-    assert channels[0][0] == chan.object_path, channels
-    assert channels[0][1] == channel_properties, channels
+    # both channels are on the same connection, so Empathy is told about
+    # them in a single call
+    e = q.expect('dbus-method-call',
+            path=empathy.object_path,
+            interface=cs.OBSERVER, method='ObserveChannels',
+            handled=False)
 
-    assert e2.args[0] == account.object_path, e2.args
-    assert e2.args[1] == conn.object_path, e2.args
-    assert e2.args[4] == [], e2.args      # no requests satisfied
-    assert e2.args[5]['recovering'] == 1, e2.args # due to observer recovery
-    channels = e2.args[2]
-    assert len(channels) == 1, channels
-    assert channels[0][0] == chan2.object_path, channels
-    assert channels[0][1] == channel2_properties, channels
+    assert e.args[0] == account.object_path, e.args
+    assert e.args[1] == conn.object_path, e.args
+    assert e.args[4] == [], e.args      # no requests satisfied
+    assert e.args[5]['recovering'] == 1, e.args # due to observer recovery
+    channels = e.args[2]
+    assert len(channels) == 2, channels
+    # the order of the channels is not significant
+    assertSameSets([chan.object_path, chan2.object_path],
+            [c[0] for c in channels])
+    properties = dict((c[0], c[1]) for c in channels)
+    assertEquals(channel_properties, properties[chan.object_path])
+    assertEquals(channel2_properties, properties[chan2.object_path])
 
     # Empathy indicates that it is ready to proceed
-    q.dbus_return(e1.message, bus=empathy_bus, signature='')
-    q.dbus_return(e2.message, bus=empathy_bus, signature='')
+    q.dbus_return(e.message, bus=empathy_bus, signature='')
 
     sync_dbus(bus, q, mc)
 
@@ -0,0 +1,138 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Report how many messages per second Messages.DRAFT.SendMessage can send
+when every message needs a new channel, as they all did before MC kept
+channels for reuse, and when they all go to the same contact.
+"""
+
+import sys
+import time
+
+import dbus
+
+from servicetest import call_async
+from mctest import exec_test, create_fakecm_account, enable_fakecm_account, \
+        SimulatedChannel
+import constants as cs
+
+N_MESSAGES = 200
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+messages_properties = dbus.Dictionary({
+    cs.CHANNEL_IFACE_MESSAGES + '.PendingMessages':
+        dbus.Array(signature='aa{sv}'),
+    cs.CHANNEL_IFACE_MESSAGES + '.SupportedContentTypes': ['text/plain'],
+    cs.CHANNEL_IFACE_MESSAGES + '.MessagePartSupportFlags': dbus.UInt32(0),
+    cs.CHANNEL_IFACE_MESSAGES + '.DeliveryReportingSupport': dbus.UInt32(0),
+    cs.CHANNEL_IFACE_MESSAGES + '.MessageTypes': dbus.Array([dbus.UInt32(0)],
+        signature='u'),
+    }, signature='sv')
+
+message = dbus.Array([
+    dbus.Dictionary({}, signature='sv'),
+    dbus.Dictionary({'content-type': 'text/plain', 'content': 'ping'},
+        signature='sv'),
+    ], signature='a{sv}')
+
+def expect_channel(q, conn, target, channels):
+    e = q.expect('dbus-method-call',
+            path=conn.object_path,
+            interface=cs.CONN_IFACE_REQUESTS, method='EnsureChannel',
+            handled=False)
+
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = target
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, target)
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = conn.self_handle
+    channel_properties[cs.CHANNEL + '.Requested'] = True
+    channel_properties[cs.CHANNEL + '.Interfaces'] = \
+            dbus.Array([cs.CHANNEL_IFACE_MESSAGES], signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties,
+            mutable=messages_properties)
+    channels.add(chan.object_path)
+    q.dbus_return(e.message, True, chan.object_path, chan.immutable,
+            signature='boa{sv}')
+    chan.announce()
+
+def send_to(q, conn, cd_messages, account, channels, target, warm):
+    call_async(q, cd_messages, 'SendMessage', account.object_path, target,
+            message, dbus.UInt32(0))
+
+    if not warm:
+        expect_channel(q, conn, target, channels)
+
+    e = q.expect('dbus-method-call',
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            predicate=lambda e: e.path in channels,
+            handled=False)
+    q.dbus_return(e.message, 'token', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_messages = dbus.Interface(cd, cs.CD_IFACE_MESSAGES)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+    channels = set()
+
+    # Every message to a different contact, so each needs a new channel
+    cd_debug.ResetPhaseHistograms()
+    start = time.time()
+
+    for i in range(N_MESSAGES):
+        send_to(q, conn, cd_messages, account, channels, 'contact%d' % i,
+                False)
+
+    cold = N_MESSAGES / (time.time() - start)
+
+    counters = cd_debug.GetCounters()
+    assert counters['send-message-new-channel'] == N_MESSAGES, counters
+    assert 'send-message-warm-channel' not in counters, counters
+
+    # Every message to the same contact, so only the first one does
+    send_to(q, conn, cd_messages, account, channels, 'juliet', False)
+
+    cd_debug.ResetPhaseHistograms()
+    start = time.time()
+
+    for i in range(N_MESSAGES):
+        send_to(q, conn, cd_messages, account, channels, 'juliet', True)
+
+    warm = N_MESSAGES / (time.time() - start)
+
+    counters = cd_debug.GetCounters()
+    assert counters['send-message-warm-channel'] == N_MESSAGES, counters
+    assert 'send-message-new-channel' not in counters, counters
+
+    print >> sys.stderr, ("SendMessage: %.0f messages/s with a new channel "
+            "each, %.0f messages/s reusing one" % (cold, warm))
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,146 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for Messages.DRAFT.SendMessage closing the text channel
+it kept for the least recently used contact when it has to make way for
+another, with MC_WARM_CHANNELS=1 (see run-test.sh.in).
+"""
+
+import dbus
+
+from servicetest import EventPattern, call_async, sync_dbus
+from mctest import exec_test, create_fakecm_account, enable_fakecm_account, \
+        SimulatedChannel
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+messages_properties = dbus.Dictionary({
+    cs.CHANNEL_IFACE_MESSAGES + '.PendingMessages':
+        dbus.Array(signature='aa{sv}'),
+    cs.CHANNEL_IFACE_MESSAGES + '.SupportedContentTypes': ['text/plain'],
+    cs.CHANNEL_IFACE_MESSAGES + '.MessagePartSupportFlags': dbus.UInt32(0),
+    cs.CHANNEL_IFACE_MESSAGES + '.DeliveryReportingSupport': dbus.UInt32(0),
+    cs.CHANNEL_IFACE_MESSAGES + '.MessageTypes': dbus.Array([dbus.UInt32(0)],
+        signature='u'),
+    }, signature='sv')
+
+def make_message(text):
+    return dbus.Array([
+        dbus.Dictionary({}, signature='sv'),
+        dbus.Dictionary({'content-type': 'text/plain', 'content': text},
+            signature='sv'),
+        ], signature='a{sv}')
+
+def send_message_new_channel(q, cd_messages, account, conn, target, text,
+        expect_after=()):
+    call_async(q, cd_messages, 'SendMessage', account.object_path, target,
+            make_message(text), dbus.UInt32(0))
+
+    e = q.expect('dbus-method-call',
+            path=conn.object_path,
+            interface=cs.CONN_IFACE_REQUESTS, method='EnsureChannel',
+            handled=False)
+    assert e.args[0][cs.CHANNEL + '.TargetID'] == target, e.args
+
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = target
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, target)
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = conn.self_handle
+    channel_properties[cs.CHANNEL + '.Requested'] = True
+    channel_properties[cs.CHANNEL + '.Interfaces'] = \
+            dbus.Array([cs.CHANNEL_IFACE_MESSAGES], signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties,
+            mutable=messages_properties)
+    q.dbus_return(e.message, True, chan.object_path, chan.immutable,
+            signature='boa{sv}')
+    chan.announce()
+
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    assert e.args[0][1]['content'] == text, e.args
+    q.dbus_return(e.message, 'token-' + text, signature='s')
+
+    q.expect_many(EventPattern('dbus-return', method='SendMessage'),
+            *expect_after)
+    return chan
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_messages = dbus.Interface(cd, cs.CD_IFACE_MESSAGES)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+    cd_debug.ResetPhaseHistograms()
+
+    # MC keeps the channel to Juliet
+    juliet = send_message_new_channel(q, cd_messages, account, conn,
+            'juliet', 'hello')
+
+    # There's only room for one kept channel, so when MC keeps the channel
+    # to Romeo, it closes Juliet's, since nothing else will
+    romeo = send_message_new_channel(q, cd_messages, account, conn,
+            'romeo', 'hi',
+            expect_after=[EventPattern('dbus-method-call',
+                path=juliet.object_path, interface=cs.CHANNEL,
+                method='Close')])
+
+    # The next message to Juliet needs a new channel, and in turn pushes
+    # out Romeo's
+    juliet = send_message_new_channel(q, cd_messages, account, conn,
+            'juliet', 'are you there?',
+            expect_after=[EventPattern('dbus-method-call',
+                path=romeo.object_path, interface=cs.CHANNEL,
+                method='Close')])
+
+    # ... and the one after that can use it
+    no_requests = [
+            EventPattern('dbus-method-call', path=conn.object_path,
+                interface=cs.CONN_IFACE_REQUESTS, method='EnsureChannel'),
+            EventPattern('dbus-method-call', path=juliet.object_path,
+                interface=cs.CHANNEL, method='Close'),
+            ]
+    q.forbid_events(no_requests)
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'juliet',
+            make_message('again'), dbus.UInt32(0))
+    e = q.expect('dbus-method-call',
+            path=juliet.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    q.dbus_return(e.message, 'token-again', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+    sync_dbus(bus, q, mc)
+    q.unforbid_events(no_requests)
+
+    counters = cd_debug.GetCounters()
+    assert counters['send-message-warm-channel'] == 1, counters
+    assert counters['send-message-new-channel'] == 3, counters
+
+if __name__ == '__main__':
+    exec_test(test, {})
@@ -0,0 +1,268 @@
+# Copyright (C) 2012 Collabora Ltd.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for Messages.DRAFT.SendMessage reusing the text channel
+from the previous message to the same contact, and not reusing it once it
+has closed, been wanted by someone else, received a message, or lost its
+connection.
+"""
+
+import dbus
+
+from servicetest import EventPattern, call_async, sync_dbus
+from mctest import exec_test, create_fakecm_account, enable_fakecm_account, \
+        SimulatedChannel, SimulatedConnection
+import constants as cs
+
+text_fixed_properties = dbus.Dictionary({
+    cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+    cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+    }, signature='sv')
+
+messages_properties = dbus.Dictionary({
+    cs.CHANNEL_IFACE_MESSAGES + '.PendingMessages':
+        dbus.Array(signature='aa{sv}'),
+    cs.CHANNEL_IFACE_MESSAGES + '.SupportedContentTypes': ['text/plain'],
+    cs.CHANNEL_IFACE_MESSAGES + '.MessagePartSupportFlags': dbus.UInt32(0),
+    cs.CHANNEL_IFACE_MESSAGES + '.DeliveryReportingSupport': dbus.UInt32(0),
+    cs.CHANNEL_IFACE_MESSAGES + '.MessageTypes': dbus.Array([dbus.UInt32(0)],
+        signature='u'),
+    }, signature='sv')
+
+def make_message(text):
+    return dbus.Array([
+        dbus.Dictionary({}, signature='sv'),
+        dbus.Dictionary({'content-type': 'text/plain', 'content': text},
+            signature='sv'),
+        ], signature='a{sv}')
+
+def expect_new_channel(q, conn, target):
+    e = q.expect('dbus-method-call',
+            path=conn.object_path,
+            interface=cs.CONN_IFACE_REQUESTS, method='EnsureChannel',
+            handled=False)
+    assert e.args[0][cs.CHANNEL + '.TargetID'] == target, e.args
+
+    channel_properties = dbus.Dictionary(text_fixed_properties,
+            signature='sv')
+    channel_properties[cs.CHANNEL + '.TargetID'] = target
+    channel_properties[cs.CHANNEL + '.TargetHandle'] = \
+            conn.ensure_handle(cs.HT_CONTACT, target)
+    channel_properties[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    channel_properties[cs.CHANNEL + '.InitiatorHandle'] = conn.self_handle
+    channel_properties[cs.CHANNEL + '.Requested'] = True
+    channel_properties[cs.CHANNEL + '.Interfaces'] = \
+            dbus.Array([cs.CHANNEL_IFACE_MESSAGES], signature='s')
+
+    chan = SimulatedChannel(conn, channel_properties,
+            mutable=messages_properties)
+    q.dbus_return(e.message, True, chan.object_path, chan.immutable,
+            signature='boa{sv}')
+    chan.announce()
+    return chan
+
+def send_message(q, cd_messages, account, chan, target, text):
+    call_async(q, cd_messages, 'SendMessage', account.object_path, target,
+            make_message(text), dbus.UInt32(0))
+
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    assert e.args[0][1]['content'] == text, e.args
+    q.dbus_return(e.message, 'token-' + text, signature='s')
+
+    ret = q.expect('dbus-return', method='SendMessage')
+    assert ret.value[0] == 'token-' + text, ret.value
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    cm_name_ref, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+    cd_messages = dbus.Interface(cd, cs.CD_IFACE_MESSAGES)
+    cd_debug = dbus.Interface(cd, cs.CD_IFACE_DEBUG)
+    cd_debug.ResetPhaseHistograms()
+
+    # The first message to Juliet needs a channel
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'juliet',
+            make_message('hello'), dbus.UInt32(0))
+    chan = expect_new_channel(q, conn, 'juliet')
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    q.dbus_return(e.message, 'token-hello', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+
+    # ... and MC keeps it, rather than closing it, so the next message goes
+    # straight there
+    no_requests = [
+            EventPattern('dbus-method-call', path=conn.object_path,
+                interface=cs.CONN_IFACE_REQUESTS, method='EnsureChannel'),
+            EventPattern('dbus-method-call', path=chan.object_path,
+                interface=cs.CHANNEL, method='Close'),
+            ]
+    q.forbid_events(no_requests)
+    send_message(q, cd_messages, account, chan, 'juliet', 'again')
+    sync_dbus(bus, q, mc)
+    q.unforbid_events(no_requests)
+
+    # Once the channel has closed, it's no use
+    chan.close()
+    sync_dbus(bus, q, mc)
+
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'juliet',
+            make_message('are you there?'), dbus.UInt32(0))
+    chan = expect_new_channel(q, conn, 'juliet')
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    q.dbus_return(e.message, 'token', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+
+    # A UI wants a channel to Juliet. MC is the channel's handler, so it
+    # closes the channel before requesting another, which will go to the UI
+    request = dbus.Dictionary({
+            cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+            cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+            cs.CHANNEL + '.TargetID': 'juliet',
+            }, signature='sv')
+    call_async(q, cd, 'EnsureChannel', account.object_path, request,
+            dbus.Int64(0), '', dbus_interface=cs.CD)
+    q.expect_many(
+            EventPattern('dbus-method-call', path=chan.object_path,
+                interface=cs.CHANNEL, method='Close'),
+            EventPattern('dbus-return', method='EnsureChannel'),
+            )
+
+    # Romeo's channel is kept until he says something, which nobody would
+    # see if MC kept it open; so MC closes it, and the connection manager
+    # would respawn it to be dispatched to a UI
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'romeo',
+            make_message('hi'), dbus.UInt32(0))
+    chan = expect_new_channel(q, conn, 'romeo')
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    q.dbus_return(e.message, 'token', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+
+    q.dbus_emit(chan.object_path, cs.CHANNEL_IFACE_MESSAGES, 'MessageReceived',
+            dbus.Array([
+                dbus.Dictionary({
+                    'message-sender': conn.ensure_handle(cs.HT_CONTACT,
+                        'romeo'),
+                    'pending-message-id': dbus.UInt32(1),
+                    }, signature='sv'),
+                dbus.Dictionary({'content-type': 'text/plain',
+                    'content': 'hello yourself'}, signature='sv'),
+                ], signature='a{sv}'),
+            signature='aa{sv}')
+    q.expect('dbus-method-call', path=chan.object_path,
+            interface=cs.CHANNEL, method='Close')
+
+    # Likewise, if Mercutio has already said something by the time MC
+    # would keep the channel, it's closed instead
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'mercutio',
+            make_message('hi'), dbus.UInt32(0))
+    chan = expect_new_channel(q, conn, 'mercutio')
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    chan.properties[cs.CHANNEL_IFACE_MESSAGES + '.PendingMessages'] = \
+            dbus.Array([
+                dbus.Array([
+                    dbus.Dictionary({
+                        'message-sender': conn.ensure_handle(cs.HT_CONTACT,
+                            'mercutio'),
+                        'pending-message-id': dbus.UInt32(2),
+                        }, signature='sv'),
+                    dbus.Dictionary({'content-type': 'text/plain',
+                        'content': 'a plague on both your houses'},
+                        signature='sv'),
+                    ], signature='a{sv}'),
+                ], signature='aa{sv}')
+    q.dbus_return(e.message, 'token', signature='s')
+    q.expect_many(
+            EventPattern('dbus-return', method='SendMessage'),
+            EventPattern('dbus-method-call', path=chan.object_path,
+                interface=cs.CHANNEL, method='Close'),
+            )
+
+    counters = cd_debug.GetCounters()
+    assert counters['send-message-warm-channel'] == 1, counters
+    assert counters['send-message-new-channel'] == 4, counters
+
+    # MC keeps a channel to Tybalt...
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'tybalt',
+            make_message('hi'), dbus.UInt32(0))
+    chan = expect_new_channel(q, conn, 'tybalt')
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    q.dbus_return(e.message, 'token', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+
+    # ... but then the connection falls over, taking the channel with it
+    conn.StatusChanged(cs.CONN_STATUS_DISCONNECTED,
+            cs.CONN_STATUS_REASON_NETWORK_ERROR)
+
+    e = q.expect('dbus-method-call', method='RequestConnection',
+            args=['fakeprotocol', params],
+            destination=cs.tp_name_prefix + '.ConnectionManager.fakecm',
+            path=cs.tp_path_prefix + '/ConnectionManager/fakecm',
+            interface=cs.tp_name_prefix + '.ConnectionManager',
+            handled=False)
+
+    # the first connection is still exported, so use a different path
+    conn = SimulatedConnection(q, bus, 'fakecm', 'fakeprotocol', 'second',
+            'myself')
+    q.dbus_return(e.message, conn.bus_name, conn.object_path, signature='so')
+    q.expect('dbus-method-call', method='Connect',
+            path=conn.object_path, handled=True)
+    conn.StatusChanged(cs.CONN_STATUS_CONNECTED, cs.CONN_STATUS_REASON_NONE)
+    q.expect('dbus-signal', signal='AccountPropertyChanged',
+            path=account.object_path,
+            predicate=(lambda e:
+                e.args[0].get('ConnectionStatus') ==
+                    cs.CONN_STATUS_CONNECTED))
+
+    # so the next message to Tybalt needs a new channel on the new
+    # connection
+    call_async(q, cd_messages, 'SendMessage', account.object_path, 'tybalt',
+            make_message('where did you go?'), dbus.UInt32(0))
+    chan = expect_new_channel(q, conn, 'tybalt')
+    e = q.expect('dbus-method-call',
+            path=chan.object_path,
+            interface=cs.CHANNEL_IFACE_MESSAGES, method='SendMessage',
+            handled=False)
+    q.dbus_return(e.message, 'token', signature='s')
+    q.expect('dbus-return', method='SendMessage')
+
+    counters = cd_debug.GetCounters()
+    assert counters['send-message-warm-channel'] == 1, counters
+    assert counters['send-message-new-channel'] == 6, counters
+
+if __name__ == '__main__':
+    exec_test(test, {})